@@ -0,0 +1,456 @@
+/**
+ * @file bench_codec.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Microbenchmarks of the codec primitives through the MQTT_TESTING entry points
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mqtt.h"
+#include "status.h"
+#include "utf8.h"
+#include "mqtt_memory.h"
+#include "mqtt_testing.h"
+
+#define REPETITIONS     3
+#define UTF8_CORPUS_LEN 4096
+
+typedef void (*bench_fn)(void* arg, uint32_t iterations);
+
+static volatile uint32_t sink;
+static uint64_t min_time_ns = 200000000ull;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Grows the iteration count until one run takes a tenth of the minimum time,
+ * then reports the best of several runs of the minimum time.
+ */
+static void run(const char* benchmark, const char* variant, bench_fn fn, void* arg, size_t bytes_per_op)
+{
+    uint32_t iterations = 1000;
+    uint64_t elapsed;
+    while (1) {
+        uint64_t start = now_ns();
+        fn(arg, iterations);
+        elapsed = now_ns() - start;
+        if (elapsed >= min_time_ns / 10 || iterations >= UINT32_MAX / 2) {
+            break;
+        }
+        iterations *= 2;
+    }
+    iterations = (uint32_t)((double) iterations * min_time_ns / (elapsed ? elapsed : 1));
+    if (!iterations) {
+        iterations = 1;
+    }
+
+    double best = 0.0;
+    for (int r = 0; r < REPETITIONS; r++) {
+        uint64_t start = now_ns();
+        fn(arg, iterations);
+        double ns_per_op = (double)(now_ns() - start) / iterations;
+        if (!r || ns_per_op < best) {
+            best = ns_per_op;
+        }
+    }
+
+    printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"iterations\":%u,\"ns_per_op\":%.2f,"
+           "\"ops_per_sec\":%.0f,\"mb_per_sec\":%.1f}\n",
+           benchmark, variant, iterations, best, 1e9 / best,
+           bytes_per_op ? bytes_per_op * 1e3 / best : 0.0);
+    fflush(stdout);
+}
+
+/***** Primitives ********************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+struct codec_arg {
+    struct mqtt_client* stat;
+    uint8_t buf[2048];
+    uint32_t value;
+    const char* string;
+    uint32_t len;
+};
+
+static void bench_varint_pack(void* arg, uint32_t iterations)
+{
+    struct codec_arg* a = arg;
+    for (uint32_t i = 0; i < iterations; i++) {
+        a->stat->pout = a->buf;
+        mqtt_test_pack_variable_size(a->stat, a->value);
+    }
+    sink = a->buf[0];
+}
+
+static void bench_varint_unpack(void* arg, uint32_t iterations)
+{
+    struct codec_arg* a = arg;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        a->stat->pin = a->buf;
+        a->stat->pin_end = a->buf + a->len;
+        sum += mqtt_test_unpack_variable_size(a->stat);
+    }
+    sink = sum;
+}
+
+static void bench_string_pack(void* arg, uint32_t iterations)
+{
+    struct codec_arg* a = arg;
+    for (uint32_t i = 0; i < iterations; i++) {
+        a->stat->pout = a->buf;
+        mqtt_test_pack_string(a->stat, a->string);
+    }
+    sink = a->buf[2];
+}
+
+static void bench_string_unpack(void* arg, uint32_t iterations)
+{
+    struct codec_arg* a = arg;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        // Decoded strings live in the packet arena until the next packet
+        mqtt_test_release_packet_data(a->stat);
+        a->stat->pin = a->buf;
+        a->stat->pin_end = a->buf + a->len;
+        char* s = mqtt_test_unpack_string(a->stat);
+        sum += s ? (uint8_t) s[0] : 0;
+    }
+    sink = sum;
+}
+
+static void bench_utf8(void* arg, uint32_t iterations)
+{
+    struct codec_arg* a = arg;
+    uint32_t valid = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        valid += is_valid_utf8(a->string, a->len);
+    }
+    sink = valid;
+}
+
+static void codec_primitives(struct mqtt_client* stat)
+{
+    static const struct { const char* name; uint32_t value; } varints[] = {
+        { "1_byte", 100 }, { "2_bytes", 10000 }, { "3_bytes", 1000000 }, { "4_bytes", 200000000 }
+    };
+    struct codec_arg* a = calloc(1, sizeof(struct codec_arg));
+    if (!a) {
+        return;
+    }
+    a->stat = stat;
+
+    for (size_t i = 0; i < sizeof(varints) / sizeof(varints[0]); i++) {
+        a->value = varints[i].value;
+        run("varint_pack", varints[i].name, bench_varint_pack, a, 0);
+        a->len = (uint32_t)(stat->pout - a->buf);
+        run("varint_unpack", varints[i].name, bench_varint_unpack, a, 0);
+    }
+
+    static const uint32_t string_lens[] = { 8, 64, 1024 };
+    char* string = malloc(1024 + 1);
+    for (size_t i = 0; string && i < sizeof(string_lens) / sizeof(string_lens[0]); i++) {
+        char variant[16];
+        memset(string, 's', string_lens[i]);
+        string[string_lens[i]] = '\0';
+        snprintf(variant, sizeof(variant), "%u", string_lens[i]);
+        a->string = string;
+        run("string_pack", variant, bench_string_pack, a, string_lens[i]);
+        a->len = string_lens[i] + 2;
+        run("string_unpack", variant, bench_string_unpack, a, string_lens[i]);
+    }
+    free(string);
+
+    // Corpora of the same byte length, one plain ASCII, one of two to four byte sequences
+    static const char multibyte[] = "\xc3\xa4\xc3\xb6\xe2\x82\xac\xf0\x9d\x84\x9e\xe6\x97\xa5\xc3\xbc";
+    char* corpus = malloc(UTF8_CORPUS_LEN);
+    if (corpus) {
+        memset(corpus, 'a', UTF8_CORPUS_LEN);
+        a->string = corpus;
+        a->len = UTF8_CORPUS_LEN;
+        run("utf8_validate", "ascii", bench_utf8, a, UTF8_CORPUS_LEN);
+
+        size_t n = sizeof(multibyte) - 1;
+        for (size_t pos = 0; pos + n <= UTF8_CORPUS_LEN; pos += n) {
+            memcpy(corpus + pos, multibyte, n);
+        }
+        a->len = (UTF8_CORPUS_LEN / n) * n;
+        run("utf8_validate", "multibyte", bench_utf8, a, a->len);
+        free(corpus);
+    }
+    free(a);
+}
+
+/***** Packets ***********************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+struct packet_arg {
+    struct mqtt_client* stat;
+    struct mqtt_pub_packet msg;
+    uint8_t* buf;
+    uint32_t len;
+    uint8_t flags;
+    uint32_t size;
+};
+
+static void bench_make_publish(void* arg, uint32_t iterations)
+{
+    struct packet_arg* a = arg;
+    for (uint32_t i = 0; i < iterations; i++) {
+        // Both passes, as every publish runs them
+        a->stat->pout = NULL;
+        mqtt_test_make_publish(a->stat, &a->msg);
+        a->stat->pout = a->buf;
+        mqtt_test_make_publish(a->stat, &a->msg);
+    }
+    sink = a->stat->packet_size;
+}
+
+static void bench_process_publish(void* arg, uint32_t iterations)
+{
+    struct packet_arg* a = arg;
+    int failed = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        failed += FAILED(mqtt_test_process_publish(a->stat, a->flags, a->buf, a->len));
+    }
+    sink = failed;
+}
+
+static uint8_t* put_word(uint8_t* p, uint16_t value)
+{
+    *p++ = value >> 8;
+    *p++ = value & 0xff;
+    return p;
+}
+
+static uint8_t* put_string(uint8_t* p, const char* s)
+{
+    uint16_t len = strlen(s);
+    p = put_word(p, len);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+/* PUBLISH variable header and payload as the broker sends it, QoS 0 */
+static uint32_t encode_publish(uint8_t* buf, bool properties, uint32_t payload_len)
+{
+    uint8_t props[128];
+    uint8_t* p = props;
+    if (properties) {
+        *p++ = MQTT_PUB_MESSAGE_EXPIRY_INTERVAL_ID;
+        *p++ = 0; *p++ = 0; *p++ = 0x0e; *p++ = 0x10;
+        *p++ = MQTT_PUB_CONTENT_TYPE_ID;
+        p = put_string(p, "application/octet-stream");
+        *p++ = MQTT_PUB_RESPONSE_TOPIC_ID;
+        p = put_string(p, "bench/reply");
+        *p++ = MQTT_PUB_CORRELATION_DATA_ID;
+        p = put_string(p, "0123456789abcdef");
+        *p++ = MQTT_PUB_SUBSCRIPTION_IDENTIFIER_ID;
+        *p++ = 42;
+        *p++ = MQTT_USER_PROPERTY_ID;
+        p = put_string(p, "trace");
+        p = put_string(p, "4bf92f3577b34da6");
+    }
+    uint8_t* out = put_string(buf, "bench/topic/name");
+    *out++ = (uint8_t)(p - props);
+    memcpy(out, props, p - props);
+    out += p - props;
+    memset(out, 'x', payload_len);
+    return (uint32_t)(out - buf) + payload_len;
+}
+
+static void packets(struct mqtt_client* stat)
+{
+    static uint8_t payload[64];
+    static struct mqtt_user_property user_properties[] = {
+        { "trace", "4bf92f3577b34da6" }, { "origin", "bench" }
+    };
+    struct packet_arg a = { .stat = stat };
+    a.buf = malloc(4096);
+    if (!a.buf) {
+        return;
+    }
+    a.msg = mqtt_pub_packet("bench/topic/name", payload, sizeof(payload), 1, false);
+    a.msg.packet_id = 1;
+
+    run("make_publish", "no_properties", bench_make_publish, &a, 0);
+
+    stat->config->publish.payload_format_indicator = 1;
+    stat->config->publish.message_expiry_interval = 3600;
+    run("make_publish", "basic_properties", bench_make_publish, &a, 0);
+
+    stat->config->publish.content_type = "application/octet-stream";
+    stat->config->publish.response_topic = "bench/reply";
+    stat->config->publish.correlation_data.data = (uint8_t*) "0123456789abcdef";
+    stat->config->publish.correlation_data.len = 16;
+    stat->config->publish.user_properties = user_properties;
+    stat->config->publish.user_properties_count = 2;
+    run("make_publish", "all_properties", bench_make_publish, &a, 0);
+    memset(&stat->config->publish, 0, sizeof(stat->config->publish));
+
+    a.flags = 0;
+    a.len = encode_publish(a.buf, false, sizeof(payload));
+    run("process_publish", "no_properties", bench_process_publish, &a, 0);
+    a.len = encode_publish(a.buf, true, sizeof(payload));
+    run("process_publish", "properties", bench_process_publish, &a, 0);
+    mqtt_test_release_packet_data(stat);
+    free(a.buf);
+}
+
+/***** Packet slots ******************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static void bench_slots(void* arg, uint32_t iterations)
+{
+    struct mqtt_client* stat = arg;
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        // Life cycle of one QoS 1 publish: reserve, lookup on PUBACK, release
+        int packet_id = mqtt_test_reserve_slot(stat, PUBACK);
+        found += mqtt_test_await_packet(stat, PUBACK);
+        mqtt_test_free_slot(stat, (uint16_t) packet_id);
+    }
+    sink = found;
+}
+
+static void packet_slots(struct mqtt_client* stat)
+{
+    static const unsigned int occupancy[] = { 0, MQTT_RECEIVE_MAXIMUM / 4, MQTT_RECEIVE_MAXIMUM / 2,
+                                              MQTT_RECEIVE_MAXIMUM - 1 };
+    for (size_t i = 0; i < sizeof(occupancy) / sizeof(occupancy[0]); i++) {
+        char variant[32];
+        memset(stat->pending, 0, sizeof(stat->pending));
+        // Occupied slots await PUBCOMP, lookups for PUBACK scan past all of them
+        for (unsigned int n = 0; n < occupancy[i]; n++) {
+            mqtt_test_reserve_slot(stat, PUBCOMP);
+        }
+        snprintf(variant, sizeof(variant), "%u_of_%u", occupancy[i], MQTT_RECEIVE_MAXIMUM);
+        run("packet_slots", variant, bench_slots, stat, 0);
+    }
+    memset(stat->pending, 0, sizeof(stat->pending));
+}
+
+/***** Client over the in-memory transport *******************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+struct loop_arg {
+    struct mqtt_client* stat;
+    struct mqtt_mem_pipe* pipe;
+    struct mqtt_pub_packet msg;
+    uint8_t buf[512];
+    uint32_t len;
+};
+
+static void bench_publish_loop(void* arg, uint32_t iterations)
+{
+    struct loop_arg* a = arg;
+    uint32_t read = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        mqtt_publish(a->stat, &a->msg);
+        read += mqtt_mem_peer_read(a->pipe, a->buf, sizeof(a->buf));
+        if (a->msg.qos) {
+            // Topic length is below 128, the packet id follows the topic at a fixed offset
+            uint8_t* id = a->buf + 4 + strlen(a->msg.topic);
+            uint8_t puback[] = { PUBACK << 4, 2, id[0], id[1] };
+            mqtt_mem_peer_write(a->pipe, puback, sizeof(puback));
+            mqtt_poll(a->stat);
+        }
+    }
+    sink = read;
+}
+
+static void bench_receive_loop(void* arg, uint32_t iterations)
+{
+    struct loop_arg* a = arg;
+    for (uint32_t i = 0; i < iterations; i++) {
+        mqtt_mem_peer_write(a->pipe, a->buf, a->len);
+        mqtt_poll(a->stat);
+    }
+    sink = a->stat->received_publish.payload.len;
+}
+
+static void memory_transport(void)
+{
+    static struct mqtt_mem_pipe pipe;
+    static uint8_t payload[64];
+    static const uint8_t connack[] = { CONNACK << 4, 3, 0, 0, 0 };
+    struct loop_arg* a = calloc(1, sizeof(struct loop_arg));
+    if (!a) {
+        return;
+    }
+    mqtt_mem_pipe_init(&pipe, NULL);
+    struct mqtt_transport transport = mqtt_mem_transport(&pipe);
+    a->stat = mqtt_create_client_transport("memory", NULL, &transport);
+    a->pipe = &pipe;
+    if (!a->stat || FAILED(mqtt_connect(a->stat, 0, 0, true))) {
+        fprintf(stderr, "Failed to connect over the in-memory transport\n");
+        mqtt_free_client(&a->stat);
+        free(a);
+        return;
+    }
+    while (mqtt_mem_peer_read(&pipe, a->buf, sizeof(a->buf))) {
+    }
+    mqtt_mem_peer_write(&pipe, connack, sizeof(connack));
+    mqtt_poll(a->stat);
+
+    // Whole library path per message, without any kernel involvement
+    a->msg = mqtt_pub_packet("bench/topic/name", payload, sizeof(payload), 0, false);
+    run("publish_loop", "qos0", bench_publish_loop, a, sizeof(payload));
+    a->msg.qos = 1;
+    run("publish_loop", "qos1", bench_publish_loop, a, sizeof(payload));
+
+    a->buf[0] = PUBLISH << 4;
+    a->buf[1] = (uint8_t)(encode_publish(a->buf + 2, false, sizeof(payload)));
+    a->len = a->buf[1] + 2;
+    run("receive_loop", "qos0", bench_receive_loop, a, sizeof(payload));
+
+    mqtt_disconnect(a->stat, MQTT_REASON_NORMAL_DISCONNECTION);
+    mqtt_free_client(&a->stat);
+    free(a);
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "qh")) != -1) {
+        switch (opt) {
+        case 'q':
+            min_time_ns = 20000000ull;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-q]\n  -q  Quick run with shorter measurements\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // The client is never connected, it only provides the codec state
+    struct mqtt_client* stat = mqtt_create_client("bench");
+    if (!stat) {
+        fprintf(stderr, "Failed to create the client\n");
+        return 1;
+    }
+    codec_primitives(stat);
+    packets(stat);
+    packet_slots(stat);
+    mqtt_free_client(&stat);
+    memory_transport();
+    return 0;
+}
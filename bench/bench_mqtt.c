@@ -0,0 +1,431 @@
+/**
+ * @file bench_mqtt.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief End-to-end publish throughput and latency benchmark against the mock broker
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mqtt.h"
+#include "status.h"
+#include "mock_broker.h"
+
+#define MAX_TOPICS          1024
+#define MAX_PAYLOAD         UINT16_MAX          // Limited by the length of struct mqtt_blob, larger ones are streamed
+#define STREAM_PART_SIZE    (64u * 1024)        // Pieces of streamed payloads, sent and received
+#define MAX_BYTES_PER_RUN   (64u * 1024 * 1024) // Bounds the memory queued up in the broker
+#define IDLE_TIMEOUT_NS     5000000000ull
+
+struct bench_case {
+    const char* scenario;
+    uint8_t qos;
+    uint32_t payload;
+    unsigned int topics;
+    unsigned int publishers;
+    uint32_t messages;
+};
+
+struct bench_client {
+    struct mqtt_client* client;
+    struct mock_connection conn;
+    struct bench_run* run;
+    pthread_t thread;
+    uint32_t messages;
+    atomic_uint completed;      // Acknowledged QoS 1 and completed QoS 2 publishes
+    int result;
+};
+
+struct bench_run {
+    const struct bench_case* bc;
+    char topics[MAX_TOPICS][24];
+    uint64_t* latencies;
+    atomic_uint received;
+    atomic_bool subscribed;
+    uint8_t stamp[8];           // Send time at the start of a payload received in parts
+    uint64_t start_ns;
+    uint64_t last_ns;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/***** Client callbacks **************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static struct bench_client* bench_client(struct mqtt_client* stat)
+{
+    return (struct bench_client*) ((struct mock_connection*) stat->context)->user;
+}
+
+static void record_latency(struct bench_run* run, const uint8_t* stamp)
+{
+    uint64_t now = now_ns();
+    uint64_t sent;
+    memcpy(&sent, stamp, sizeof(sent));
+
+    // Only the subscriber thread writes the latencies
+    unsigned int n = atomic_load(&run->received);
+    if (n < run->bc->messages) {
+        run->latencies[n] = now - sent;
+    }
+    run->last_ns = now;
+    atomic_store(&run->received, n + 1);
+}
+
+void mqtt_received_publish(struct mqtt_client* stat)
+{
+    record_latency(bench_client(stat)->run, stat->received_publish.payload.data);
+}
+
+void mqtt_received_publish_part(struct mqtt_client* stat, uint32_t offset, const uint8_t* data, uint32_t len)
+{
+    // The send time may arrive split across pieces
+    struct bench_run* run = bench_client(stat)->run;
+    if (offset < sizeof(run->stamp)) {
+        uint32_t n = sizeof(run->stamp) - offset;
+        memcpy(run->stamp + offset, data, n < len ? n : len);
+    }
+}
+
+void mqtt_received_publish_end(struct mqtt_client* stat, int result)
+{
+    if (SUCCESSFUL(result)) {
+        struct bench_run* run = bench_client(stat)->run;
+        record_latency(run, run->stamp);
+    }
+}
+
+void mqtt_subscription_granted(struct mqtt_client* stat, uint16_t packet_id, int num)
+{
+    atomic_store(&bench_client(stat)->run->subscribed, true);
+}
+
+void mqtt_publish_acknowledged(struct mqtt_client* stat, uint16_t packet_id, uint8_t reason_code)
+{
+    atomic_fetch_add(&bench_client(stat)->completed, 1);
+}
+
+void mqtt_publish_completed(struct mqtt_client* stat, uint16_t packet_id, uint8_t reason_code)
+{
+    atomic_fetch_add(&bench_client(stat)->completed, 1);
+}
+
+/***** Benchmark threads *************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static int open_client(struct mock_broker* broker, struct bench_client* bench, int poll_timeout)
+{
+    struct mqtt_transport transport = mock_broker_transport(broker, &bench->conn);
+    bench->client = mqtt_create_client_transport("mock", NULL, &transport);
+    if (!bench->client) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    bench->conn.poll_timeout = poll_timeout;
+    bench->conn.user = bench;
+
+    // Payloads beyond a struct mqtt_blob are received in parts, without a limit on the packet size
+    if (bench->run->bc->payload > MAX_PAYLOAD) {
+        mqtt_set_receive_streaming(bench->client, STREAM_PART_SIZE);
+        mqtt_set_maximum_packet_size(bench->client, 0);
+    }
+
+    int result = mqtt_connect(bench->client, 0, 0, true);
+    uint64_t deadline = now_ns() + IDLE_TIMEOUT_NS;
+    while (SUCCESSFUL(result) && !mqtt_is_connected(bench->client) && now_ns() < deadline) {
+        result = mqtt_poll(bench->client);
+    }
+    if (SUCCESSFUL(result) && !mqtt_is_connected(bench->client)) {
+        result = ERROR_HOST_UNAVAILABLE;
+    }
+    return result;
+}
+
+static void close_client(struct bench_client* bench)
+{
+    if (bench->client) {
+        if (mqtt_is_connected(bench->client)) {
+            mqtt_disconnect(bench->client, MQTT_REASON_NORMAL_DISCONNECTION);
+        }
+        mqtt_free_client(&bench->client);
+    }
+}
+
+static void* subscriber_main(void* arg)
+{
+    struct bench_client* bench = (struct bench_client*) arg;
+    struct bench_run* run = bench->run;
+    struct mqtt_sub_entry entry = { .qos = 2, .topic = "bench/#" };
+
+    bench->result = mqtt_subscribe(bench->client, &entry, 1);
+    uint64_t idle_since = now_ns();
+    unsigned int last = 0;
+    while (SUCCESSFUL(bench->result) && atomic_load(&run->received) < run->bc->messages) {
+        int result = mqtt_poll(bench->client);
+        if (FAILED(result)) {
+            bench->result = result;
+            break;
+        }
+        unsigned int received = atomic_load(&run->received);
+        if (received != last) {
+            last = received;
+            idle_since = now_ns();
+        } else if (now_ns() - idle_since > IDLE_TIMEOUT_NS) {
+            break; // Messages got lost, report what arrived
+        }
+    }
+    return NULL;
+}
+
+static int publish_streamed(struct mqtt_client* client, struct mqtt_pub_packet* msg,
+                            const uint8_t* payload, uint32_t size)
+{
+    int result = mqtt_publish_begin(client, msg, size);
+    for (uint32_t offset = 0; SUCCESSFUL(result) && offset < size; offset += STREAM_PART_SIZE) {
+        uint32_t len = size - offset < STREAM_PART_SIZE ? size - offset : STREAM_PART_SIZE;
+        result = mqtt_publish_write(client, payload + offset, len);
+    }
+    if (SUCCESSFUL(result)) {
+        result = mqtt_publish_end(client);
+    }
+    return result;
+}
+
+static void* publisher_main(void* arg)
+{
+    struct bench_client* bench = (struct bench_client*) arg;
+    struct bench_run* run = bench->run;
+    const struct bench_case* bc = run->bc;
+    uint8_t* payload = calloc(1, bc->payload);
+    if (!payload) {
+        bench->result = ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < bench->messages && SUCCESSFUL(bench->result); i++) {
+        bool streamed = bc->payload > MAX_PAYLOAD;
+        struct mqtt_pub_packet msg = mqtt_pub_packet(run->topics[i % bc->topics], payload,
+                                                     streamed ? 0 : bc->payload, bc->qos, false);
+        uint64_t sent = now_ns();
+        memcpy(payload, &sent, sizeof(sent));
+
+        int result;
+        while (BASE_ERROR(result = streamed ? publish_streamed(bench->client, &msg, payload, bc->payload) :
+                                              mqtt_publish(bench->client, &msg)) == E_ERROR_OUT_OF_RESOURCE) {
+            // All packet ids in flight, wait for acknowledgements
+            int polled = mqtt_poll(bench->client);
+            if (FAILED(polled)) {
+                result = polled;
+                break;
+            }
+        }
+        bench->result = FAILED(result) ? result : OK;
+    }
+
+    // Finish the handshakes before the connection is closed
+    uint64_t deadline = now_ns() + IDLE_TIMEOUT_NS;
+    while (SUCCESSFUL(bench->result) && bc->qos && atomic_load(&bench->completed) < bench->messages
+           && now_ns() < deadline) {
+        int result = mqtt_poll(bench->client);
+        if (FAILED(result)) {
+            bench->result = result;
+        }
+    }
+    free(payload);
+    return NULL;
+}
+
+/***** Reporting *********************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const uint64_t* sorted, uint32_t count, double p)
+{
+    if (!count) {
+        return 0.0;
+    }
+    uint32_t index = (uint32_t)(p * (count - 1) + 0.5);
+    return sorted[index] / 1000.0;
+}
+
+static void report(const struct bench_run* run, int result)
+{
+    const struct bench_case* bc = run->bc;
+    uint32_t received = atomic_load(&run->received);
+    if (received > bc->messages) {
+        received = bc->messages;
+    }
+    double seconds = received ? (run->last_ns - run->start_ns) / 1e9 : 0.0;
+    qsort(run->latencies, received, sizeof(uint64_t), compare_u64);
+
+    printf("{\"scenario\":\"%s\",\"qos\":%u,\"payload\":%u,\"topics\":%u,\"publishers\":%u,"
+           "\"messages\":%u,\"received\":%u,\"seconds\":%.6f,\"msg_per_sec\":%.1f,\"mb_per_sec\":%.3f,"
+           "\"lat_p50_us\":%.1f,\"lat_p99_us\":%.1f,\"lat_max_us\":%.1f,\"status\":%d}\n",
+           bc->scenario, bc->qos, bc->payload, bc->topics, bc->publishers,
+           bc->messages, received, seconds,
+           seconds > 0 ? received / seconds : 0.0,
+           seconds > 0 ? (double) received * bc->payload / seconds / 1e6 : 0.0,
+           percentile_us(run->latencies, received, 0.50),
+           percentile_us(run->latencies, received, 0.99),
+           received ? run->latencies[received - 1] / 1000.0 : 0.0,
+           result);
+    fflush(stdout);
+}
+
+/***** Benchmark cases ***************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static int run_case(struct mock_broker* broker, const struct bench_case* bc)
+{
+    struct bench_run* run = calloc(1, sizeof(struct bench_run));
+    struct bench_client* clients = calloc(bc->publishers + 1, sizeof(struct bench_client));
+    if (!run || !clients || !(run->latencies = malloc(bc->messages * sizeof(uint64_t)))) {
+        free(clients);
+        free(run);
+        return ERROR_OUT_OF_MEMORY;
+    }
+    run->bc = bc;
+    for (unsigned int i = 0; i < bc->topics; i++) {
+        snprintf(run->topics[i], sizeof(run->topics[i]), "bench/%u", i);
+    }
+
+    // Client 0 subscribes, all others publish
+    int result = OK;
+    for (unsigned int i = 0; i <= bc->publishers && SUCCESSFUL(result); i++) {
+        clients[i].run = run;
+        clients[i].messages = i ? bc->messages / bc->publishers + (i <= bc->messages % bc->publishers) : 0;
+        result = open_client(broker, &clients[i], i ? 100 : 10);
+    }
+
+    if (SUCCESSFUL(result)) {
+        atomic_init(&run->received, 0);
+        pthread_create(&clients[0].thread, NULL, subscriber_main, &clients[0]);
+        while (!atomic_load(&run->subscribed) && SUCCESSFUL(clients[0].result)) {
+            usleep(100);
+        }
+
+        run->start_ns = now_ns();
+        for (unsigned int i = 1; i <= bc->publishers; i++) {
+            pthread_create(&clients[i].thread, NULL, publisher_main, &clients[i]);
+        }
+        for (unsigned int i = 0; i <= bc->publishers; i++) {
+            pthread_join(clients[i].thread, NULL);
+            if (FAILED(clients[i].result) && SUCCESSFUL(result)) {
+                result = clients[i].result;
+            }
+        }
+    }
+
+    report(run, result);
+    for (unsigned int i = 0; i <= bc->publishers; i++) {
+        close_client(&clients[i]);
+    }
+    free(run->latencies);
+    free(run);
+    free(clients);
+    return result;
+}
+
+static uint32_t message_count(uint32_t requested, uint32_t payload)
+{
+    uint32_t limit = MAX_BYTES_PER_RUN / payload;
+    uint32_t count = requested < limit ? requested : limit;
+    if (count < 1000 && payload <= MAX_PAYLOAD) {
+        count = requested < 1000 ? requested : 1000;
+    }
+    return count;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-q] [-n messages]\n"
+                    "  -q  Quick run with fewer cases and messages\n"
+                    "  -n  Messages per case (default 100000, reduced for large payloads)\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    static const uint32_t payloads[] = { 8, 64, 512, 4096, 32768, 65535, 1048576 };
+    static const unsigned int topic_counts[] = { 1, 16, 256, 1024 };
+    static const unsigned int publisher_counts[] = { 1, 2, 4, 8, 16 };
+    uint32_t messages = 100000;
+    bool quick = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "qn:h")) != -1) {
+        switch (opt) {
+        case 'q':
+            quick = true;
+            messages = 10000;
+            break;
+        case 'n':
+            messages = (uint32_t) strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!messages) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct mock_broker* broker = mock_broker_start();
+    if (!broker) {
+        fprintf(stderr, "Failed to start the mock broker\n");
+        return 1;
+    }
+
+    int failures = 0;
+    unsigned int step = quick ? 2 : 1;
+
+    // Payload size sweep with one publisher on one topic
+    for (uint8_t qos = 0; qos <= 2; qos++) {
+        for (unsigned int i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i += step) {
+            struct bench_case bc = { "payload", qos, payloads[i], 1, 1, message_count(messages, payloads[i]) };
+            failures += FAILED(run_case(broker, &bc));
+        }
+    }
+
+    // Topic count sweep, the subscriber matches every topic through one wildcard filter
+    for (unsigned int i = 0; i < sizeof(topic_counts) / sizeof(topic_counts[0]); i += step) {
+        struct bench_case bc = { "topics", 1, 64, topic_counts[i], 1, message_count(messages, 64) };
+        failures += FAILED(run_case(broker, &bc));
+    }
+
+    // Fan-in of several publishers into one subscriber
+    for (unsigned int i = 0; i < sizeof(publisher_counts) / sizeof(publisher_counts[0]); i += step) {
+        for (uint8_t qos = quick ? 1 : 0; qos <= (quick ? 1 : 2); qos++) {
+            struct bench_case bc = { "fan_in", qos, 64, 16, publisher_counts[i], message_count(messages, 64) };
+            failures += FAILED(run_case(broker, &bc));
+        }
+    }
+
+    mock_broker_stop(broker);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,731 @@
+/**
+ * @file mock_broker.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Minimal in-process MQTT 5 broker for benchmarks
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "mock_broker.h"
+#include "status.h"
+
+#define MAX_CONNECTIONS     64
+#define MAX_SUBSCRIPTIONS   16
+#define RECV_CHUNK_SIZE     65536
+
+struct subscription {
+    char* filter;
+    uint8_t qos;
+};
+
+struct buffer {
+    uint8_t* data;
+    size_t pos;
+    size_t len;
+    size_t size;
+};
+
+struct connection {
+    int fd;
+    uint8_t* rx;
+    size_t rx_len;
+    size_t rx_size;
+    struct buffer tx;
+    struct buffer backlog;      // QoS 1 and 2 messages held back by the receive maximum
+    struct subscription subs[MAX_SUBSCRIPTIONS];
+    int sub_count;
+    uint16_t packet_id;
+    uint16_t receive_max;
+    uint16_t inflight;
+};
+
+struct mock_broker {
+    pthread_t thread;
+    int control[2];     // Attached sockets and the stop request are passed through here
+    struct connection conns[MAX_CONNECTIONS];
+    int conn_count;
+};
+
+/***** Packet encoding ***************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static bool reserve(struct buffer* buf, size_t len)
+{
+    if (buf->len + len <= buf->size) {
+        return true;
+    }
+    if (buf->pos) {
+        // Drop what has been consumed already before growing the buffer
+        memmove(buf->data, buf->data + buf->pos, buf->len - buf->pos);
+        buf->len -= buf->pos;
+        buf->pos = 0;
+        if (buf->len + len <= buf->size) {
+            return true;
+        }
+    }
+    size_t size = buf->size ? buf->size : 4096;
+    while (size < buf->len + len) {
+        size *= 2;
+    }
+    uint8_t* data = realloc(buf->data, size);
+    if (!data) {
+        return false;
+    }
+    buf->data = data;
+    buf->size = size;
+    return true;
+}
+
+static void put(struct buffer* buf, const void* data, size_t len)
+{
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static size_t varint(uint8_t* out, uint32_t value)
+{
+    size_t n = 0;
+    do {
+        out[n] = value & 0x7f;
+        value >>= 7;
+        if (value) {
+            out[n] |= 0x80;
+        }
+        n++;
+    } while (value);
+    return n;
+}
+
+static void send_packet(struct connection* conn, uint8_t header, const uint8_t* body, size_t len)
+{
+    uint8_t fixed[5];
+    fixed[0] = header;
+    size_t n = varint(fixed + 1, (uint32_t) len) + 1;
+    if (reserve(&conn->tx, n + len)) {
+        put(&conn->tx, fixed, n);
+        put(&conn->tx, body, len);
+    }
+}
+
+static void send_ack(struct connection* conn, mqtt_packet_type type, uint8_t flags, uint16_t packet_id)
+{
+    uint8_t body[2] = { packet_id >> 8, packet_id & 0xff };
+    send_packet(conn, type << 4 | flags, body, sizeof(body));
+}
+
+static uint16_t next_packet_id(struct connection* conn)
+{
+    if (!++conn->packet_id) {
+        conn->packet_id = 1;
+    }
+    return conn->packet_id;
+}
+
+/* Moves one PUBLISH from the backlog into the send buffer and assigns its packet id */
+static void release_backlog(struct connection* conn)
+{
+    struct buffer* backlog = &conn->backlog;
+    uint8_t* packet = backlog->data + backlog->pos;
+    const uint8_t* p = packet + 1;
+    uint32_t len = 0;
+    for (int i = 0; i < 4; i++) {
+        len |= (uint32_t)(*p & 0x7f) << (7 * i);
+        if (!(*p++ & 0x80)) {
+            break;
+        }
+    }
+    size_t size = (p - packet) + len;
+    uint8_t* id = (uint8_t*) p + 2 + (p[0] << 8 | p[1]);
+    uint16_t packet_id = next_packet_id(conn);
+    id[0] = packet_id >> 8;
+    id[1] = packet_id & 0xff;
+
+    if (reserve(&conn->tx, size)) {
+        put(&conn->tx, packet, size);
+    }
+    backlog->pos += size;
+    if (backlog->pos == backlog->len) {
+        backlog->pos = 0;
+        backlog->len = 0;
+    }
+    conn->inflight++;
+}
+
+static void send_publish(struct connection* conn, const char* topic, size_t topic_len,
+                         const uint8_t* payload, size_t payload_len, uint8_t qos)
+{
+    uint8_t fixed[5];
+    uint8_t head[4];
+    size_t head_len = 0;
+    if (qos) {
+        head[head_len++] = 0; // Packet id is assigned when the message is released
+        head[head_len++] = 0;
+    }
+    head[head_len++] = 0; // No properties
+
+    size_t len = 2 + topic_len + head_len + payload_len;
+    fixed[0] = PUBLISH << 4 | qos << 1;
+    size_t n = varint(fixed + 1, (uint32_t) len) + 1;
+
+    // QoS 0 goes out right away, QoS 1 and 2 queue up behind the receive maximum
+    struct buffer* buf = qos ? &conn->backlog : &conn->tx;
+    if (reserve(buf, n + len)) {
+        uint8_t topic_size[2] = { topic_len >> 8, topic_len & 0xff };
+        put(buf, fixed, n);
+        put(buf, topic_size, 2);
+        put(buf, topic, topic_len);
+        put(buf, head, head_len);
+        put(buf, payload, payload_len);
+    }
+    while (conn->backlog.len && conn->inflight < conn->receive_max) {
+        release_backlog(conn);
+    }
+}
+
+static void complete_delivery(struct connection* conn)
+{
+    if (conn->inflight) {
+        conn->inflight--;
+    }
+    while (conn->backlog.len && conn->inflight < conn->receive_max) {
+        release_backlog(conn);
+    }
+}
+
+/***** Packet handling ***************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static bool topic_matches(const char* filter, const char* topic, size_t topic_len)
+{
+    const char* end = topic + topic_len;
+    while (*filter) {
+        if (*filter == '#') {
+            return true;
+        }
+        if (*filter == '+') {
+            while (topic < end && *topic != '/') {
+                topic++;
+            }
+            filter++;
+        } else {
+            if (topic == end || *filter != *topic) {
+                return false;
+            }
+            filter++;
+            topic++;
+        }
+    }
+    return topic == end;
+}
+
+static uint32_t read_varint(const uint8_t** p, const uint8_t* end)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4 && *p < end; i++) {
+        uint8_t byte = *(*p)++;
+        value |= (uint32_t)(byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    return value;
+}
+
+static void handle_publish(struct mock_broker* broker, struct connection* conn, uint8_t flags,
+                           const uint8_t* p, const uint8_t* end)
+{
+    uint8_t qos = (flags >> 1) & 0x03;
+    if (end - p < 2) {
+        return;
+    }
+    size_t topic_len = p[0] << 8 | p[1];
+    const char* topic = (const char*)(p + 2);
+    p += 2 + topic_len;
+    uint16_t packet_id = 0;
+    if (qos) {
+        packet_id = p[0] << 8 | p[1];
+        p += 2;
+    }
+    p += read_varint(&p, end);  // Properties are not forwarded
+    if (p > end) {
+        return;
+    }
+
+    for (int i = 0; i < broker->conn_count; i++) {
+        struct connection* sub = &broker->conns[i];
+        int granted = -1;
+        for (int s = 0; s < sub->sub_count; s++) {
+            if (topic_matches(sub->subs[s].filter, topic, topic_len) && sub->subs[s].qos > granted) {
+                granted = sub->subs[s].qos;
+            }
+        }
+        if (granted >= 0) {
+            send_publish(sub, topic, topic_len, p, end - p, qos < granted ? qos : (uint8_t) granted);
+        }
+    }
+
+    if (qos == 1) {
+        send_ack(conn, PUBACK, 0, packet_id);
+    } else if (qos == 2) {
+        send_ack(conn, PUBREC, 0, packet_id);
+    }
+}
+
+static void handle_subscribe(struct connection* conn, const uint8_t* p, const uint8_t* end)
+{
+    uint8_t reply[2 + 1 + MAX_SUBSCRIPTIONS];
+    size_t len = 0;
+    reply[len++] = p[0];
+    reply[len++] = p[1];
+    reply[len++] = 0; // No properties
+    p += 2;
+    p += read_varint(&p, end);
+
+    while (end - p >= 3 && len < sizeof(reply)) {
+        size_t filter_len = p[0] << 8 | p[1];
+        if ((size_t)(end - p) < 3 + filter_len) {
+            break;
+        }
+        uint8_t qos = p[2 + filter_len] & 0x03;
+        if (conn->sub_count < MAX_SUBSCRIPTIONS) {
+            char* filter = malloc(filter_len + 1);
+            if (filter) {
+                memcpy(filter, p + 2, filter_len);
+                filter[filter_len] = '\0';
+                conn->subs[conn->sub_count].filter = filter;
+                conn->subs[conn->sub_count].qos = qos;
+                conn->sub_count++;
+            }
+            reply[len++] = filter ? qos : MQTT_REASON_UNSPECIFIED_ERROR;
+        } else {
+            reply[len++] = MQTT_REASON_QUOTA_EXCEEDED;
+        }
+        p += 3 + filter_len;
+    }
+    send_packet(conn, SUBACK << 4, reply, len);
+}
+
+static void handle_unsubscribe(struct connection* conn, const uint8_t* p, const uint8_t* end)
+{
+    uint8_t reply[2 + 1 + MAX_SUBSCRIPTIONS];
+    size_t len = 0;
+    reply[len++] = p[0];
+    reply[len++] = p[1];
+    reply[len++] = 0;
+    p += 2;
+    p += read_varint(&p, end);
+
+    while (end - p >= 2 && len < sizeof(reply)) {
+        size_t filter_len = p[0] << 8 | p[1];
+        if ((size_t)(end - p) < 2 + filter_len) {
+            break;
+        }
+        uint8_t reason = MQTT_REASON_NO_SUBSCRIPTION_EXISTED;
+        for (int s = 0; s < conn->sub_count; s++) {
+            if (strlen(conn->subs[s].filter) == filter_len && !memcmp(conn->subs[s].filter, p + 2, filter_len)) {
+                free(conn->subs[s].filter);
+                conn->subs[s] = conn->subs[--conn->sub_count];
+                reason = MQTT_REASON_SUCCESS;
+                break;
+            }
+        }
+        reply[len++] = reason;
+        p += 2 + filter_len;
+    }
+    send_packet(conn, UNSUBACK << 4, reply, len);
+}
+
+static const uint8_t* skip_string(const uint8_t* p, const uint8_t* end)
+{
+    return end - p < 2 ? end : p + 2 + (p[0] << 8 | p[1]);
+}
+
+static uint16_t connect_receive_maximum(const uint8_t* p, const uint8_t* end)
+{
+    // Protocol name, version, flags and keep alive precede the properties
+    if (end - p < 10) {
+        return UINT16_MAX;
+    }
+    p += 10;
+    uint32_t len = read_varint(&p, end);
+    if ((size_t)(end - p) < len) {
+        return UINT16_MAX;
+    }
+    end = p + len;
+    while (p < end) {
+        uint8_t id = *p++;
+        switch (id) {
+        case MQTT_CON_RECEIVE_MAXIMUM_ID:
+            return end - p >= 2 && (p[0] << 8 | p[1]) ? p[0] << 8 | p[1] : UINT16_MAX;
+        case MQTT_CON_SESSION_EXPIRY_INTERVAL_ID:
+        case MQTT_CON_MAXIMUM_PACKET_SIZE_ID:
+            p += 4;
+            break;
+        case MQTT_CON_TOPIC_ALIAS_MAXIMUM_ID:
+            p += 2;
+            break;
+        case MQTT_CON_REQUEST_RESPONSE_INFO_ID:
+        case MQTT_CON_REQUEST_PROBLEM_INF_ID:
+            p += 1;
+            break;
+        case MQTT_USER_PROPERTY_ID:
+            p = skip_string(skip_string(p, end), end);
+            break;
+        case MQTT_CON_AUTH_METHOD_ID:
+        case MQTT_CON_AUTH_DATA_ID:
+            p = skip_string(p, end);
+            break;
+        default:
+            return UINT16_MAX;
+        }
+    }
+    return UINT16_MAX;
+}
+
+/* Returns false when the connection has to be closed */
+static bool handle_packet(struct mock_broker* broker, struct connection* conn, const uint8_t* packet,
+                          const uint8_t* end)
+{
+    mqtt_packet_type type = packet[0] >> 4;
+    uint8_t flags = packet[0] & 0x0f;
+    const uint8_t* p = packet + 1;
+    read_varint(&p, end);
+
+    if (type != CONNECT && type != PINGREQ && type != DISCONNECT && end - p < 2) {
+        return false; // Every other packet starts with a packet id or a topic
+    }
+
+    switch (type) {
+    case CONNECT: {
+        static const uint8_t connack[] = { 0, MQTT_REASON_SUCCESS, 0 };
+        conn->receive_max = connect_receive_maximum(p, end);
+        send_packet(conn, CONNACK << 4, connack, sizeof(connack));
+        return true;
+    }
+    case PUBLISH:
+        handle_publish(broker, conn, flags, p, end);
+        return true;
+    case PUBREC:
+        send_ack(conn, PUBREL, 0x02, p[0] << 8 | p[1]);
+        return true;
+    case PUBREL:
+        send_ack(conn, PUBCOMP, 0, p[0] << 8 | p[1]);
+        return true;
+    case PUBACK:
+    case PUBCOMP:
+        complete_delivery(conn); // Nothing is retransmitted, the packet id is not tracked
+        return true;
+    case SUBSCRIBE:
+        handle_subscribe(conn, p, end);
+        return true;
+    case UNSUBSCRIBE:
+        handle_unsubscribe(conn, p, end);
+        return true;
+    case PINGREQ:
+        send_packet(conn, PINGRESP << 4, NULL, 0);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/***** Connection handling ***********************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static void close_connection(struct mock_broker* broker, int index)
+{
+    struct connection* conn = &broker->conns[index];
+    close(conn->fd);
+    free(conn->rx);
+    free(conn->tx.data);
+    free(conn->backlog.data);
+    for (int s = 0; s < conn->sub_count; s++) {
+        free(conn->subs[s].filter);
+    }
+    broker->conns[index] = broker->conns[--broker->conn_count];
+}
+
+static bool receive(struct mock_broker* broker, struct connection* conn)
+{
+    if (conn->rx_size - conn->rx_len < RECV_CHUNK_SIZE) {
+        uint8_t* rx = realloc(conn->rx, conn->rx_size + RECV_CHUNK_SIZE);
+        if (!rx) {
+            return false;
+        }
+        conn->rx = rx;
+        conn->rx_size += RECV_CHUNK_SIZE;
+    }
+    ssize_t n = recv(conn->fd, conn->rx + conn->rx_len, conn->rx_size - conn->rx_len, 0);
+    if (n <= 0) {
+        return n < 0 && (errno == EAGAIN || errno == EINTR);
+    }
+    conn->rx_len += n;
+
+    // Handle all complete packets
+    size_t pos = 0;
+    while (conn->rx_len - pos >= 2) {
+        const uint8_t* p = conn->rx + pos + 1;
+        const uint8_t* end = conn->rx + conn->rx_len;
+        uint32_t len = 0;
+        bool complete = false;
+        for (int i = 0; i < 4 && p < end; i++) {
+            len |= (uint32_t)(*p & 0x7f) << (7 * i);
+            if (!(*p++ & 0x80)) {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete || (size_t)(end - p) < len) {
+            break;
+        }
+        if (conn->rx[pos] >> 4 == DISCONNECT) {
+            return false;
+        }
+        if (!handle_packet(broker, conn, conn->rx + pos, p + len)) {
+            return false;
+        }
+        pos = (p + len) - conn->rx;
+    }
+    memmove(conn->rx, conn->rx + pos, conn->rx_len - pos);
+    conn->rx_len -= pos;
+    return true;
+}
+
+static bool transmit(struct connection* conn)
+{
+    struct buffer* tx = &conn->tx;
+    while (tx->pos < tx->len) {
+        ssize_t n = send(conn->fd, tx->data + tx->pos, tx->len - tx->pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        tx->pos += n;
+    }
+    tx->pos = 0;
+    tx->len = 0;
+    return true;
+}
+
+static void* broker_main(void* arg)
+{
+    struct mock_broker* broker = (struct mock_broker*) arg;
+    struct pollfd fds[MAX_CONNECTIONS + 1];
+
+    while (1) {
+        fds[0].fd = broker->control[0];
+        fds[0].events = POLLIN;
+        for (int i = 0; i < broker->conn_count; i++) {
+            fds[i + 1].fd = broker->conns[i].fd;
+            fds[i + 1].events = POLLIN | (broker->conns[i].tx.len ? POLLOUT : 0);
+        }
+        int count = broker->conn_count;
+        if (poll(fds, count + 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            if (read(broker->control[0], &fd, sizeof(fd)) != sizeof(fd) || fd < 0) {
+                break; // Stop request
+            }
+            if (broker->conn_count < MAX_CONNECTIONS) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                struct connection* conn = &broker->conns[broker->conn_count++];
+                memset(conn, 0, sizeof(struct connection));
+                conn->fd = fd;
+                conn->receive_max = UINT16_MAX;
+            } else {
+                close(fd);
+            }
+        }
+
+        // Backwards, closing a connection moves the last one into its place
+        for (int i = count - 1; i >= 0; i--) {
+            bool keep = true;
+            if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                keep = receive(broker, &broker->conns[i]);
+            }
+            if (keep && broker->conns[i].tx.len) {
+                keep = transmit(&broker->conns[i]);
+            }
+            if (!keep) {
+                close_connection(broker, i);
+            }
+        }
+        // Packets routed to connections handled earlier in this round
+        for (int i = 0; i < broker->conn_count; i++) {
+            if (broker->conns[i].tx.len && !transmit(&broker->conns[i])) {
+                close_connection(broker, i--);
+            }
+        }
+    }
+
+    while (broker->conn_count) {
+        close_connection(broker, broker->conn_count - 1);
+    }
+    return NULL;
+}
+
+struct mock_broker* mock_broker_start(void)
+{
+    struct mock_broker* broker = calloc(1, sizeof(struct mock_broker));
+    if (!broker) {
+        return NULL;
+    }
+    if (pipe(broker->control) != 0) {
+        free(broker);
+        return NULL;
+    }
+    if (pthread_create(&broker->thread, NULL, broker_main, broker) != 0) {
+        close(broker->control[0]);
+        close(broker->control[1]);
+        free(broker);
+        return NULL;
+    }
+    return broker;
+}
+
+void mock_broker_stop(struct mock_broker* broker)
+{
+    if (!broker) {
+        return;
+    }
+    int stop = -1;
+    if (write(broker->control[1], &stop, sizeof(stop)) == sizeof(stop)) {
+        pthread_join(broker->thread, NULL);
+    }
+    close(broker->control[0]);
+    close(broker->control[1]);
+    free(broker);
+}
+
+int mock_broker_attach(struct mock_broker* broker, int fd)
+{
+    return write(broker->control[1], &fd, sizeof(fd)) == sizeof(fd) ? 0 : -1;
+}
+
+/***** Client network interface ******************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static int alloc_buf(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
+{
+    uint32_t alloc_len = len ? len : RECV_CHUNK_SIZE;
+    buf->payload = malloc(alloc_len);
+    buf->len = buf->payload ? alloc_len : 0;
+    return buf->payload ? OK : ERROR_OUT_OF_MEMORY;
+}
+
+static int free_buf(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    free(buf->payload);
+    buf->payload = NULL;
+    buf->len = 0;
+    return OK;
+}
+
+static int open_conn(struct mqtt_client* client, const char* addr)
+{
+    struct mock_connection* conn = (struct mock_connection*) client->context;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        return ERROR_HW_FAILURE;
+    }
+    if (mock_broker_attach(conn->broker, sv[1]) != 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return ERROR_HOST_UNAVAILABLE;
+    }
+    conn->fd = sv[0];
+    client->net.connected = true;
+    return OK;
+}
+
+static int close_conn(struct mqtt_client* client)
+{
+    struct mock_connection* conn = (struct mock_connection*) client->context;
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    client->net.connected = false;
+    return OK;
+}
+
+static int send_buf(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    struct mock_connection* conn = (struct mock_connection*) client->context;
+    const uint8_t* data = buf->payload;
+    size_t len = buf->len;
+    while (len) {
+        ssize_t n = send(conn->fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERROR_HOST_UNAVAILABLE;
+        }
+        data += n;
+        len -= n;
+    }
+    return OK;
+}
+
+static int recv_buf(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    struct mock_connection* conn = (struct mock_connection*) client->context;
+    struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+    if (poll(&pfd, 1, conn->poll_timeout) <= 0 || !(pfd.revents & (POLLIN | POLLHUP))) {
+        buf->len = 0;
+        return STATUS_PASSED;
+    }
+    ssize_t n = recv(conn->fd, buf->payload, buf->len, 0);
+    if (n <= 0) {
+        buf->len = 0;
+        return ERROR_HOST_UNAVAILABLE;
+    }
+    buf->len = (uint32_t) n;
+    return STATUS_SUCCESS;
+}
+
+static int attach(struct mqtt_client* client, void* context)
+{
+    struct mock_connection* conn = (struct mock_connection*) context;
+    conn->fd = -1;
+    client->net.alloc_send_buf = alloc_buf;
+    client->net.free_send_buf = free_buf;
+    client->net.alloc_recv_buf = alloc_buf;
+    client->net.free_recv_buf = free_buf;
+    client->net.open_conn = open_conn;
+    client->net.close_conn = close_conn;
+    client->net.send = send_buf;
+    client->net.recv = recv_buf;
+    client->context = conn;
+    return STATUS_SUCCESS;
+}
+
+struct mqtt_transport mock_broker_transport(struct mock_broker* broker, struct mock_connection* conn)
+{
+    conn->broker = broker;
+    struct mqtt_transport transport = { .scheme = "mock", .attach = attach, .context = conn };
+    return transport;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file mock_broker.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Minimal in-process MQTT 5 broker for benchmarks
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#ifndef MOCK_BROKER_H_INCLUDED
+#define MOCK_BROKER_H_INCLUDED
+
+#include <stdint.h>
+
+#include "mqtt.h"
+
+struct mock_broker;
+
+/**
+ * @brief Client side of a connection to the mock broker
+ *
+ * Installed into a client by mock_broker_transport(). The user pointer is free
+ * for the application, e.g. to find its state in the weak callbacks.
+ */
+struct mock_connection {
+    struct mock_broker* broker;
+    int fd;
+    int poll_timeout;   // Milliseconds mqtt_poll() waits for data
+    void* user;
+};
+
+/**
+ * @brief Start the broker thread
+ *
+ * The broker routes PUBLISH packets to all matching subscriptions, answers the
+ * QoS 1 and 2 handshakes and PINGREQ. It keeps no sessions, retained messages or
+ * retransmissions, which is all a benchmark needs.
+ *
+ * @return Broker instance, NULL on failure
+ */
+struct mock_broker* mock_broker_start(void);
+
+/**
+ * @brief Stop the broker thread and close all its connections
+ */
+void mock_broker_stop(struct mock_broker* broker);
+
+/**
+ * @brief Hand one end of a connected stream socket over to the broker
+ *
+ * @return 0 on success, -1 on failure
+ */
+int mock_broker_attach(struct mock_broker* broker, int fd);
+
+/**
+ * @brief Transport connecting a client through a socketpair to the broker
+ *
+ * Pass it to mqtt_create_client_transport(). The connection structure must stay
+ * valid as long as the client is used.
+ */
+struct mqtt_transport mock_broker_transport(struct mock_broker* broker, struct mock_connection* conn);
+
+#endif /* MOCK_BROKER_H_INCLUDED */
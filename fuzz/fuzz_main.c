@@ -0,0 +1,106 @@
+/**
+ * @file fuzz_main.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Driver for the fuzz targets when the compiler has no libFuzzer
+ * @version 0.1
+ * @date 2025-07-28
+ *
+ * @copyright Copyright (c) 2025
+ *
+ * Runs every file given on the command line, or every file of a given directory,
+ * through LLVMFuzzerTestOneInput(). Without arguments the input is read from stdin,
+ * which is what AFL expects (afl-fuzz -i corpus -o findings -- ./fuzz_packet).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+static int run_stream(FILE* file)
+{
+    size_t size = 0;
+    size_t capacity = 4096;
+    uint8_t* data = malloc(capacity);
+    if (!data) {
+        return -1;
+    }
+    size_t n;
+    while ((n = fread(data + size, 1, capacity - size, file)) > 0) {
+        size += n;
+        if (size == capacity) {
+            uint8_t* bigger = realloc(data, capacity * 2);
+            if (!bigger) {
+                free(data);
+                return -1;
+            }
+            data = bigger;
+            capacity *= 2;
+        }
+    }
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+    return 0;
+}
+
+static int run_file(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+    int result = run_stream(file);
+    fclose(file);
+    return result;
+}
+
+static int run_path(const char* path)
+{
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        perror(path);
+        return -1;
+    }
+    if (!S_ISDIR(info.st_mode)) {
+        return run_file(path);
+    }
+
+    DIR* dir = opendir(path);
+    if (!dir) {
+        perror(path);
+        return -1;
+    }
+    int result = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char name[4096];
+        snprintf(name, sizeof(name), "%s/%s", path, entry->d_name);
+        if (run_path(name) != 0) {
+            result = -1;
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        return run_stream(stdin) == 0 ? 0 : 1;
+    }
+    int result = 0;
+    for (int i = 1; i < argc; i++) {
+        if (run_path(argv[i]) != 0) {
+            result = 1;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file fuzz_packet.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Fuzz target for the decoding of received packets
+ * @version 0.1
+ * @date 2025-07-28
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt.h"
+
+/*
+ * The first byte of every input selects how the rest is fed into the client:
+ *   bit 0     - mqtt_process_stream() instead of mqtt_process_packet()
+ *   bit 1     - manual acknowledgement mode
+ *   bit 2     - publish packets above PART_SIZE are delivered in parts
+ *   bits 3..7 - chunk size - 1 used for mqtt_process_stream()
+ */
+#define MODE_STREAM  0x01
+#define MODE_MANUAL  0x02
+#define MODE_PARTS   0x04
+
+#define PART_SIZE    24
+
+static struct mqtt_client client;
+
+static int fuzz_send(struct mqtt_client* stat, struct mqtt_pbuf* buf)
+{
+    return 0;
+}
+
+static int fuzz_close(struct mqtt_client* stat)
+{
+    stat->net.connected = false;
+    return 0;
+}
+
+static void setup_client(struct mqtt_client* stat, uint8_t mode)
+{
+    stat->net.open_conn = NULL;
+    stat->net.close_conn = fuzz_close;
+    stat->net.send = fuzz_send;
+    stat->net.recv = NULL;
+    stat->net.connected = true;
+    stat->connected = true;
+    stat->acks.manual = (mode & MODE_MANUAL) != 0;
+    if (mode & MODE_PARTS) {
+        mqtt_set_receive_streaming(stat, PART_SIZE);
+    }
+
+    // Every packet type is accepted, the decoders have to cope with all of them
+    stat->expected_ptypes = 0xffff;
+
+    // Outstanding requests, so that the acknowledgements with packet ids 1..n are processed.
+    // The PUBREL slots stand for received QoS 2 messages that have been answered with a PUBREC.
+    static const mqtt_packet_type answers[] = { PUBACK, PUBREC, PUBCOMP, SUBACK, UNSUBACK, PUBREL };
+    for (int i = 0; i < MQTT_RECEIVE_MAXIMUM; i++) {
+        stat->pending[i].packet_id = i + 1;
+        stat->pending[i].await_packet_type = answers[i % (sizeof(answers) / sizeof(answers[0]))];
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size < 1) {
+        return 0;
+    }
+    uint8_t mode = data[0];
+    data++;
+    size--;
+
+    if (mqtt_init_client(&client, "127.0.0.1") != 0) {
+        return 0;
+    }
+    setup_client(&client, mode);
+
+    // Copy the input, so that any read past its end is caught by the sanitizers
+    uint8_t* packet = malloc(size ? size : 1);
+    if (!packet) {
+        mqtt_deinit_client(&client);
+        return 0;
+    }
+    memcpy(packet, data, size);
+
+    if (mode & MODE_STREAM) {
+        size_t chunk = (mode >> 3) + 1;
+        for (size_t pos = 0; pos < size; pos += chunk) {
+            mqtt_process_stream(&client, packet + pos, (uint32_t)(size - pos < chunk ? size - pos : chunk));
+        }
+    } else if (size) {
+        mqtt_process_packet(&client, packet, (uint32_t) size);
+    }
+
+    mqtt_deinit_client(&client);
+    free(packet);
+    return 0;
+}
@@ -40,7 +40,9 @@ typedef struct mqtt_blob mqtt_blob_t;
  * @brief Set the maximum packet size for the MQTT connection
  * 
  * This function sets the maximum packet size that the client is willing to accept.
- * The server will not send packets larger than this size.
+ * The server will not send packets larger than this size. It defaults to
+ * MQTT_MAX_PACKET_SIZE, 0 announces no limit. Packets that are not delivered in
+ * parts are always limited to MQTT_MAX_PACKET_SIZE when no size is set.
  * 
  * @param stat Pointer to the MQTT client structure
  * @param size Maximum packet size in bytes
@@ -48,7 +50,7 @@ typedef struct mqtt_blob mqtt_blob_t;
 static inline void mqtt_set_maximum_packet_size(struct mqtt_client *stat,
                                                 uint32_t size)
 {
-    stat->connect.max_packet_size = size;
+    stat->config->connect.max_packet_size = size;
 }
 
 /**
@@ -64,10 +66,10 @@ static inline void mqtt_set_maximum_packet_size(struct mqtt_client *stat,
 static inline void mqtt_set_basic_auth(struct mqtt_client *stat, const char *user,
                                        const char *passwd)
 {
-    stat->connect.pw_flag = true;
-    stat->connect.un_flag = true;
-    stat->connect.user = user;
-    stat->connect.passwd = passwd;
+    stat->config->connect.pw_flag = true;
+    stat->config->connect.un_flag = true;
+    stat->config->connect.user = user;
+    stat->config->connect.passwd = passwd;
 }
 
 /**
@@ -81,6 +83,22 @@ static inline bool mqtt_is_connected(struct mqtt_client *stat)
     return stat && stat->connected;
 }
 
+/**
+ * @brief Enable or disable manual acknowledgement of received messages
+ * 
+ * In manual mode the PUBACK (QoS 1) or PUBREC (QoS 2) for a received PUBLISH is not
+ * sent before mqtt_received_publish() is called. Instead the application releases it
+ * with mqtt_ack() once the message has been processed. All released acknowledgements
+ * are sent together with one write on the next mqtt_poll() or mqtt_flush().
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param enable Whether received messages have to be acknowledged by the application
+ */
+static inline void mqtt_set_manual_ack(struct mqtt_client *stat, bool enable)
+{
+    stat->acks.manual = enable;
+}
+
 /**
  * @brief Create a publish packet structure
  * 
@@ -114,21 +132,122 @@ static inline struct mqtt_pub_packet mqtt_pub_packet(const char *topic,
 /**
  * @brief Convert mqtt_blob to a null-terminated string
  * @param blob Pointer to the mqtt_blob structure
- * @return Dynamically allocated string (caller must free) or NULL on error
+ * @return String allocated with the default allocator (caller must free) or NULL on error
  */
 char* mqtt_blob_to_string(const struct mqtt_blob* blob);
 
+/**
+ * @brief Replace the default allocator
+ * 
+ * The default allocator is used by clients created with mqtt_create_client() and
+ * by mqtt_blob_to_string(). Clients created before keep their allocator.
+ * 
+ * @param allocator Allocator callbacks to copy, or NULL to restore malloc/realloc/free
+ */
+void mqtt_set_default_allocator(const struct mqtt_allocator* allocator);
+
+/**
+ * @brief Transport over TCP, Berkeley sockets or lwIP depending on the build
+ * 
+ * Registered under the scheme "tcp" and used for addresses without a scheme.
+ */
+extern const struct mqtt_transport mqtt_tcp_transport;
+
+/**
+ * @brief Transport over Unix domain stream sockets, Berkeley sockets builds only
+ * 
+ * Registered under the scheme "unix" for brokers on the same host, the address is
+ * a socket path ("unix:///run/mosquitto/mqtt.sock") or, on Linux, a name in the
+ * abstract namespace prefixed with '@' ("unix://@mqtt").
+ */
+extern const struct mqtt_transport mqtt_unix_transport;
+
+/**
+ * @brief Register a transport for a broker address scheme
+ * 
+ * Clients created afterwards with an address "scheme://..." are attached to the
+ * transport. A transport with the same scheme, built-in ones included, is replaced.
+ * Registration is meant for startup and is not thread-safe, the descriptor is not
+ * copied and must stay valid while it is registered.
+ * 
+ * @param transport Transport descriptor with scheme and attach function
+ * @return Status code, ERROR_OUT_OF_RESOURCE when MQTT_MAX_TRANSPORTS are registered
+ */
+int mqtt_register_transport(const struct mqtt_transport* transport);
+
+/**
+ * @brief Initialize a client structure provided by the caller
+ * 
+ * Prepares the client in place, the structure itself is not allocated. This is the
+ * only way to set up a client when the library is built with MQTT_STATIC_MEMORY, all
+ * buffers are then part of the structure and sized by the MQTT_STATIC_* constants.
+ * Release the resources with mqtt_deinit_client().
+ * 
+ * The broker address is "[scheme://]host[:port]", the scheme picks a transport from
+ * the registry (see mqtt_register_transport()), without one the first built-in
+ * transport (TCP) is used. The port defaults to MQTT_PORT.
+ * 
+ * @param stat Pointer to the client structure to initialize
+ * @param broker_addr Broker address, e.g. "192.168.1.10" or "tcp://192.168.1.10:1884"
+ * @return Status code indicating success or failure
+ */
+int mqtt_init_client(struct mqtt_client* stat, const char* broker_addr);
+
+/**
+ * @brief Initialize a client structure with a given network interface
+ * 
+ * Like mqtt_init_client(), but the network interface is installed by the given
+ * transport instead of one selected by the scheme of the address, e.g. the
+ * in-memory transport of mqtt_memory.h.
+ * 
+ * @param stat Pointer to the client structure to initialize
+ * @param broker_addr Broker address, its meaning depends on the transport
+ * @param transport Transport descriptor, NULL to select it by the scheme of the address
+ * @return Status code indicating success or failure
+ */
+int mqtt_init_client_transport(struct mqtt_client* stat, const char* broker_addr, const struct mqtt_transport* transport);
+
+#ifndef MQTT_STATIC_MEMORY
 /**
  * @brief Create a new MQTT client instance
  * 
  * Allocates and initializes a new MQTT client structure with the specified broker address.
  * The client must be freed using mqtt_free_client() when no longer needed.
  * 
- * @param broker_addr IP address or hostname of the MQTT broker
+ * @param broker_addr Broker address, see mqtt_init_client()
  * @return Pointer to the newly created MQTT client, or NULL on failure
  */
 struct mqtt_client* mqtt_create_client(const char* broker_addr);
 
+/**
+ * @brief Create a new MQTT client instance using a custom allocator
+ * 
+ * Like mqtt_create_client(), but the client structure and every allocation made on
+ * its behalf (decoded strings, buffers, queued messages) go through the given
+ * allocator. The callbacks are copied into the client. When the submission queue or
+ * the I/O thread mode is used, the allocator must be thread-safe.
+ * 
+ * @param broker_addr Broker address, see mqtt_init_client()
+ * @param allocator Allocator callbacks, or NULL for the default allocator
+ * @return Pointer to the newly created MQTT client, or NULL on failure
+ */
+struct mqtt_client* mqtt_create_client_ex(const char* broker_addr, const struct mqtt_allocator* allocator);
+
+/**
+ * @brief Create a new MQTT client instance with a given network interface
+ * 
+ * Like mqtt_create_client_ex(), the network interface is installed by the transport,
+ * see mqtt_init_client_transport().
+ * 
+ * @param broker_addr Broker address, its meaning depends on the transport
+ * @param allocator Allocator callbacks, or NULL for the default allocator
+ * @param transport Transport descriptor, NULL to select it by the scheme of the address
+ * @return Pointer to the newly created MQTT client, or NULL on failure
+ */
+struct mqtt_client* mqtt_create_client_transport(const char* broker_addr, const struct mqtt_allocator* allocator,
+                                                 const struct mqtt_transport* transport);
+#endif
+
 /**
  * @brief Connect to the MQTT broker
  * 
@@ -167,10 +286,33 @@ int mqtt_disconnect(struct mqtt_client* stat, mqtt_reason_code reason_code);
  */
 int mqtt_process_packet(struct mqtt_client *stat, void* data, uint32_t len);
 
+/**
+ * @brief Process a chunk of the byte stream received from the broker
+ * 
+ * Splits the stream into MQTT packets and processes each of them with
+ * mqtt_process_packet(). Complete packets are processed in place, packets split
+ * across chunks are reassembled internally until the remaining bytes arrive.
+ * PUBLISH packets above the size set with mqtt_set_receive_streaming() are not
+ * reassembled. Once their variable header is in, the payload is passed to
+ * mqtt_received_publish_part() piece by piece as it arrives, instead of
+ * mqtt_received_publish().
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param data Pointer to the received bytes
+ * @param len Number of received bytes
+ * @return Status code of the first failing packet, or success
+ */
+int mqtt_process_stream(struct mqtt_client *stat, void* data, uint32_t len);
+
 /**
  * @brief Poll for incoming MQTT packets
  * 
  * Checks for incoming packets from the broker and processes them if available.
+ * All packets contained in the received data are processed, the payload and the
+ * decoded strings of the last received packet stay valid until the next call.
+ * The topic and strings of received_publish stay valid until the next PUBLISH is decoded,
+ * acknowledgements processed behind it in the same call do not affect them.
+ * Strings of the CONNACK (e.g. the assigned client id) are kept until the next CONNACK.
  * This function should be called regularly in the main loop.
  * 
  * @param stat Pointer to the MQTT client structure
@@ -210,6 +352,9 @@ int mqtt_unsubscribe(struct mqtt_client* stat, struct mqtt_sub_entry* entries, u
  * 
  * Sends a PUBLISH packet with the specified message to the broker.
  * For QoS > 0, the function will handle acknowledgment packets automatically.
+ * Payloads larger than MQTT_PUBLISH_COPY_LIMIT are not copied into the send
+ * buffer, the transport sends them from the buffer of the caller right after the
+ * header. The buffer can be reused when the function returns.
  * 
  * @param stat Pointer to the MQTT client structure
  * @param msg Pointer to the publish packet structure containing message details
@@ -217,6 +362,187 @@ int mqtt_unsubscribe(struct mqtt_client* stat, struct mqtt_sub_entry* entries, u
  */
 int mqtt_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg);
 
+/**
+ * @brief Publish several messages to the MQTT broker with a single send
+ * 
+ * All messages are validated first, packet identifiers are reserved for every
+ * message with QoS > 0 and the PUBLISH packets are encoded back-to-back into one
+ * send buffer which is handed to the network interface at once.
+ * If any message is invalid or no packet identifiers are left, nothing is sent.
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param msgs Array of publish packet structures (packet_id fields are updated)
+ * @param count Number of messages in the array
+ * @return Status code indicating success or failure
+ */
+int mqtt_publish_batch(struct mqtt_client* stat, struct mqtt_pub_packet* msgs, unsigned int count);
+
+/**
+ * @brief Start a publish whose payload is written in pieces as it is produced
+ * 
+ * The PUBLISH header is sent right away with the total payload size declared here,
+ * the payload of msg is ignored. Until mqtt_publish_end() other packets of the client
+ * are held back in the coalescing buffer, mqtt_publish() and mqtt_disconnect() fail.
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param msg Publish packet structure without payload (packet_id field is updated)
+ * @param payload_size Total number of bytes that will be written
+ * @return Status code indicating success or failure
+ */
+int mqtt_publish_begin(struct mqtt_client* stat, struct mqtt_pub_packet* msg, uint32_t payload_size);
+
+/**
+ * @brief Send the next piece of a payload started with mqtt_publish_begin()
+ * 
+ * The data is handed to the transport without a copy into the send buffer and
+ * can be reused when the call returns.
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param data Next bytes of the payload
+ * @param len Number of bytes, at most what is left of the declared size
+ * @return Status code indicating success or failure, ERROR_OUT_OF_RESOURCE if the transport
+ *         has no room right now (e.g. in an lwIP callback), the bytes can be written again
+ */
+int mqtt_publish_write(struct mqtt_client* stat, const void* data, uint32_t len);
+
+/**
+ * @brief Complete a publish started with mqtt_publish_begin()
+ * 
+ * Sends the packets held back meanwhile. If less than the declared payload was
+ * written, the packet cannot be completed: the connection is closed and
+ * ERROR_INVALID_OPERATION is returned.
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @return Status code indicating success or failure
+ */
+int mqtt_publish_end(struct mqtt_client* stat);
+
+/**
+ * @brief Enable or disable write coalescing on the outbound path
+ * 
+ * When enabled, PUBLISH, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBSCRIBE, UNSUBSCRIBE and
+ * PINGREQ packets are appended to an outbound buffer instead of being sent one by one.
+ * The buffer is handed to the network interface when it reaches max_bytes, when the
+ * oldest queued packet is older than max_delay_ms, on every call of mqtt_poll(),
+ * before a DISCONNECT and on mqtt_flush().
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param max_bytes Byte threshold of the outbound buffer (0 disables coalescing)
+ * @param max_delay_ms Maximum time a packet stays queued (0 for no time limit)
+ * @return Status code indicating success or failure
+ */
+int mqtt_set_write_coalescing(struct mqtt_client* stat, uint32_t max_bytes, uint32_t max_delay_ms);
+
+/**
+ * @brief Deliver large received messages in parts instead of one buffer
+ * 
+ * PUBLISH packets larger than part_size are never held in memory as a whole. The
+ * first part_size bytes are reassembled, they have to hold the topic and the
+ * properties. mqtt_received_publish_begin() is called with them, then
+ * mqtt_received_publish_part() for each piece of the payload as it arrives from the
+ * transport, and mqtt_received_publish_end() when the payload is complete or the
+ * connection ended before. The message is acknowledged after the end. In I/O thread
+ * mode the callbacks run on the I/O thread.
+ * 
+ * The broker never sends more than the maximum packet size announced on connect,
+ * see mqtt_set_maximum_packet_size().
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param part_size Size above which messages are delivered in parts, 0 to reassemble all
+ *                  (with MQTT_STATIC_MEMORY at most MQTT_STATIC_PACKET_SIZE)
+ * @return Status code indicating success or failure
+ */
+int mqtt_set_receive_streaming(struct mqtt_client* stat, uint32_t part_size);
+
+/**
+ * @brief Send all packets queued by write coalescing
+ * 
+ * Acknowledgements released with mqtt_ack() are sent as well.
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @return Status code indicating success or failure
+ */
+int mqtt_flush(struct mqtt_client* stat);
+
+/**
+ * @brief Acknowledge a received QoS 1 or QoS 2 message in manual acknowledgement mode
+ * 
+ * The acknowledgement is queued and sent with the next mqtt_poll() or mqtt_flush().
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param packet_id Packet identifier of the received message
+ * @return Status code indicating success or failure
+ */
+int mqtt_ack(struct mqtt_client* stat, uint16_t packet_id);
+
+/**
+ * @brief Enable the thread-safe submission queue of the client
+ * 
+ * Allocates lock-free multi-producer/single-consumer rings of MQTT_SUBMIT_QUEUE_SIZE
+ * requests, one for messages and one for acknowledgements. It must be called before any
+ * thread uses mqtt_submit_publish() or mqtt_submit_ack(). The thread calling mqtt_poll()
+ * or mqtt_flush() drains the queue, encodes the queued messages back-to-back and sends
+ * them with as few writes as possible. Acknowledgements are sent first and never wait
+ * for queued messages.
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @return Status code indicating success or failure
+ */
+int mqtt_enable_submit_queue(struct mqtt_client* stat);
+
+/**
+ * @brief Queue a message for publishing from any thread
+ * 
+ * Topic and payload are copied, the caller may reuse its buffers after the call returns.
+ * The packet identifier and the send result are reported to mqtt_submitted_publish()
+ * on the thread draining the queue. Messages with QoS > 0 remain queued while all
+ * packet identifiers are in use.
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param msg Pointer to the publish packet structure containing message details
+ * @return Status code indicating success or failure (queue full: out of resource)
+ */
+int mqtt_submit_publish(struct mqtt_client* stat, const struct mqtt_pub_packet* msg);
+
+/**
+ * @brief Queue the acknowledgement of a received message from any thread
+ * 
+ * Thread-safe counterpart of mqtt_ack() for manual acknowledgement mode.
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param packet_id Packet identifier of the received message
+ * @return Status code indicating success or failure (queue full: out of resource)
+ */
+int mqtt_submit_ack(struct mqtt_client* stat, uint16_t packet_id);
+
+#ifndef MQTT_STATIC_MEMORY
+/**
+ * @brief Start the background I/O thread of the client (not available for LwIP)
+ * 
+ * The I/O thread runs mqtt_poll() and the keep-alive pings for the connection.
+ * Received PUBLISH messages are copied and dispatched to a pool of worker threads
+ * which call mqtt_dispatched_publish(). Messages with the same topic are always
+ * handled by the same worker, so their order is preserved. Call this function after
+ * mqtt_connect(); while the I/O thread runs, other threads may only use
+ * mqtt_submit_publish() and mqtt_submit_ack().
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @param worker_count Number of worker threads (at least one)
+ * @return Status code indicating success or failure
+ */
+int mqtt_start_io_thread(struct mqtt_client* stat, unsigned int worker_count);
+
+/**
+ * @brief Stop the background I/O thread and its worker threads
+ * 
+ * Waits until the worker threads have handled all messages dispatched so far.
+ * 
+ * @param stat Pointer to the MQTT client structure
+ * @return Status code indicating success or failure
+ */
+int mqtt_stop_io_thread(struct mqtt_client* stat);
+#endif
+
 /**
  * @brief Send a ping request to the MQTT broker
  * 
@@ -232,13 +558,25 @@ int mqtt_ping(struct mqtt_client* stat);
  * @brief Free all dynamically allocated strings in the MQTT client
  * 
  * Frees all strings that were allocated during the client's operation,
- * such as received strings from broker responses. This function is automatically
+ * such as received strings from broker responses. Strings decoded from received
+ * packets are kept in three arenas, one reset with every processed packet, one
+ * with every received PUBLISH and one with every CONNACK. This function is automatically
  * called by mqtt_free_client() but can be called separately if needed.
  * 
  * @param stat Pointer to the MQTT client structure
  */
 void mqtt_free_client_strings(struct mqtt_client* stat);
 
+/**
+ * @brief Release the resources of a client initialized with mqtt_init_client()
+ * 
+ * Frees everything the client allocated, but not the client structure itself.
+ * 
+ * @param stat Pointer to the MQTT client structure
+ */
+void mqtt_deinit_client(struct mqtt_client* stat);
+
+#ifndef MQTT_STATIC_MEMORY
 /**
  * @brief Free the MQTT client and all associated resources
  * 
@@ -248,5 +586,6 @@ void mqtt_free_client_strings(struct mqtt_client* stat);
  * @param stat Pointer to the MQTT client pointer (will be set to NULL)
  */
 void mqtt_free_client(struct mqtt_client** stat);
+#endif
 
 #endif /* MQTT_H_INCLUDED */
\ No newline at end of file
@@ -18,14 +18,153 @@
 #define MQTT_RECEIVE_MAXIMUM    32
 #endif
 
-#ifndef MQTT_CORELATION_DATA_MAXIMUM
-#define MQTT_CORELATION_DATA_MAXIMUM 256
+#ifndef MQTT_SUBMIT_QUEUE_SIZE
+#define MQTT_SUBMIT_QUEUE_SIZE  64
+#endif
+
+#ifndef MQTT_SUBMIT_BATCH_SIZE
+#define MQTT_SUBMIT_BATCH_SIZE  16
+#endif
+
+#ifndef MQTT_ARENA_BLOCK_SIZE
+#define MQTT_ARENA_BLOCK_SIZE   256
+#endif
+
+#ifdef MQTT_STATIC_MEMORY
+/* Storage embedded into the client structure when the library is built without heap */
+#ifndef MQTT_STATIC_SEND_BUFFER_SIZE
+#define MQTT_STATIC_SEND_BUFFER_SIZE      1024
+#endif
+
+#ifndef MQTT_STATIC_RECV_BUFFER_SIZE
+#define MQTT_STATIC_RECV_BUFFER_SIZE      1024
+#endif
+
+#ifndef MQTT_STATIC_PACKET_SIZE
+#define MQTT_STATIC_PACKET_SIZE           1024
+#endif
+
+#ifndef MQTT_STATIC_PACKET_STRINGS_SIZE
+#define MQTT_STATIC_PACKET_STRINGS_SIZE   512
+#endif
+
+#ifndef MQTT_STATIC_PUBLISH_STRINGS_SIZE
+#define MQTT_STATIC_PUBLISH_STRINGS_SIZE  512
+#endif
+
+#ifndef MQTT_STATIC_SESSION_STRINGS_SIZE
+#define MQTT_STATIC_SESSION_STRINGS_SIZE  256
+#endif
+
+#ifndef MQTT_STATIC_ADDRESS_SIZE
+#define MQTT_STATIC_ADDRESS_SIZE          128
+#endif
+
+#ifndef MQTT_STATIC_CLIENT_ID_SIZE
+#define MQTT_STATIC_CLIENT_ID_SIZE        64
+#endif
+
+#ifndef MQTT_STATIC_TRANSPORT_SIZE
+#define MQTT_STATIC_TRANSPORT_SIZE        64
+#endif
+
+/* Packets sent while the payload of a publish is streamed, they follow it */
+#ifndef MQTT_STATIC_HOLD_SIZE
+#define MQTT_STATIC_HOLD_SIZE             64
+#endif
+#endif
+
+/* Largest packet received in one piece, announced to the broker on connect unless set with
+   mqtt_set_maximum_packet_size(). A payload up to 65535 bytes with its topic and properties. */
+#ifndef MQTT_MAX_PACKET_SIZE
+#ifdef MQTT_STATIC_MEMORY
+#define MQTT_MAX_PACKET_SIZE      MQTT_STATIC_PACKET_SIZE
+#else
+#define MQTT_MAX_PACKET_SIZE      (65535 + 1024)
+#endif
+#endif
+
+/* Publish payloads above this size are not copied, the transport sends them from the caller's buffer */
+#ifndef MQTT_PUBLISH_COPY_LIMIT
+#ifdef MQTT_STATIC_MEMORY
+#define MQTT_PUBLISH_COPY_LIMIT   (MQTT_STATIC_SEND_BUFFER_SIZE / 4)
+#else
+#define MQTT_PUBLISH_COPY_LIMIT   4096
+#endif
+#endif
+
+/* Default of mqtt_set_receive_streaming(), received publish packets above it are delivered in parts */
+#ifndef MQTT_PUBLISH_PART_SIZE
+#ifdef MQTT_STATIC_MEMORY
+#define MQTT_PUBLISH_PART_SIZE    MQTT_STATIC_PACKET_SIZE
+#else
+#define MQTT_PUBLISH_PART_SIZE    0
+#endif
+#endif
+
+/* Transports registered at runtime in addition to the built-in ones */
+#ifndef MQTT_MAX_TRANSPORTS
+#define MQTT_MAX_TRANSPORTS   8
+#endif
+
+/* Capacity of each direction of the in-memory transport */
+#ifndef MQTT_MEM_PIPE_SIZE
+#define MQTT_MEM_PIPE_SIZE    16384
+#endif
+
+#ifndef MQTT_MEM_PIPE_WRITES
+#define MQTT_MEM_PIPE_WRITES  64
+#endif
+
+/* Default capacity of each direction of the shared memory transport, a power of two */
+#ifndef MQTT_SHM_RING_SIZE
+#define MQTT_SHM_RING_SIZE    65536
+#endif
+
+/* Polls of an empty or full ring before a side goes to sleep on the futex */
+#ifndef MQTT_SHM_SPIN_COUNT
+#define MQTT_SHM_SPIN_COUNT   2000
+#endif
+
+#ifndef MQTT_SHM_NAME_SIZE
+#define MQTT_SHM_NAME_SIZE    64
 #endif
 
 #ifndef MQTT_PORT
 #define MQTT_PORT  1883
 #endif
 
+#ifndef MQTT_TLS_PORT
+#define MQTT_TLS_PORT  8883
+#endif
+
+/* Brokers a TLS context keeps a session ticket for */
+#ifndef MQTT_TLS_SESSION_CACHE
+#define MQTT_TLS_SESSION_CACHE  16
+#endif
+
+#ifndef MQTT_WS_PORT
+#define MQTT_WS_PORT   80
+#endif
+
+#ifndef MQTT_WSS_PORT
+#define MQTT_WSS_PORT  443
+#endif
+
+/* Request path of WebSocket addresses without one */
+#ifndef MQTT_WS_PATH
+#define MQTT_WS_PATH  "/mqtt"
+#endif
+
+/* Largest HTTP upgrade response, and the time the broker has to send it */
+#ifndef MQTT_WS_HANDSHAKE_SIZE
+#define MQTT_WS_HANDSHAKE_SIZE     1024
+#endif
+
+#ifndef MQTT_WS_HANDSHAKE_TIMEOUT
+#define MQTT_WS_HANDSHAKE_TIMEOUT  5000
+#endif
+
 #ifndef MQTT_POLL_TIMEOUT
 #define MQTT_POLL_TIMEOUT 250
 #endif
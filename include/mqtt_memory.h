@@ -0,0 +1,134 @@
+/**
+ * @file mqtt_memory.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief In-memory transport for tests and benchmarks
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#ifndef MQTT_MEMORY_H_INCLUDED
+#define MQTT_MEMORY_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mqtt_types.h"
+
+/**
+ * @brief Delivery behaviour of an in-memory pipe, applies to both directions
+ */
+struct mqtt_mem_config {
+    uint32_t max_segment;       // Most bytes a single read returns, 0 for no limit
+    bool split_writes;          // A read never returns bytes of two writes, otherwise writes coalesce
+    uint32_t latency_ms;        // Written bytes become readable after this delay
+    uint16_t loss_permille;     // Share of writes dropped as a whole
+    uint32_t seed;              // Seed of the loss generator, equal seeds drop the same writes
+    uint8_t* buffer;            // Storage for larger rings, NULL for the built-in MQTT_MEM_PIPE_SIZE per direction
+    uint32_t buffer_size;       // Split between both directions, each gets the largest power of two of its half
+};
+
+/* One direction of the pipe, a byte ring with the boundaries of the writes in it */
+struct mqtt_mem_channel {
+    uint8_t* data;              // The built-in ring or a part of the configured buffer
+    uint32_t size;              // Capacity, a power of two
+    uint32_t rd;                // Free running byte counters
+    uint32_t wr;
+    struct {
+        uint32_t end;           // Value of wr after the write
+        uint32_t due;           // Time in ms the write becomes readable
+    } writes[MQTT_MEM_PIPE_WRITES];
+    uint16_t first;
+    uint16_t count;
+    uint8_t ring[MQTT_MEM_PIPE_SIZE];
+};
+
+/**
+ * @brief Duplex pipe between one client and a peer in the same thread
+ *
+ * The client side is the network interface installed by mqtt_mem_transport(), the
+ * peer side (usually a scripted broker) uses the mqtt_mem_peer_* functions. Nothing
+ * blocks and nothing is locked, both sides have to be driven from the same thread.
+ * The structure is provided by the caller, the transport does not allocate. Every
+ * write has to fit into the channel as a whole, a send larger than the capacity fails
+ * with ERROR_OUT_OF_RANGE, so messages beyond MQTT_MEM_PIPE_SIZE need a larger
+ * buffer in the configuration.
+ */
+struct mqtt_mem_pipe {
+    struct mqtt_mem_config config;
+    struct mqtt_mem_channel to_peer;
+    struct mqtt_mem_channel to_client;
+    uint32_t rng;
+    uint32_t dropped;           // Number of writes dropped by the loss setting
+    bool connected;             // Opened by the client and not closed by it
+    bool peer_closed;
+};
+
+/**
+ * @brief Initialize a pipe
+ *
+ * @param pipe Pipe structure to initialize
+ * @param config Delivery behaviour, NULL for immediate and lossless delivery
+ */
+void mqtt_mem_pipe_init(struct mqtt_mem_pipe* pipe, const struct mqtt_mem_config* config);
+
+/**
+ * @brief Installs the network interface of the pipe into a client
+ *
+ * @param stat Pointer to the MQTT client structure
+ * @param pipe Pointer to the struct mqtt_mem_pipe the client talks through
+ * @return Status code indicating success or failure
+ */
+int mqtt_mem_attach(struct mqtt_client* stat, void* pipe);
+
+/**
+ * @brief Transport descriptor of a pipe
+ *
+ * Can also be registered with mqtt_register_transport() under a scheme of its own,
+ * it must stay valid as long as it is registered then.
+ *
+ * @param pipe Pipe the client talks through, must stay valid while the client is used
+ * @return Descriptor for mqtt_init_client_transport() or mqtt_create_client_transport()
+ */
+static inline struct mqtt_transport mqtt_mem_transport(struct mqtt_mem_pipe* pipe)
+{
+    struct mqtt_transport transport = { .scheme = "mem", .attach = mqtt_mem_attach, .context = pipe };
+    return transport;
+}
+
+/**
+ * @brief Write bytes from the peer to the client
+ *
+ * @param pipe Pointer to the pipe
+ * @param data Bytes to write
+ * @param len Number of bytes
+ * @return Status code, ERROR_OUT_OF_RESOURCE if the channel has no room for all bytes yet,
+ *         ERROR_OUT_OF_RANGE if they exceed its capacity and would never fit
+ */
+int mqtt_mem_peer_write(struct mqtt_mem_pipe* pipe, const void* data, uint32_t len);
+
+/**
+ * @brief Read bytes the client has sent
+ *
+ * Honours latency, segmentation and write boundaries like the client side does.
+ *
+ * @param pipe Pointer to the pipe
+ * @param data Buffer for the bytes
+ * @param len Size of the buffer
+ * @return Number of bytes read, 0 if nothing is readable yet
+ */
+uint32_t mqtt_mem_peer_read(struct mqtt_mem_pipe* pipe, void* data, uint32_t len);
+
+/**
+ * @brief Close the connection from the peer side
+ *
+ * Bytes already written stay readable for the client, afterwards its receive
+ * reports the host as unavailable.
+ *
+ * @param pipe Pointer to the pipe
+ */
+void mqtt_mem_peer_close(struct mqtt_mem_pipe* pipe);
+
+#endif /* MQTT_MEMORY_H_INCLUDED */
@@ -0,0 +1,98 @@
+/**
+ * @file mqtt_shm.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Shared memory transport for processes on the same host (Linux)
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#ifndef MQTT_SHM_H_INCLUDED
+#define MQTT_SHM_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mqtt_types.h"
+
+/**
+ * @brief Transport over a shared memory segment, registered under the scheme "shm"
+ *
+ * The segment is created by the peer with mqtt_shm_peer_create(), the client opens
+ * it with an address like "shm://control-loop" (the name in /dev/shm). The MQTT byte
+ * stream runs through two lock-free single producer/single consumer rings. A side
+ * that finds its ring empty (or full) spins for a short while and then sleeps on a
+ * futex, the other side only issues the wake-up system call when someone sleeps.
+ * One client at a time can be connected to a segment.
+ */
+extern const struct mqtt_transport mqtt_shm_transport;
+
+/**
+ * @brief Peer end of a shared memory segment, usually a broker or a bridge to one
+ */
+struct mqtt_shm_peer {
+    void* segment;
+    size_t size;
+    char name[MQTT_SHM_NAME_SIZE];
+};
+
+/**
+ * @brief Create a segment and wait for a client
+ *
+ * An existing segment with the same name is replaced.
+ *
+ * @param peer Peer structure to initialize
+ * @param name Segment name, with or without the leading '/'
+ * @param ring_size Bytes per direction, a power of two, 0 for MQTT_SHM_RING_SIZE
+ * @return Status code indicating success or failure
+ */
+int mqtt_shm_peer_create(struct mqtt_shm_peer* peer, const char* name, uint32_t ring_size);
+
+/**
+ * @brief Read bytes the client has sent
+ *
+ * @param peer Pointer to the peer
+ * @param data Buffer for the bytes
+ * @param len Size of the buffer
+ * @param timeout_ms Time to wait for bytes, 0 to return at once
+ * @return Number of bytes read, ERROR_HOST_UNAVAILABLE once the client has closed
+ *         the connection and everything it sent has been read
+ */
+int mqtt_shm_peer_read(struct mqtt_shm_peer* peer, void* data, uint32_t len, uint32_t timeout_ms);
+
+/**
+ * @brief Write bytes to the client
+ *
+ * Waits for room in the ring as long as the client is connected and reads.
+ *
+ * @param peer Pointer to the peer
+ * @param data Bytes to write
+ * @param len Number of bytes
+ * @param timeout_ms Time to wait for room, ERROR_TIMEOUT if not all bytes were written
+ * @return Status code, ERROR_HOST_UNAVAILABLE if no client is connected
+ */
+int mqtt_shm_peer_write(struct mqtt_shm_peer* peer, const void* data, uint32_t len, uint32_t timeout_ms);
+
+/**
+ * @brief Make the segment available for the next client
+ *
+ * Discards what is left in both rings, call it after mqtt_shm_peer_read() reported
+ * that the client has closed the connection.
+ *
+ * @param peer Pointer to the peer
+ */
+void mqtt_shm_peer_accept(struct mqtt_shm_peer* peer);
+
+/**
+ * @brief Close the connection, unmap and remove the segment
+ *
+ * A connected client receives ERROR_HOST_UNAVAILABLE after it has read the
+ * remaining bytes.
+ *
+ * @param peer Pointer to the peer
+ */
+void mqtt_shm_peer_destroy(struct mqtt_shm_peer* peer);
+
+#endif /* MQTT_SHM_H_INCLUDED */
@@ -0,0 +1,104 @@
+/**
+ * @file mqtt_tls.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief TLS transport with session resumption
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#ifndef MQTT_TLS_H_INCLUDED
+#define MQTT_TLS_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mqtt_types.h"
+
+/**
+ * @brief Certificates and record settings of a TLS context
+ */
+struct mqtt_tls_config {
+    const char* ca_file;        // PEM file with the CAs the broker is verified against
+    const char* ca_path;        // Hashed CA directory, with ca_file NULL too the system store is used
+    const char* cert_file;      // Client certificate (PEM) for mutual authentication, may be NULL
+    const char* key_file;       // Private key of the client certificate
+    const char* server_name;    // SNI and name checked in the broker certificate, NULL for the host of the address
+    bool insecure;              // Skip the verification of the broker, for local tests only
+    uint16_t max_record;        // Largest plaintext per record (512..16384), 0 for the default
+};
+
+/**
+ * @brief TLS context shared by clients, holds the resumable session per broker
+ */
+struct mqtt_tls_context;
+
+/**
+ * @brief Session statistics of a TLS context
+ */
+struct mqtt_tls_stats {
+    uint32_t handshakes;        // Completed handshakes
+    uint32_t resumed;           // Handshakes that resumed a cached session
+};
+
+/**
+ * @brief Transport over TLS, registered under the scheme "mqtts"
+ *
+ * Addresses are "mqtts://host[:port]", the port defaults to MQTT_TLS_PORT. The
+ * built-in descriptor uses a default context that verifies brokers against the
+ * system CA store. Use mqtt_tls_transport() for a context with certificates of
+ * its own.
+ */
+extern const struct mqtt_transport mqtt_tls_default_transport;
+
+/**
+ * @brief Create a TLS context
+ *
+ * Clients created with the context resume the session of their broker on
+ * reconnects instead of running a full handshake. A context can be used by
+ * clients in different threads.
+ *
+ * @param config Certificates and record settings, NULL for the defaults
+ * @return Pointer to the context, or NULL if the configuration was rejected
+ */
+struct mqtt_tls_context* mqtt_tls_create_context(const struct mqtt_tls_config* config);
+
+/**
+ * @brief Free a TLS context, no client may use it anymore
+ *
+ * @param ctx Pointer to the context
+ */
+void mqtt_tls_free_context(struct mqtt_tls_context* ctx);
+
+/**
+ * @brief Read the session statistics of a TLS context
+ *
+ * @param ctx Pointer to the context
+ * @param stats Receives the counters
+ */
+void mqtt_tls_get_stats(struct mqtt_tls_context* ctx, struct mqtt_tls_stats* stats);
+
+/**
+ * @brief Installs the TLS network interface into a client
+ *
+ * @param stat Pointer to the MQTT client structure
+ * @param ctx Pointer to the struct mqtt_tls_context, NULL for the default context
+ * @return Status code indicating success or failure
+ */
+int mqtt_tls_attach(struct mqtt_client* stat, void* ctx);
+
+/**
+ * @brief Transport descriptor of a TLS context
+ *
+ * @param ctx Context the client connects with, must stay valid while the client is used
+ * @return Descriptor for mqtt_create_client_transport() or mqtt_register_transport()
+ */
+static inline struct mqtt_transport mqtt_tls_transport(struct mqtt_tls_context* ctx)
+{
+    struct mqtt_transport transport = { .scheme = "mqtts", .attach = mqtt_tls_attach, .context = ctx };
+    return transport;
+}
+
+#endif /* MQTT_TLS_H_INCLUDED */
@@ -19,6 +19,9 @@
 #include "mqtt_const.h"
 
 struct mqtt_client;
+struct submit_queue;
+struct mqtt_io_thread;
+struct arena_block;
 
 struct mqtt_pbuf {
     void* payload;
@@ -31,6 +34,19 @@ struct mqtt_blob {
     uint16_t maxlen;
 };
 
+struct mqtt_allocator {
+    void* (*alloc)(void* context, size_t size);
+    void* (*realloc)(void* context, void* ptr, size_t size);
+    void (*free)(void* context, void* ptr);
+    void* context;
+};
+
+struct mqtt_arena {
+    const struct mqtt_allocator* allocator;
+    struct arena_block* block;
+    size_t used;
+};
+
 struct mqtt_net_api {
     bool connected;
     int (*open_conn)(struct mqtt_client*, const char*);
@@ -41,6 +57,14 @@ struct mqtt_net_api {
     int (*free_recv_buf)(struct mqtt_client*, struct mqtt_pbuf*);
     int (*recv) (struct mqtt_client*, struct mqtt_pbuf*);
     int (*send) (struct mqtt_client*, struct mqtt_pbuf*);
+    void (*release)(struct mqtt_client*);   // Frees the per-client state of the transport, may be NULL
+};
+
+/* Installs a network interface into a client, see mqtt_init_client_transport() */
+struct mqtt_transport {
+    const char* scheme;     // Selects the transport by broker addresses like "tcp://host:port", may be NULL
+    int (*attach)(struct mqtt_client* stat, void* context);
+    void* context;
 };
 
 struct mqtt_user_property {
@@ -57,6 +81,21 @@ struct mqtt_pub_packet {
     uint16_t packet_id;
 };
 
+struct mqtt_message {
+    const char* topic;
+    const char* response_topic;
+    const char* content_type;
+    struct mqtt_blob payload;
+    struct mqtt_blob correlation_data;
+    uint16_t packet_id;
+    uint32_t message_expiry_interval;
+    uint32_t subscription_identifier;
+    uint8_t qos;
+    uint8_t payload_format_indicator;
+    bool dup;
+    bool retain;
+};
+
 struct mqtt_sub_entry {
     uint8_t qos;
     uint8_t no_local;
@@ -65,11 +104,8 @@ struct mqtt_sub_entry {
     const char* topic;
 };
 
-struct mqtt_client {
-    struct mqtt_net_api net;
-    struct mqtt_pbuf outp;
-    struct mqtt_pbuf inp;
-
+/* Configuration of the connection and of outgoing packets, only read when a packet is built */
+struct mqtt_client_config {
     struct {
         bool un_flag;
         bool pw_flag;
@@ -107,84 +143,68 @@ struct mqtt_client {
     } connect;
 
     struct {
-        uint16_t packet_id;
-        uint8_t reason_code;
-        const char* reason_string;
+        uint8_t payload_format_indicator;
+        uint32_t message_expiry_interval;
+        const char* content_type;
+        const char* response_topic;
+        struct mqtt_blob correlation_data;
+        uint16_t topic_alias;
+        uint32_t subscription_identifier;
         struct mqtt_user_property* user_properties;
         int user_properties_count;
-    } pubrec;
+    } publish;
 
     struct {
+        struct mqtt_sub_entry* entries;
+        unsigned int entry_count;
         uint16_t packet_id;
-        uint8_t reason_code;
-        const char* reason_string;
+        uint32_t subscription_identifier;
         struct mqtt_user_property* user_properties;
         int user_properties_count;
-    } pubrel;
+    } subscribe;
 
     struct {
+        struct mqtt_sub_entry* entries;
+        unsigned int entry_count;
         uint16_t packet_id;
-        uint8_t reason_code;
-        const char* reason_string;
         struct mqtt_user_property* user_properties;
         int user_properties_count;
-    } pubcomp;
-
-    struct {
-        bool ack_flag;
-        uint8_t reason;
-        uint16_t recv_max;
-        uint16_t topic_alias_max;
-        uint8_t max_qos;
-        uint32_t max_packet_size;
-        bool retain_avail;
-        char* assigned_client_id;
-        char* reason_string;
-        bool wildcard_sub_avail;
-        bool sub_id_avail;
-        bool shared_sub_avail;
-        uint16_t server_keep_alive;
-        char* server_reference;
-        char* response_info;
-    } connack;
+    } unsubscribe;
+};
 
+/* Properties of the acknowledgements sent and of the last ones received */
+struct mqtt_client_diag {
     struct {
-        const char* reason_string;
-        const char* server_reference;
+        uint16_t packet_id;
         uint8_t reason_code;
-        uint32_t session_expiry_interval;
+        const char* reason_string;
         struct mqtt_user_property* user_properties;
         int user_properties_count;
-    } disconn;
+    } puback;
 
     struct {
-        uint8_t payload_format_indicator;
-        uint32_t message_expiry_interval;
-        const char* content_type;
-        const char* response_topic;
-        struct mqtt_blob correlation_data;
-        uint16_t topic_alias;
-        uint32_t subscription_identifier;
+        uint16_t packet_id;
+        uint8_t reason_code;
+        const char* reason_string;
         struct mqtt_user_property* user_properties;
         int user_properties_count;
-    } publish;
+    } pubrec;
 
     struct {
-        struct mqtt_sub_entry* entries;
-        unsigned int entry_count;
         uint16_t packet_id;
-        uint32_t subscription_identifier;
+        uint8_t reason_code;
+        const char* reason_string;
         struct mqtt_user_property* user_properties;
         int user_properties_count;
-    } subscribe;
+    } pubrel;
 
     struct {
-        struct mqtt_sub_entry* entries;
-        unsigned int entry_count;
         uint16_t packet_id;
+        uint8_t reason_code;
+        const char* reason_string;
         struct mqtt_user_property* user_properties;
         int user_properties_count;
-    } unsubscribe;
+    } pubcomp;
 
     struct {
         uint16_t packet_id;
@@ -196,17 +216,30 @@ struct mqtt_client {
     } unsuback;
 
     struct {
-        uint16_t packet_id;
-        uint8_t reason_code;
         const char* reason_string;
+        const char* server_reference;
+        uint8_t reason_code;
+        uint32_t session_expiry_interval;
         struct mqtt_user_property* user_properties;
         int user_properties_count;
-    } puback;
+    } disconn;
+};
 
-    struct {
-        uint16_t packet_id;
-        mqtt_packet_type await_packet_type;
-    } pending[MQTT_RECEIVE_MAXIMUM];
+struct mqtt_client {
+    /* Hot state, touched for every packet sent or received */
+    uint8_t* pin;
+    uint8_t* pin_end;       // Received data is never read beyond this point
+    uint8_t* pout;
+    struct mqtt_pbuf inp;
+    struct mqtt_pbuf outp;
+    uint32_t packet_size;
+    uint16_t expected_ptypes;
+    uint16_t packet_id_count;
+    bool connected;
+    bool message_available;
+    bool malformed;         // Set when a read through pin ran out of the packet
+    struct mqtt_net_api net;
+    void *context;
 
     struct {
         const char* topic;
@@ -214,7 +247,6 @@ struct mqtt_client {
         const char* content_type;
         struct mqtt_blob payload;
         struct mqtt_blob correlation_data;
-        uint8_t correlation_data_buffer[MQTT_CORELATION_DATA_MAXIMUM];  // Buffer for correlation data
         uint16_t packet_id;
         uint32_t message_expiry_interval;
         uint32_t subscription_identifier;
@@ -223,17 +255,102 @@ struct mqtt_client {
         uint8_t payload_format_indicator;
         bool dup;
         bool retain;
+        uint32_t payload_size;  // Full payload length of a publish delivered in parts
     } received_publish;
 
-    void *context;
+    struct {
+        uint16_t packet_id;
+        uint8_t await_packet_type;   // mqtt_packet_type
+    } pending[MQTT_RECEIVE_MAXIMUM];
+
+    struct {
+        bool ack_flag;
+        uint8_t reason;
+        uint16_t recv_max;
+        uint16_t topic_alias_max;
+        uint8_t max_qos;
+        uint32_t max_packet_size;
+        bool retain_avail;
+        char* assigned_client_id;
+        char* reason_string;
+        bool wildcard_sub_avail;
+        bool sub_id_avail;
+        bool shared_sub_avail;
+        uint16_t server_keep_alive;
+        char* server_reference;
+        char* response_info;
+    } connack;
+
+    struct {
+        bool manual;
+        struct {
+            uint16_t packet_id;
+            uint8_t qos;
+            bool acked;
+        } slots[MQTT_RECEIVE_MAXIMUM];
+    } acks;
+
+    struct {
+        struct mqtt_pbuf recv;
+        uint32_t recv_size;
+        uint8_t* buffer;
+        uint32_t len;
+        uint32_t size;
+        uint32_t part_size;     // Received publish packets above this size are delivered in parts, 0 for never
+        uint32_t part_offset;   // Payload bytes of a publish delivered in parts so far
+        uint32_t part_left;     // Payload bytes still to come, passed on straight from the received data
+        int part_result;        // Failure of the header, the rest of the packet is skipped
+    } rx;
+
+    struct {
+        bool enabled;
+        uint32_t max_bytes;
+        uint32_t max_delay;
+        uint32_t since;
+        uint32_t len;
+        uint32_t size;
+        uint8_t* buffer;
+    } coalesce;
+
+    struct {
+        bool open;              // Other packets are queued in the coalescing buffer until the end
+        uint8_t qos;
+        uint16_t packet_id;
+        uint32_t left;          // Payload bytes still to be written
+    } publish_stream;
+
+    struct mqtt_allocator allocator;    // Used for every allocation made on behalf of the client
+    struct mqtt_arena packet_arena;     // Decoded data of the packet currently processed
+    struct mqtt_arena publish_arena;    // Strings of the last received PUBLISH, kept until the next one
+    struct mqtt_arena session_arena;    // Decoded data kept until the next CONNACK
+
+    struct submit_queue* submit;
+    struct submit_queue* submit_acks;   // Never wait behind a publish short of packet identifiers
+    struct mqtt_io_thread* io_thread;
+    int (*dispatch_publish)(struct mqtt_client*);
+
+    /* Cold state, allocated separately */
+    struct mqtt_client_config* config;
+    struct mqtt_client_diag* diag;
     char *broker_addr;
-    bool connected;
-    uint8_t* pout;
-    uint8_t* pin;
-    uint32_t packet_size;
-    uint16_t expected_ptypes;
-    uint16_t packet_id_count;
-    bool message_available;
+
+#ifdef MQTT_STATIC_MEMORY
+    struct {
+        uint8_t send[MQTT_STATIC_SEND_BUFFER_SIZE];
+        uint8_t recv[MQTT_STATIC_RECV_BUFFER_SIZE];
+        uint8_t packet[MQTT_STATIC_PACKET_SIZE];    // Reassembly of packets split across reads
+        _Alignas(void*) uint8_t packet_strings[MQTT_STATIC_PACKET_STRINGS_SIZE];
+        _Alignas(void*) uint8_t publish_strings[MQTT_STATIC_PUBLISH_STRINGS_SIZE];
+        _Alignas(void*) uint8_t session_strings[MQTT_STATIC_SESSION_STRINGS_SIZE];
+        char broker_addr[MQTT_STATIC_ADDRESS_SIZE];
+        char client_id[MQTT_STATIC_CLIENT_ID_SIZE];
+        _Alignas(void*) uint8_t transport[MQTT_STATIC_TRANSPORT_SIZE];  // Per-client state of the transport
+        uint16_t transport_used;                    // Layered transports stack their state
+        uint8_t held[MQTT_STATIC_HOLD_SIZE];       // Packets held back behind a streamed publish
+        struct mqtt_client_config config;
+        struct mqtt_client_diag diag;
+    } storage;
+#endif
 };
 
 #endif /* MQTT_TYPE_H_INCLUDED */
\ No newline at end of file
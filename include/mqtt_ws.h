@@ -0,0 +1,80 @@
+/**
+ * @file mqtt_ws.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief MQTT over WebSocket, on TCP or TLS
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#ifndef MQTT_WS_H_INCLUDED
+#define MQTT_WS_H_INCLUDED
+
+#include <stdint.h>
+
+#include "mqtt_types.h"
+
+/**
+ * @brief Transport the WebSocket frames travel on
+ */
+struct mqtt_ws_config {
+    const struct mqtt_transport* inner;     // TCP, TLS or any other stream transport, NULL for TCP
+    uint16_t port;                          // Port of addresses without one, 0 for MQTT_WS_PORT
+};
+
+/**
+ * @brief WebSocket over TCP, registered under the scheme "ws"
+ *
+ * Addresses are "ws://host[:port][/path]", the port defaults to MQTT_WS_PORT and
+ * the path to MQTT_WS_PATH. The client upgrades the connection with an HTTP
+ * request for the subprotocol "mqtt" and sends every packet in a masked binary
+ * frame. Fragmented frames of the broker are joined into the byte stream, pings
+ * are answered.
+ */
+extern const struct mqtt_transport mqtt_ws_transport;
+
+/**
+ * @brief WebSocket over TLS, registered under the scheme "wss" (builds with the TLS transport)
+ *
+ * Addresses are "wss://host[:port][/path]", the port defaults to MQTT_WSS_PORT.
+ * The TLS connection uses the default context of mqtt_tls_default_transport.
+ */
+extern const struct mqtt_transport mqtt_wss_transport;
+
+/**
+ * @brief Installs the WebSocket network interface into a client
+ *
+ * Attaches the inner transport first and layers the framing on top of it. With
+ * MQTT_STATIC_MEMORY both states have to fit into MQTT_STATIC_TRANSPORT_SIZE
+ * (about 256 bytes plus the address), and packets into the send buffer minus
+ * 14 bytes of frame header.
+ *
+ * @param stat Pointer to the MQTT client structure
+ * @param config Pointer to the struct mqtt_ws_config, NULL for WebSocket over TCP
+ * @return Status code indicating success or failure
+ */
+int mqtt_ws_attach(struct mqtt_client* stat, void* config);
+
+/**
+ * @brief Transport descriptor for WebSocket over another transport
+ *
+ * For example over TLS with a context of its own:
+ * @code
+ * static struct mqtt_transport tls;
+ * static struct mqtt_ws_config config = { .inner = &tls, .port = MQTT_WSS_PORT };
+ * tls = mqtt_tls_transport(ctx);
+ * struct mqtt_transport wss = mqtt_ws_transport_with(&config);
+ * @endcode
+ *
+ * @param config Inner transport and default port, must stay valid while the client is used
+ * @return Descriptor for mqtt_create_client_transport() or mqtt_register_transport()
+ */
+static inline struct mqtt_transport mqtt_ws_transport_with(const struct mqtt_ws_config* config)
+{
+    struct mqtt_transport transport = { .scheme = "ws", .attach = mqtt_ws_attach, .context = (void*) config };
+    return transport;
+}
+
+#endif /* MQTT_WS_H_INCLUDED */
@@ -0,0 +1,88 @@
+/**
+ * @file arena.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Bump allocator for data decoded from received packets
+ * @version 0.1
+ * @date 2025-07-26
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "mqtt_const.h"
+
+/*
+ * Allocations are carved from a list of blocks, the newest block first. Nothing is
+ * freed individually, a reset releases all blocks except the first one, so packets
+ * fitting into MQTT_ARENA_BLOCK_SIZE are decoded without touching the heap.
+ * A fixed arena has no allocator and lives in a single caller provided block.
+ */
+
+struct arena_block {
+    struct arena_block* next;
+    size_t size;
+    uint8_t data[];
+};
+
+#define ARENA_ALIGN(n) (((n) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+void arena_init(struct mqtt_arena* arena, const struct mqtt_allocator* allocator)
+{
+    arena->allocator = allocator;
+    arena->block = NULL;
+    arena->used = 0;
+}
+
+void arena_init_fixed(struct mqtt_arena* arena, void* buffer, size_t size)
+{
+    arena->allocator = NULL;
+    arena->block = (struct arena_block*) buffer;
+    arena->block->next = NULL;
+    arena->block->size = size - sizeof(struct arena_block);
+    arena->used = 0;
+}
+
+void* arena_alloc(struct mqtt_arena* arena, size_t size)
+{
+    size = ARENA_ALIGN(size);
+    if (!arena->block || arena->block->size - arena->used < size) {
+        if (!arena->allocator) {
+            return NULL;
+        }
+        size_t block_size = size > MQTT_ARENA_BLOCK_SIZE ? size : MQTT_ARENA_BLOCK_SIZE;
+        struct arena_block* block = arena->allocator->alloc(arena->allocator->context,
+                                                           sizeof(struct arena_block) + block_size);
+        if (!block) {
+            return NULL;
+        }
+        block->next = arena->block;
+        block->size = block_size;
+        arena->block = block;
+        arena->used = 0;
+    }
+    void* ptr = arena->block->data + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+void arena_reset(struct mqtt_arena* arena)
+{
+    while (arena->block && arena->block->next) {
+        struct arena_block* next = arena->block->next;
+        arena->allocator->free(arena->allocator->context, arena->block);
+        arena->block = next;
+    }
+    arena->used = 0;
+}
+
+void arena_free(struct mqtt_arena* arena)
+{
+    arena_reset(arena);
+    if (arena->block && arena->allocator) {
+        arena->allocator->free(arena->allocator->context, arena->block);
+        arena->block = NULL;
+    }
+}
@@ -0,0 +1,25 @@
+/**
+ * @file arena.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Bump allocator for data decoded from received packets
+ * @version 0.1
+ * @date 2025-07-26
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include <stddef.h>
+
+#include "mqtt_types.h"
+
+void arena_init(struct mqtt_arena* arena, const struct mqtt_allocator* allocator);
+void arena_init_fixed(struct mqtt_arena* arena, void* buffer, size_t size);
+void* arena_alloc(struct mqtt_arena* arena, size_t size);
+void arena_reset(struct mqtt_arena* arena);
+void arena_free(struct mqtt_arena* arena);
+
+#endif /* ARENA_H_INCLUDED */
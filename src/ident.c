@@ -27,27 +27,18 @@
 #endif
 
 #define MAX_HOSTNAME_LEN      256
-#define NAX_UNIQUE_ID_LEN     (MAX_HOSTNAME_LEN + 32)
 
 static const char* client_id_prefix = "MQLite";
 
-static char* assign_string(const char* input)
-{
-    char* string = (char*) malloc(strlen(input)+1);
-    strcpy(string, input);
-    return string;
-}
-
-char *get_unique_client_id()
+int get_unique_client_id(char* id, size_t size)
 {
     uint64_t ticks = 0;
-    char id[NAX_UNIQUE_ID_LEN];
     char hostname[MAX_HOSTNAME_LEN];
     uint32_t hostname_len = MAX_HOSTNAME_LEN;
 
     #ifdef _WIN32
         if (!GetComputerNameA(hostname, &hostname_len)) {
-            return NULL;
+            return -1;
         }
         
         // GetTickCount64 returns milliseconds since system start
@@ -59,19 +50,19 @@ char *get_unique_client_id()
     #else
         struct sysinfo info;
         if (gethostname(hostname, MAX_HOSTNAME_LEN) != 0) {
-            return NULL;
+            return -1;
         }
 
         if (sysinfo(&info) != 0) {
-            return NULL;
+            return -1;
         }
         ticks = info.uptime;
     #endif
     #endif
 
     // Combine hostname and uptime to create a unique ID
-    (void)snprintf(id, NAX_UNIQUE_ID_LEN, "%s@%s_%llu",
+    (void)snprintf(id, size, "%s@%s_%llu",
              client_id_prefix, hostname, ticks);
 
-    return assign_string(id);
+    return 0;
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+/**
+ * @file mqtt_alloc.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Allocation through the allocator installed in a client
+ * @version 0.1
+ * @date 2025-07-27
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#ifndef MQTT_ALLOC_H_INCLUDED
+#define MQTT_ALLOC_H_INCLUDED
+
+#include <stddef.h>
+#include <string.h>
+
+#include "mqtt_types.h"
+
+static inline void* mqtt_malloc(struct mqtt_client* stat, size_t size)
+{
+    return stat->allocator.alloc(stat->allocator.context, size);
+}
+
+static inline void* mqtt_calloc(struct mqtt_client* stat, size_t size)
+{
+    void* ptr = stat->allocator.alloc(stat->allocator.context, size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+static inline void* mqtt_realloc(struct mqtt_client* stat, void* ptr, size_t size)
+{
+    return stat->allocator.realloc(stat->allocator.context, ptr, size);
+}
+
+static inline void mqtt_free(struct mqtt_client* stat, void* ptr)
+{
+    if (ptr) {
+        stat->allocator.free(stat->allocator.context, ptr);
+    }
+}
+
+#endif /* MQTT_ALLOC_H_INCLUDED */
@@ -9,29 +9,37 @@
  *
  */
 
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 
 #include "mqtt.h"
 #include "common.h"
 #include "status.h"
 #include "utf8.h"
+#include "systime.h"
+#include "submit_queue.h"
+#include "arena.h"
+#include "mqtt_alloc.h"
+#include "transport.h"
+#include "mqtt_testing.h"
 
 #define STRLEN(s)  ((s) ? strlen(s) + 2 : 2)
 #define BLEN(b)    ((b).len + 2)
 
-/* This function must be implemented by the network interface module! */
-void mqtt_assign_net_api(struct mqtt_client* stat);
-
 /* From indent module */
-char *get_unique_client_id();
+int get_unique_client_id(char* id, size_t size);
+
+#define UNIQUE_CLIENT_ID_LEN  288
 
 /* Only internally used */
 int mqtt_puback(struct mqtt_client* stat, uint16_t packet_id);
 int mqtt_pubrec(struct mqtt_client* stat, uint16_t packet_id);
 int mqtt_pubrel(struct mqtt_client* stat, uint16_t packet_id);
 int mqtt_pubcomp(struct mqtt_client* stat, uint16_t packet_id);
+static int drain_submit_queue(struct mqtt_client* stat);
 
 /***** Data pack/unpacking ***********************************************************************/
 /*                                                                                               */
@@ -67,38 +75,49 @@ static void pack_binary(struct mqtt_client *stat, const struct mqtt_blob *blob)
     }
 }
 
+/* Reading beyond pin_end moves pin to the end and marks the packet as malformed, */
+/* every further read returns zero. Decoders check stat->malformed once they are done. */
+static bool unpack_check(struct mqtt_client* stat, uint32_t len)
+{
+    if ((uint32_t)(stat->pin_end - stat->pin) < len) {
+        stat->pin = stat->pin_end;
+        stat->malformed = true;
+        return false;
+    }
+    return true;
+}
+
 static inline uint8_t unpack_byte(struct mqtt_client* stat)
 {
+    if (!unpack_check(stat, 1)) {
+        return 0;
+    }
     return *(stat->pin++);
 }
 
 static inline uint16_t unpack_word(struct mqtt_client* stat)
 {
-    uint16_t data = unpack_byte(stat) << 8;
-    data |= unpack_byte(stat);
+    if (!unpack_check(stat, 2)) {
+        return 0;
+    }
+    uint16_t data = stat->pin[0] << 8 | stat->pin[1];
+    stat->pin += 2;
     return data;
 }
 
 static inline uint32_t unpack_dword(struct mqtt_client* stat)
 {
-    uint32_t data = unpack_byte(stat) << 24;
-    data |= unpack_byte(stat) << 16;
-    data |= unpack_byte(stat) << 8;
-    data |= unpack_byte(stat);
+    if (!unpack_check(stat, 4)) {
+        return 0;
+    }
+    uint32_t data = (uint32_t) stat->pin[0] << 24 | (uint32_t) stat->pin[1] << 16 | (uint32_t) stat->pin[2] << 8 | stat->pin[3];
+    stat->pin += 4;
     return data;
 }
 
-static int unpack_binary(struct mqtt_client *stat, struct mqtt_blob *blob)
+static inline bool unpack_remaining(const struct mqtt_client* stat)
 {
-    uint16_t length = unpack_word(stat);
-    if (length > blob->maxlen) {
-        return ERROR_INDEX_OUT_OF_RANGE;
-    }
-    blob->len = length;
-    for (size_t i = 0; i < length; ++i) {
-        blob->data[i] = unpack_byte(stat);
-    }
-    return OK;
+    return stat->pin < stat->pin_end;
 }
 
 static void pack_string(struct mqtt_client* stat, const char* data)
@@ -110,29 +129,32 @@ static void pack_string(struct mqtt_client* stat, const char* data)
     }
 }
 
-static char* unpack_string(struct mqtt_client* stat)
+static char* unpack_string(struct mqtt_client* stat, struct mqtt_arena* arena)
 {
     char* string = NULL;
-    int len = unpack_word(stat);
-    if (len > 0) {
-        string = malloc(len + 1);
-        assert(string);
-        for (int i = 0; i < len; ++i) {
-            string[i] = (char) unpack_byte(stat);
-        }
+    uint16_t len = unpack_word(stat);
+    if (len > 0 && unpack_check(stat, len)) {
+        string = arena_alloc(arena, len + 1);
+        if (!string) {
+            stat->pin += len; // Skip the string, it is treated as empty
+            return NULL;
+        }
+        memcpy(string, stat->pin, len);
         string[len] = '\0';
+        stat->pin += len;
     }
     return string;
 }
 
-static char* string_copy(const char* source)
+#ifndef MQTT_STATIC_MEMORY
+static char* string_copy(struct mqtt_client* stat, const char* source)
 {
     if (source == NULL) {
         return NULL;
     }
 
     size_t len = strlen(source);
-    char* copy = malloc(len + 1);
+    char* copy = mqtt_malloc(stat, len + 1);
 
     if (copy == NULL) {
         return NULL; // Memory allocation failed
@@ -143,6 +165,7 @@ static char* string_copy(const char* source)
 
     return copy;
 }
+#endif
 
 static void pack_variable_size(struct mqtt_client* stat, uint32_t size)
 {
@@ -159,19 +182,18 @@ static void pack_variable_size(struct mqtt_client* stat, uint32_t size)
 
 static uint32_t unpack_variable_size(struct mqtt_client* stat)
 {
-    uint32_t multiplier = 1;
     uint32_t value = 0;
-    uint8_t encoded_byte = 0;
-    int shift = 0;
-
-    do {
+    for (int i = 0; i < 4; i++) {
         uint8_t encoded_byte = unpack_byte(stat);
-        value += (encoded_byte & 0x7F) * multiplier;
-        multiplier <<= 7;
-        shift++;
-    } while ((encoded_byte & 0x80) != 0 && shift < 4);
-
-    return value;
+        value |= (uint32_t)(encoded_byte & 0x7F) << (7 * i);
+        if (!(encoded_byte & 0x80)) {
+            return value;
+        }
+    }
+    // A variable byte integer has four bytes at most
+    stat->pin = stat->pin_end;
+    stat->malformed = true;
+    return 0;
 }
 
 static inline uint8_t get_variable_size_byte_count(uint32_t len)
@@ -208,6 +230,21 @@ void WEAK mqtt_received_publish(struct mqtt_client* stat)
     /* Can be overloaded by user code */
 }
 
+void WEAK mqtt_received_publish_begin(struct mqtt_client* stat)
+{
+    /* Can be overloaded by user code */
+}
+
+void WEAK mqtt_received_publish_part(struct mqtt_client* stat, uint32_t offset, const uint8_t* data, uint32_t len)
+{
+    /* Can be overloaded by user code */
+}
+
+void WEAK mqtt_received_publish_end(struct mqtt_client* stat, int result)
+{
+    /* Can be overloaded by user code */
+}
+
 void WEAK mqtt_subscription_declined(struct mqtt_client* stat, uint16_t packet_id, int num, uint8_t reason_code)
 {
     /* Can be overloaded by user code */
@@ -243,6 +280,11 @@ void WEAK mqtt_connected(struct mqtt_client* stat)
     /* Can be overloaded by user code */
 }
 
+void WEAK mqtt_submitted_publish(struct mqtt_client* stat, const struct mqtt_pub_packet* msg, int result)
+{
+    /* Can be overloaded by user code */
+}
+
 /***** Packet size estimations *******************************************************************/
 /*                                                                                               */
 /*************************************************************************************************/
@@ -252,720 +294,527 @@ static inline uint32_t estimate_fixed_header_size(uint32_t len)
     return get_variable_size_byte_count(len) + 1;
 }
 
-static uint32_t estimate_conn_prop_size(struct mqtt_client* stat)
-{
-    uint32_t size = 0;
-    if (stat->connect.session_expiry_interval) {
-        size += 5;  // 1 byte ID + 4 bytes value
-    }
-    if (stat->connect.recv_max) {
-        size += 3;  // 1 byte ID + 2 bytes value
-    }
-    if (stat->connect.max_packet_size) {
-        size += 5;  // 1 byte ID + 4 bytes value
-    }
-    if (stat->connect.topic_alias_max) {
-        size += 3;  // 1 byte ID + 2 bytes value
-    }
-    if (stat->connect.req_res_inf) {
-        size += 2;  // 1 byte ID + 1 byte value
-    }
-    if (stat->connect.req_prob_inf) {
-        size += 2;  // 1 byte ID + 1 byte value
-    }
-    if (stat->connect.auth_method) {
-        size += 1 + STRLEN(stat->connect.auth_method);  // 1 byte ID + string length
-    }
-    if (stat->connect.auth_data.data && stat->connect.auth_data.len) {
-        size += 1 + stat->connect.auth_data.len;  // 1 byte ID + binary data length
-    }
-    for (int i = 0; i < stat->connect.user_properties_count; i++) {
-        size += STRLEN(stat->connect.user_properties[i].key);
-        size += STRLEN(stat->connect.user_properties[i].value) + 1;
-    }
-    return size;
-}
+/***** Property codec ****************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
 
-static uint32_t estimate_will_prop_size(struct mqtt_client* stat)
-{
-    uint32_t size = 0;
-    if (stat->connect.will.delay_interval) {
-        size += 5;
-    }
-    if (stat->connect.will.payload_format_indicator) {
-        size += 2;
-    }
-    if (stat->connect.will.message_expiry_delay) {
-        size += 5;
-    }
-    if (stat->connect.will.content_type) {
-        size += STRLEN(stat->connect.will.content_type) + 1;
-    }
-    if (stat->connect.will.response_topic) {
-        size += STRLEN(stat->connect.will.response_topic) + 1;
-    }
-    if (stat->connect.will.correlation_data.len) {
-        size += BLEN(stat->connect.will.correlation_data) + 1;
+enum prop_type {
+    PROP_BYTE,      // uint8_t
+    PROP_FLAG,      // bool, transferred as a single byte
+    PROP_WORD,      // uint16_t
+    PROP_DWORD,     // uint32_t
+    PROP_VARINT,    // uint32_t, encoded as variable byte integer
+    PROP_STRING,    // const char*
+    PROP_BINARY,    // struct mqtt_blob
+    PROP_USER       // struct mqtt_user_property* followed by the int count of the list
+};
+
+enum prop_block {
+    PROP_CONFIG,    // Field of stat->config, only sent
+    PROP_DIAG,      // Field of stat->diag, sent and received
+    PROP_CLIENT,    // Field of the client structure, only received
+    PROP_NONE       // Only received, not stored
+};
+
+/* The packet type 0 is reserved, its bit marks the will properties of the CONNECT packet */
+#define PROP_WILL  BIT(UNKNOWN)
+
+struct prop_desc {
+    uint8_t id;
+    uint8_t type;       // enum prop_type
+    uint16_t packets;   // BIT() of every packet type the property belongs to
+    uint8_t block;      // enum prop_block
+    uint16_t offset;    // Offset of the field within its block
+};
+
+#define CONFIG(field)  PROP_CONFIG, offsetof(struct mqtt_client_config, field)
+#define DIAG(field)    PROP_DIAG, offsetof(struct mqtt_client_diag, field)
+#define CLIENT(field)  PROP_CLIENT, offsetof(struct mqtt_client, field)
+#define NOWHERE        PROP_NONE, 0
+
+#define ACK_PACKETS  (BIT(PUBACK) | BIT(PUBREC) | BIT(PUBREL) | BIT(PUBCOMP))
+#define RX_PACKETS   (BIT(CONNACK) | BIT(PUBLISH) | ACK_PACKETS | BIT(SUBACK) | BIT(UNSUBACK) | BIT(DISCONNECT))
+
+static const struct prop_desc properties[] = {
+    // Sent with CONNECT
+    { MQTT_CON_SESSION_EXPIRY_INTERVAL_ID, PROP_DWORD, BIT(CONNECT), CONFIG(connect.session_expiry_interval) },
+    { MQTT_CON_RECEIVE_MAXIMUM_ID, PROP_WORD, BIT(CONNECT), CONFIG(connect.recv_max) },
+    { MQTT_CON_MAXIMUM_PACKET_SIZE_ID, PROP_DWORD, BIT(CONNECT), CONFIG(connect.max_packet_size) },
+    { MQTT_CON_TOPIC_ALIAS_MAXIMUM_ID, PROP_WORD, BIT(CONNECT), CONFIG(connect.topic_alias_max) },
+    { MQTT_CON_REQUEST_RESPONSE_INFO_ID, PROP_FLAG, BIT(CONNECT), CONFIG(connect.req_res_inf) },
+    { MQTT_CON_REQUEST_PROBLEM_INF_ID, PROP_FLAG, BIT(CONNECT), CONFIG(connect.req_prob_inf) },
+    { MQTT_CON_AUTH_METHOD_ID, PROP_STRING, BIT(CONNECT), CONFIG(connect.auth_method) },
+    { MQTT_CON_AUTH_DATA_ID, PROP_BINARY, BIT(CONNECT), CONFIG(connect.auth_data) },
+    { MQTT_USER_PROPERTY_ID, PROP_USER, BIT(CONNECT), CONFIG(connect.user_properties) },
+
+    // Will properties, sent with CONNECT
+    { MQTT_WILL_DELAY_INTERVAL_ID, PROP_DWORD, PROP_WILL, CONFIG(connect.will.delay_interval) },
+    { MQTT_WILL_FORMAT_INDICATOR_ID, PROP_BYTE, PROP_WILL, CONFIG(connect.will.payload_format_indicator) },
+    { MQTT_WILL_MSG_EXPIRY_INTERVAL_ID, PROP_DWORD, PROP_WILL, CONFIG(connect.will.message_expiry_delay) },
+    { MQTT_WILL_CONTENT_TYPE_ID, PROP_STRING, PROP_WILL, CONFIG(connect.will.content_type) },
+    { MQTT_WILL_RESPONSE_TOPIC_ID, PROP_STRING, PROP_WILL, CONFIG(connect.will.response_topic) },
+    { MQTT_WILL_CORELATION_DATA_ID, PROP_BINARY, PROP_WILL, CONFIG(connect.will.correlation_data) },
+
+    // Sent with PUBLISH
+    { MQTT_PUB_PAYLOAD_FORMAT_INDICATOR_ID, PROP_BYTE, BIT(PUBLISH), CONFIG(publish.payload_format_indicator) },
+    { MQTT_PUB_MESSAGE_EXPIRY_INTERVAL_ID, PROP_DWORD, BIT(PUBLISH), CONFIG(publish.message_expiry_interval) },
+    { MQTT_PUB_CONTENT_TYPE_ID, PROP_STRING, BIT(PUBLISH), CONFIG(publish.content_type) },
+    { MQTT_PUB_RESPONSE_TOPIC_ID, PROP_STRING, BIT(PUBLISH), CONFIG(publish.response_topic) },
+    { MQTT_PUB_CORRELATION_DATA_ID, PROP_BINARY, BIT(PUBLISH), CONFIG(publish.correlation_data) },
+    { MQTT_PUB_TOPIC_ALIAS_ID, PROP_WORD, BIT(PUBLISH), CONFIG(publish.topic_alias) },
+    { MQTT_PUB_SUBSCRIPTION_IDENTIFIER_ID, PROP_VARINT, BIT(PUBLISH), CONFIG(publish.subscription_identifier) },
+    { MQTT_USER_PROPERTY_ID, PROP_USER, BIT(PUBLISH), CONFIG(publish.user_properties) },
+
+    // Sent with SUBSCRIBE and UNSUBSCRIBE
+    { MQTT_SUB_SUBSCRIPTION_IDENTIFIER_ID, PROP_VARINT, BIT(SUBSCRIBE), CONFIG(subscribe.subscription_identifier) },
+    { MQTT_USER_PROPERTY_ID, PROP_USER, BIT(SUBSCRIBE), CONFIG(subscribe.user_properties) },
+    { MQTT_USER_PROPERTY_ID, PROP_USER, BIT(UNSUBSCRIBE), CONFIG(unsubscribe.user_properties) },
+
+    // Sent and received with the acknowledgements and DISCONNECT
+    { MQTT_REASON_STRING_ID, PROP_STRING, BIT(PUBACK), DIAG(puback.reason_string) },
+    { MQTT_USER_PROPERTY_ID, PROP_USER, BIT(PUBACK), DIAG(puback.user_properties) },
+    { MQTT_REASON_STRING_ID, PROP_STRING, BIT(PUBREC), DIAG(pubrec.reason_string) },
+    { MQTT_USER_PROPERTY_ID, PROP_USER, BIT(PUBREC), DIAG(pubrec.user_properties) },
+    { MQTT_REASON_STRING_ID, PROP_STRING, BIT(PUBREL), DIAG(pubrel.reason_string) },
+    { MQTT_USER_PROPERTY_ID, PROP_USER, BIT(PUBREL), DIAG(pubrel.user_properties) },
+    { MQTT_REASON_STRING_ID, PROP_STRING, BIT(PUBCOMP), DIAG(pubcomp.reason_string) },
+    { MQTT_USER_PROPERTY_ID, PROP_USER, BIT(PUBCOMP), DIAG(pubcomp.user_properties) },
+    { MQTT_REASON_STRING_ID, PROP_STRING, BIT(UNSUBACK), DIAG(unsuback.reason_string) },
+    { MQTT_DISC_SESSION_EXPIRY_INTERVAL_ID, PROP_DWORD, BIT(DISCONNECT), DIAG(disconn.session_expiry_interval) },
+    { MQTT_DISC_REASON_STRING_ID, PROP_STRING, BIT(DISCONNECT), DIAG(disconn.reason_string) },
+    { MQTT_DISC_SERVER_REFERENCE_ID, PROP_STRING, BIT(DISCONNECT), DIAG(disconn.server_reference) },
+    { MQTT_USER_PROPERTY_ID, PROP_USER, BIT(DISCONNECT), DIAG(disconn.user_properties) },
+
+    // Received with CONNACK
+    { MQTT_ACK_SERVER_REFERENCE_ID, PROP_STRING, BIT(CONNACK), CLIENT(connack.server_reference) },
+    { MQTT_CON_RESPONSE_INFO_ID, PROP_STRING, BIT(CONNACK), CLIENT(connack.response_info) },
+    { MQTT_CON_TOPIC_ALIAS_MAXIMUM_ID, PROP_WORD, BIT(CONNACK), CLIENT(connack.topic_alias_max) },
+    { MQTT_CON_RECEIVE_MAXIMUM_ID, PROP_WORD, BIT(CONNACK), CLIENT(connack.recv_max) },
+    { MQTT_CON_MAXIMUM_QOS_ID, PROP_BYTE, BIT(CONNACK), CLIENT(connack.max_qos) },
+    { MQTT_CON_RETAIN_AVAILABLE_ID, PROP_FLAG, BIT(CONNACK), CLIENT(connack.retain_avail) },
+    { MQTT_CON_MAXIMUM_PACKET_SIZE_ID, PROP_DWORD, BIT(CONNACK), CLIENT(connack.max_packet_size) },
+    { MQTT_ACK_ASSIGNED_CLIENT_ID, PROP_STRING, BIT(CONNACK), CLIENT(connack.assigned_client_id) },
+    { MQTT_REASON_STRING_ID, PROP_STRING, BIT(CONNACK), CLIENT(connack.reason_string) },
+    { MQTT_ACK_WILDCARD_SUB_AVAIL_ID, PROP_FLAG, BIT(CONNACK), CLIENT(connack.wildcard_sub_avail) },
+    { MQTT_ACK_SUB_ID_AVAIL_ID, PROP_FLAG, BIT(CONNACK), CLIENT(connack.sub_id_avail) },
+    { MQTT_ACK_SHARED_SUB_AVAIL_ID, PROP_FLAG, BIT(CONNACK), CLIENT(connack.shared_sub_avail) },
+    { MQTT_ACK_SEVER_KEEP_ALIVE_ID, PROP_WORD, BIT(CONNACK), CLIENT(connack.server_keep_alive) },
+    { MQTT_CON_REQUEST_RESPONSE_INFO_ID, PROP_BYTE, BIT(CONNACK), NOWHERE },
+    { MQTT_CON_REQUEST_PROBLEM_INF_ID, PROP_BYTE, BIT(CONNACK), NOWHERE },
+
+    // Received with PUBLISH
+    { MQTT_PUB_PAYLOAD_FORMAT_INDICATOR_ID, PROP_BYTE, BIT(PUBLISH), CLIENT(received_publish.payload_format_indicator) },
+    { MQTT_PUB_MESSAGE_EXPIRY_INTERVAL_ID, PROP_DWORD, BIT(PUBLISH), CLIENT(received_publish.message_expiry_interval) },
+    { MQTT_PUB_TOPIC_ALIAS_ID, PROP_WORD, BIT(PUBLISH), CLIENT(received_publish.topic_alias) },
+    { MQTT_PUB_RESPONSE_TOPIC_ID, PROP_STRING, BIT(PUBLISH), CLIENT(received_publish.response_topic) },
+    { MQTT_PUB_CORRELATION_DATA_ID, PROP_BINARY, BIT(PUBLISH), CLIENT(received_publish.correlation_data) },
+    { MQTT_PUB_CONTENT_TYPE_ID, PROP_STRING, BIT(PUBLISH), CLIENT(received_publish.content_type) },
+    { MQTT_PUB_SUBSCRIPTION_IDENTIFIER_ID, PROP_VARINT, BIT(PUBLISH), CLIENT(received_publish.subscription_identifier) },
+
+    // Received with SUBACK, the reason string is reported like a user property
+    { MQTT_SUBACK_REASON_STRING_ID, PROP_STRING, BIT(SUBACK), NOWHERE },
+
+    // Received user properties are always reported through mqtt_user_property()
+    { MQTT_USER_PROPERTY_ID, PROP_USER, RX_PACKETS, NOWHERE },
+};
+
+/* The count of a user property list is read right behind the list pointer */
+#define CHECK_USER_LIST(type, member) \
+    _Static_assert(offsetof(type, member.user_properties_count) == \
+                   offsetof(type, member.user_properties) + sizeof(struct mqtt_user_property*), \
+                   "user_properties_count must follow user_properties")
+
+CHECK_USER_LIST(struct mqtt_client_config, connect);
+CHECK_USER_LIST(struct mqtt_client_config, publish);
+CHECK_USER_LIST(struct mqtt_client_config, subscribe);
+CHECK_USER_LIST(struct mqtt_client_config, unsubscribe);
+CHECK_USER_LIST(struct mqtt_client_diag, puback);
+CHECK_USER_LIST(struct mqtt_client_diag, pubrec);
+CHECK_USER_LIST(struct mqtt_client_diag, pubrel);
+CHECK_USER_LIST(struct mqtt_client_diag, pubcomp);
+CHECK_USER_LIST(struct mqtt_client_diag, disconn);
+
+static uint8_t* property_field(const struct mqtt_client* stat, const struct prop_desc* prop)
+{
+    switch (prop->block) {
+    case PROP_CONFIG:
+        return (uint8_t*) stat->config + prop->offset;
+    case PROP_DIAG:
+        return (uint8_t*) stat->diag + prop->offset;
+    case PROP_CLIENT:
+        return (uint8_t*) stat + prop->offset;
+    default:
+        return NULL;
     }
-    return size;
 }
 
-static uint32_t estimate_disconn_prop_size(struct mqtt_client *stat)
+static inline bool is_sent_property(const struct prop_desc* prop, uint16_t packets)
 {
-    uint32_t size = 0;
-    if (stat->disconn.session_expiry_interval) {
-        size += 5;
-    }
-    if (stat->disconn.reason_string) {
-        size += STRLEN(stat->disconn.reason_string) + 1;
-    }
-    if (stat->disconn.server_reference) {
-        size += STRLEN(stat->disconn.server_reference) + 1;
-    }
-    for (int i = 0; i < stat->disconn.user_properties_count; i++) {
-        size += STRLEN(stat->disconn.user_properties[i].key);
-        size += STRLEN(stat->disconn.user_properties[i].value) + 1;
-    }
-    return size;
+    return (prop->packets & packets) && (prop->block == PROP_CONFIG || prop->block == PROP_DIAG);
 }
 
-static uint32_t estimate_publish_prop_size(struct mqtt_client* stat)
-{
-    uint32_t size = 0;
-    if (stat->publish.payload_format_indicator) {
-        size += 2;  // 1 byte ID + 1 byte value
-    }
-    if (stat->publish.message_expiry_interval) {
-        size += 5;  // 1 byte ID + 4 bytes value
-    }
-    if (stat->publish.content_type) {
-        size += 1 + STRLEN(stat->publish.content_type);  // 1 byte ID + string length
-    }
-    if (stat->publish.response_topic) {
-        size += 1 + STRLEN(stat->publish.response_topic);  // 1 byte ID + string length
-    }
-    if (stat->publish.correlation_data.len) {
-        size += 1 + BLEN(stat->publish.correlation_data);  // 1 byte ID + binary data length
-    }
-    if (stat->publish.topic_alias) {
-        size += 3;  // 1 byte ID + 2 bytes value
-    }
-    if (stat->publish.subscription_identifier) {
-        size += 1 + get_variable_size_byte_count(stat->publish.subscription_identifier);  // 1 byte ID + variable int
-    }
-    for (int i = 0; i < stat->publish.user_properties_count; i++) {
-        size += 1 + STRLEN(stat->publish.user_properties[i].key);
-        size += STRLEN(stat->publish.user_properties[i].value);
-    }
-    return size;
-}
+/*
+ * Received properties by packet type and identifier, 1 + index into properties[] or 0 if not
+ * allowed there. Built once from the table by the first client initialized, until it is ready
+ * the table is searched instead.
+ */
+#define PROPERTY_ID_LIMIT   (MQTT_CON_SHARED_SUBSCRIPTION_AVAILABLE_ID + 1)
+
+_Static_assert(sizeof(properties) / sizeof(properties[0]) < UINT8_MAX, "properties[] must be indexable by uint8_t");
+
+enum { INDEX_EMPTY, INDEX_BUILDING, INDEX_READY };
+static uint8_t received_index[16][PROPERTY_ID_LIMIT];
+static atomic_uint received_index_state;
 
-static uint32_t estimate_subscribe_prop_size(struct mqtt_client* stat)
+static void build_received_index(void)
 {
-    uint32_t size = 0;
-    if (stat->subscribe.subscription_identifier) {
-        size += 1 + get_variable_size_byte_count(stat->subscribe.subscription_identifier);
+    unsigned int expected = INDEX_EMPTY;
+    if (!atomic_compare_exchange_strong(&received_index_state, &expected, INDEX_BUILDING)) {
+        return;
     }
-    for (int i = 0; i < stat->subscribe.user_properties_count; i++) {
-        size += 1 + STRLEN(stat->subscribe.user_properties[i].key);
-        size += STRLEN(stat->subscribe.user_properties[i].value);
+    // Backwards, the first entry of the table wins like it does for a search
+    for (size_t i = sizeof(properties) / sizeof(properties[0]); i-- > 0;) {
+        const struct prop_desc* prop = &properties[i];
+        if (prop->block == PROP_CONFIG || prop->id >= PROPERTY_ID_LIMIT) {
+            continue;
+        }
+        for (unsigned int type = 0; type < 16; type++) {
+            if (prop->packets & BIT(type)) {
+                received_index[type][prop->id] = (uint8_t)(i + 1);
+            }
+        }
     }
-    return size;
+    atomic_store_explicit(&received_index_state, INDEX_READY, memory_order_release);
 }
 
-static uint32_t estimate_puback_prop_size(struct mqtt_client* stat)
+static const struct prop_desc* find_received_property(uint8_t id, mqtt_packet_type type)
 {
-    uint32_t size = 0;
-    if (stat->puback.reason_string) {
-        size += 1 + STRLEN(stat->puback.reason_string);  // 1 byte ID + string length
+    if (atomic_load_explicit(&received_index_state, memory_order_acquire) == INDEX_READY) {
+        uint8_t index = id < PROPERTY_ID_LIMIT ? received_index[type & 0x0f][id] : 0;
+        return index ? &properties[index - 1] : NULL;
     }
-    for (int i = 0; i < stat->puback.user_properties_count; i++) {
-        size += 1 + STRLEN(stat->puback.user_properties[i].key);
-        size += STRLEN(stat->puback.user_properties[i].value);
+    for (size_t i = 0; i < sizeof(properties) / sizeof(properties[0]); i++) {
+        const struct prop_desc* prop = &properties[i];
+        if (prop->id == id && (prop->packets & BIT(type)) && prop->block != PROP_CONFIG) {
+            return prop;
+        }
     }
-    return size;
+    return NULL;
 }
 
-static uint32_t estimate_pubrec_prop_size(struct mqtt_client* stat)
+/* Returns the size of the properties of the given packets, they are packed as well if pack is set */
+static uint32_t encode_properties(struct mqtt_client* stat, uint16_t packets, bool pack)
 {
     uint32_t size = 0;
-    if (stat->pubrec.reason_string) {
-        size += 1 + STRLEN(stat->pubrec.reason_string);  // 1 byte ID + string length
-    }
-    for (int i = 0; i < stat->pubrec.user_properties_count; i++) {
-        size += 1 + STRLEN(stat->pubrec.user_properties[i].key);
-        size += STRLEN(stat->pubrec.user_properties[i].value);
+    for (size_t i = 0; i < sizeof(properties) / sizeof(properties[0]); i++) {
+        const struct prop_desc* prop = &properties[i];
+        if (!is_sent_property(prop, packets)) {
+            continue;
+        }
+        const uint8_t* field = property_field(stat, prop);
+        uint32_t value = 0;
+        uint32_t len = 0;
+
+        switch (prop->type) {
+        case PROP_BYTE:
+            value = *field;
+            len = 1;
+            break;
+
+        case PROP_FLAG:
+            value = *(const bool*) field ? 1 : 0;
+            len = 1;
+            break;
+
+        case PROP_WORD:
+            value = *(const uint16_t*) field;
+            len = 2;
+            break;
+
+        case PROP_DWORD:
+            value = *(const uint32_t*) field;
+            len = 4;
+            break;
+
+        case PROP_VARINT:
+            value = *(const uint32_t*) field;
+            len = get_variable_size_byte_count(value);
+            break;
+
+        case PROP_STRING: {
+            const char* string = *(const char* const*) field;
+            if (string) {
+                size += 1 + STRLEN(string);
+                if (pack) {
+                    pack_byte(stat, prop->id);
+                    pack_string(stat, string);
+                }
+            }
+            continue;
+        }
+
+        case PROP_BINARY: {
+            const struct mqtt_blob* blob = (const struct mqtt_blob*) field;
+            if (blob->data && blob->len) {
+                size += 1 + BLEN(*blob);
+                if (pack) {
+                    pack_byte(stat, prop->id);
+                    pack_binary(stat, blob);
+                }
+            }
+            continue;
+        }
+
+        case PROP_USER: {
+            const struct mqtt_user_property* list = *(struct mqtt_user_property* const*) field;
+            int count = *(const int*)(field + sizeof(list));
+            for (int n = 0; n < count; n++) {
+                size += 1 + STRLEN(list[n].key) + STRLEN(list[n].value);
+                if (pack) {
+                    pack_byte(stat, prop->id);
+                    pack_string(stat, list[n].key);
+                    pack_string(stat, list[n].value);
+                }
+            }
+            continue;
+        }
+        }
+
+        if (!value) {
+            continue; // Numeric properties are only sent when set
+        }
+        size += 1 + len;
+        if (pack) {
+            pack_byte(stat, prop->id);
+            switch (prop->type) {
+            case PROP_WORD:
+                pack_word(stat, value);
+                break;
+            case PROP_DWORD:
+                pack_dword(stat, value);
+                break;
+            case PROP_VARINT:
+                pack_variable_size(stat, value);
+                break;
+            default:
+                pack_byte(stat, value);
+                break;
+            }
+        }
     }
     return size;
 }
 
-static uint32_t estimate_pubrel_prop_size(struct mqtt_client* stat)
+static inline uint32_t property_size(struct mqtt_client* stat, uint16_t packets)
 {
-    uint32_t size = 0;
-    if (stat->pubrel.reason_string) {
-        size += 1 + STRLEN(stat->pubrel.reason_string);  // 1 byte ID + string length
-    }
-    for (int i = 0; i < stat->pubrel.user_properties_count; i++) {
-        size += 1 + STRLEN(stat->pubrel.user_properties[i].key);
-        size += STRLEN(stat->pubrel.user_properties[i].value);
-    }
-    return size;
+    return encode_properties(stat, packets, false);
 }
 
-static uint32_t estimate_pubcomp_prop_size(struct mqtt_client* stat)
+static void pack_properties(struct mqtt_client* stat, uint16_t packets, uint32_t size)
 {
-    uint32_t size = 0;
-    if (stat->pubcomp.reason_string) {
-        size += 1 + STRLEN(stat->pubcomp.reason_string);  // 1 byte ID + string length
-    }
-    for (int i = 0; i < stat->pubcomp.user_properties_count; i++) {
-        size += 1 + STRLEN(stat->pubcomp.user_properties[i].key);
-        size += STRLEN(stat->pubcomp.user_properties[i].value);
-    }
-    return size;
+    pack_variable_size(stat, size);
+    encode_properties(stat, packets, true);
 }
 
-static uint32_t estimate_unsubscribe_prop_size(struct mqtt_client* stat)
+static int decode_properties(struct mqtt_client* stat, mqtt_packet_type type, uint32_t len)
 {
-    uint32_t size = 0;
-    for (int i = 0; i < stat->unsubscribe.user_properties_count; i++) {
-        size += 1 + STRLEN(stat->unsubscribe.user_properties[i].key);
-        size += STRLEN(stat->unsubscribe.user_properties[i].value);
+    // Strings of the CONNACK stay valid for the whole session, those of a PUBLISH until the next one
+    struct mqtt_arena* arena = type == CONNACK ? &stat->session_arena :
+                               type == PUBLISH ? &stat->publish_arena : &stat->packet_arena;
+    if (!unpack_check(stat, len)) {
+        return ERROR_MALFORMED_PACKET;
     }
-    return size;
-}
 
-/***** Packet property generation ****************************************************************/
-/*                                                                                               */
-/*************************************************************************************************/
+    // No property may reach beyond the property block
+    uint8_t* packet_end = stat->pin_end;
+    stat->pin_end = stat->pin + len;
 
-static void pack_subscribe_props(struct mqtt_client* stat)
-{
-    pack_variable_size(stat, estimate_subscribe_prop_size(stat));
-    if (stat->subscribe.subscription_identifier) {
-        pack_byte(stat, MQTT_SUB_SUBSCRIPTION_IDENTIFIER_ID);
-        pack_variable_size(stat, stat->subscribe.subscription_identifier);
-    }
-    for (int i = 0; i < stat->subscribe.user_properties_count; i++) {
-        pack_byte(stat, MQTT_USER_PROPERTY_ID);
-        pack_string(stat, stat->subscribe.user_properties[i].key);
-        pack_string(stat, stat->subscribe.user_properties[i].value);
-    }
-}
+    int result = OK;
+    while (unpack_remaining(stat)) {
+        const struct prop_desc* prop = find_received_property(unpack_byte(stat), type);
+        if (!prop) {
+            result = ERROR_UNKNOWN_IDENTIFIER;
+            break;
+        }
+        uint8_t* field = property_field(stat, prop);
 
-static void pack_conn_props(struct mqtt_client* stat)
-{
-    pack_variable_size(stat, estimate_conn_prop_size(stat));
-    if (stat->connect.session_expiry_interval) {
-        pack_byte(stat, MQTT_CON_SESSION_EXPIRY_INTERVAL_ID);
-        pack_dword(stat, stat->connect.session_expiry_interval);
-    }
-    if (stat->connect.recv_max) {
-        pack_byte(stat, MQTT_CON_RECEIVE_MAXIMUM_ID);
-        pack_word(stat, stat->connect.recv_max);
-    }
-    if (stat->connect.max_packet_size) {
-        pack_byte(stat, MQTT_CON_MAXIMUM_PACKET_SIZE_ID);
-        pack_dword(stat, stat->connect.max_packet_size);
-    }
-    if (stat->connect.topic_alias_max) {
-        pack_byte(stat, MQTT_CON_TOPIC_ALIAS_MAXIMUM_ID);
-        pack_word(stat, stat->connect.topic_alias_max);
-    }
-    if (stat->connect.req_res_inf) {
-        pack_byte(stat, MQTT_CON_REQUEST_RESPONSE_INFO_ID);
-        pack_byte(stat, stat->connect.req_res_inf & 0x01);
-    }
-    if (stat->connect.req_prob_inf) {
-        pack_byte(stat, MQTT_CON_REQUEST_PROBLEM_INF_ID);
-        pack_byte(stat, stat->connect.req_prob_inf & 0x01);
-    }
-    if (stat->connect.auth_method) {
-        pack_byte(stat, MQTT_CON_AUTH_METHOD_ID);
-        pack_string(stat, stat->connect.auth_method);
-    }
-    if (stat->connect.auth_data.data && stat->connect.auth_data.len) {
-        pack_byte(stat, MQTT_CON_AUTH_DATA_ID);
-        pack_binary(stat, &stat->connect.auth_data);
-    }
-}
+        switch (prop->type) {
+        case PROP_BYTE: {
+            uint8_t value = unpack_byte(stat);
+            if (field) {
+                *field = value;
+            }
+        }
+        break;
 
-static void pack_will_props(struct mqtt_client* stat)
-{
-    pack_variable_size(stat, estimate_will_prop_size(stat));
-    if (stat->connect.will.delay_interval) {
-        pack_byte(stat, MQTT_WILL_DELAY_INTERVAL_ID);
-        pack_dword(stat, stat->connect.will.delay_interval);
-    }
-    if (stat->connect.will.payload_format_indicator) {
-        pack_byte(stat, MQTT_WILL_FORMAT_INDICATOR_ID);
-        pack_byte(stat, stat->connect.will.payload_format_indicator);
-    }
-    if (stat->connect.will.message_expiry_delay) {
-        pack_byte(stat, MQTT_WILL_MSG_EXPIRY_INTERVAL_ID);
-        pack_dword(stat, stat->connect.will.message_expiry_delay);
-    }
-    if (stat->connect.will.content_type) {
-        pack_byte(stat, MQTT_WILL_CONTENT_TYPE_ID);
-        pack_string(stat, stat->connect.will.content_type);
-    }
-    if (stat->connect.will.response_topic) {
-        pack_byte(stat, MQTT_WILL_RESPONSE_TOPIC_ID);
-        pack_string(stat, stat->connect.will.response_topic);
-    }
-    if (stat->connect.will.correlation_data.len) {
-        pack_byte(stat, MQTT_WILL_CORELATION_DATA_ID);
-        pack_binary(stat, &stat->connect.will.correlation_data);
-    }
-}
+        case PROP_FLAG: {
+            bool value = unpack_byte(stat) & 0x01;
+            if (field) {
+                *(bool*) field = value;
+            }
+        }
+        break;
 
-static void pack_disconn_props(struct mqtt_client* stat)
-{
-    pack_variable_size(stat, estimate_will_prop_size(stat));
-    if (stat->disconn.session_expiry_interval) {
-        pack_byte(stat, MQTT_DISC_SESSION_EXPIRY_INTERVAL_ID);
-        pack_dword(stat, stat->disconn.session_expiry_interval);
-    }
-    if (stat->disconn.reason_string) {
-        pack_byte(stat, MQTT_DISC_REASON_STRING_ID);
-        pack_string(stat, stat->disconn.reason_string);
-    }
-    if (stat->disconn.server_reference) {
-        pack_byte(stat, MQTT_DISC_SERVER_REFERENCE_ID);
-        pack_string(stat, stat->disconn.server_reference);
-    }
-    for (int i = 0; i < stat->disconn.user_properties_count; i++) {
-        pack_byte(stat, MQTT_USER_PROPERTY_ID);
-        pack_string(stat, stat->disconn.user_properties[i].key);
-        pack_string(stat, stat->disconn.user_properties[i].value);
-    }
-}
+        case PROP_WORD: {
+            uint16_t value = unpack_word(stat);
+            if (field) {
+                *(uint16_t*) field = value;
+            }
+        }
+        break;
 
-static void pack_publish_props(struct mqtt_client* stat)
-{
-    pack_variable_size(stat, estimate_publish_prop_size(stat));
-    if (stat->publish.payload_format_indicator) {
-        pack_byte(stat, MQTT_PUB_PAYLOAD_FORMAT_INDICATOR_ID);
-        pack_byte(stat, stat->publish.payload_format_indicator);
-    }
-    if (stat->publish.message_expiry_interval) {
-        pack_byte(stat, MQTT_PUB_MESSAGE_EXPIRY_INTERVAL_ID);
-        pack_dword(stat, stat->publish.message_expiry_interval);
-    }
-    if (stat->publish.content_type) {
-        pack_byte(stat, MQTT_PUB_CONTENT_TYPE_ID);
-        pack_string(stat, stat->publish.content_type);
-    }
-    if (stat->publish.response_topic) {
-        pack_byte(stat, MQTT_PUB_RESPONSE_TOPIC_ID);
-        pack_string(stat, stat->publish.response_topic);
-    }
-    if (stat->publish.correlation_data.len) {
-        pack_byte(stat, MQTT_PUB_CORRELATION_DATA_ID);
-        pack_binary(stat, &stat->publish.correlation_data);
-    }
-    if (stat->publish.topic_alias) {
-        pack_byte(stat, MQTT_PUB_TOPIC_ALIAS_ID);
-        pack_word(stat, stat->publish.topic_alias);
-    }
-    if (stat->publish.subscription_identifier) {
-        pack_byte(stat, MQTT_PUB_SUBSCRIPTION_IDENTIFIER_ID);
-        pack_variable_size(stat, stat->publish.subscription_identifier);
-    }
-    for (int i = 0; i < stat->publish.user_properties_count; i++) {
-        pack_byte(stat, MQTT_PUB_USER_PROPERTY_ID);
-        pack_string(stat, stat->publish.user_properties[i].key);
-        pack_string(stat, stat->publish.user_properties[i].value);
-    }
-}
+        case PROP_DWORD: {
+            uint32_t value = unpack_dword(stat);
+            if (field) {
+                *(uint32_t*) field = value;
+            }
+        }
+        break;
 
-static void pack_puback_props(struct mqtt_client* stat)
-{
-    pack_variable_size(stat, estimate_puback_prop_size(stat));
-    if (stat->puback.reason_string) {
-        pack_byte(stat, MQTT_PUBACK_REASON_STRING_ID);
-        pack_string(stat, stat->puback.reason_string);
-    }
-    for (int i = 0; i < stat->puback.user_properties_count; i++) {
-        pack_byte(stat, MQTT_USER_PROPERTY_ID);
-        pack_string(stat, stat->puback.user_properties[i].key);
-        pack_string(stat, stat->puback.user_properties[i].value);
-    }
-}
+        case PROP_VARINT: {
+            uint32_t value = unpack_variable_size(stat);
+            if (field) {
+                *(uint32_t*) field = value;
+            }
+        }
+        break;
 
-static void pack_pubrec_props(struct mqtt_client* stat)
-{
-    pack_variable_size(stat, estimate_pubrec_prop_size(stat));
-    if (stat->pubrec.reason_string) {
-        pack_byte(stat, MQTT_PUBREC_REASON_STRING_ID);
-        pack_string(stat, stat->pubrec.reason_string);
-    }
-    for (int i = 0; i < stat->pubrec.user_properties_count; i++) {
-        pack_byte(stat, MQTT_USER_PROPERTY_ID);
-        pack_string(stat, stat->pubrec.user_properties[i].key);
-        pack_string(stat, stat->pubrec.user_properties[i].value);
-    }
-}
+        case PROP_STRING: {
+            char* string = unpack_string(stat, arena);
+            if (field) {
+                *(char**) field = string;
+            } else if (string) {
+                mqtt_user_property(stat, type, "reason_string", string);
+            }
+        }
+        break;
 
-static void pack_pubrel_props(struct mqtt_client* stat)
-{
-    pack_variable_size(stat, estimate_pubrel_prop_size(stat));
-    if (stat->pubrel.reason_string) {
-        pack_byte(stat, MQTT_PUBREL_REASON_STRING_ID);
-        pack_string(stat, stat->pubrel.reason_string);
-    }
-    for (int i = 0; i < stat->pubrel.user_properties_count; i++) {
-        pack_byte(stat, MQTT_USER_PROPERTY_ID);
-        pack_string(stat, stat->pubrel.user_properties[i].key);
-        pack_string(stat, stat->pubrel.user_properties[i].value);
-    }
-}
+        case PROP_BINARY: {
+            uint16_t data_len = unpack_word(stat);
+            if (!unpack_check(stat, data_len)) {
+                break;
+            }
+            uint8_t* data = data_len ? arena_alloc(arena, data_len) : NULL;
+            if (data && field) {
+                struct mqtt_blob* blob = (struct mqtt_blob*) field;
+                memcpy(data, stat->pin, data_len);
+                blob->data = data;
+                blob->len = data_len;
+                blob->maxlen = data_len;
+            }
+            // Data which does not fit into the arena is skipped
+            stat->pin += data_len;
+        }
+        break;
 
-static void pack_pubcomp_props(struct mqtt_client* stat)
-{
-    pack_variable_size(stat, estimate_pubcomp_prop_size(stat));
-    if (stat->pubcomp.reason_string) {
-        pack_byte(stat, MQTT_PUBCOMP_REASON_STRING_ID);
-        pack_string(stat, stat->pubcomp.reason_string);
+        case PROP_USER: {
+            char* key = unpack_string(stat, &stat->packet_arena);
+            char* value = unpack_string(stat, &stat->packet_arena);
+            if (key && value) {
+                mqtt_user_property(stat, type, key, value);
+            }
+        }
+        break;
+        }
     }
-    for (int i = 0; i < stat->pubcomp.user_properties_count; i++) {
-        pack_byte(stat, MQTT_USER_PROPERTY_ID);
-        pack_string(stat, stat->pubcomp.user_properties[i].key);
-        pack_string(stat, stat->pubcomp.user_properties[i].value);
+
+    stat->pin_end = packet_end;
+    if (stat->malformed) {
+        return ERROR_MALFORMED_PACKET;
     }
+    return result;
 }
 
-static void pack_unsubscribe_props(struct mqtt_client* stat)
+static int unpack_properties(struct mqtt_client* stat, mqtt_packet_type type)
 {
-    pack_variable_size(stat, estimate_unsubscribe_prop_size(stat));
-    for (int i = 0; i < stat->unsubscribe.user_properties_count; i++) {
-        pack_byte(stat, MQTT_USER_PROPERTY_ID);
-        pack_string(stat, stat->unsubscribe.user_properties[i].key);
-        pack_string(stat, stat->unsubscribe.user_properties[i].value);
+    uint32_t len = unpack_variable_size(stat);
+    if (stat->malformed) {
+        return ERROR_MALFORMED_PACKET;
     }
+    return len ? decode_properties(stat, type, len) : OK;
 }
 
 /***** Validity checks ***************************************************************************/
 /*                                                                                               */
 /*************************************************************************************************/
 
-static int validate_subscribe_utf8_strings(const struct mqtt_client *stat)
+static inline bool is_valid_utf8_string(const char* string)
 {
-    if (!stat) {
-        return ERROR_NULL_REFERENCE;
-    }
+    return !string || is_valid_utf8(string, strlen(string));
+}
 
-    // Check subscription entries
-    if (stat->subscribe.entries && stat->subscribe.entry_count > 0) {
-        for (unsigned int i = 0; i < stat->subscribe.entry_count; i++) {
-            if (stat->subscribe.entries[i].topic &&
-                    !is_valid_utf8(stat->subscribe.entries[i].topic, strlen(stat->subscribe.entries[i].topic))) {
-                return ERROR_INVALID_ENCODING;
-            }
+static int validate_properties(const struct mqtt_client *stat, uint16_t packets)
+{
+    for (size_t i = 0; i < sizeof(properties) / sizeof(properties[0]); i++) {
+        const struct prop_desc* prop = &properties[i];
+        if (!is_sent_property(prop, packets)) {
+            continue;
         }
-    }
-
-    // Check user properties if present
-    if (stat->subscribe.user_properties && stat->subscribe.user_properties_count > 0) {
-        for (int i = 0; i < stat->subscribe.user_properties_count; i++) {
-            if (stat->subscribe.user_properties[i].key &&
-                    !is_valid_utf8(stat->subscribe.user_properties[i].key, strlen(stat->subscribe.user_properties[i].key))) {
+        const uint8_t* field = property_field(stat, prop);
+        if (prop->type == PROP_STRING) {
+            if (!is_valid_utf8_string(*(const char* const*) field)) {
                 return ERROR_INVALID_ENCODING;
             }
-
-            if (stat->subscribe.user_properties[i].value &&
-                    !is_valid_utf8(stat->subscribe.user_properties[i].value, strlen(stat->subscribe.user_properties[i].value))) {
-                return ERROR_INVALID_ENCODING;
+        } else if (prop->type == PROP_USER) {
+            const struct mqtt_user_property* list = *(struct mqtt_user_property* const*) field;
+            int count = *(const int*)(field + sizeof(list));
+            for (int n = 0; n < count; n++) {
+                if (!is_valid_utf8_string(list[n].key) || !is_valid_utf8_string(list[n].value)) {
+                    return ERROR_INVALID_ENCODING;
+                }
             }
         }
     }
+    return OK;
+}
 
+static int validate_topics(const struct mqtt_sub_entry* entries, unsigned int count)
+{
+    for (unsigned int i = 0; entries && i < count; i++) {
+        if (!is_valid_utf8_string(entries[i].topic)) {
+            return ERROR_INVALID_ENCODING;
+        }
+    }
     return OK;
 }
 
-static int validate_connect_utf8_strings(const struct mqtt_client *stat)
+static int validate_utf8_strings(const struct mqtt_client *stat, mqtt_packet_type type)
 {
     if (!stat) {
         return ERROR_NULL_REFERENCE;
     }
 
-    // Check client_id (required field)
-    if (stat->connect.client_id && !is_valid_utf8(stat->connect.client_id, strlen(stat->connect.client_id))) {
-        return ERROR_INVALID_ENCODING;
-    }
+    uint16_t packets = BIT(type);
+    int result = OK;
+    switch (type) {
+    case CONNECT:
+        if (!is_valid_utf8_string(stat->config->connect.client_id) ||
+                !is_valid_utf8_string(stat->config->connect.user) ||
+                !is_valid_utf8_string(stat->config->connect.passwd) ||
+                !is_valid_utf8_string(stat->config->connect.will_topic) ||
+                !is_valid_utf8_string(stat->config->connect.will_data) ||
+                !is_valid_utf8_string(stat->config->connect.will.topic)) {
+            return ERROR_INVALID_ENCODING;
+        }
+        packets |= PROP_WILL;
+        break;
 
-    // Check username if present
-    if (stat->connect.user && !is_valid_utf8(stat->connect.user, strlen(stat->connect.user))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check password if present
-    if (stat->connect.passwd && !is_valid_utf8(stat->connect.passwd, strlen(stat->connect.passwd))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check will topic if present
-    if (stat->connect.will_topic && !is_valid_utf8(stat->connect.will_topic, strlen(stat->connect.will_topic))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check will data if present
-    if (stat->connect.will_data && !is_valid_utf8(stat->connect.will_data, strlen(stat->connect.will_data))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check will properties if present
-    if (stat->connect.will.topic && !is_valid_utf8(stat->connect.will.topic, strlen(stat->connect.will.topic))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    if (stat->connect.will.content_type
-            && !is_valid_utf8(stat->connect.will.content_type, strlen(stat->connect.will.content_type))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    if (stat->connect.will.response_topic
-            && !is_valid_utf8(stat->connect.will.response_topic, strlen(stat->connect.will.response_topic))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    return OK;
-}
-
-static int validate_disconnect_utf8_strings(const struct mqtt_client *stat)
-{
-    if (!stat) {
-        return ERROR_NULL_REFERENCE;
-    }
-
-    // Check reason_string if present
-    if (stat->disconn.reason_string && !is_valid_utf8(stat->disconn.reason_string, strlen(stat->disconn.reason_string))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check server_reference if present
-    if (stat->disconn.server_reference
-            && !is_valid_utf8(stat->disconn.server_reference, strlen(stat->disconn.server_reference))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check user_properties if present
-    if (stat->disconn.user_properties && stat->disconn.user_properties_count > 0) {
-        for (int i = 0; i < stat->disconn.user_properties_count; i++) {
-            // Check property name
-            if (stat->disconn.user_properties[i].key &&
-                    !is_valid_utf8(stat->disconn.user_properties[i].key, strlen(stat->disconn.user_properties[i].key))) {
-                return ERROR_INVALID_ENCODING;
-            }
-
-            // Check property value
-            if (stat->disconn.user_properties[i].value &&
-                    !is_valid_utf8(stat->disconn.user_properties[i].value, strlen(stat->disconn.user_properties[i].value))) {
-                return ERROR_INVALID_ENCODING;
-            }
-        }
-    }
-
-    return OK;
-}
-
-static int validate_publish_utf8_strings(const struct mqtt_client *stat, const struct mqtt_pub_packet *msg)
-{
-    if (!stat || !msg) {
-        return ERROR_NULL_REFERENCE;
-    }
-
-    // Check topic (required field)
-    if (!msg->topic || !is_valid_utf8(msg->topic, strlen(msg->topic))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check publish properties if present
-    if (stat->publish.content_type && !is_valid_utf8(stat->publish.content_type, strlen(stat->publish.content_type))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    if (stat->publish.response_topic
-            && !is_valid_utf8(stat->publish.response_topic, strlen(stat->publish.response_topic))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check user properties if present
-    if (stat->publish.user_properties && stat->publish.user_properties_count > 0) {
-        for (int i = 0; i < stat->publish.user_properties_count; i++) {
-            // Check property name
-            if (stat->publish.user_properties[i].key &&
-                    !is_valid_utf8(stat->publish.user_properties[i].key, strlen(stat->publish.user_properties[i].key))) {
-                return ERROR_INVALID_ENCODING;
-            }
-
-            // Check property value
-            if (stat->publish.user_properties[i].value &&
-                    !is_valid_utf8(stat->publish.user_properties[i].value, strlen(stat->publish.user_properties[i].value))) {
-                return ERROR_INVALID_ENCODING;
-            }
-        }
-    }
-
-    return OK;
-}
-
-static int validate_puback_utf8_strings(const struct mqtt_client *stat)
-{
-    if (!stat) {
-        return ERROR_NULL_REFERENCE;
-    }
-
-    // Check reason_string if present
-    if (stat->puback.reason_string && !is_valid_utf8(stat->puback.reason_string, strlen(stat->puback.reason_string))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check user_properties if present
-    if (stat->puback.user_properties && stat->puback.user_properties_count > 0) {
-        for (int i = 0; i < stat->puback.user_properties_count; i++) {
-            // Check property name
-            if (stat->puback.user_properties[i].key &&
-                    !is_valid_utf8(stat->puback.user_properties[i].key, strlen(stat->puback.user_properties[i].key))) {
-                return ERROR_INVALID_ENCODING;
-            }
-
-            // Check property value
-            if (stat->puback.user_properties[i].value &&
-                    !is_valid_utf8(stat->puback.user_properties[i].value, strlen(stat->puback.user_properties[i].value))) {
-                return ERROR_INVALID_ENCODING;
-            }
-        }
-    }
-
-    return OK;
-}
-
-static int validate_pubrec_utf8_strings(const struct mqtt_client *stat)
-{
-    if (!stat) {
-        return ERROR_NULL_REFERENCE;
-    }
-
-    // Check reason_string if present
-    if (stat->pubrec.reason_string && !is_valid_utf8(stat->pubrec.reason_string, strlen(stat->pubrec.reason_string))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check user_properties if present
-    if (stat->pubrec.user_properties && stat->pubrec.user_properties_count > 0) {
-        for (int i = 0; i < stat->pubrec.user_properties_count; i++) {
-            // Check property name
-            if (stat->pubrec.user_properties[i].key &&
-                    !is_valid_utf8(stat->pubrec.user_properties[i].key, strlen(stat->pubrec.user_properties[i].key))) {
-                return ERROR_INVALID_ENCODING;
-            }
-
-            // Check property value
-            if (stat->pubrec.user_properties[i].value &&
-                    !is_valid_utf8(stat->pubrec.user_properties[i].value, strlen(stat->pubrec.user_properties[i].value))) {
-                return ERROR_INVALID_ENCODING;
-            }
-        }
-    }
-
-    return OK;
-}
-
-static int validate_pubrel_utf8_strings(const struct mqtt_client *stat)
-{
-    if (!stat) {
-        return ERROR_NULL_REFERENCE;
-    }
-
-    // Check reason_string if present
-    if (stat->pubrel.reason_string && !is_valid_utf8(stat->pubrel.reason_string, strlen(stat->pubrel.reason_string))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check user_properties if present
-    if (stat->pubrel.user_properties && stat->pubrel.user_properties_count > 0) {
-        for (int i = 0; i < stat->pubrel.user_properties_count; i++) {
-            // Check property name
-            if (stat->pubrel.user_properties[i].key &&
-                    !is_valid_utf8(stat->pubrel.user_properties[i].key, strlen(stat->pubrel.user_properties[i].key))) {
-                return ERROR_INVALID_ENCODING;
-            }
-
-            // Check property value
-            if (stat->pubrel.user_properties[i].value &&
-                    !is_valid_utf8(stat->pubrel.user_properties[i].value, strlen(stat->pubrel.user_properties[i].value))) {
-                return ERROR_INVALID_ENCODING;
-            }
-        }
-    }
-
-    return OK;
-}
-
-static int validate_pubcomp_utf8_strings(const struct mqtt_client *stat)
-{
-    if (!stat) {
-        return ERROR_NULL_REFERENCE;
-    }
-
-    // Check reason_string if present
-    if (stat->pubcomp.reason_string && !is_valid_utf8(stat->pubcomp.reason_string, strlen(stat->pubcomp.reason_string))) {
-        return ERROR_INVALID_ENCODING;
-    }
-
-    // Check user_properties if present
-    if (stat->pubcomp.user_properties && stat->pubcomp.user_properties_count > 0) {
-        for (int i = 0; i < stat->pubcomp.user_properties_count; i++) {
-            // Check property name
-            if (stat->pubcomp.user_properties[i].key &&
-                    !is_valid_utf8(stat->pubcomp.user_properties[i].key, strlen(stat->pubcomp.user_properties[i].key))) {
-                return ERROR_INVALID_ENCODING;
-            }
-
-            // Check property value
-            if (stat->pubcomp.user_properties[i].value &&
-                    !is_valid_utf8(stat->pubcomp.user_properties[i].value, strlen(stat->pubcomp.user_properties[i].value))) {
-                return ERROR_INVALID_ENCODING;
-            }
-        }
-    }
-
-    return OK;
-}
+    case SUBSCRIBE:
+        result = validate_topics(stat->config->subscribe.entries, stat->config->subscribe.entry_count);
+        break;
 
-static int validate_unsubscribe_utf8_strings(const struct mqtt_client *stat)
-{
-    if (!stat) {
-        return ERROR_NULL_REFERENCE;
-    }
+    case UNSUBSCRIBE:
+        result = validate_topics(stat->config->unsubscribe.entries, stat->config->unsubscribe.entry_count);
+        break;
 
-    // Check unsubscribe entries
-    if (stat->unsubscribe.entries && stat->unsubscribe.entry_count > 0) {
-        for (unsigned int i = 0; i < stat->unsubscribe.entry_count; i++) {
-            if (stat->unsubscribe.entries[i].topic &&
-                    !is_valid_utf8(stat->unsubscribe.entries[i].topic, strlen(stat->unsubscribe.entries[i].topic))) {
-                return ERROR_INVALID_ENCODING;
-            }
-        }
+    default:
+        break;
     }
 
-    // Check user properties if present
-    if (stat->unsubscribe.user_properties && stat->unsubscribe.user_properties_count > 0) {
-        for (int i = 0; i < stat->unsubscribe.user_properties_count; i++) {
-            if (stat->unsubscribe.user_properties[i].key &&
-                    !is_valid_utf8(stat->unsubscribe.user_properties[i].key, strlen(stat->unsubscribe.user_properties[i].key))) {
-                return ERROR_INVALID_ENCODING;
-            }
-
-            if (stat->unsubscribe.user_properties[i].value &&
-                    !is_valid_utf8(stat->unsubscribe.user_properties[i].value, strlen(stat->unsubscribe.user_properties[i].value))) {
-                return ERROR_INVALID_ENCODING;
-            }
-        }
+    if (SUCCESSFUL(result)) {
+        result = validate_properties(stat, packets);
     }
-
-    return OK;
+    return result;
 }
 
 /***** Packet generation *************************************************************************/
@@ -974,32 +823,32 @@ static int validate_unsubscribe_utf8_strings(const struct mqtt_client *stat)
 
 static void make_subscribe(struct mqtt_client* stat)
 {
-    uint32_t prop_size = estimate_subscribe_prop_size(stat);
+    uint32_t prop_size = property_size(stat, BIT(SUBSCRIBE));
     uint32_t rsize = 2 + get_variable_size_byte_count(prop_size) + prop_size; // packet_id + props
 
     // Calculate size for all subscription entries
-    for (unsigned int i = 0; i < stat->subscribe.entry_count; i++) {
-        rsize += STRLEN(stat->subscribe.entries[i].topic) + 1; // topic + subscription options
+    for (unsigned int i = 0; i < stat->config->subscribe.entry_count; i++) {
+        rsize += STRLEN(stat->config->subscribe.entries[i].topic) + 1; // topic + subscription options
     }
 
     if (stat->pout) {
         write_fixed_header(stat, SUBSCRIBE, 0x02, rsize); // Fixed header flags = 0010 (reserved)
-        pack_word(stat, stat->subscribe.packet_id);
-        pack_subscribe_props(stat);
+        pack_word(stat, stat->config->subscribe.packet_id);
+        pack_properties(stat, BIT(SUBSCRIBE), prop_size);
 
-        for (unsigned int i = 0; i < stat->subscribe.entry_count; i++) {
-            pack_string(stat, stat->subscribe.entries[i].topic);
+        for (unsigned int i = 0; i < stat->config->subscribe.entry_count; i++) {
+            pack_string(stat, stat->config->subscribe.entries[i].topic);
 
             // Pack subscription options byte
             uint8_t options = 0;
-            options |= (stat->subscribe.entries[i].qos & 0x03);
-            if (stat->subscribe.entries[i].no_local) {
+            options |= (stat->config->subscribe.entries[i].qos & 0x03);
+            if (stat->config->subscribe.entries[i].no_local) {
                 options |= 0x04;
             }
-            if (stat->subscribe.entries[i].retain_as_published) {
+            if (stat->config->subscribe.entries[i].retain_as_published) {
                 options |= 0x08;
             }
-            options |= (stat->subscribe.entries[i].retain_handling & 0x03) << 4;
+            options |= (stat->config->subscribe.entries[i].retain_handling & 0x03) << 4;
 
             pack_byte(stat, options);
         }
@@ -1010,49 +859,50 @@ static void make_subscribe(struct mqtt_client* stat)
 
 static void make_connect(struct mqtt_client* stat)
 {
-    uint8_t flags = (stat->connect.will_qos & 0x03) << 2;
-    if (stat->connect.clean_start) {
+    uint8_t flags = (stat->config->connect.will_qos & 0x03) << 2;
+    if (stat->config->connect.clean_start) {
         SET(flags, BIT(1));
     }
-    if (stat->connect.will_flag) {
+    if (stat->config->connect.will_flag) {
         SET(flags, BIT(2));
     }
-    if (stat->connect.pw_flag) {
+    if (stat->config->connect.pw_flag) {
         SET(flags, BIT(6));
     }
-    if (stat->connect.un_flag) {
+    if (stat->config->connect.un_flag) {
         SET(flags, BIT(7));
     }
-    uint8_t plen = estimate_conn_prop_size(stat);
-    uint32_t rsize = 10 + plen + STRLEN(stat->connect.client_id) + get_variable_size_byte_count(plen);
-    if (stat->connect.will_flag) {
-        plen = estimate_will_prop_size(stat);
-        rsize += plen + STRLEN(stat->connect.will.topic) + BLEN(stat->connect.will.payload) + get_variable_size_byte_count(
-                     plen);
+    uint32_t plen = property_size(stat, BIT(CONNECT));
+    uint32_t wlen = 0;
+    uint32_t rsize = 10 + plen + STRLEN(stat->config->connect.client_id) + get_variable_size_byte_count(plen);
+    if (stat->config->connect.will_flag) {
+        wlen = property_size(stat, PROP_WILL);
+        rsize += wlen + STRLEN(stat->config->connect.will.topic) + BLEN(stat->config->connect.will.payload) + get_variable_size_byte_count(
+                     wlen);
     }
-    if (stat->connect.un_flag) {
-        rsize += STRLEN(stat->connect.user);
+    if (stat->config->connect.un_flag) {
+        rsize += STRLEN(stat->config->connect.user);
     }
-    if (stat->connect.pw_flag) {
-        rsize += STRLEN(stat->connect.passwd);
+    if (stat->config->connect.pw_flag) {
+        rsize += STRLEN(stat->config->connect.passwd);
     }
     if (stat->pout) {
         write_fixed_header(stat, CONNECT, 0, rsize);
         pack_string(stat, "MQTT");
         pack_byte(stat, MQTT_PROTOCOL_VERSION);
         pack_byte(stat, flags);
-        pack_word(stat, stat->connect.keep_alive);
-        pack_conn_props(stat);
-        pack_string(stat, stat->connect.client_id);
-        if (stat->connect.will_flag) {
-            pack_will_props(stat);
-            pack_string(stat, stat->connect.will.topic);
-            pack_binary(stat, &stat->connect.will.payload);
-            if (stat->connect.un_flag) {
-                pack_string(stat, stat->connect.user);
+        pack_word(stat, stat->config->connect.keep_alive);
+        pack_properties(stat, BIT(CONNECT), plen);
+        pack_string(stat, stat->config->connect.client_id);
+        if (stat->config->connect.will_flag) {
+            pack_properties(stat, PROP_WILL, wlen);
+            pack_string(stat, stat->config->connect.will.topic);
+            pack_binary(stat, &stat->config->connect.will.payload);
+            if (stat->config->connect.un_flag) {
+                pack_string(stat, stat->config->connect.user);
             }
-            if (stat->connect.pw_flag) {
-                pack_string(stat, stat->connect.passwd);
+            if (stat->config->connect.pw_flag) {
+                pack_string(stat, stat->config->connect.passwd);
             }
         }
     }
@@ -1062,25 +912,27 @@ static void make_connect(struct mqtt_client* stat)
 static void make_disconnect(struct mqtt_client *stat)
 {
     uint32_t rsize = 1;
-    bool disconnect_with_properties = stat->disconn.reason_string ||
-                                      stat->disconn.server_reference ||
-                                      stat->disconn.session_expiry_interval ||
-                                      stat->disconn.user_properties_count;
-    if (disconnect_with_properties) {
-        rsize += estimate_disconn_prop_size(stat);
-        rsize += get_variable_size_byte_count(rsize);
+    uint32_t prop_size = property_size(stat, BIT(DISCONNECT));
+    if (prop_size > 0) {
+        rsize += get_variable_size_byte_count(prop_size) + prop_size;
     }
     if (stat->pout) {
         write_fixed_header(stat, DISCONNECT, 0, rsize);
-        pack_byte(stat, stat->disconn.reason_code);
-        if (disconnect_with_properties) {
-            pack_disconn_props(stat);
+        pack_byte(stat, stat->diag->disconn.reason_code);
+        if (prop_size > 0) {
+            pack_properties(stat, BIT(DISCONNECT), prop_size);
         }
     }
     stat->packet_size = rsize + estimate_fixed_header_size(rsize);
 }
 
-static void make_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg)
+static inline bool publish_by_reference(const struct mqtt_pub_packet* msg)
+{
+    return msg->payload.data && msg->payload.len > MQTT_PUBLISH_COPY_LIMIT;
+}
+
+/* Everything of a PUBLISH up to its payload of payload_len bytes */
+static void make_publish_header(struct mqtt_client* stat, const struct mqtt_pub_packet* msg, uint32_t payload_len)
 {
     uint8_t flags = 0;
 
@@ -1094,7 +946,7 @@ static void make_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg)
     flags |= (msg->qos & 0x03) << 1;
 
     // Calculate remaining length
-    uint32_t prop_size = estimate_publish_prop_size(stat);
+    uint32_t prop_size = property_size(stat, BIT(PUBLISH));
     uint32_t rsize = STRLEN(msg->topic) + get_variable_size_byte_count(prop_size) + prop_size;
 
     // Add packet identifier for QoS > 0
@@ -1102,11 +954,8 @@ static void make_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg)
         rsize += 2;  // 2 bytes for packet identifier
     }
 
-    // Add payload length
-    rsize += msg->payload.len;
-
     if (stat->pout) {
-        write_fixed_header(stat, PUBLISH, flags, rsize);
+        write_fixed_header(stat, PUBLISH, flags, rsize + payload_len);
 
         // Pack topic name
         pack_string(stat, msg->topic);
@@ -1117,17 +966,26 @@ static void make_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg)
         }
 
         // Pack properties
-        pack_publish_props(stat);
+        pack_properties(stat, BIT(PUBLISH), prop_size);
+    }
 
-        // Pack payload
-        if (msg->payload.data && msg->payload.len > 0) {
-            for (uint32_t i = 0; i < msg->payload.len; i++) {
-                pack_byte(stat, msg->payload.data[i]);
-            }
+    stat->packet_size = rsize + estimate_fixed_header_size(rsize + payload_len);
+}
+
+static void make_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg)
+{
+    make_publish_header(stat, msg, msg->payload.len);
+
+    // Pack payload, large ones follow the packet from the buffer of the caller
+    if (publish_by_reference(msg)) {
+        return;
+    }
+    if (stat->pout && msg->payload.data) {
+        for (uint32_t i = 0; i < msg->payload.len; i++) {
+            pack_byte(stat, msg->payload.data[i]);
         }
     }
-
-    stat->packet_size = rsize + estimate_fixed_header_size(rsize);
+    stat->packet_size += msg->payload.len;
 }
 
 static void make_pingreq(struct mqtt_client* stat)
@@ -1143,7 +1001,7 @@ static void make_pingreq(struct mqtt_client* stat)
 
 static void make_puback(struct mqtt_client* stat)
 {
-    uint32_t prop_size = estimate_puback_prop_size(stat);
+    uint32_t prop_size = property_size(stat, BIT(PUBACK));
     uint32_t rsize = 2 + 1; // packet_id + reason_code
 
     // Add properties size if there are properties
@@ -1155,9 +1013,9 @@ static void make_puback(struct mqtt_client* stat)
 
     if (stat->pout) {
         write_fixed_header(stat, PUBACK, 0, rsize);
-        pack_word(stat, stat->puback.packet_id);
-        pack_byte(stat, stat->puback.reason_code);
-        pack_puback_props(stat);
+        pack_word(stat, stat->diag->puback.packet_id);
+        pack_byte(stat, stat->diag->puback.reason_code);
+        pack_properties(stat, BIT(PUBACK), prop_size);
     }
 
     stat->packet_size = rsize + estimate_fixed_header_size(rsize);
@@ -1165,7 +1023,7 @@ static void make_puback(struct mqtt_client* stat)
 
 static void make_pubrec(struct mqtt_client* stat)
 {
-    uint32_t prop_size = estimate_pubrec_prop_size(stat);
+    uint32_t prop_size = property_size(stat, BIT(PUBREC));
     uint32_t rsize = 2 + 1; // packet_id + reason_code
 
     // Add properties size if there are properties
@@ -1177,9 +1035,9 @@ static void make_pubrec(struct mqtt_client* stat)
 
     if (stat->pout) {
         write_fixed_header(stat, PUBREC, 0, rsize);
-        pack_word(stat, stat->pubrec.packet_id);
-        pack_byte(stat, stat->pubrec.reason_code);
-        pack_pubrec_props(stat);
+        pack_word(stat, stat->diag->pubrec.packet_id);
+        pack_byte(stat, stat->diag->pubrec.reason_code);
+        pack_properties(stat, BIT(PUBREC), prop_size);
     }
 
     stat->packet_size = rsize + estimate_fixed_header_size(rsize);
@@ -1187,7 +1045,7 @@ static void make_pubrec(struct mqtt_client* stat)
 
 static void make_pubrel(struct mqtt_client* stat)
 {
-    uint32_t prop_size = estimate_pubrel_prop_size(stat);
+    uint32_t prop_size = property_size(stat, BIT(PUBREL));
     uint32_t rsize = 2 + 1; // packet_id + reason_code
 
     // Add properties size if there are properties
@@ -1199,9 +1057,9 @@ static void make_pubrel(struct mqtt_client* stat)
 
     if (stat->pout) {
         write_fixed_header(stat, PUBREL, 0x02, rsize); // Fixed header flags = 0010 (reserved)
-        pack_word(stat, stat->pubrel.packet_id);
-        pack_byte(stat, stat->pubrel.reason_code);
-        pack_pubrel_props(stat);
+        pack_word(stat, stat->diag->pubrel.packet_id);
+        pack_byte(stat, stat->diag->pubrel.reason_code);
+        pack_properties(stat, BIT(PUBREL), prop_size);
     }
 
     stat->packet_size = rsize + estimate_fixed_header_size(rsize);
@@ -1209,7 +1067,7 @@ static void make_pubrel(struct mqtt_client* stat)
 
 static void make_pubcomp(struct mqtt_client* stat)
 {
-    uint32_t prop_size = estimate_pubcomp_prop_size(stat);
+    uint32_t prop_size = property_size(stat, BIT(PUBCOMP));
     uint32_t rsize = 2 + 1; // packet_id + reason_code
 
     // Add properties size if there are properties
@@ -1221,9 +1079,9 @@ static void make_pubcomp(struct mqtt_client* stat)
 
     if (stat->pout) {
         write_fixed_header(stat, PUBCOMP, 0, rsize);
-        pack_word(stat, stat->pubcomp.packet_id);
-        pack_byte(stat, stat->pubcomp.reason_code);
-        pack_pubcomp_props(stat);
+        pack_word(stat, stat->diag->pubcomp.packet_id);
+        pack_byte(stat, stat->diag->pubcomp.reason_code);
+        pack_properties(stat, BIT(PUBCOMP), prop_size);
     }
 
     stat->packet_size = rsize + estimate_fixed_header_size(rsize);
@@ -1231,21 +1089,21 @@ static void make_pubcomp(struct mqtt_client* stat)
 
 static void make_unsubscribe(struct mqtt_client* stat)
 {
-    uint32_t prop_size = estimate_unsubscribe_prop_size(stat);
+    uint32_t prop_size = property_size(stat, BIT(UNSUBSCRIBE));
     uint32_t rsize = 2 + get_variable_size_byte_count(prop_size) + prop_size; // packet_id + props
 
     // Calculate size for all unsubscribe entries
-    for (unsigned int i = 0; i < stat->unsubscribe.entry_count; i++) {
-        rsize += STRLEN(stat->unsubscribe.entries[i].topic);
+    for (unsigned int i = 0; i < stat->config->unsubscribe.entry_count; i++) {
+        rsize += STRLEN(stat->config->unsubscribe.entries[i].topic);
     }
 
     if (stat->pout) {
         write_fixed_header(stat, UNSUBSCRIBE, 0x02, rsize); // Fixed header flags = 0010 (reserved)
-        pack_word(stat, stat->unsubscribe.packet_id);
-        pack_unsubscribe_props(stat);
+        pack_word(stat, stat->config->unsubscribe.packet_id);
+        pack_properties(stat, BIT(UNSUBSCRIBE), prop_size);
 
-        for (unsigned int i = 0; i < stat->unsubscribe.entry_count; i++) {
-            pack_string(stat, stat->unsubscribe.entries[i].topic);
+        for (unsigned int i = 0; i < stat->config->unsubscribe.entry_count; i++) {
+            pack_string(stat, stat->config->unsubscribe.entries[i].topic);
         }
     }
 
@@ -1318,264 +1176,346 @@ static bool await_for_packet(struct mqtt_client *stat, mqtt_packet_type type)
     return false;
 }
 
-/***** Packet processing *************************************************************************/
+/***** Outbound buffer handling ******************************************************************/
 /*                                                                                               */
 /*************************************************************************************************/
 
-static inline void connack_default_properties(struct mqtt_client *stat)
+/* Packets go through the coalescing buffer when enabled and while the payload of a publish is streamed */
+static inline bool queue_packets(const struct mqtt_client *stat)
 {
-    stat->connack.max_qos = 2;
-    stat->connack.retain_avail = true;
-    stat->connack.wildcard_sub_avail = true;
-    stat->connack.sub_id_avail = true;
-    stat->connack.shared_sub_avail = true;
-    stat->connack.server_keep_alive = stat->connect.keep_alive;
-    stat->connack.max_packet_size = stat->connect.max_packet_size;
+    return stat->coalesce.enabled || stat->publish_stream.open;
 }
 
-static int process_connack_poperties(struct mqtt_client *stat, int len)
+static int flush_coalesced(struct mqtt_client *stat)
 {
-    char *key = NULL;
-    char *value = NULL;
-    while (len > 0) {
-        uint8_t prop_id = unpack_byte(stat);
-        switch (prop_id) {
-        case MQTT_ACK_SERVER_REFERENCE_ID:
-            stat->connack.server_reference = unpack_string(stat);
-            len -= (int) STRLEN(stat->connack.server_reference);
-            break;
-
-        case MQTT_CON_RESPONSE_INFO_ID:
-            stat->connack.response_info = unpack_string(stat);
-            len -= (int) STRLEN(stat->connack.response_info);
-            break;
-
-        case MQTT_CON_REQUEST_RESPONSE_INFO_ID:
-        case MQTT_CON_REQUEST_PROBLEM_INF_ID:
-            unpack_byte(stat); // Single byte
-            len -= 1;
-            break;
-
-        case MQTT_CON_TOPIC_ALIAS_MAXIMUM_ID:
-            stat->connack.topic_alias_max = unpack_word(stat);
-            len -= 2;
-            break;
-
-        case MQTT_CON_RECEIVE_MAXIMUM_ID:
-            stat->connack.recv_max = unpack_word(stat);
-            len -= 2;
-            break;
-
-        case MQTT_CON_MAXIMUM_QOS_ID:
-            stat->connack.max_qos = unpack_byte(stat);
-            len -= 1;
-            break;
-
-        case MQTT_CON_RETAIN_AVAILABLE_ID:
-            stat->connack.retain_avail = unpack_byte(stat) & 0x01;
-            len -= 1;
-            break;
-
-        case MQTT_CON_MAXIMUM_PACKET_SIZE_ID:
-            stat->connack.max_packet_size = unpack_dword(stat);
-            len -= 4;
-            break;
-
-        case MQTT_ACK_ASSIGNED_CLIENT_ID:
-            stat->connack.assigned_client_id = unpack_string(stat);
-            len -= (int)STRLEN(stat->connack.assigned_client_id);
-            break;
-
-        case MQTT_REASON_STRING_ID:
-            stat->connack.reason_string = unpack_string(stat);
-            len -= (int)STRLEN(stat->connack.reason_string);
-            break;
-
-        case MQTT_USER_PROPERTY_ID:
-            key = unpack_string(stat);
-            value = unpack_string(stat);
-            len -= (int)(STRLEN(key) + STRLEN(value));
-            mqtt_user_property(stat, CONNACK, key, value);
-            free(key);
-            free(value);
-            break;
-
-        case MQTT_ACK_WILDCARD_SUB_AVAIL_ID:
-            stat->connack.wildcard_sub_avail = unpack_byte(stat) & 0x01;
-            len -= 1;
-            break;
-
-        case MQTT_ACK_SUB_ID_AVAIL_ID:
-            stat->connack.sub_id_avail = unpack_byte(stat) & 0x01;
-            len -= 1;
-            break;
-
-        case MQTT_ACK_SHARED_SUB_AVAIL_ID:
-            stat->connack.shared_sub_avail = unpack_byte(stat) & 0x01;
-            len -= 1;
-            break;
+    // Held back until a streamed payload is complete, it must not be interrupted
+    if (!stat->coalesce.len || stat->publish_stream.open) {
+        return OK;
+    }
+    struct mqtt_pbuf buf = { .payload = stat->coalesce.buffer, .len = stat->coalesce.len };
+    stat->coalesce.len = 0;
+    int result = stat->net.send(stat, &buf);
+    if (result == STATUS_BUSY) {
+        // Not taken by the transport, it resumes the send later
+        stat->coalesce.len = (uint32_t) buf.len;
+    }
+    return result;
+}
 
-        case MQTT_ACK_SEVER_KEEP_ALIVE_ID:
-            stat->connack.server_keep_alive = unpack_word(stat);
-            len -= 2;
-            break;
+static int alloc_packet_buf(struct mqtt_client *stat, uint32_t len)
+{
+    if (!queue_packets(stat)) {
+        return stat->net.alloc_send_buf(stat, &stat->outp, len);
+    }
 
-        default:
-            return ERROR_UNKNOWN_IDENTIFIER;
+    // Flush first if the new packet would exceed the byte threshold
+    if (stat->coalesce.len && (stat->coalesce.len + len > stat->coalesce.max_bytes)) {
+        int result = flush_coalesced(stat);
+        if (FAILED(result)) {
+            return result;
         }
-        --len;
     }
-    if (len < 0) {
-        return ERROR_MALFORMED_PACKET;
+
+    // Grow the coalescing buffer if needed (only for packets above the threshold)
+    uint32_t required = stat->coalesce.len + len;
+    if (required > stat->coalesce.size) {
+#ifdef MQTT_STATIC_MEMORY
+        // Without heap only packets held back behind a streamed publish are queued
+        if (required > sizeof(stat->storage.held)) {
+            return ERROR_OUT_OF_MEMORY;
+        }
+        stat->coalesce.buffer = stat->storage.held;
+        stat->coalesce.size = sizeof(stat->storage.held);
+#else
+        uint8_t* buffer = mqtt_realloc(stat, stat->coalesce.buffer, required);
+        if (!buffer) {
+            return ERROR_OUT_OF_MEMORY;
+        }
+        stat->coalesce.buffer = buffer;
+        stat->coalesce.size = required;
+#endif
     }
+
+    // The packet is built directly behind the already queued packets
+    stat->outp.payload = stat->coalesce.buffer + stat->coalesce.len;
+    stat->outp.len = len;
     return OK;
 }
 
-static int process_connack(struct mqtt_client *stat)
+/* Only the coalescing buffer is kept for a transport that takes nothing for now, other data fails the send */
+static int send_direct(struct mqtt_client *stat, struct mqtt_pbuf *buf)
 {
-    int result = OK;
-    stat->connack.ack_flag = unpack_byte(stat) & 0x01;
-    stat->connack.reason = unpack_byte(stat);
-    if (stat->connack.reason & 0x80) {
-        return ERROR_SERVER_DECLINED;
+    int result = stat->net.send(stat, buf);
+    return result == STATUS_BUSY ? ERROR_OUT_OF_RESOURCE : result;
+}
+
+static int send_packet_buf(struct mqtt_client *stat)
+{
+    if (!queue_packets(stat)) {
+        return send_direct(stat, &stat->outp);
     }
-    uint32_t prop_len = unpack_variable_size(stat);
-    connack_default_properties(stat);
-    if (prop_len > 0) {
-        result = process_connack_poperties(stat, (int)prop_len);
+
+    if (!stat->coalesce.len) {
+        stat->coalesce.since = get_time_ms();
     }
-    if (SUCCESSFUL(result)) {
-        stat->connected = true;
-        stat->expected_ptypes |= BIT(DISCONNECT) | BIT(PUBLISH);
-        mqtt_connected(stat);
+    stat->coalesce.len += stat->outp.len;
+
+    if ((stat->coalesce.len >= stat->coalesce.max_bytes) || (stat->coalesce.max_delay &&
+            (get_time_ms() - stat->coalesce.since >= stat->coalesce.max_delay))) {
+        return flush_coalesced(stat);
     }
-    return result;
+    return OK;
 }
 
-static int process_publish_properties(struct mqtt_client *stat, uint32_t prop_len)
+static void free_packet_buf(struct mqtt_client *stat)
 {
-    while (prop_len > 0) {
-        uint8_t prop_id = unpack_byte(stat);
-        prop_len--;
+    if (!queue_packets(stat)) {
+        stat->net.free_send_buf(stat, &stat->outp);
+        return;
+    }
+    stat->outp.payload = NULL;
+    stat->outp.len = 0;
+}
 
-        switch (prop_id) {
-        case MQTT_PUB_PAYLOAD_FORMAT_INDICATOR_ID:
-            stat->received_publish.payload_format_indicator = unpack_byte(stat);
-            prop_len--;
-            break;
+/* A streamed publish ends with its connection, so do the packets held back behind it */
+static void abort_publish_stream(struct mqtt_client *stat)
+{
+    if (!stat->publish_stream.open) {
+        return;
+    }
+    if (stat->publish_stream.qos > 0) {
+        free_packet_slot(stat, stat->publish_stream.packet_id);
+    }
+    stat->publish_stream.open = false;
+    stat->coalesce.len = 0;
+}
 
-        case MQTT_PUB_MESSAGE_EXPIRY_INTERVAL_ID:
-            stat->received_publish.message_expiry_interval = unpack_dword(stat);
-            prop_len -= 4;
-            break;
+/* Ends a connection whose byte stream cannot be continued, a packet went out incomplete */
+static void break_connection(struct mqtt_client *stat)
+{
+    abort_publish_stream(stat);
+    stat->connected = false;
+    stat->expected_ptypes = BIT(PINGREQ);
+    stat->net.close_conn(stat);
+}
 
-        case MQTT_PUB_TOPIC_ALIAS_ID:
-            stat->received_publish.topic_alias = unpack_word(stat);
-            prop_len -= 2;
-            break;
+/*
+ * Sends a payload from the buffer of the caller, right behind its header and everything coalesced before.
+ * The last queued bytes, header_len of them, are withdrawn when the transport takes nothing for now.
+ */
+static int send_payload(struct mqtt_client *stat, const struct mqtt_blob *payload, uint32_t header_len)
+{
+    int result = flush_coalesced(stat);
+    if (result == STATUS_BUSY) {
+        stat->coalesce.len -= header_len;
+        return ERROR_OUT_OF_RESOURCE;
+    }
+    if (FAILED(result)) {
+        return result;
+    }
+    struct mqtt_pbuf buf = { .payload = payload->data, .len = payload->len };
+    result = send_direct(stat, &buf);
+    if (FAILED(result)) {
+        // The header is gone already, the payload cannot follow later
+        break_connection(stat);
+    }
+    return result;
+}
 
-        case MQTT_PUB_RESPONSE_TOPIC_ID:
-            stat->received_publish.response_topic = unpack_string(stat);
-            if (stat->received_publish.response_topic) {
-                prop_len -= strlen(stat->received_publish.response_topic) + 2;
-            } else {
-                prop_len -= 2;
-            }
-            break;
+static int make_pending_ack(struct mqtt_client *stat, uint16_t packet_id, uint8_t qos)
+{
+    if (qos == 2) {
+        stat->diag->pubrec.packet_id = packet_id;
+        stat->diag->pubrec.reason_code = MQTT_REASON_SUCCESS;
+        make_pubrec(stat);
+    } else {
+        stat->diag->puback.packet_id = packet_id;
+        stat->diag->puback.reason_code = MQTT_REASON_SUCCESS;
+        make_puback(stat);
+    }
+    return stat->packet_size;
+}
 
-        case MQTT_PUB_CORRELATION_DATA_ID: {
-            uint16_t data_len = unpack_word(stat);
-            if (data_len > 0 && data_len <= sizeof(stat->received_publish.correlation_data_buffer)) {
-                stat->received_publish.correlation_data.data = stat->received_publish.correlation_data_buffer;
-                stat->received_publish.correlation_data.len = data_len;
-                stat->received_publish.correlation_data.maxlen = sizeof(stat->received_publish.correlation_data_buffer);
+static int send_pending_acks(struct mqtt_client *stat)
+{
+    uint32_t total_size = 0;
+    int result = validate_utf8_strings(stat, PUBACK);
+    if (SUCCESSFUL(result)) {
+        result = validate_utf8_strings(stat, PUBREC);
+    }
+    if (FAILED(result)) {
+        return result;
+    }
 
-                for (uint16_t i = 0; i < data_len; i++) {
-                    stat->received_publish.correlation_data.data[i] = unpack_byte(stat);
-                }
-            } else {
-                // Skip data if too large
-                for (uint16_t i = 0; i < data_len; i++) {
-                    unpack_byte(stat);
+    // First pass: estimate the size of all acknowledgements released by the application
+    stat->pout = NULL;
+    for (int i = 0; i < MQTT_RECEIVE_MAXIMUM; ++i) {
+        if (stat->acks.slots[i].acked) {
+            total_size += make_pending_ack(stat, stat->acks.slots[i].packet_id, stat->acks.slots[i].qos);
+        }
+    }
+    if (!total_size) {
+        return OK;
+    }
+
+    // Allocate one buffer for all of them
+    result = alloc_packet_buf(stat, total_size);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    // Second pass: encode the acknowledgements back-to-back
+    stat->pout = (uint8_t*) stat->outp.payload;
+    for (int i = 0; i < MQTT_RECEIVE_MAXIMUM; ++i) {
+        if (stat->acks.slots[i].acked) {
+            uint16_t packet_id = stat->acks.slots[i].packet_id;
+            if (stat->acks.slots[i].qos == 2) {
+                // Reserve packet slot for expected PUBREL
+                result = reserve_packet_slot_for_request(stat, packet_id, PUBREL);
+                if (FAILED(result)) {
+                    break;
                 }
+                stat->expected_ptypes |= BIT(PUBREL);
             }
-            prop_len -= data_len + 2;
+            make_pending_ack(stat, packet_id, stat->acks.slots[i].qos);
+            memset(&stat->acks.slots[i], 0, sizeof(stat->acks.slots[i]));
         }
-        break;
+    }
 
-        case MQTT_PUB_CONTENT_TYPE_ID:
-            stat->received_publish.content_type = unpack_string(stat);
-            if (stat->received_publish.content_type) {
-                prop_len -= strlen(stat->received_publish.content_type) + 2;
-            } else {
-                prop_len -= 2;
-            }
-            break;
+    // Only the packets actually encoded are sent
+    stat->outp.len = stat->pout - (uint8_t*) stat->outp.payload;
+    if (stat->outp.len) {
+        int send_result = send_packet_buf(stat);
+        if (SUCCESSFUL(result)) {
+            result = send_result;
+        }
+    }
+    free_packet_buf(stat);
 
-        case MQTT_PUB_SUBSCRIPTION_IDENTIFIER_ID:
-            stat->received_publish.subscription_identifier = unpack_variable_size(stat);
-            prop_len -= get_variable_size_byte_count(stat->received_publish.subscription_identifier);
-            break;
+    return result;
+}
 
-        case MQTT_PUB_USER_PROPERTY_ID: {
-            char* key = unpack_string(stat);
-            char* value = unpack_string(stat);
+int transport_resume_send(struct mqtt_client *stat)
+{
+    int result = send_pending_acks(stat);
+    if (FAILED(result)) {
+        return result;
+    }
+    return flush_coalesced(stat);
+}
 
-            if (key && value) {
-                prop_len -= strlen(key) + strlen(value) + 4;
-                mqtt_user_property(stat, PUBLISH, key, value);
-            } else {
-                prop_len -= 4; // Minimum for two empty strings
-            }
+static int flush_outbound(struct mqtt_client *stat)
+{
+    int result = drain_submit_queue(stat);
+    if (SUCCESSFUL(result)) {
+        result = send_pending_acks(stat);
+    }
+    if (FAILED(result)) {
+        return result;
+    }
+    return flush_coalesced(stat);
+}
 
-            free(key);
-            free(value);
+static int queue_pending_ack(struct mqtt_client *stat, uint16_t packet_id, uint8_t qos)
+{
+    int free_slot = -1;
+    for (int i = 0; i < MQTT_RECEIVE_MAXIMUM; ++i) {
+        if (stat->acks.slots[i].packet_id == packet_id) {
+            return OK; // Redelivery of a message the application has not acknowledged yet
         }
-        break;
-
-        default:
-            // Unknown property - skip remaining properties to avoid corruption
-            return ERROR_UNKNOWN_IDENTIFIER;
+        if (!stat->acks.slots[i].packet_id && free_slot < 0) {
+            free_slot = i;
         }
     }
-
-    if (prop_len < 0) {
-        return ERROR_MALFORMED_PACKET;
+    if (free_slot < 0) {
+        return ERROR_OUT_OF_RESOURCE;
     }
-
+    stat->acks.slots[free_slot].packet_id = packet_id;
+    stat->acks.slots[free_slot].qos = qos;
+    stat->acks.slots[free_slot].acked = false;
     return OK;
 }
 
-static int process_publish(struct mqtt_client *stat, uint8_t fixed_header_flags)
+/***** Packet processing *************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static void release_packet_data(struct mqtt_client *stat)
 {
-    int result = OK;
+    // Everything decoded from the previous packet becomes invalid, except the last received message
+    stat->diag->disconn.reason_string = NULL;
+    stat->diag->disconn.server_reference = NULL;
+    stat->diag->puback.reason_string = NULL;
+    stat->diag->pubrec.reason_string = NULL;
+    stat->diag->pubrel.reason_string = NULL;
+    stat->diag->pubcomp.reason_string = NULL;
+    stat->diag->unsuback.reason_string = NULL;
+    stat->diag->unsuback.reason_codes = NULL;
+    stat->diag->unsuback.reason_codes_count = 0;
+    arena_reset(&stat->packet_arena);
+}
+
+static void release_session_data(struct mqtt_client *stat)
+{
+    stat->connack.assigned_client_id = NULL;
+    stat->connack.reason_string = NULL;
+    stat->connack.server_reference = NULL;
+    stat->connack.response_info = NULL;
+    arena_reset(&stat->session_arena);
+}
+
+static inline void connack_default_properties(struct mqtt_client *stat)
+{
+    stat->connack.max_qos = 2;
+    stat->connack.retain_avail = true;
+    stat->connack.wildcard_sub_avail = true;
+    stat->connack.sub_id_avail = true;
+    stat->connack.shared_sub_avail = true;
+    stat->connack.server_keep_alive = stat->config->connect.keep_alive;
+    stat->connack.max_packet_size = stat->config->connect.max_packet_size;
+}
 
-    // Free allocated strings from last received packet
-    if (stat->received_publish.topic) {
-        free((void *)stat->received_publish.topic);
-        stat->received_publish.topic = NULL;
+static int process_connack(struct mqtt_client *stat)
+{
+    int result = OK;
+    stat->connack.ack_flag = unpack_byte(stat) & 0x01;
+    stat->connack.reason = unpack_byte(stat);
+    if (stat->connack.reason & 0x80) {
+        return ERROR_SERVER_DECLINED;
+    }
+    uint32_t prop_len = unpack_variable_size(stat);
+    if (stat->malformed) {
+        return ERROR_MALFORMED_PACKET;
     }
-    if (stat->received_publish.response_topic) {
-        free((void *)stat->received_publish.response_topic);
-        stat->received_publish.response_topic = NULL;
+    release_session_data(stat);
+    connack_default_properties(stat);
+    if (prop_len > 0) {
+        result = decode_properties(stat, CONNACK, prop_len);
     }
-    if (stat->received_publish.content_type) {
-        free((void *)stat->received_publish.content_type);
-        stat->received_publish.content_type = NULL;
+    if (SUCCESSFUL(result)) {
+        stat->connected = true;
+        stat->expected_ptypes |= BIT(DISCONNECT) | BIT(PUBLISH);
+        mqtt_connected(stat);
     }
+    return result;
+}
 
-    // Clear previous publish data
+/* Topic, flags, packet identifier and properties, pin is left at the payload */
+static int unpack_publish(struct mqtt_client *stat, uint8_t fixed_header_flags)
+{
+    // Clear previous publish data, it stays valid until the next PUBLISH is decoded
     memset(&stat->received_publish, 0, sizeof(stat->received_publish));
+    stat->message_available = false;
+    arena_reset(&stat->publish_arena);
 
     // Unpack topic name
-    char* topic = unpack_string(stat);
+    char* topic = unpack_string(stat, &stat->publish_arena);
     if (!topic) {
         return ERROR_MALFORMED_PACKET;
     }
 
     // Validate UTF-8 encoding of topic
     if (!is_valid_utf8(topic, strlen(topic))) {
-        free(topic);
         return ERROR_INVALID_ENCODING;
     }
 
@@ -1594,45 +1534,29 @@ static int process_publish(struct mqtt_client *stat, uint8_t fixed_header_flags)
         stat->received_publish.packet_id = unpack_word(stat);
     }
 
-    // Unpack properties length
-    uint32_t prop_len = unpack_variable_size(stat);
-
     // Process properties
-    if (prop_len > 0) {
-        result = process_publish_properties(stat, prop_len);
-        if (FAILED(result)) {
-            goto cleanup;
-        }
-    }
-
-    // Calculate payload length (remaining bytes after properties)
-    uint32_t bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-    if (bytes_consumed < stat->inp.len) {
-        stat->received_publish.payload.len = stat->inp.len - bytes_consumed;
-        stat->received_publish.payload.data = stat->pin;
-    }
+    return unpack_properties(stat, PUBLISH);
+}
 
-    // Validate payload format if indicator is set
-    if (stat->received_publish.payload_format_indicator == 1) {
-        // Payload should be UTF-8 encoded
-        if (stat->received_publish.payload.data && stat->received_publish.payload.len > 0) {
-            if (!is_valid_utf8((char*)stat->received_publish.payload.data, stat->received_publish.payload.len)) {
-                result = ERROR_INVALID_ENCODING;
-                goto cleanup;
-            }
-        }
+/* Acknowledges a received publish once its payload is complete */
+static int acknowledge_publish(struct mqtt_client *stat)
+{
+    uint8_t qos = stat->received_publish.qos;
+    if (stat->acks.manual && qos > 0) {
+        // In manual mode the application releases the acknowledgement with mqtt_ack()
+        return queue_pending_ack(stat, stat->received_publish.packet_id, qos);
     }
 
-    // Handle QoS acknowledgments
+    int result = OK;
     switch (qos) {
     case 1:
         // QoS 1 - send PUBACK
-        mqtt_puback(stat, stat->received_publish.packet_id);
+        result = mqtt_puback(stat, stat->received_publish.packet_id);
         break;
 
     case 2:
         // QoS 2 - send PUBREC
-        mqtt_pubrec(stat, stat->received_publish.packet_id);
+        result = mqtt_pubrec(stat, stat->received_publish.packet_id);
         break;
 
     default:
@@ -1640,75 +1564,118 @@ static int process_publish(struct mqtt_client *stat, uint8_t fixed_header_flags)
         break;
     }
 
-    // Set flag indicating new message is available
-    stat->message_available = true;
-    mqtt_received_publish(stat);
-
-cleanup:
-    if (FAILED(result)) {
-        // Free allocated strings on error
-        if (stat->received_publish.topic) {
-            free((void*)stat->received_publish.topic);
-            stat->received_publish.topic = NULL;
-        }
-        if (stat->received_publish.response_topic) {
-            free((void*)stat->received_publish.response_topic);
-            stat->received_publish.response_topic = NULL;
-        }
-        if (stat->received_publish.content_type) {
-            free((void*)stat->received_publish.content_type);
-            stat->received_publish.content_type = NULL;
+    // No send buffer left, e.g. in a callback of the network stack. The acknowledgement is
+    // released like a manual one and goes out with the next flush.
+    if (BASE_ERROR(result) == E_ERROR_OUT_OF_MEMORY) {
+        result = queue_pending_ack(stat, stat->received_publish.packet_id, qos);
+        if (SUCCESSFUL(result)) {
+            mqtt_ack(stat, stat->received_publish.packet_id);
         }
+        return result;
     }
-
-    return result;
+    return OK;
 }
 
-static int process_suback_properties(struct mqtt_client *stat, uint32_t prop_len)
+static int process_publish(struct mqtt_client *stat, uint8_t fixed_header_flags)
 {
-    while (prop_len > 0) {
-        uint8_t prop_id = unpack_byte(stat);
-        prop_len--;
+    int result = unpack_publish(stat, fixed_header_flags);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    // Calculate payload length (remaining bytes after properties), larger payloads are
+    // only taken in parts, see mqtt_set_receive_streaming()
+    if (unpack_remaining(stat)) {
+        uint32_t payload_len = (uint32_t)(stat->pin_end - stat->pin);
+        if (payload_len > UINT16_MAX) {
+            return ERROR_INVALID_PACKET_SIZE;
+        }
+        stat->received_publish.payload.len = (uint16_t) payload_len;
+        stat->received_publish.payload.data = stat->pin;
+    }
 
-        switch (prop_id) {
-        case MQTT_SUBACK_REASON_STRING_ID: {
-            char* reason_string = unpack_string(stat);
-            if (reason_string) {
-                prop_len -= strlen(reason_string) + 2;
-                mqtt_user_property(stat, SUBACK, "reason_string", reason_string);
-                free(reason_string);
-            } else {
-                prop_len -= 2;
+    // Validate payload format if indicator is set
+    if (stat->received_publish.payload_format_indicator == 1) {
+        // Payload should be UTF-8 encoded
+        if (stat->received_publish.payload.data && stat->received_publish.payload.len > 0) {
+            if (!is_valid_utf8((char*)stat->received_publish.payload.data, stat->received_publish.payload.len)) {
+                result = ERROR_INVALID_ENCODING;
+                return result;
             }
         }
-        break;
+    }
 
-        case MQTT_SUBACK_USER_PROPERTY_ID: {
-            char* key = unpack_string(stat);
-            char* value = unpack_string(stat);
+    // Handle QoS acknowledgments
+    result = acknowledge_publish(stat);
+    if (FAILED(result)) {
+        return result;
+    }
 
-            if (key && value) {
-                prop_len -= strlen(key) + strlen(value) + 4;
-                mqtt_user_property(stat, SUBACK, key, value);
-            } else {
-                prop_len -= 4;
-            }
+    // Set flag indicating new message is available
+    stat->message_available = true;
+    if (stat->dispatch_publish) {
+        // Handed over to the worker threads of the I/O thread mode
+        result = stat->dispatch_publish(stat);
+    } else {
+        mqtt_received_publish(stat);
+    }
 
-            free(key);
-            free(value);
-        }
-        break;
+    return result;
+}
 
-        default:
-            return ERROR_UNKNOWN_IDENTIFIER;
-        }
+/* Passes the next piece of a payload delivered in parts on, the last one completes the packet */
+static int deliver_publish_part(struct mqtt_client *stat, const uint8_t* data, uint32_t len)
+{
+    if (FAILED(stat->rx.part_result)) {
+        return OK;  // Skipped, the failure was reported with the header
+    }
+    if (len) {
+        mqtt_received_publish_part(stat, stat->rx.part_offset, data, len);
+        stat->rx.part_offset += len;
+    }
+    if (stat->rx.part_left) {
+        return OK;
     }
+    // Acknowledged once the application is done with the payload
+    mqtt_received_publish_end(stat, OK);
+    return acknowledge_publish(stat);
+}
 
-    if (prop_len < 0) {
-        return ERROR_MALFORMED_PACKET;
+/* A connection ending inside a publish delivered in parts leaves it incomplete */
+static void abort_publish_parts(struct mqtt_client *stat)
+{
+    if (stat->rx.part_left && SUCCESSFUL(stat->rx.part_result)) {
+        mqtt_received_publish_end(stat, ERROR_HOST_UNAVAILABLE);
     }
+    stat->rx.part_left = 0;
+}
 
-    return OK;
+/* Data holds the fixed and variable header of the packet, followed by the first payload bytes */
+static int begin_publish_parts(struct mqtt_client *stat, uint8_t* data, uint32_t len, uint32_t frame_len)
+{
+    release_packet_data(stat);
+    stat->pin = data;
+    stat->pin_end = data + len;
+    stat->malformed = false;
+    uint8_t fixed_header = unpack_byte(stat);
+    unpack_variable_size(stat);
+
+    int result = ERROR_UNEXPECTED_PACKET_TYPE;
+    if (TST(stat->expected_ptypes, BIT(PUBLISH))) {
+        result = unpack_publish(stat, fixed_header & 0x0f);
+        if (SUCCESSFUL(result) && stat->malformed) {
+            result = ERROR_INVALID_PACKET_SIZE; // The variable header does not fit into the first part
+        }
+    }
+    stat->rx.part_result = result;
+    stat->rx.part_offset = 0;
+    stat->rx.part_left = frame_len - len;
+    if (FAILED(result)) {
+        return result;
+    }
+    stat->received_publish.payload_size = frame_len - (uint32_t)(stat->pin - data);
+    mqtt_received_publish_begin(stat);
+    return deliver_publish_part(stat, stat->pin, (uint32_t)(stat->pin_end - stat->pin));
 }
 
 static int process_suback(struct mqtt_client *stat)
@@ -1723,17 +1690,13 @@ static int process_suback(struct mqtt_client *stat)
     }
 
     // Process properties
-    uint32_t prop_len = unpack_variable_size(stat);
-    if (prop_len > 0) {
-        result = process_suback_properties(stat, prop_len);
-        if (FAILED(result)) {
-            return result;
-        }
+    result = unpack_properties(stat, SUBACK);
+    if (FAILED(result)) {
+        return result;
     }
 
     // Process reason codes for each subscription
-    uint32_t bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-    uint32_t remaining_bytes = stat->inp.len - bytes_consumed;
+    uint32_t remaining_bytes = stat->pin_end - stat->pin;
 
     int sub_num = 0;
     for (uint32_t i = 0; i < remaining_bytes; i++) {
@@ -1768,99 +1731,23 @@ static int process_suback(struct mqtt_client *stat)
     return result;
 }
 
-static int process_disconnect_properties(struct mqtt_client *stat, uint32_t prop_len)
-{
-    while (prop_len > 0) {
-        uint8_t prop_id = unpack_byte(stat);
-        prop_len--;
-
-        switch (prop_id) {
-        case MQTT_DISC_SESSION_EXPIRY_INTERVAL_ID:
-            stat->disconn.session_expiry_interval = unpack_dword(stat);
-            prop_len -= 4;
-            break;
-
-        case MQTT_DISC_REASON_STRING_ID: {
-            char* reason_string = unpack_string(stat);
-            if (reason_string) {
-                stat->disconn.reason_string = reason_string;
-                prop_len -= strlen(reason_string) + 2;
-            } else {
-                prop_len -= 2;
-            }
-        }
-        break;
-
-        case MQTT_DISC_SERVER_REFERENCE_ID: {
-            char* server_reference = unpack_string(stat);
-            if (server_reference) {
-                stat->disconn.server_reference = server_reference;
-                prop_len -= strlen(server_reference) + 2;
-            } else {
-                prop_len -= 2;
-            }
-        }
-        break;
-
-        case MQTT_DISC_USER_PROPERTY_ID: {
-            char* key = unpack_string(stat);
-            char* value = unpack_string(stat);
-
-            if (key && value) {
-                prop_len -= strlen(key) + strlen(value) + 4;
-                mqtt_user_property(stat, DISCONNECT, key, value);
-            } else {
-                prop_len -= 4;
-            }
-
-            free(key);
-            free(value);
-        }
-        break;
-
-        default:
-            return ERROR_UNKNOWN_IDENTIFIER;
-        }
-    }
-
-    if (prop_len < 0) {
-        return ERROR_MALFORMED_PACKET;
-    }
-
-    return OK;
-}
-
 static int process_disconnect(struct mqtt_client *stat)
 {
     int result = OK;
 
-    // Free previously allocated strings
-    if (stat->disconn.reason_string) {
-        free((void*)stat->disconn.reason_string);
-        stat->disconn.reason_string = NULL;
-    }
-    if (stat->disconn.server_reference) {
-        free((void*)stat->disconn.server_reference);
-        stat->disconn.server_reference = NULL;
-    }
-
     // Clear disconnect structure
-    memset(&stat->disconn, 0, sizeof(stat->disconn));
+    memset(&stat->diag->disconn, 0, sizeof(stat->diag->disconn));
 
-    // Unpack reason code
-    stat->disconn.reason_code = unpack_byte(stat);
+    // Unpack reason code, a DISCONNECT without one means normal disconnection
+    if (unpack_remaining(stat)) {
+        stat->diag->disconn.reason_code = unpack_byte(stat);
+    }
 
     // Check if there are properties to process
-    uint32_t bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-    if (bytes_consumed < stat->inp.len) {
-        // Process properties
-        uint32_t prop_len = unpack_variable_size(stat);
-
-        if (prop_len > 0) {
-            result = process_disconnect_properties(stat, prop_len);
-            if (FAILED(result)) {
-                goto cleanup;
-            }
+    if (unpack_remaining(stat)) {
+        result = unpack_properties(stat, DISCONNECT);
+        if (FAILED(result)) {
+            return result;
         }
     }
 
@@ -1869,123 +1756,54 @@ static int process_disconnect(struct mqtt_client *stat)
     stat->expected_ptypes = BIT(PINGREQ);
 
     // Call user callback
-    mqtt_received_disconnect(stat, (mqtt_reason_code)stat->disconn.reason_code);
+    mqtt_received_disconnect(stat, (mqtt_reason_code)stat->diag->disconn.reason_code);
 
     // Close network connection
     if (stat->net.close_conn) {
         stat->net.close_conn(stat);
     }
 
-cleanup:
-    if (FAILED(result)) {
-        // Free allocated strings on error
-        if (stat->disconn.reason_string) {
-            free((void*)stat->disconn.reason_string);
-            stat->disconn.reason_string = NULL;
-        }
-        if (stat->disconn.server_reference) {
-            free((void*)stat->disconn.server_reference);
-            stat->disconn.server_reference = NULL;
-        }
-    }
-
     return result;
 }
 
-static int process_puback_properties(struct mqtt_client *stat, uint32_t prop_len)
+static int process_puback(struct mqtt_client *stat)
 {
-    while (prop_len > 0) {
-        uint8_t prop_id = unpack_byte(stat);
-        prop_len--;
+    int result = OK;
 
-        switch (prop_id) {
-        case MQTT_PUBACK_REASON_STRING_ID: {
-            char* reason_string = unpack_string(stat);
-            if (reason_string) {
-                stat->puback.reason_string = reason_string;
-                prop_len -= strlen(reason_string) + 2;
-            } else {
-                prop_len -= 2;
-            }
-        }
-        break;
+    // Clear PUBACK structure
+    memset(&stat->diag->puback, 0, sizeof(stat->diag->puback));
 
-        case MQTT_USER_PROPERTY_ID: {
-            char* key = unpack_string(stat);
-            char* value = unpack_string(stat);
-
-            if (key && value) {
-                prop_len -= strlen(key) + strlen(value) + 4;
-                mqtt_user_property(stat, PUBACK, key, value);
-            } else {
-                prop_len -= 4;
-            }
-
-            free(key);
-            free(value);
-        }
-        break;
-
-        default:
-            return ERROR_UNKNOWN_IDENTIFIER;
-        }
-    }
-
-    if (prop_len < 0) {
+    // Unpack packet identifier
+    stat->diag->puback.packet_id = unpack_word(stat);
+    if (stat->malformed) {
         return ERROR_MALFORMED_PACKET;
     }
 
-    return OK;
-}
-
-static int process_puback(struct mqtt_client *stat)
-{
-    int result = OK;
-
-    // Free previously allocated reason string
-    if (stat->puback.reason_string) {
-        free((void*)stat->puback.reason_string);
-        stat->puback.reason_string = NULL;
-    }
-
-    // Clear PUBACK structure
-    memset(&stat->puback, 0, sizeof(stat->puback));
-
-    // Unpack packet identifier
-    stat->puback.packet_id = unpack_word(stat);
-
     // Verify this packet ID was expected
-    mqtt_packet_type expected = get_expected_packet_answer(stat, stat->puback.packet_id);
+    mqtt_packet_type expected = get_expected_packet_answer(stat, stat->diag->puback.packet_id);
     if (expected != PUBACK) {
         return ERROR_UNEXPECTED_PACKET_TYPE;
     }
 
     // Check if there's a reason code and properties
-    uint32_t bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-    if (bytes_consumed < stat->inp.len) {
+    if (unpack_remaining(stat)) {
         // Unpack reason code
-        stat->puback.reason_code = unpack_byte(stat);
+        stat->diag->puback.reason_code = unpack_byte(stat);
 
         // Check if there are properties
-        bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-        if (bytes_consumed < stat->inp.len) {
-            // Process properties
-            uint32_t prop_len = unpack_variable_size(stat);
-
-            if (prop_len > 0) {
-                result = process_puback_properties(stat, prop_len);
-                if (FAILED(result)) {
-                    goto cleanup;
-                }
+        if (unpack_remaining(stat)) {
+            result = unpack_properties(stat, PUBACK);
+            if (FAILED(result)) {
+                return result;
             }
         }
     } else {
         // No reason code or properties - assume success
-        stat->puback.reason_code = 0;
+        stat->diag->puback.reason_code = 0;
     }
 
     // Free the packet slot
-    free_packet_slot(stat, stat->puback.packet_id);
+    free_packet_slot(stat, stat->diag->puback.packet_id);
 
     // Remove PUBACK from expected packet types if no more pending
     if (!await_for_packet(stat, PUBACK)) {
@@ -1993,115 +1811,50 @@ static int process_puback(struct mqtt_client *stat)
     }
 
     // Call user callback
-    mqtt_publish_acknowledged(stat, stat->puback.packet_id, stat->puback.reason_code);
-
-cleanup:
-    if (FAILED(result)) {
-        // Free allocated strings on error
-        if (stat->puback.reason_string) {
-            free((void*)stat->puback.reason_string);
-            stat->puback.reason_string = NULL;
-        }
-    }
+    mqtt_publish_acknowledged(stat, stat->diag->puback.packet_id, stat->diag->puback.reason_code);
 
     return result;
 }
 
-static int process_pubrec_properties(struct mqtt_client *stat, uint32_t prop_len)
-{
-    while (prop_len > 0) {
-        uint8_t prop_id = unpack_byte(stat);
-        prop_len--;
-
-        switch (prop_id) {
-        case MQTT_PUBREC_REASON_STRING_ID: {
-            char* reason_string = unpack_string(stat);
-            if (reason_string) {
-                stat->pubrec.reason_string = reason_string;
-                prop_len -= strlen(reason_string) + 2;
-            } else {
-                prop_len -= 2;
-            }
-        }
-        break;
-
-        case MQTT_USER_PROPERTY_ID: {
-            char* key = unpack_string(stat);
-            char* value = unpack_string(stat);
-
-            if (key && value) {
-                prop_len -= strlen(key) + strlen(value) + 4;
-                mqtt_user_property(stat, PUBREC, key, value);
-            } else {
-                prop_len -= 4;
-            }
-
-            free(key);
-            free(value);
-        }
-        break;
-
-        default:
-            return ERROR_UNKNOWN_IDENTIFIER;
-        }
-    }
-
-    if (prop_len < 0) {
-        return ERROR_MALFORMED_PACKET;
-    }
-
-    return OK;
-}
-
 static int process_pubrec(struct mqtt_client *stat)
 {
     int result = OK;
 
-    // Free previously allocated reason string
-    if (stat->pubrec.reason_string) {
-        free((void*)stat->pubrec.reason_string);
-        stat->pubrec.reason_string = NULL;
-    }
-
     // Clear PUBREC structure
-    memset(&stat->pubrec, 0, sizeof(stat->pubrec));
+    memset(&stat->diag->pubrec, 0, sizeof(stat->diag->pubrec));
 
     // Unpack packet identifier
-    stat->pubrec.packet_id = unpack_word(stat);
+    stat->diag->pubrec.packet_id = unpack_word(stat);
+    if (stat->malformed) {
+        return ERROR_MALFORMED_PACKET;
+    }
 
     // Verify this packet ID was expected
-    mqtt_packet_type expected = get_expected_packet_answer(stat, stat->pubrec.packet_id);
+    mqtt_packet_type expected = get_expected_packet_answer(stat, stat->diag->pubrec.packet_id);
     if (expected != PUBREC) {
         return ERROR_UNEXPECTED_PACKET_TYPE;
     }
 
     // Check if there's a reason code and properties
-    uint32_t bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-    if (bytes_consumed < stat->inp.len) {
+    if (unpack_remaining(stat)) {
         // Unpack reason code
-        stat->pubrec.reason_code = unpack_byte(stat);
+        stat->diag->pubrec.reason_code = unpack_byte(stat);
 
         // Check if there are properties
-        bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-        if (bytes_consumed < stat->inp.len) {
-            // Process properties
-            uint32_t prop_len = unpack_variable_size(stat);
-
-            if (prop_len > 0) {
-                result = process_pubrec_properties(stat, prop_len);
-                if (FAILED(result)) {
-                    goto cleanup;
-                }
+        if (unpack_remaining(stat)) {
+            result = unpack_properties(stat, PUBREC);
+            if (FAILED(result)) {
+                return result;
             }
         }
     } else {
         // No reason code or properties - assume success
-        stat->pubrec.reason_code = 0;
+        stat->diag->pubrec.reason_code = 0;
     }
 
     // Update packet slot to expect PUBCOMP instead of PUBREC
     for (int i = 0; i < MQTT_RECEIVE_MAXIMUM; ++i) {
-        if (stat->pending[i].packet_id == stat->pubrec.packet_id) {
+        if (stat->pending[i].packet_id == stat->diag->pubrec.packet_id) {
             stat->pending[i].await_packet_type = PUBCOMP;
             break;
         }
@@ -2116,114 +1869,49 @@ static int process_pubrec(struct mqtt_client *stat)
     stat->expected_ptypes |= BIT(PUBCOMP);
 
     // Send PUBREL in response to PUBREC
-    result = mqtt_pubrel(stat, stat->pubrec.packet_id);
-
-cleanup:
-    if (FAILED(result)) {
-        // Free allocated strings on error
-        if (stat->pubrec.reason_string) {
-            free((void*)stat->pubrec.reason_string);
-            stat->pubrec.reason_string = NULL;
-        }
-    }
+    result = mqtt_pubrel(stat, stat->diag->pubrec.packet_id);
 
     return result;
 }
 
-static int process_pubrel_properties(struct mqtt_client *stat, uint32_t prop_len)
-{
-    while (prop_len > 0) {
-        uint8_t prop_id = unpack_byte(stat);
-        prop_len--;
-
-        switch (prop_id) {
-        case MQTT_PUBREL_REASON_STRING_ID: {
-            char* reason_string = unpack_string(stat);
-            if (reason_string) {
-                stat->pubrel.reason_string = reason_string;
-                prop_len -= strlen(reason_string) + 2;
-            } else {
-                prop_len -= 2;
-            }
-        }
-        break;
-
-        case MQTT_USER_PROPERTY_ID: {
-            char* key = unpack_string(stat);
-            char* value = unpack_string(stat);
-
-            if (key && value) {
-                prop_len -= strlen(key) + strlen(value) + 4;
-                mqtt_user_property(stat, PUBREL, key, value);
-            } else {
-                prop_len -= 4;
-            }
-
-            free(key);
-            free(value);
-        }
-        break;
-
-        default:
-            return ERROR_UNKNOWN_IDENTIFIER;
-        }
-    }
-
-    if (prop_len < 0) {
-        return ERROR_MALFORMED_PACKET;
-    }
-
-    return OK;
-}
-
 static int process_pubrel(struct mqtt_client *stat)
 {
     int result = OK;
 
-    // Free previously allocated reason string
-    if (stat->pubrel.reason_string) {
-        free((void*)stat->pubrel.reason_string);
-        stat->pubrel.reason_string = NULL;
-    }
-
     // Clear PUBREL structure
-    memset(&stat->pubrel, 0, sizeof(stat->pubrel));
+    memset(&stat->diag->pubrel, 0, sizeof(stat->diag->pubrel));
 
     // Unpack packet identifier
-    stat->pubrel.packet_id = unpack_word(stat);
+    stat->diag->pubrel.packet_id = unpack_word(stat);
+    if (stat->malformed) {
+        return ERROR_MALFORMED_PACKET;
+    }
 
     // Verify this packet ID was expected
-    mqtt_packet_type expected = get_expected_packet_answer(stat, stat->pubrel.packet_id);
+    mqtt_packet_type expected = get_expected_packet_answer(stat, stat->diag->pubrel.packet_id);
     if (expected != PUBREL) {
         return ERROR_UNEXPECTED_PACKET_TYPE;
     }
 
     // Check if there's a reason code and properties
-    uint32_t bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-    if (bytes_consumed < stat->inp.len) {
+    if (unpack_remaining(stat)) {
         // Unpack reason code
-        stat->pubrel.reason_code = unpack_byte(stat);
+        stat->diag->pubrel.reason_code = unpack_byte(stat);
 
         // Check if there are properties
-        bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-        if (bytes_consumed < stat->inp.len) {
-            // Process properties
-            uint32_t prop_len = unpack_variable_size(stat);
-
-            if (prop_len > 0) {
-                result = process_pubrel_properties(stat, prop_len);
-                if (FAILED(result)) {
-                    goto cleanup;
-                }
+        if (unpack_remaining(stat)) {
+            result = unpack_properties(stat, PUBREL);
+            if (FAILED(result)) {
+                return result;
             }
         }
     } else {
         // No reason code or properties - assume success
-        stat->pubrel.reason_code = 0;
+        stat->diag->pubrel.reason_code = 0;
     }
 
     // Free the packet slot
-    free_packet_slot(stat, stat->pubrel.packet_id);
+    free_packet_slot(stat, stat->diag->pubrel.packet_id);
 
     // Remove PUBREL from expected packet types if no more pending
     if (!await_for_packet(stat, PUBREL)) {
@@ -2231,114 +1919,49 @@ static int process_pubrel(struct mqtt_client *stat)
     }
 
     // Send PUBCOMP in response to PUBREL
-    result = mqtt_pubcomp(stat, stat->pubrel.packet_id);
-
-cleanup:
-    if (FAILED(result)) {
-        // Free allocated strings on error
-        if (stat->pubrel.reason_string) {
-            free((void*)stat->pubrel.reason_string);
-            stat->pubrel.reason_string = NULL;
-        }
-    }
+    result = mqtt_pubcomp(stat, stat->diag->pubrel.packet_id);
 
     return result;
 }
 
-static int process_pubcomp_properties(struct mqtt_client *stat, uint32_t prop_len)
-{
-    while (prop_len > 0) {
-        uint8_t prop_id = unpack_byte(stat);
-        prop_len--;
-
-        switch (prop_id) {
-        case MQTT_PUBCOMP_REASON_STRING_ID: {
-            char* reason_string = unpack_string(stat);
-            if (reason_string) {
-                stat->pubcomp.reason_string = reason_string;
-                prop_len -= strlen(reason_string) + 2;
-            } else {
-                prop_len -= 2;
-            }
-        }
-        break;
-
-        case MQTT_USER_PROPERTY_ID: {
-            char* key = unpack_string(stat);
-            char* value = unpack_string(stat);
-
-            if (key && value) {
-                prop_len -= strlen(key) + strlen(value) + 4;
-                mqtt_user_property(stat, PUBCOMP, key, value);
-            } else {
-                prop_len -= 4;
-            }
-
-            free(key);
-            free(value);
-        }
-        break;
-
-        default:
-            return ERROR_UNKNOWN_IDENTIFIER;
-        }
-    }
-
-    if (prop_len < 0) {
-        return ERROR_MALFORMED_PACKET;
-    }
-
-    return OK;
-}
-
 static int process_pubcomp(struct mqtt_client *stat)
 {
     int result = OK;
 
-    // Free previously allocated reason string
-    if (stat->pubcomp.reason_string) {
-        free((void*)stat->pubcomp.reason_string);
-        stat->pubcomp.reason_string = NULL;
-    }
-
     // Clear PUBCOMP structure
-    memset(&stat->pubcomp, 0, sizeof(stat->pubcomp));
+    memset(&stat->diag->pubcomp, 0, sizeof(stat->diag->pubcomp));
 
     // Unpack packet identifier
-    stat->pubcomp.packet_id = unpack_word(stat);
+    stat->diag->pubcomp.packet_id = unpack_word(stat);
+    if (stat->malformed) {
+        return ERROR_MALFORMED_PACKET;
+    }
 
     // Verify this packet ID was expected
-    mqtt_packet_type expected = get_expected_packet_answer(stat, stat->pubcomp.packet_id);
+    mqtt_packet_type expected = get_expected_packet_answer(stat, stat->diag->pubcomp.packet_id);
     if (expected != PUBCOMP) {
         return ERROR_UNEXPECTED_PACKET_TYPE;
     }
 
     // Check if there's a reason code and properties
-    uint32_t bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-    if (bytes_consumed < stat->inp.len) {
+    if (unpack_remaining(stat)) {
         // Unpack reason code
-        stat->pubcomp.reason_code = unpack_byte(stat);
+        stat->diag->pubcomp.reason_code = unpack_byte(stat);
 
         // Check if there are properties
-        bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-        if (bytes_consumed < stat->inp.len) {
-            // Process properties
-            uint32_t prop_len = unpack_variable_size(stat);
-
-            if (prop_len > 0) {
-                result = process_pubcomp_properties(stat, prop_len);
-                if (FAILED(result)) {
-                    goto cleanup;
-                }
+        if (unpack_remaining(stat)) {
+            result = unpack_properties(stat, PUBCOMP);
+            if (FAILED(result)) {
+                return result;
             }
         }
     } else {
         // No reason code or properties - assume success
-        stat->pubcomp.reason_code = 0;
+        stat->diag->pubcomp.reason_code = 0;
     }
 
     // Free the packet slot - QoS 2 flow is now complete
-    free_packet_slot(stat, stat->pubcomp.packet_id);
+    free_packet_slot(stat, stat->diag->pubcomp.packet_id);
 
     // Remove PUBCOMP from expected packet types if no more pending
     if (!await_for_packet(stat, PUBCOMP)) {
@@ -2346,87 +1969,20 @@ static int process_pubcomp(struct mqtt_client *stat)
     }
 
     // Call user callback to notify QoS 2 publish is complete
-    mqtt_publish_completed(stat, stat->pubcomp.packet_id, stat->pubcomp.reason_code);
-
-cleanup:
-    if (FAILED(result)) {
-        // Free allocated strings on error
-        if (stat->pubcomp.reason_string) {
-            free((void*)stat->pubcomp.reason_string);
-            stat->pubcomp.reason_string = NULL;
-        }
-    }
+    mqtt_publish_completed(stat, stat->diag->pubcomp.packet_id, stat->diag->pubcomp.reason_code);
 
     return result;
 }
 
-static int process_unsuback_properties(struct mqtt_client *stat, uint32_t prop_len)
-{
-    while (prop_len > 0) {
-        uint8_t prop_id = unpack_byte(stat);
-        prop_len--;
-
-        switch (prop_id) {
-        case MQTT_UNSUBACK_REASON_STRING_ID: {
-            char* reason_string = unpack_string(stat);
-            if (reason_string) {
-                stat->unsuback.reason_string = reason_string;
-                prop_len -= strlen(reason_string) + 2;
-            } else {
-                prop_len -= 2;
-            }
-        }
-        break;
-
-        case MQTT_UNSUBACK_USER_PROPERTY_ID: {
-            char* key = unpack_string(stat);
-            char* value = unpack_string(stat);
-
-            if (key && value) {
-                prop_len -= strlen(key) + strlen(value) + 4;
-                mqtt_user_property(stat, UNSUBACK, key, value);
-            } else {
-                prop_len -= 4;
-            }
-
-            free(key);
-            free(value);
-        }
-        break;
-
-        default:
-            return ERROR_UNKNOWN_IDENTIFIER;
-        }
-    }
-
-    if (prop_len < 0) {
-        return ERROR_MALFORMED_PACKET;
-    }
-
-    return OK;
-}
-
 static int process_unsuback(struct mqtt_client *stat)
 {
     int result = OK;
 
-    // Free previously allocated reason string
-    if (stat->unsuback.reason_string) {
-        free((void*)stat->unsuback.reason_string);
-        stat->unsuback.reason_string = NULL;
-    }
-
-    // Free previously allocated reason codes
-    if (stat->unsuback.reason_codes) {
-        free(stat->unsuback.reason_codes);
-        stat->unsuback.reason_codes = NULL;
-    }
-
     // Clear UNSUBACK structure
-    memset(&stat->unsuback, 0, sizeof(stat->unsuback));
+    memset(&stat->diag->unsuback, 0, sizeof(stat->diag->unsuback));
 
     uint16_t packet_id = unpack_word(stat);
-    stat->unsuback.packet_id = packet_id;
+    stat->diag->unsuback.packet_id = packet_id;
 
     // Verify this packet ID was expected
     mqtt_packet_type expected = get_expected_packet_answer(stat, packet_id);
@@ -2435,28 +1991,24 @@ static int process_unsuback(struct mqtt_client *stat)
     }
 
     // Process properties
-    uint32_t prop_len = unpack_variable_size(stat);
-    if (prop_len > 0) {
-        result = process_unsuback_properties(stat, prop_len);
-        if (FAILED(result)) {
-            return result;
-        }
+    result = unpack_properties(stat, UNSUBACK);
+    if (FAILED(result)) {
+        return result;
     }
 
     // Process reason codes for each unsubscription
-    uint32_t bytes_consumed = stat->pin - (uint8_t*)stat->inp.payload;
-    uint32_t remaining_bytes = stat->inp.len - bytes_consumed;
+    uint32_t remaining_bytes = stat->pin_end - stat->pin;
 
     if (remaining_bytes > 0) {
-        stat->unsuback.reason_codes = malloc(remaining_bytes);
-        if (!stat->unsuback.reason_codes) {
+        stat->diag->unsuback.reason_codes = arena_alloc(&stat->packet_arena, remaining_bytes);
+        if (!stat->diag->unsuback.reason_codes) {
             return ERROR_OUT_OF_MEMORY;
         }
 
-        stat->unsuback.reason_codes_count = remaining_bytes;
+        stat->diag->unsuback.reason_codes_count = remaining_bytes;
 
         for (uint32_t i = 0; i < remaining_bytes; i++) {
-            stat->unsuback.reason_codes[i] = unpack_byte(stat);
+            stat->diag->unsuback.reason_codes[i] = unpack_byte(stat);
         }
     }
 
@@ -2507,13 +2059,64 @@ static int process_packet(struct mqtt_client *stat, mqtt_packet_type type,
 /*                                                                                               */
 /*************************************************************************************************/
 
+#ifdef MQTT_STATIC_MEMORY
+// Without heap every dynamic allocation fails, features depending on it report out of memory
+static void* default_alloc(void* context, size_t size)
+{
+    return NULL;
+}
+
+static void* default_realloc(void* context, void* ptr, size_t size)
+{
+    return NULL;
+}
+
+static void default_free(void* context, void* ptr)
+{
+}
+#else
+static void* default_alloc(void* context, size_t size)
+{
+    return malloc(size);
+}
+
+static void* default_realloc(void* context, void* ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+static void default_free(void* context, void* ptr)
+{
+    free(ptr);
+}
+#endif
+
+static struct mqtt_allocator default_allocator = {
+    .alloc = default_alloc,
+    .realloc = default_realloc,
+    .free = default_free,
+    .context = NULL
+};
+
+void mqtt_set_default_allocator(const struct mqtt_allocator* allocator)
+{
+    if (allocator) {
+        default_allocator = *allocator;
+    } else {
+        default_allocator.alloc = default_alloc;
+        default_allocator.realloc = default_realloc;
+        default_allocator.free = default_free;
+        default_allocator.context = NULL;
+    }
+}
+
 char* mqtt_blob_to_string(const struct mqtt_blob* blob)
 {
     if (!blob || !blob->data || blob->len == 0) {
         return NULL;
     }
 
-    char* str = malloc(blob->len + 1);
+    char* str = default_allocator.alloc(default_allocator.context, blob->len + 1);
     if (!str) {
         return NULL;
     }
@@ -2524,17 +2127,39 @@ char* mqtt_blob_to_string(const struct mqtt_blob* blob)
     return str;
 }
 
+static int get_frame_length(const uint8_t* data, uint32_t len, uint32_t* frame_len)
+{
+    uint32_t value = 0;
+    for (uint32_t i = 1; i < len && i <= 4; ++i) {
+        value |= (uint32_t)(data[i] & 0x7F) << (7 * (i - 1));
+        if (!(data[i] & 0x80)) {
+            *frame_len = value + i + 1;
+            return OK;
+        }
+    }
+    if (len > 4) {
+        return ERROR_MALFORMED_PACKET; // More than four remaining length bytes
+    }
+    return STATUS_PENDING;
+}
+
 int mqtt_process_packet(struct mqtt_client *stat, void* data, uint32_t len)
 {
     if (data && len) {
         stat->inp.len = len;
         stat->inp.payload = data;
     }
+    release_packet_data(stat);
     stat->pin = (uint8_t*) stat->inp.payload;
+    stat->pin_end = stat->pin + stat->inp.len;
+    stat->malformed = false;
     uint8_t fixed_header = unpack_byte(stat);
     mqtt_packet_type type = (mqtt_packet_type) fixed_header >> 4;
     uint32_t remaining_len = unpack_variable_size(stat);
-    if (remaining_len == (stat->inp.len - get_variable_size_byte_count(remaining_len) - 1)) {
+    if (stat->malformed) {
+        return ERROR_MALFORMED_PACKET;
+    }
+    if (remaining_len == (uint32_t)(stat->pin_end - stat->pin)) {
         if (TST(stat->expected_ptypes, BIT(type))) {
             return process_packet(stat, type, fixed_header & 0x0f);
         } else {
@@ -2545,21 +2170,139 @@ int mqtt_process_packet(struct mqtt_client *stat, void* data, uint32_t len)
     }
 }
 
+/* Large publish packets are not reassembled, the first part has to hold their variable header */
+static inline bool deliver_in_parts(const struct mqtt_client *stat, const uint8_t* data, uint32_t frame_len)
+{
+    return stat->rx.part_size && frame_len > stat->rx.part_size && (data[0] >> 4) == PUBLISH;
+}
+
+int mqtt_process_stream(struct mqtt_client *stat, void* data, uint32_t len)
+{
+    uint8_t* p = (uint8_t*) data;
+    uint32_t frame_len = 0;
+    int result = OK;
+
+    if (!stat || (!data && len)) {
+        return ERROR_NULL_REFERENCE;
+    }
+
+    while (len > 0) {
+        int status;
+        if (stat->rx.part_left) {
+            // The payload of a publish delivered in parts is passed on where it was received
+            uint32_t take = MIN(len, stat->rx.part_left);
+            stat->rx.part_left -= take;
+            int part_result = deliver_publish_part(stat, p, take);
+            if (FAILED(part_result) && SUCCESSFUL(result)) {
+                result = part_result;
+            }
+            p += take;
+            len -= take;
+            continue;
+        }
+
+        if (!stat->rx.len) {
+            // Complete packets are processed in place
+            status = get_frame_length(p, len, &frame_len);
+            if (status == OK && frame_len <= len) {
+                int packet_result = deliver_in_parts(stat, p, frame_len) ?
+                                    begin_publish_parts(stat, p, frame_len, frame_len) :
+                                    mqtt_process_packet(stat, p, frame_len);
+                if (FAILED(packet_result) && SUCCESSFUL(result)) {
+                    result = packet_result;
+                }
+                p += frame_len;
+                len -= frame_len;
+                continue;
+            }
+        } else {
+            status = get_frame_length(stat->rx.buffer, stat->rx.len, &frame_len);
+        }
+
+        // Packets split across reads are reassembled, the fixed header byte by byte.
+        // Of a publish delivered in parts only the first part is.
+        const uint8_t* first = stat->rx.len ? stat->rx.buffer : p;
+        bool in_parts = (status == OK) && deliver_in_parts(stat, first, frame_len);
+
+        // Packets reassembled as a whole are always limited, the announced size applies to all
+        uint32_t limit = stat->config->connect.max_packet_size;
+        if (!limit && !in_parts) {
+            limit = MQTT_MAX_PACKET_SIZE;
+        }
+        if (FAILED(status) || (status == OK && limit && frame_len > limit)) {
+            // The stream cannot be resynchronized after a broken fixed header
+            stat->rx.len = 0;
+            return FAILED(status) ? status : ERROR_INVALID_PACKET_SIZE;
+        }
+
+        uint32_t part_len = in_parts ? stat->rx.part_size : frame_len;
+        uint32_t take = (status == OK) ? MIN(len, part_len - stat->rx.len) : 1;
+        uint32_t required = stat->rx.len + take;
+        if (required > stat->rx.size) {
+#ifdef MQTT_STATIC_MEMORY
+            if ((status == OK ? part_len : required) > sizeof(stat->storage.packet)) {
+                stat->rx.len = 0;
+                return ERROR_INVALID_PACKET_SIZE;
+            }
+            stat->rx.buffer = stat->storage.packet;
+            stat->rx.size = sizeof(stat->storage.packet);
+#else
+            // Grown with the data that actually arrived, not to the size the peer declares
+            uint32_t size = MAX(required, stat->rx.size * 2);
+            if (status == OK) {
+                size = MIN(size, part_len);
+            }
+            uint8_t* buffer = mqtt_realloc(stat, stat->rx.buffer, size);
+            if (!buffer) {
+                stat->rx.len = 0;
+                return ERROR_OUT_OF_MEMORY;
+            }
+            stat->rx.buffer = buffer;
+            stat->rx.size = size;
+#endif
+        }
+        memcpy(stat->rx.buffer + stat->rx.len, p, take);
+        stat->rx.len += take;
+        p += take;
+        len -= take;
+
+        if (status == OK && stat->rx.len == part_len) {
+            stat->rx.len = 0;
+            int packet_result = (part_len < frame_len) ?
+                                begin_publish_parts(stat, stat->rx.buffer, part_len, frame_len) :
+                                mqtt_process_packet(stat, stat->rx.buffer, frame_len);
+            if (FAILED(packet_result) && SUCCESSFUL(result)) {
+                result = packet_result;
+            }
+        }
+    }
+
+    return result;
+}
+
 int mqtt_poll(struct mqtt_client *stat)
 {
-    int result = STATUS_PASSED;
+    // Acknowledgements and packets queued since the last poll cycle go out before we wait for data
+    int result = flush_outbound(stat);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    result = STATUS_PASSED;
     if (stat->net.alloc_recv_buf && stat->net.recv && stat->net.free_recv_buf) {
-        stat->net.alloc_recv_buf(stat, &stat->inp,
-                                 stat->connack.max_packet_size);
-        while (1) {
-            result = stat->net.recv(stat, &stat->inp);
-            if (stat->inp.len && !result) {
-                return mqtt_process_packet(stat, NULL, 0);
-            } else {
-                break;
+        // The receive buffer is kept, so received payloads stay valid until the next poll
+        if (!stat->rx.recv.payload) {
+            result = stat->net.alloc_recv_buf(stat, &stat->rx.recv, 0);
+            if (FAILED(result)) {
+                return result;
             }
+            stat->rx.recv_size = stat->rx.recv.len;
+        }
+        stat->rx.recv.len = stat->rx.recv_size;
+        result = stat->net.recv(stat, &stat->rx.recv);
+        if (result == STATUS_SUCCESS && stat->rx.recv.len) {
+            result = mqtt_process_stream(stat, stat->rx.recv.payload, stat->rx.recv.len);
         }
-        stat->net.free_recv_buf(stat, &stat->inp);
     }
     return result;
 }
@@ -2570,308 +2313,910 @@ void mqtt_free_client_strings(struct mqtt_client* stat)
         return;
     }
 
-    // Free CONNACK allocated strings
-    if (stat->connack.assigned_client_id) {
-        free(stat->connack.assigned_client_id);
-        stat->connack.assigned_client_id = NULL;
-    }
-    if (stat->connack.reason_string) {
-        free(stat->connack.reason_string);
-        stat->connack.reason_string = NULL;
-    }
-    if (stat->connack.server_reference) {
-        free(stat->connack.server_reference);
-        stat->connack.server_reference = NULL;
-    }
-    if (stat->connack.response_info) {
-        free(stat->connack.response_info);
-        stat->connack.response_info = NULL;
+    // Decoded strings live in the arenas, drop the references and the memory
+    release_packet_data(stat);
+    release_session_data(stat);
+    memset(&stat->received_publish, 0, sizeof(stat->received_publish));
+    stat->message_available = false;
+    arena_free(&stat->packet_arena);
+    arena_free(&stat->publish_arena);
+    arena_free(&stat->session_arena);
+
+#ifdef MQTT_STATIC_MEMORY
+    // Client id and broker address are kept in the client storage
+    stat->config->connect.client_id = NULL;
+    stat->broker_addr = NULL;
+#else
+    // Free CONNECT allocated strings (client_id from get_unique_client_id)
+    if (stat->config->connect.client_id) {
+        mqtt_free(stat, (void*)stat->config->connect.client_id);
+        stat->config->connect.client_id = NULL;
     }
 
-    // Free DISCONNECT allocated strings
-    if (stat->disconn.reason_string) {
-        free((void*)stat->disconn.reason_string);
-        stat->disconn.reason_string = NULL;
+    // Free the broker address
+    if (stat->broker_addr) {
+        mqtt_free(stat, stat->broker_addr);
+        stat->broker_addr = NULL;
     }
-    if (stat->disconn.server_reference) {
-        free((void*)stat->disconn.server_reference);
-        stat->disconn.server_reference = NULL;
+#endif
+}
+
+static int init_client(struct mqtt_client* stat, const char* broker_addr, const struct mqtt_allocator* allocator,
+                       const struct mqtt_transport* transport)
+{
+    memset(stat, 0, sizeof(struct mqtt_client));
+    stat->allocator = *allocator;
+    build_received_index();
+    if (!transport) {
+        // Without a descriptor the scheme of the address selects the transport
+        transport = transport_select(&broker_addr);
+        if (!transport) {
+            return ERROR_INVALID_ARGUMENT;
+        }
+    } else {
+        broker_addr = transport_strip_scheme(broker_addr);
+    }
+    if (!transport->attach) {
+        return ERROR_NULL_REFERENCE;
+    }
+#ifdef MQTT_STATIC_MEMORY
+    stat->config = &stat->storage.config;
+    stat->diag = &stat->storage.diag;
+    if (!broker_addr || strlen(broker_addr) >= sizeof(stat->storage.broker_addr)) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+    strcpy(stat->storage.broker_addr, broker_addr);
+    stat->broker_addr = stat->storage.broker_addr;
+    arena_init_fixed(&stat->packet_arena, stat->storage.packet_strings, sizeof(stat->storage.packet_strings));
+    arena_init_fixed(&stat->publish_arena, stat->storage.publish_strings, sizeof(stat->storage.publish_strings));
+    arena_init_fixed(&stat->session_arena, stat->storage.session_strings, sizeof(stat->storage.session_strings));
+    // Tell the broker not to send packets the reassembly buffer cannot hold
+    stat->config->connect.max_packet_size = sizeof(stat->storage.packet);
+#else
+    // Configuration and diagnostics are rarely used, they are kept out of the client structure
+    stat->config = mqtt_calloc(stat, sizeof(struct mqtt_client_config));
+    stat->diag = mqtt_calloc(stat, sizeof(struct mqtt_client_diag));
+    if (!stat->config || !stat->diag) {
+        mqtt_free(stat, stat->config);
+        mqtt_free(stat, stat->diag);
+        return ERROR_OUT_OF_MEMORY;
+    }
+    arena_init(&stat->packet_arena, &stat->allocator);
+    arena_init(&stat->publish_arena, &stat->allocator);
+    arena_init(&stat->session_arena, &stat->allocator);
+    stat->broker_addr = string_copy(stat, broker_addr);
+    // Tell the broker not to send packets above the receive limit
+    stat->config->connect.max_packet_size = MQTT_MAX_PACKET_SIZE;
+#endif
+    int result = transport->attach(stat, transport->context);
+    if (FAILED(result)) {
+        mqtt_deinit_client(stat);
+        return result;
+    }
+    assert(stat->net.alloc_send_buf);
+    assert(stat->net.free_send_buf);
+    assert(stat->net.send);
+    assert(stat->net.open_conn);
+    assert(stat->net.close_conn);
+    stat->expected_ptypes = BIT(PINGREQ);
+    stat->rx.part_size = MQTT_PUBLISH_PART_SIZE;
+    return OK;
+}
+
+int mqtt_init_client(struct mqtt_client* stat, const char* broker_addr)
+{
+    if (!stat) {
+        return ERROR_NULL_REFERENCE;
+    }
+    return init_client(stat, broker_addr, &default_allocator, NULL);
+}
+
+int mqtt_init_client_transport(struct mqtt_client* stat, const char* broker_addr, const struct mqtt_transport* transport)
+{
+    if (!stat) {
+        return ERROR_NULL_REFERENCE;
+    }
+    return init_client(stat, broker_addr, &default_allocator, transport);
+}
+
+void mqtt_deinit_client(struct mqtt_client* stat)
+{
+    if (!stat) {
+        return;
+    }
+    abort_publish_parts(stat);
+    mqtt_free_client_strings(stat);
+#ifndef MQTT_STATIC_MEMORY
+    mqtt_free(stat, stat->coalesce.buffer);
+    mqtt_free(stat, stat->rx.buffer);
+#endif
+    stat->coalesce.buffer = NULL;
+    stat->rx.buffer = NULL;
+    if (stat->rx.recv.payload) {
+        stat->net.free_recv_buf(stat, &stat->rx.recv);
+    }
+    if (stat->net.release) {
+        // Per-client state of the transport, e.g. the socket context
+        stat->net.release(stat);
+        stat->net.release = NULL;
+    }
+    if (stat->submit) {
+        // Release requests which have never been sent
+        struct submit_request* req;
+        while ((req = submit_queue_peek(stat->submit))) {
+            mqtt_free(stat, req->topic);
+            submit_queue_pop(stat->submit);
+        }
+        mqtt_free(stat, stat->submit);
+        stat->submit = NULL;
+    }
+    mqtt_free(stat, stat->submit_acks);
+    stat->submit_acks = NULL;
+#ifndef MQTT_STATIC_MEMORY
+    mqtt_free(stat, stat->config);
+    mqtt_free(stat, stat->diag);
+#endif
+    stat->config = NULL;
+    stat->diag = NULL;
+}
+
+#ifndef MQTT_STATIC_MEMORY
+void mqtt_free_client(struct mqtt_client** stat)
+{
+    if (stat && *stat) {
+        struct mqtt_client* client = *stat;
+        mqtt_deinit_client(client);
+        // The client itself is released last, its allocator is part of it
+        struct mqtt_allocator allocator = client->allocator;
+        allocator.free(allocator.context, client);
+        *stat = NULL;
+    }
+}
+
+struct mqtt_client* mqtt_create_client_transport(const char* broker_addr, const struct mqtt_allocator* allocator,
+                                                 const struct mqtt_transport* transport)
+{
+    if (!allocator) {
+        allocator = &default_allocator;
+    }
+    assert(allocator->alloc && allocator->realloc && allocator->free);
+
+    struct mqtt_client* stat = (struct mqtt_client*) allocator->alloc(allocator->context, sizeof(struct mqtt_client));
+    if (!stat) {
+        return NULL;
+    }
+    if (FAILED(init_client(stat, broker_addr, allocator, transport))) {
+        allocator->free(allocator->context, stat);
+        return NULL;
+    }
+    return stat;
+}
+
+struct mqtt_client* mqtt_create_client_ex(const char* broker_addr, const struct mqtt_allocator* allocator)
+{
+    return mqtt_create_client_transport(broker_addr, allocator, NULL);
+}
+
+struct mqtt_client* mqtt_create_client(const char* broker_addr)
+{
+    return mqtt_create_client_transport(broker_addr, NULL, NULL);
+}
+#endif
+
+int mqtt_connect(struct mqtt_client* stat, uint16_t keep_alive, uint32_t session_expiry, bool clean_start)
+{
+    int result = validate_utf8_strings(stat, CONNECT);
+    if (SUCCESSFUL(result)) {
+        stat->config->connect.keep_alive = keep_alive;
+        stat->config->connect.session_expiry_interval = session_expiry;
+        stat->config->connect.clean_start = clean_start;
+        stat->config->connect.recv_max = MQTT_RECEIVE_MAXIMUM;
+#ifdef MQTT_STATIC_MEMORY
+        if (get_unique_client_id(stat->storage.client_id, sizeof(stat->storage.client_id)) != 0) {
+            return ERROR_NULL_REFERENCE;
+        }
+        stat->config->connect.client_id = stat->storage.client_id;
+#else
+        char id[UNIQUE_CLIENT_ID_LEN];
+        if (get_unique_client_id(id, sizeof(id)) != 0) {
+            return ERROR_NULL_REFERENCE;
+        }
+        mqtt_free(stat, (void*)stat->config->connect.client_id);
+        stat->config->connect.client_id = string_copy(stat, id);
+        if (!stat->config->connect.client_id) {
+            return ERROR_OUT_OF_MEMORY;
+        }
+#endif
+
+        // First run estimates the needed memory size
+        stat->pout = NULL;
+        make_connect(stat);
+
+        // Allocate send buffer
+        result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+        if (FAILED(result)) {
+            return result;
+        }
+
+        // Second run builds the actual packet
+        stat->pout = (uint8_t*) stat->outp.payload;
+        make_connect(stat);
+
+        // A packet the previous connection left incomplete is dropped
+        stat->rx.len = 0;
+        abort_publish_parts(stat);
+        abort_publish_stream(stat);
+
+        // Open connection
+        result = stat->net.open_conn(stat, stat->broker_addr);
+        if (FAILED(result)) {
+            stat->net.free_send_buf(stat, &stat->outp);
+            return result;
+        }
+
+        // For async net APIs we may not connected here. 
+        // In that case we prepare the connect packet and send it later
+        if (!stat->net.connected) {
+            stat->config->connect.deferred = true;
+        }
+
+        // Send the packet
+        result = stat->net.send(stat, &stat->outp);
+        if (FAILED(result)) {
+            stat->net.free_send_buf(stat, &stat->outp);
+            stat->net.close_conn(stat);
+            return result;
+        }
+
+        // Free send buffer
+        if (result != STATUS_PENDING) {
+            result = stat->net.free_send_buf(stat, &stat->outp);
+            if (FAILED(result)) {
+                stat->net.close_conn(stat);
+                return result;
+            }
+        }
+
+        stat->expected_ptypes |= BIT(CONNACK);
+    }
+    return result;
+}
+
+int mqtt_disconnect(struct mqtt_client* stat, mqtt_reason_code reason_code)
+{
+    // A streamed publish is completed or aborted with mqtt_publish_end() first
+    if (stat->publish_stream.open) {
+        return ERROR_INVALID_OPERATION;
+    }
+
+    int result = validate_utf8_strings(stat, DISCONNECT);
+    if (SUCCESSFUL(result)) {
+        // Packets still queued for coalescing must precede the DISCONNECT
+        result = flush_outbound(stat);
+        if (FAILED(result)) {
+            return result;
+        }
+
+        stat->diag->disconn.reason_code = reason_code;
+
+        // First run estimates the needed memory size
+        stat->pout = NULL;
+        make_disconnect(stat);
+
+        // Allocate send buffer
+        result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+        if (FAILED(result)) {
+            return result;
+        }
+
+        // Second run builds the actual packet
+        stat->pout = (uint8_t*) stat->outp.payload;
+        make_disconnect(stat);
+
+        // Send the packet
+        result = stat->net.send(stat, &stat->outp);
+        if (FAILED(result)) {
+            stat->net.free_send_buf(stat, &stat->outp);
+            return result;
+        }
+
+        // Free send buffer
+        result = stat->net.free_send_buf(stat, &stat->outp);
+        if (FAILED(result)) {
+            // Still close connection even if free fails
+            stat->net.close_conn(stat);
+            return result;
+        }
+
+        // Update state
+        stat->connected = false;
+        stat->expected_ptypes = BIT(PINGREQ);
+
+        // Close connection
+        result = stat->net.close_conn(stat);
+    }
+    return result;
+}
+
+static int check_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg)
+{
+    // Validate UTF-8 strings, the topic is required
+    if (!msg->topic || !is_valid_utf8(msg->topic, strlen(msg->topic))) {
+        return ERROR_INVALID_ENCODING;
+    }
+    int result = validate_utf8_strings(stat, PUBLISH);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    // Validate QoS level
+    if (msg->qos > 2) {
+        return ERROR_INVALID_QOS;
+    }
+
+    // Check if server supports the requested QoS level
+    if (msg->qos > stat->connack.max_qos) {
+        return ERROR_QOS_NOT_SUPPORTED;
+    }
+
+    // Check if retain is supported
+    if (msg->retain && !stat->connack.retain_avail) {
+        return ERROR_RETAIN_NOT_SUPPORTED;
+    }
+
+    // Validate topic name (no wildcards allowed in publish)
+    if (strstr(msg->topic, "+") || strstr(msg->topic, "#")) {
+        return ERROR_INVALID_TOPIC;
+    }
+
+    return OK;
+}
+
+static void update_publish_expectations(struct mqtt_client* stat, uint8_t qos)
+{
+    switch (qos) {
+    case 1:
+        stat->expected_ptypes |= BIT(PUBACK);
+        break;
+    case 2:
+        stat->expected_ptypes |= BIT(PUBREC);
+        break;
+    default:
+        // QoS 0 - no acknowledgment expected
+        break;
+    }
+}
+
+int mqtt_set_write_coalescing(struct mqtt_client* stat, uint32_t max_bytes, uint32_t max_delay_ms)
+{
+    if (!stat) {
+        return ERROR_NULL_REFERENCE;
+    }
+
+    // Packets held back behind a streamed publish stay in the buffer
+    if (stat->publish_stream.open) {
+        return ERROR_INVALID_OPERATION;
+    }
+#ifdef MQTT_STATIC_MEMORY
+    // Needs heap, the buffer of the client only takes the packets held back
+    if (max_bytes) {
+        return ERROR_UNSUPPORTED;
+    }
+    return OK;
+#else
+
+    // Queued packets are always sent with the old settings
+    int result = flush_coalesced(stat);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    if (!max_bytes) {
+        mqtt_free(stat, stat->coalesce.buffer);
+        memset(&stat->coalesce, 0, sizeof(stat->coalesce));
+        return OK;
+    }
+
+    if (max_bytes > stat->coalesce.size) {
+        uint8_t* buffer = mqtt_realloc(stat, stat->coalesce.buffer, max_bytes);
+        if (!buffer) {
+            return ERROR_OUT_OF_MEMORY;
+        }
+        stat->coalesce.buffer = buffer;
+        stat->coalesce.size = max_bytes;
+    }
+    stat->coalesce.max_bytes = max_bytes;
+    stat->coalesce.max_delay = max_delay_ms;
+    stat->coalesce.enabled = true;
+    return OK;
+#endif
+}
+
+int mqtt_set_receive_streaming(struct mqtt_client* stat, uint32_t part_size)
+{
+    if (!stat) {
+        return ERROR_NULL_REFERENCE;
+    }
+
+    // Not while a packet is reassembled or delivered, its parts are counted with the old size
+    if (stat->rx.len || stat->rx.part_left) {
+        return ERROR_INVALID_OPERATION;
+    }
+#ifdef MQTT_STATIC_MEMORY
+    // The first part is reassembled like any other packet
+    if (part_size > sizeof(stat->storage.packet)) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+#endif
+    stat->rx.part_size = part_size;
+    return OK;
+}
+
+int mqtt_flush(struct mqtt_client* stat)
+{
+    if (!stat) {
+        return ERROR_NULL_REFERENCE;
+    }
+    return flush_outbound(stat);
+}
+
+int mqtt_ack(struct mqtt_client* stat, uint16_t packet_id)
+{
+    if (!stat) {
+        return ERROR_NULL_REFERENCE;
+    }
+
+    if (packet_id == 0) {
+        return ERROR_INVALID_PACKET_ID;
+    }
+
+    for (int i = 0; i < MQTT_RECEIVE_MAXIMUM; ++i) {
+        if (stat->acks.slots[i].packet_id == packet_id) {
+            stat->acks.slots[i].acked = true;
+            return OK;
+        }
+    }
+    return ERROR_INVALID_PACKET_ID;
+}
+
+int mqtt_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg)
+{
+    if (!stat || !msg) {
+        return ERROR_NULL_REFERENCE;
+    }
+
+    if (!stat->connected) {
+        return ERROR_NOT_CONNECTED;
+    }
+
+    // The payload of a streamed publish must not be interrupted
+    if (stat->publish_stream.open) {
+        return ERROR_INVALID_OPERATION;
+    }
+
+    int result = check_publish(stat, msg);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    // Generate packet identifier for QoS > 0
+    if (msg->qos > 0) {
+        int packet_id = reserve_packet_slot_for_answer(stat, msg->qos == 2 ? PUBREC : PUBACK);
+        if (SUCCESSFUL(packet_id)) {
+            msg->packet_id = (uint16_t)packet_id;
+        } else {
+            return packet_id; // Error out of packet slots
+        }
+    }
+
+    // First pass: estimate packet size
+    stat->pout = NULL;
+    make_publish(stat, msg);
+
+    // Allocate send buffer
+    result = alloc_packet_buf(stat, stat->packet_size);
+    if (FAILED(result)) {
+        if (msg->qos > 0) {
+            free_packet_slot(stat, msg->packet_id);
+        }
+        return result;
+    }
+
+    // Second pass: actually build the packet
+    stat->pout = (uint8_t*) stat->outp.payload;
+    make_publish(stat, msg);
+
+    // Send the packet
+    uint32_t header_len = stat->packet_size;
+    result = send_packet_buf(stat);
+
+    // Free send buffer
+    free_packet_buf(stat);
+
+    // A large payload follows without a copy
+    if (SUCCESSFUL(result) && publish_by_reference(msg)) {
+        result = send_payload(stat, &msg->payload, header_len);
+    }
+
+    // Update expected packet types based on QoS
+    if (SUCCESSFUL(result)) {
+        update_publish_expectations(stat, msg->qos);
+    } else if (msg->qos > 0) {
+        free_packet_slot(stat, msg->packet_id);
+    }
+
+    return result;
+}
+
+int mqtt_publish_begin(struct mqtt_client* stat, struct mqtt_pub_packet* msg, uint32_t payload_size)
+{
+    if (!stat || !msg) {
+        return ERROR_NULL_REFERENCE;
+    }
+
+    if (!stat->connected) {
+        return ERROR_NOT_CONNECTED;
+    }
+
+    if (stat->publish_stream.open) {
+        return ERROR_INVALID_OPERATION;
+    }
+
+    int result = check_publish(stat, msg);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    // The remaining length covers the whole payload and has four bytes at most
+    stat->pout = NULL;
+    make_publish_header(stat, msg, payload_size);
+    if (payload_size > 268435455 - stat->packet_size) {
+        return ERROR_INVALID_PACKET_SIZE;
+    }
+
+    // Generate packet identifier for QoS > 0
+    if (msg->qos > 0) {
+        int packet_id = reserve_packet_slot_for_answer(stat, msg->qos == 2 ? PUBREC : PUBACK);
+        if (SUCCESSFUL(packet_id)) {
+            msg->packet_id = (uint16_t)packet_id;
+        } else {
+            return packet_id; // Error out of packet slots
+        }
+    }
+
+    // The header goes out at once, behind everything coalesced before. The payload is written past
+    // the coalescing buffer, so the stream only opens when the transport has taken all of it.
+    uint32_t header_len = stat->packet_size;
+    result = alloc_packet_buf(stat, header_len);
+    if (SUCCESSFUL(result)) {
+        stat->pout = (uint8_t*) stat->outp.payload;
+        make_publish_header(stat, msg, payload_size);
+        result = send_packet_buf(stat);
+        free_packet_buf(stat);
+    }
+    if (SUCCESSFUL(result)) {
+        result = flush_coalesced(stat);
+    }
+    if (result == STATUS_BUSY) {
+        stat->coalesce.len -= header_len;
+        result = ERROR_OUT_OF_RESOURCE;
+    }
+    if (FAILED(result)) {
+        if (msg->qos > 0) {
+            free_packet_slot(stat, msg->packet_id);
+        }
+        return result;
     }
 
-    // Free PUBACK allocated strings
-    if (stat->puback.reason_string) {
-        free((void*)stat->puback.reason_string);
-        stat->puback.reason_string = NULL;
-    }
+    stat->publish_stream.open = true;
+    stat->publish_stream.qos = msg->qos;
+    stat->publish_stream.packet_id = msg->packet_id;
+    stat->publish_stream.left = payload_size;
+    return OK;
+}
 
-    // Free PUBREC allocated strings
-    if (stat->pubrec.reason_string) {
-        free((void*)stat->pubrec.reason_string);
-        stat->pubrec.reason_string = NULL;
+int mqtt_publish_write(struct mqtt_client* stat, const void* data, uint32_t len)
+{
+    if (!stat || (!data && len)) {
+        return ERROR_NULL_REFERENCE;
     }
 
-    // Free PUBREL allocated strings
-    if (stat->pubrel.reason_string) {
-        free((void*)stat->pubrel.reason_string);
-        stat->pubrel.reason_string = NULL;
+    if (!stat->publish_stream.open) {
+        return ERROR_INVALID_OPERATION;
     }
 
-    // Free PUBCOMP allocated strings
-    if (stat->pubcomp.reason_string) {
-        free((void*)stat->pubcomp.reason_string);
-        stat->pubcomp.reason_string = NULL;
+    if (len > stat->publish_stream.left) {
+        return ERROR_INVALID_ARGUMENT;
     }
 
-    // Free RECEIVED_PUBLISH allocated strings
-    if (stat->received_publish.topic) {
-        free((void*)stat->received_publish.topic);
-        stat->received_publish.topic = NULL;
-    }
-    if (stat->received_publish.response_topic) {
-        free((void*)stat->received_publish.response_topic);
-        stat->received_publish.response_topic = NULL;
-    }
-    if (stat->received_publish.content_type) {
-        free((void*)stat->received_publish.content_type);
-        stat->received_publish.content_type = NULL;
+    if (!len) {
+        return OK;
     }
 
-    // Free CONNECT allocated strings (client_id from get_unique_client_id)
-    if (stat->connect.client_id) {
-        free((void*)stat->connect.client_id);
-        stat->connect.client_id = NULL;
+    // Straight from the buffer of the caller, the transport copies what it cannot send right away.
+    // Refused data is not counted, the same bytes can be written again.
+    struct mqtt_pbuf buf = { .payload = (void*) data, .len = len };
+    int result = send_direct(stat, &buf);
+    if (SUCCESSFUL(result)) {
+        stat->publish_stream.left -= len;
     }
+    return result;
+}
 
-    // Free UNSUBACK allocated strings
-    if (stat->unsuback.reason_string) {
-        free((void*)stat->unsuback.reason_string);
-        stat->unsuback.reason_string = NULL;
-    }
-    if (stat->unsuback.reason_codes) {
-        free(stat->unsuback.reason_codes);
-        stat->unsuback.reason_codes = NULL;
+int mqtt_publish_end(struct mqtt_client* stat)
+{
+    if (!stat) {
+        return ERROR_NULL_REFERENCE;
     }
 
-    // Free the broker address
-    if (stat->broker_addr) {
-        free(stat->broker_addr);
-        stat->broker_addr = NULL;
+    if (!stat->publish_stream.open) {
+        return ERROR_INVALID_OPERATION;
     }
-}
 
-void mqtt_free_client(struct mqtt_client** stat)
-{
-    if (stat && *stat) {
-        mqtt_free_client_strings(*stat);
-        free(*stat);
-        *stat = NULL;
+    // A packet with missing payload cannot be completed, only the connection can be ended
+    if (stat->publish_stream.left) {
+        break_connection(stat);
+        return ERROR_INVALID_OPERATION;
     }
-}
 
-struct mqtt_client* mqtt_create_client(const char* broker_addr)
-{
-    struct mqtt_client* stat = (struct mqtt_client*) calloc(1, sizeof(struct mqtt_client));
-    stat->broker_addr = string_copy(broker_addr);
-    mqtt_assign_net_api(stat);
-    assert(stat->net.alloc_send_buf);
-    assert(stat->net.free_send_buf);
-    assert(stat->net.send);
-    assert(stat->net.open_conn);
-    assert(stat->net.close_conn);
-    stat->expected_ptypes = BIT(PINGREQ);
-    return stat;
+    stat->publish_stream.open = false;
+    update_publish_expectations(stat, stat->publish_stream.qos);
+
+    // Packets held back meanwhile follow the payload
+    return flush_coalesced(stat);
 }
 
-int mqtt_connect(struct mqtt_client* stat, uint16_t keep_alive, uint32_t session_expiry, bool clean_start)
+static int send_publish_batch(struct mqtt_client* stat, struct mqtt_pub_packet* msgs, unsigned int count)
 {
-    int result = validate_connect_utf8_strings(stat);
-    if (SUCCESSFUL(result)) {
-        stat->connect.keep_alive = keep_alive;
-        stat->connect.session_expiry_interval = session_expiry;
-        stat->connect.clean_start = clean_start;
-        stat->connect.client_id = get_unique_client_id();
-        stat->connect.recv_max = MQTT_RECEIVE_MAXIMUM;
-        assert(stat->connect.client_id);
-        if (!stat->connect.client_id) {
-            return ERROR_NULL_REFERENCE;
-        }
+    int result = OK;
+    unsigned int sent = 0;
 
-        // First run estimates the needed memory size
+    while (sent < count) {
+        // First pass: estimate the size of the packets up to the next one with a large payload,
+        // which is sent from the buffer of the caller behind its header
+        unsigned int end = sent;
+        uint32_t total_size = 0;
         stat->pout = NULL;
-        make_connect(stat);
+        do {
+            make_publish(stat, &msgs[end]);
+            total_size += stat->packet_size;
+        } while (!publish_by_reference(&msgs[end++]) && end < count);
 
-        // Allocate send buffer
-        result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+        // Allocate one send buffer for these packets
+        result = alloc_packet_buf(stat, total_size);
         if (FAILED(result)) {
-            return result;
+            break;
         }
 
-        // Second run builds the actual packet
+        // Second pass: encode the packets back-to-back
         stat->pout = (uint8_t*) stat->outp.payload;
-        make_connect(stat);
-
-        // Open connection
-        result = stat->net.open_conn(stat, stat->broker_addr);
-        if (FAILED(result)) {
-            stat->net.free_send_buf(stat, &stat->outp);
-            return result;
+        for (unsigned int i = sent; i < end; i++) {
+            make_publish(stat, &msgs[i]);
         }
+        stat->packet_size = total_size;
 
-        // For async net APIs we may not connected here. 
-        // In that case we prepare the connect packet and send it later
-        if (!stat->net.connected) {
-            stat->connect.deferred = true;
-        }
+        // Send them at once
+        result = send_packet_buf(stat);
 
-        // Send the packet
-        result = stat->net.send(stat, &stat->outp);
+        // Free send buffer
+        free_packet_buf(stat);
+
+        if (SUCCESSFUL(result) && publish_by_reference(&msgs[end - 1])) {
+            result = send_payload(stat, &msgs[end - 1].payload, total_size);
+        }
         if (FAILED(result)) {
-            stat->net.free_send_buf(stat, &stat->outp);
-            stat->net.close_conn(stat);
-            return result;
+            break;
         }
 
-        // Free send buffer
-        if (result != STATUS_PENDING) {
-            result = stat->net.free_send_buf(stat, &stat->outp);
-            if (FAILED(result)) {
-                stat->net.close_conn(stat);
-                return result;
-            }
+        // Update expected packet types based on QoS
+        for (; sent < end; sent++) {
+            update_publish_expectations(stat, msgs[sent].qos);
         }
+    }
 
-        stat->expected_ptypes |= BIT(CONNACK);
+    // No answer is expected for the messages not sent, their packet identifiers are free again
+    if (FAILED(result)) {
+        for (unsigned int i = sent; i < count; i++) {
+            if (msgs[i].qos > 0) {
+                free_packet_slot(stat, msgs[i].packet_id);
+            }
+        }
     }
+
     return result;
 }
 
-int mqtt_disconnect(struct mqtt_client* stat, mqtt_reason_code reason_code)
+int mqtt_publish_batch(struct mqtt_client* stat, struct mqtt_pub_packet* msgs, unsigned int count)
 {
-    int result = validate_disconnect_utf8_strings(stat);
-    if (SUCCESSFUL(result)) {
-        stat->disconn.reason_code = reason_code;
+    if (!stat || !msgs || count == 0) {
+        return ERROR_NULL_REFERENCE;
+    }
 
-        // First run estimates the needed memory size
-        stat->pout = NULL;
-        make_disconnect(stat);
+    if (!stat->connected) {
+        return ERROR_NOT_CONNECTED;
+    }
 
-        // Allocate send buffer
-        result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+    if (stat->publish_stream.open) {
+        return ERROR_INVALID_OPERATION;
+    }
+
+    // Validate all messages before any packet identifier is consumed
+    for (unsigned int i = 0; i < count; i++) {
+        int result = check_publish(stat, &msgs[i]);
         if (FAILED(result)) {
             return result;
         }
+    }
 
-        // Second run builds the actual packet
-        stat->pout = (uint8_t*) stat->outp.payload;
-        make_disconnect(stat);
+    // Reserve packet identifiers for all messages with QoS > 0
+    unsigned int reserved = 0;
+    int result = OK;
+    for (; reserved < count; reserved++) {
+        struct mqtt_pub_packet* msg = &msgs[reserved];
+        if (msg->qos > 0) {
+            int packet_id = reserve_packet_slot_for_answer(stat, msg->qos == 2 ? PUBREC : PUBACK);
+            if (FAILED(packet_id)) {
+                result = packet_id; // Error out of packet slots
+                break;
+            }
+            msg->packet_id = (uint16_t)packet_id;
+        }
+    }
 
-        // Send the packet
-        result = stat->net.send(stat, &stat->outp);
-        if (FAILED(result)) {
-            stat->net.free_send_buf(stat, &stat->outp);
-            return result;
+    if (FAILED(result)) {
+        // Release the packet identifiers reserved so far
+        for (unsigned int i = 0; i < reserved; i++) {
+            if (msgs[i].qos > 0) {
+                free_packet_slot(stat, msgs[i].packet_id);
+            }
         }
+        return result;
+    }
 
-        // Free send buffer
-        result = stat->net.free_send_buf(stat, &stat->outp);
-        if (FAILED(result)) {
-            // Still close connection even if free fails
-            stat->net.close_conn(stat);
-            return result;
+    return send_publish_batch(stat, msgs, count);
+}
+
+static int drain_submit_queue(struct mqtt_client* stat)
+{
+    struct mqtt_pub_packet msgs[MQTT_SUBMIT_BATCH_SIZE];
+    char* blocks[MQTT_SUBMIT_BATCH_SIZE];
+    int result = OK;
+
+    if (!stat->submit) {
+        return OK;
+    }
+
+    // Acknowledgements go first, a publish waiting for a packet slot must not hold them back
+    struct submit_request* req;
+    while ((req = submit_queue_peek(stat->submit_acks))) {
+        mqtt_ack(stat, req->packet_id);
+        submit_queue_pop(stat->submit_acks);
+    }
+
+    // Submitted publishes wait until a streamed one is complete
+    if (stat->publish_stream.open) {
+        return OK;
+    }
+
+    while (SUCCESSFUL(result)) {
+        unsigned int count = 0;
+
+        while (count < MQTT_SUBMIT_BATCH_SIZE && (req = submit_queue_peek(stat->submit))) {
+            struct mqtt_pub_packet msg = mqtt_pub_packet(req->topic, req->payload, req->payload_len,
+                                                         req->qos, req->retain);
+            int check = stat->connected ? check_publish(stat, &msg) : ERROR_NOT_CONNECTED;
+            if (SUCCESSFUL(check) && msg.qos > 0) {
+                int packet_id = reserve_packet_slot_for_answer(stat, msg.qos == 2 ? PUBREC : PUBACK);
+                if (BASE_ERROR(packet_id) == E_ERROR_OUT_OF_RESOURCE) {
+                    break; // Leave the request queued until acknowledgements free a packet slot
+                }
+                check = packet_id;
+                msg.packet_id = (uint16_t)packet_id;
+            }
+            submit_queue_pop(stat->submit);
+            if (FAILED(check)) {
+                mqtt_submitted_publish(stat, &msg, check);
+                mqtt_free(stat, req->topic);
+                continue;
+            }
+            msgs[count] = msg;
+            blocks[count++] = req->topic;
         }
 
-        // Update state
-        stat->connected = false;
-        stat->expected_ptypes = BIT(PINGREQ);
+        if (!count) {
+            break;
+        }
 
-        // Close connection
-        result = stat->net.close_conn(stat);
+        // The payloads are sent or copied by now, the request memory can be released afterwards
+        result = send_publish_batch(stat, msgs, count);
+        for (unsigned int i = 0; i < count; i++) {
+            mqtt_submitted_publish(stat, &msgs[i], result);
+            mqtt_free(stat, blocks[i]);
+        }
     }
+
     return result;
 }
 
-int mqtt_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg)
+int mqtt_enable_submit_queue(struct mqtt_client* stat)
 {
-    if (!stat || !msg) {
+    if (!stat) {
         return ERROR_NULL_REFERENCE;
     }
+    if (!stat->submit) {
+        struct submit_queue* acks = mqtt_malloc(stat, sizeof(struct submit_queue));
+        stat->submit = mqtt_malloc(stat, sizeof(struct submit_queue));
+        if (!acks || !stat->submit) {
+            mqtt_free(stat, acks);
+            mqtt_free(stat, stat->submit);
+            stat->submit = NULL;
+            return ERROR_OUT_OF_MEMORY;
+        }
+        submit_queue_init(acks);
+        submit_queue_init(stat->submit);
+        stat->submit_acks = acks;
+    }
+    return OK;
+}
 
-    if (!stat->connected) {
-        return ERROR_NOT_CONNECTED;
+int mqtt_submit_publish(struct mqtt_client* stat, const struct mqtt_pub_packet* msg)
+{
+    if (!stat || !msg || !msg->topic) {
+        return ERROR_NULL_REFERENCE;
     }
 
-    // Validate UTF-8 strings
-    int result = validate_publish_utf8_strings(stat, msg);
-    if (FAILED(result)) {
-        return result;
+    if (!stat->submit) {
+        return ERROR_INVALID_OPERATION;
     }
 
-    // Validate QoS level
     if (msg->qos > 2) {
         return ERROR_INVALID_QOS;
     }
 
-    // Check if server supports the requested QoS level
-    if (msg->qos > stat->connack.max_qos) {
-        return ERROR_QOS_NOT_SUPPORTED;
+    // Topic and payload are copied, the caller may reuse its buffers right away
+    size_t topic_len = strlen(msg->topic) + 1;
+    struct submit_request req = {
+        .kind = SUBMIT_PUBLISH,
+        .qos = msg->qos,
+        .retain = msg->retain,
+        .payload_len = msg->payload.len
+    };
+    req.topic = mqtt_malloc(stat, topic_len + msg->payload.len);
+    if (!req.topic) {
+        return ERROR_OUT_OF_MEMORY;
     }
-
-    // Check if retain is supported
-    if (msg->retain && !stat->connack.retain_avail) {
-        return ERROR_RETAIN_NOT_SUPPORTED;
+    memcpy(req.topic, msg->topic, topic_len);
+    req.payload = (uint8_t*) req.topic + topic_len;
+    if (msg->payload.data && msg->payload.len) {
+        memcpy(req.payload, msg->payload.data, msg->payload.len);
     }
 
-    // Validate topic name (no wildcards allowed in publish)
-    if (strstr(msg->topic, "+") || strstr(msg->topic, "#")) {
-        return ERROR_INVALID_TOPIC;
+    if (!submit_queue_push(stat->submit, &req)) {
+        mqtt_free(stat, req.topic);
+        return ERROR_OUT_OF_RESOURCE;
     }
+    return OK;
+}
 
-    // Generate packet identifier for QoS > 0
-    if (msg->qos > 0) {
-        int packet_id = reserve_packet_slot_for_answer(stat, msg->qos == 2 ? PUBREC : PUBACK);
-        if (SUCCESSFUL(packet_id)) {
-            msg->packet_id = (uint16_t)packet_id;
-        } else {
-            return packet_id; // Error out of packet slots
-        }
+int mqtt_submit_ack(struct mqtt_client* stat, uint16_t packet_id)
+{
+    if (!stat) {
+        return ERROR_NULL_REFERENCE;
     }
 
-    // First pass: estimate packet size
-    stat->pout = NULL;
-    make_publish(stat, msg);
-
-    // Allocate send buffer
-    result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
-    if (FAILED(result)) {
-        return result;
+    if (!stat->submit) {
+        return ERROR_INVALID_OPERATION;
     }
 
-    // Second pass: actually build the packet
-    stat->pout = (uint8_t*) stat->outp.payload;
-    make_publish(stat, msg);
-
-    // Send the packet
-    result = stat->net.send(stat, &stat->outp);
-
-    // Free send buffer
-    stat->net.free_send_buf(stat, &stat->outp);
-
-    // Update expected packet types based on QoS
-    if (SUCCESSFUL(result)) {
-        switch (msg->qos) {
-        case 1:
-            stat->expected_ptypes |= BIT(PUBACK);
-            break;
-        case 2:
-            stat->expected_ptypes |= BIT(PUBREC);
-            break;
-        default:
-            // QoS 0 - no acknowledgment expected
-            break;
-        }
+    if (packet_id == 0) {
+        return ERROR_INVALID_PACKET_ID;
     }
 
-    return result;
+    struct submit_request req = { .kind = SUBMIT_ACK, .packet_id = packet_id };
+    if (!submit_queue_push(stat->submit_acks, &req)) {
+        return ERROR_OUT_OF_RESOURCE;
+    }
+    return OK;
 }
 
 int mqtt_subscribe(struct mqtt_client* stat, struct mqtt_sub_entry* entries, unsigned int entry_count)
@@ -2885,19 +3230,19 @@ int mqtt_subscribe(struct mqtt_client* stat, struct mqtt_sub_entry* entries, uns
     }
 
     // Store subscription data
-    stat->subscribe.entries = entries;
-    stat->subscribe.entry_count = entry_count;
+    stat->config->subscribe.entries = entries;
+    stat->config->subscribe.entry_count = entry_count;
 
     // Acquire new packet ID with expected answer type
     int packet_id = reserve_packet_slot_for_answer(stat, SUBACK);
     if (SUCCESSFUL(packet_id)) {
-        stat->subscribe.packet_id = (uint16_t)packet_id;
+        stat->config->subscribe.packet_id = (uint16_t)packet_id;
     } else {
         return packet_id; // Error out of packet slots
     }
 
     // Validate UTF-8 strings
-    int result = validate_subscribe_utf8_strings(stat);
+    int result = validate_utf8_strings(stat, SUBSCRIBE);
     if (FAILED(result)) {
         return result;
     }
@@ -2940,7 +3285,7 @@ int mqtt_subscribe(struct mqtt_client* stat, struct mqtt_sub_entry* entries, uns
     make_subscribe(stat);
 
     // Allocate send buffer
-    result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+    result = alloc_packet_buf(stat, stat->packet_size);
     if (FAILED(result)) {
         return result;
     }
@@ -2950,10 +3295,10 @@ int mqtt_subscribe(struct mqtt_client* stat, struct mqtt_sub_entry* entries, uns
     make_subscribe(stat);
 
     // Send the packet
-    result = stat->net.send(stat, &stat->outp);
+    result = send_packet_buf(stat);
 
     // Free send buffer
-    stat->net.free_send_buf(stat, &stat->outp);
+    free_packet_buf(stat);
 
     // Update expected packet types
     if (SUCCESSFUL(result)) {
@@ -2978,7 +3323,7 @@ int mqtt_ping(struct mqtt_client* stat)
     make_pingreq(stat);
 
     // Allocate send buffer
-    int result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+    int result = alloc_packet_buf(stat, stat->packet_size);
     if (FAILED(result)) {
         return result;
     }
@@ -2988,10 +3333,10 @@ int mqtt_ping(struct mqtt_client* stat)
     make_pingreq(stat);
 
     // Send the packet
-    result = stat->net.send(stat, &stat->outp);
+    result = send_packet_buf(stat);
 
     // Free send buffer
-    stat->net.free_send_buf(stat, &stat->outp);
+    free_packet_buf(stat);
 
     // Update expected packet types to include PINGRESP
     if (SUCCESSFUL(result)) {
@@ -3016,17 +3361,17 @@ int mqtt_puback(struct mqtt_client* stat, uint16_t packet_id)
     }
 
     // Validate UTF-8 strings in PUBACK properties
-    int result = validate_puback_utf8_strings(stat);
+    int result = validate_utf8_strings(stat, PUBACK);
     if (FAILED(result)) {
         return result;
     }
 
     // Store packet ID for PUBACK (reason_code should be set by user before calling this)
-    stat->puback.packet_id = packet_id;
+    stat->diag->puback.packet_id = packet_id;
 
     // Set default reason code if not already set
-    if (stat->puback.reason_code == 0) {
-        stat->puback.reason_code = MQTT_REASON_SUCCESS;
+    if (stat->diag->puback.reason_code == 0) {
+        stat->diag->puback.reason_code = MQTT_REASON_SUCCESS;
     }
 
     // First pass: estimate packet size
@@ -3034,7 +3379,7 @@ int mqtt_puback(struct mqtt_client* stat, uint16_t packet_id)
     make_puback(stat);
 
     // Allocate send buffer
-    result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+    result = alloc_packet_buf(stat, stat->packet_size);
     if (FAILED(result)) {
         return result;
     }
@@ -3044,10 +3389,10 @@ int mqtt_puback(struct mqtt_client* stat, uint16_t packet_id)
     make_puback(stat);
 
     // Send the packet
-    result = stat->net.send(stat, &stat->outp);
+    result = send_packet_buf(stat);
 
     // Free send buffer
-    stat->net.free_send_buf(stat, &stat->outp);
+    free_packet_buf(stat);
 
     return result;
 }
@@ -3067,23 +3412,17 @@ int mqtt_pubrec(struct mqtt_client* stat, uint16_t packet_id)
     }
 
     // Validate UTF-8 strings in PUBREC properties
-    int result = validate_pubrec_utf8_strings(stat);
+    int result = validate_utf8_strings(stat, PUBREC);
     if (FAILED(result)) {
         return result;
     }
 
     // Store packet ID for PUBREC (reason_code should be set by user before calling this)
-    stat->pubrec.packet_id = packet_id;
+    stat->diag->pubrec.packet_id = packet_id;
 
     // Set default reason code if not already set
-    if (stat->pubrec.reason_code == 0) {
-        stat->pubrec.reason_code = MQTT_REASON_SUCCESS;
-    }
-
-    // Reserve packet slot for expected PUBREL
-    result = reserve_packet_slot_for_request(stat, packet_id, PUBREL);
-    if (FAILED(result)) {
-        return result;
+    if (stat->diag->pubrec.reason_code == 0) {
+        stat->diag->pubrec.reason_code = MQTT_REASON_SUCCESS;
     }
 
     // First pass: estimate packet size
@@ -3091,20 +3430,27 @@ int mqtt_pubrec(struct mqtt_client* stat, uint16_t packet_id)
     make_pubrec(stat);
 
     // Allocate send buffer
-    result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+    result = alloc_packet_buf(stat, stat->packet_size);
     if (FAILED(result)) {
         return result;
     }
 
+    // Reserve packet slot for expected PUBREL, once the PUBREC can be sent
+    result = reserve_packet_slot_for_request(stat, packet_id, PUBREL);
+    if (FAILED(result)) {
+        free_packet_buf(stat);
+        return result;
+    }
+
     // Second pass: actually build the packet
     stat->pout = (uint8_t*) stat->outp.payload;
     make_pubrec(stat);
 
     // Send the packet
-    result = stat->net.send(stat, &stat->outp);
+    result = send_packet_buf(stat);
 
     // Free send buffer
-    stat->net.free_send_buf(stat, &stat->outp);
+    free_packet_buf(stat);
 
     // Update expected packet types
     if (SUCCESSFUL(result)) {
@@ -3129,17 +3475,17 @@ int mqtt_pubrel(struct mqtt_client* stat, uint16_t packet_id)
     }
 
     // Validate UTF-8 strings in PUBREL properties
-    int result = validate_pubrel_utf8_strings(stat);
+    int result = validate_utf8_strings(stat, PUBREL);
     if (FAILED(result)) {
         return result;
     }
 
     // Store packet ID for PUBREL (reason_code should be set by user before calling this)
-    stat->pubrel.packet_id = packet_id;
+    stat->diag->pubrel.packet_id = packet_id;
 
     // Set default reason code if not already set
-    if (stat->pubrel.reason_code == 0) {
-        stat->pubrel.reason_code = MQTT_REASON_SUCCESS;
+    if (stat->diag->pubrel.reason_code == 0) {
+        stat->diag->pubrel.reason_code = MQTT_REASON_SUCCESS;
     }
 
     // Update packet slot to expect PUBCOMP instead of PUBREL
@@ -3155,7 +3501,7 @@ int mqtt_pubrel(struct mqtt_client* stat, uint16_t packet_id)
     make_pubrel(stat);
 
     // Allocate send buffer
-    result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+    result = alloc_packet_buf(stat, stat->packet_size);
     if (FAILED(result)) {
         return result;
     }
@@ -3165,10 +3511,10 @@ int mqtt_pubrel(struct mqtt_client* stat, uint16_t packet_id)
     make_pubrel(stat);
 
     // Send the packet
-    result = stat->net.send(stat, &stat->outp);
+    result = send_packet_buf(stat);
 
     // Free send buffer
-    stat->net.free_send_buf(stat, &stat->outp);
+    free_packet_buf(stat);
 
     // Update expected packet types
     if (SUCCESSFUL(result)) {
@@ -3193,17 +3539,17 @@ int mqtt_pubcomp(struct mqtt_client* stat, uint16_t packet_id)
     }
 
     // Validate UTF-8 strings in PUBCOMP properties
-    int result = validate_pubcomp_utf8_strings(stat);
+    int result = validate_utf8_strings(stat, PUBCOMP);
     if (FAILED(result)) {
         return result;
     }
 
     // Store packet ID for PUBCOMP (reason_code should be set by user before calling this)
-    stat->pubcomp.packet_id = packet_id;
+    stat->diag->pubcomp.packet_id = packet_id;
 
     // Set default reason code if not already set
-    if (stat->pubcomp.reason_code == 0) {
-        stat->pubcomp.reason_code = MQTT_REASON_SUCCESS;
+    if (stat->diag->pubcomp.reason_code == 0) {
+        stat->diag->pubcomp.reason_code = MQTT_REASON_SUCCESS;
     }
 
     // First pass: estimate packet size
@@ -3211,7 +3557,7 @@ int mqtt_pubcomp(struct mqtt_client* stat, uint16_t packet_id)
     make_pubcomp(stat);
 
     // Allocate send buffer
-    result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+    result = alloc_packet_buf(stat, stat->packet_size);
     if (FAILED(result)) {
         return result;
     }
@@ -3221,10 +3567,10 @@ int mqtt_pubcomp(struct mqtt_client* stat, uint16_t packet_id)
     make_pubcomp(stat);
 
     // Send the packet
-    result = stat->net.send(stat, &stat->outp);
+    result = send_packet_buf(stat);
 
     // Free send buffer
-    stat->net.free_send_buf(stat, &stat->outp);
+    free_packet_buf(stat);
 
     return result;
 }
@@ -3240,19 +3586,19 @@ int mqtt_unsubscribe(struct mqtt_client* stat, struct mqtt_sub_entry* entries, u
     }
 
     // Store unsubscribe data
-    stat->unsubscribe.entries = entries;
-    stat->unsubscribe.entry_count = entry_count;
+    stat->config->unsubscribe.entries = entries;
+    stat->config->unsubscribe.entry_count = entry_count;
 
     // Acquire new packet ID with expected answer type
     int packet_id = reserve_packet_slot_for_answer(stat, UNSUBACK);
     if (SUCCESSFUL(packet_id)) {
-        stat->unsubscribe.packet_id = (uint16_t)packet_id;
+        stat->config->unsubscribe.packet_id = (uint16_t)packet_id;
     } else {
         return packet_id; // Error out of packet slots
     }
 
     // Validate UTF-8 strings
-    int result = validate_unsubscribe_utf8_strings(stat);
+    int result = validate_utf8_strings(stat, UNSUBSCRIBE);
     if (FAILED(result)) {
         return result;
     }
@@ -3274,7 +3620,7 @@ int mqtt_unsubscribe(struct mqtt_client* stat, struct mqtt_sub_entry* entries, u
     make_unsubscribe(stat);
 
     // Allocate send buffer
-    result = stat->net.alloc_send_buf(stat, &stat->outp, stat->packet_size);
+    result = alloc_packet_buf(stat, stat->packet_size);
     if (FAILED(result)) {
         return result;
     }
@@ -3284,10 +3630,10 @@ int mqtt_unsubscribe(struct mqtt_client* stat, struct mqtt_sub_entry* entries, u
     make_unsubscribe(stat);
 
     // Send the packet
-    result = stat->net.send(stat, &stat->outp);
+    result = send_packet_buf(stat);
 
     // Free send buffer
-    stat->net.free_send_buf(stat, &stat->outp);
+    free_packet_buf(stat);
 
     // Update expected packet types
     if (SUCCESSFUL(result)) {
@@ -3295,4 +3641,64 @@ int mqtt_unsubscribe(struct mqtt_client* stat, struct mqtt_sub_entry* entries, u
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+#ifdef MQTT_TESTING
+/***** Test entry points *************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+void mqtt_test_pack_variable_size(struct mqtt_client* stat, uint32_t size)
+{
+    pack_variable_size(stat, size);
+}
+
+uint32_t mqtt_test_unpack_variable_size(struct mqtt_client* stat)
+{
+    return unpack_variable_size(stat);
+}
+
+void mqtt_test_pack_string(struct mqtt_client* stat, const char* data)
+{
+    pack_string(stat, data);
+}
+
+char* mqtt_test_unpack_string(struct mqtt_client* stat)
+{
+    return unpack_string(stat, &stat->packet_arena);
+}
+
+void mqtt_test_release_packet_data(struct mqtt_client* stat)
+{
+    release_packet_data(stat);
+}
+
+void mqtt_test_make_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg)
+{
+    make_publish(stat, msg);
+}
+
+int mqtt_test_process_publish(struct mqtt_client* stat, uint8_t flags, uint8_t* data, uint32_t len)
+{
+    release_packet_data(stat);
+    stat->pin = data;
+    stat->pin_end = data + len;
+    stat->malformed = false;
+    return process_publish(stat, flags);
+}
+
+int mqtt_test_reserve_slot(struct mqtt_client* stat, mqtt_packet_type await)
+{
+    return reserve_packet_slot_for_answer(stat, await);
+}
+
+int mqtt_test_free_slot(struct mqtt_client* stat, uint16_t packet_id)
+{
+    return free_packet_slot(stat, packet_id);
+}
+
+bool mqtt_test_await_packet(struct mqtt_client* stat, mqtt_packet_type type)
+{
+    return await_for_packet(stat, type);
+}
+#endif
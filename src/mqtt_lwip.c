@@ -10,6 +10,7 @@
  */
 
 #include "pico/cyw43_arch.h"
+#include "pico/time.h"
 
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
@@ -17,21 +18,228 @@
 #include "status.h"
 #include "mqtt.h"
 #include "logging.h"
+#include "transport.h"
+#include "mqtt_alloc.h"
 #include <lwip/err.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
-#define MAX_BUFFER_LEN  4096
+#define ITEM_ALIGN(len)  (((len) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+/* Packet handed to lwIP without a copy, it stays referenced until the broker acknowledged it */
+struct send_item {
+    struct send_item *next;
+    uint32_t len;
+    uint32_t written;           // Bytes passed to tcp_write()
+    uint32_t acked;             // Bytes acknowledged in tcp_sent()
+    const uint8_t *source;      // Buffer of a waiting caller copied by lwIP, NULL for the data of the item
+    _Alignas(void*) uint8_t data[];
+};
 
 struct socket_context {
     struct tcp_pcb *tcp_pcb;
     struct mqtt_client *client;
     ip_addr_t remote_addr;
-    char buffer[MAX_BUFFER_LEN];
-    uint16_t send_len;
     bool connecting;
     int mqtt_proc_state;
+    struct send_item *pending;  // Allocated send buffer, not sent yet
+    struct send_item *head;     // Oldest packet not fully acknowledged
+    struct send_item *tail;
+    struct send_item *write;    // First packet with bytes left for tcp_write()
+    struct send_item *borrowed; // Written from the buffer of the waiting caller, NULL once lwIP took it all
+    struct tcp_pcb *closing_pcb; // Closed connection still sending queued packets
+    bool in_callback;           // Sends from callbacks of lwIP must not wait for room
+    bool resume_send;           // A send was refused in a callback, retried from tcp_client_sent()
+#ifdef MQTT_STATIC_MEMORY
+    uint32_t ring_head;         // Next free byte of the send ring in the client storage
+#endif
 };
 
+static int close_conn(struct mqtt_client* client);
+
+/***** Send queue ********************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+#ifdef MQTT_STATIC_MEMORY
+/*
+ * The send buffer of the client storage is a ring. Packets are acknowledged in the
+ * order they were sent, so the oldest one marks the end of the free space.
+ */
+static struct send_item* item_alloc(struct socket_context* ctx, uint32_t len)
+{
+    uint8_t* ring = ctx->client->storage.send;
+    size_t size = sizeof(ctx->client->storage.send);
+    size_t need = ITEM_ALIGN(sizeof(struct send_item) + len);
+    struct send_item* oldest = ctx->head ? ctx->head : ctx->pending;
+    if (!oldest) {
+        ctx->ring_head = 0;
+    }
+    size_t tail = oldest ? (size_t) ((uint8_t*) oldest - ring) : 0;
+    size_t offset;
+    if (!oldest || ctx->ring_head > tail) {
+        if (size - ctx->ring_head >= need) {
+            offset = ctx->ring_head;
+        } else if (tail >= need) {
+            offset = 0;     // Wraps, the rest of the ring stays unused until the oldest packet is gone
+        } else {
+            return NULL;
+        }
+    } else if (tail - ctx->ring_head >= need) {
+        offset = ctx->ring_head;
+    } else {
+        return NULL;
+    }
+    ctx->ring_head = (uint32_t) (offset + need);
+    return (struct send_item*) (ring + offset);
+}
+
+static void item_free(struct socket_context* ctx, struct send_item* item)
+{
+    if (item == ctx->pending) {
+        // Only the latest allocation is ever given back unsent
+        ctx->ring_head = (uint32_t) ((uint8_t*) item - ctx->client->storage.send);
+    }
+}
+#else
+static struct send_item* item_alloc(struct socket_context* ctx, uint32_t len)
+{
+    return mqtt_malloc(ctx->client, sizeof(struct send_item) + len);
+}
+
+static void item_free(struct socket_context* ctx, struct send_item* item)
+{
+    mqtt_free(ctx->client, item);
+}
+#endif
+
+static void drop_queue(struct socket_context* ctx)
+{
+    while (ctx->head) {
+        struct send_item* item = ctx->head;
+        ctx->head = item->next;
+        item_free(ctx, item);
+    }
+    ctx->tail = NULL;
+    ctx->write = NULL;
+    ctx->borrowed = NULL;
+}
+
+/* On close only the bytes lwIP has taken are still sent */
+static void discard_unwritten(struct socket_context* ctx)
+{
+    struct send_item** link = &ctx->head;
+    ctx->tail = NULL;
+    while (*link) {
+        struct send_item* item = *link;
+        item->len = item->written;
+        if (!item->len) {
+            *link = item->next;
+            item_free(ctx, item);
+        } else {
+            ctx->tail = item;
+            link = &item->next;
+        }
+    }
+    ctx->write = NULL;
+    ctx->borrowed = NULL;
+}
+
+static void detach_pcb(struct tcp_pcb* pcb)
+{
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_err(pcb, NULL);
+}
+
+/* Writes queued bytes as far as the send buffer and the segment queue of the connection allow */
+static err_t write_queued(struct socket_context* ctx)
+{
+    struct tcp_pcb* pcb = ctx->tcp_pcb;
+    while (ctx->write) {
+        struct send_item* item = ctx->write;
+        uint32_t room = tcp_sndbuf(pcb);
+        if (!room || tcp_sndqueuelen(pcb) >= TCP_SND_QUEUELEN) {
+            break;      // Resumed from tcp_sent()
+        }
+        uint32_t n = item->len - item->written;
+        n = (n < room) ? n : room;
+        n = (n < UINT16_MAX) ? n : UINT16_MAX;
+        uint8_t flags = (item->written + n < item->len || item->next) ? TCP_WRITE_FLAG_MORE : 0;
+        const uint8_t* data = item->data;
+        if (item->source) {
+            // lwIP copies no more than the window takes, the caller's buffer is not referenced
+            data = item->source;
+            flags |= TCP_WRITE_FLAG_COPY;
+        }
+        err_t err = tcp_write(pcb, data + item->written, (uint16_t) n, flags);
+        if (err == ERR_MEM) {
+            break;
+        }
+        if (err != ERR_OK) {
+            return err;
+        }
+        item->written += n;
+        if (item->written == item->len) {
+            ctx->write = item->next;
+            if (item == ctx->borrowed) {
+                item->source = NULL;
+                ctx->borrowed = NULL;
+            }
+        }
+    }
+    return ERR_OK;
+}
+
+static err_t tcp_client_sent(void *arg, struct tcp_pcb *tpcb, u16_t len)
+{
+    struct socket_context* state = (struct socket_context*) arg;
+    if (!state) {
+        return ERR_VAL;
+    }
+    uint32_t acked = len;
+    while (acked && state->head) {
+        struct send_item* item = state->head;
+        uint32_t n = item->len - item->acked;
+        n = (n < acked) ? n : acked;
+        item->acked += n;
+        acked -= n;
+        if (item->acked == item->len) {
+            state->head = item->next;
+            if (!state->head) {
+                state->tail = NULL;
+            }
+            item_free(state, item);
+        }
+    }
+    if (tpcb == state->closing_pcb) {
+        if (!state->head) {
+            detach_pcb(tpcb);
+            state->closing_pcb = NULL;
+        }
+        return ERR_OK;
+    }
+    if (state->resume_send) {
+        // Acknowledged data made room for what a callback could not send
+        state->resume_send = false;
+        state->in_callback = true;
+        transport_resume_send(state->client);
+        state->in_callback = false;
+    }
+    err_t err = write_queued(state);
+    if (err != ERR_OK) {
+        LOG_ERROR("LwIP: tcp_write() returned: %d", err);
+        return err;
+    }
+    return tcp_output(tpcb);
+}
+
+/***** Network interface *************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
 static err_t tcp_client_connected(void *arg, struct tcp_pcb *tpcb, err_t err)
 {
     struct socket_context* state = (struct socket_context*) arg;
@@ -43,14 +251,16 @@ static err_t tcp_client_connected(void *arg, struct tcp_pcb *tpcb, err_t err)
         state->client->net.connected = true;
         state->connecting = false;
         LOG_DEBUG("LwIP: TCP connected");
-        if (state->client->connect.deferred) {
+        if (state->client->config->connect.deferred) {
+            state->in_callback = true;
             int result = state->client->net.send(state->client, &state->client->outp);
+            state->in_callback = false;
             state->client->net.free_send_buf(state->client, &state->client->outp);
             if (FAILED(result)) {
                 state->client->net.close_conn(state->client);
                 return ERR_CONN;
             }
-            state->client->connect.deferred = false;
+            state->client->config->connect.deferred = false;
         }
     } else {
         LOG_ERROR("LwIP: missing arg!");
@@ -62,25 +272,45 @@ static err_t tcp_client_connected(void *arg, struct tcp_pcb *tpcb, err_t err)
 static err_t tcp_client_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 {
     struct socket_context* state = (struct socket_context*) arg;
-    if (!p) {
+    if (!state) {
+        if (p) {
+            pbuf_free(p);
+        }
         LOG_ERROR("LwIP: missing arg reference!");
-        return -1;
+        return ERR_VAL;
     }
 
     // this method is callback from lwIP, so cyw43_arch_lwip_begin is not required, however you
     // can use this method to cause an assertion in debug mode, if this method is called when
     // cyw43_arch_lwip_begin IS needed
     cyw43_arch_lwip_check();
-    if (p->tot_len > 0) {
+    if (!p) {
+        // The broker has closed the connection
+        LOG_DEBUG("LwIP: TCP connection closed by peer");
+        close_conn(state->client);
+        return ERR_OK;
+    }
+    if (err != ERR_OK) {
+        pbuf_free(p);
+        return err;
+    }
+
+    // Segments of a chain are only contiguous each for itself. The stream parser processes the
+    // packets of a segment in place and reassembles just the ones spanning segment boundaries.
+    state->mqtt_proc_state = OK;
+    state->in_callback = true;
+    for (struct pbuf* q = p; q; q = q->next) {
 #ifdef MQTT_LWIP_VERBOSE
-        LOG_DEBUG("LwIP: tcp recv data=0x%p, len=%d", p->payload, p->len);
+        LOG_DEBUG("LwIP: tcp recv data=0x%p, len=%d", q->payload, q->len);
 #endif
-        state->mqtt_proc_state = mqtt_process_packet(state->client, p->payload, p->tot_len);
-        if (FAILED(state->mqtt_proc_state)) {
-            LOG_ERROR("mqtt_process_packet() returned: %d", state->mqtt_proc_state);
+        int result = mqtt_process_stream(state->client, q->payload, q->len);
+        if (FAILED(result) && SUCCESSFUL(state->mqtt_proc_state)) {
+            state->mqtt_proc_state = result;
+            LOG_ERROR("mqtt_process_stream() returned: %d", result);
         }
-        tcp_recved(tpcb, p->tot_len);
     }
+    state->in_callback = false;
+    tcp_recved(tpcb, p->tot_len);
     pbuf_free(p);
 
     return ERR_OK;
@@ -88,41 +318,21 @@ static err_t tcp_client_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, er
 
 static void tcp_client_err(void *arg, err_t err)
 {
+    struct socket_context* state = (struct socket_context*) arg;
     if (err != ERR_ABRT) {
         LOG_ERROR("LwIP: tcp_client_err: %d", err);
     }
-}
-
-static int alloc_send_buf(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
-{
-    int res = STATUS_SUCCESS;
-    if (client) {
-        struct socket_context* state = (struct socket_context*) client->context;
-        if (!state) {
-            return ERROR_NULL_REFERENCE;
-        }
-        if (len <= MAX_BUFFER_LEN) {
-            buf->payload = state->buffer;
-            buf->len = len;
+    if (state) {
+        // lwIP has freed the pcb already, the queued packets are not going out anymore
+        if (state->closing_pcb) {
+            state->closing_pcb = NULL;
         } else {
-            buf->payload = NULL;
-            buf->len = 0;
-            res = ERROR_OUT_OF_MEMORY;
+            state->tcp_pcb = NULL;
+            state->connecting = false;
+            state->client->net.connected = false;
         }
-    } else {
-        res = ERROR_NULL_REFERENCE;
-    }
-    return res;
-}
-
-static int free_send_buf(struct mqtt_client* client, struct mqtt_pbuf* buf)
-{
-    if (buf) {
-        buf->payload = NULL;
-        buf->len = 0;
-        return STATUS_SUCCESS;
+        drop_queue(state);
     }
-    return ERROR_NULL_REFERENCE;
 }
 
 static int open_conn(struct mqtt_client* client, const char* addr)
@@ -142,19 +352,37 @@ static int open_conn(struct mqtt_client* client, const char* addr)
     }
 
     if (!ctx->client->net.connected && !ctx->connecting) {
-        ip4addr_aton(addr, &ctx->remote_addr);
+        char host[IP4ADDR_STRLEN_MAX];
+        uint16_t port;
+        result = transport_parse_address(addr, host, sizeof(host), MQTT_PORT, &port);
+        if (FAILED(result)) {
+            return result;
+        }
+        if (!ip4addr_aton(host, ip_2_ip4(&ctx->remote_addr))) {
+            return ERROR_INVALID_DATA;
+        }
+        if (ctx->closing_pcb) {
+            // The queue belongs to the new connection, what the old one did not get out is lost
+            cyw43_arch_lwip_begin();
+            detach_pcb(ctx->closing_pcb);
+            tcp_abort(ctx->closing_pcb);
+            ctx->closing_pcb = NULL;
+            drop_queue(ctx);
+            cyw43_arch_lwip_end();
+        }
         if (!ctx->tcp_pcb) {
-            ctx->tcp_pcb = tcp_new_ip_type(IP_GET_TYPE(&ctx.remote_addr));
+            ctx->tcp_pcb = tcp_new_ip_type(IP_GET_TYPE(&ctx->remote_addr));
             if (!ctx->tcp_pcb) {
                 return ERROR_SW_FAILURE;
             }
         }
         tcp_arg(ctx->tcp_pcb, ctx);
         tcp_recv(ctx->tcp_pcb, tcp_client_recv);
+        tcp_sent(ctx->tcp_pcb, tcp_client_sent);
         tcp_err(ctx->tcp_pcb, tcp_client_err);
         LOG_INFO("LwIP: connecting to host %s", addr);
         cyw43_arch_lwip_begin();
-        err_t err = tcp_connect(ctx->tcp_pcb, &ctx->remote_addr, MQTT_PORT, tcp_client_connected);
+        err_t err = tcp_connect(ctx->tcp_pcb, &ctx->remote_addr, port, tcp_client_connected);
         if (err != ERR_OK) {
             LOG_ERROR("LwIP: tcp_connect() returned: %d", err);
             result = ERROR_HOST_UNAVAILABLE;
@@ -180,10 +408,21 @@ static int close_conn(struct mqtt_client* client)
     }
 
     if (state->client->net.connected) {
-        tcp_recv(state->tcp_pcb, NULL);
-        tcp_err(state->tcp_pcb, NULL);
-        tcp_arg(state->tcp_pcb, NULL);
-        tcp_close(state->tcp_pcb);
+        discard_unwritten(state);
+        if (state->head) {
+            // lwIP still references queued packets, e.g. the DISCONNECT. The pcb stays
+            // attached until they are acknowledged and can be released.
+            tcp_recv(state->tcp_pcb, NULL);
+            state->closing_pcb = state->tcp_pcb;
+        } else {
+            detach_pcb(state->tcp_pcb);
+        }
+        if (tcp_close(state->tcp_pcb) != ERR_OK) {
+            detach_pcb(state->tcp_pcb);
+            tcp_abort(state->tcp_pcb);
+            state->closing_pcb = NULL;
+            drop_queue(state);
+        }
         state->client->net.connected = false;
         state->tcp_pcb = NULL;
         LOG_DEBUG("LwIP: TCP connection closed");
@@ -192,41 +431,218 @@ static int close_conn(struct mqtt_client* client)
     return OK;
 }
 
+static int alloc_send_buf(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
+{
+    struct socket_context* ctx = (struct socket_context*) client->context;
+    buf->payload = NULL;
+    buf->len = 0;
+    if (ctx->pending) {
+        return ERROR_INVALID_OPERATION;
+    }
+    cyw43_arch_lwip_begin();
+    struct send_item* item = item_alloc(ctx, len);
+    cyw43_arch_lwip_end();
+    if (!item) {
+        // With MQTT_STATIC_MEMORY the ring may only be full until the broker acknowledges
+        if (ctx->in_callback) {
+            ctx->resume_send = true;
+        }
+        return ERROR_OUT_OF_MEMORY;
+    }
+    item->next = NULL;
+    item->len = len;
+    item->written = 0;
+    item->acked = 0;
+    item->source = NULL;
+    ctx->pending = item;
+    buf->payload = item->data;
+    buf->len = len;
+    return OK;
+}
+
+static int free_send_buf(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    struct socket_context* ctx = (struct socket_context*) client->context;
+    if (ctx->pending && buf->payload == ctx->pending->data) {
+        // Never sent, queued packets are released when they are acknowledged
+        cyw43_arch_lwip_begin();
+        item_free(ctx, ctx->pending);
+        cyw43_arch_lwip_end();
+        ctx->pending = NULL;
+    }
+    buf->payload = NULL;
+    buf->len = 0;
+    return OK;
+}
+
+static void enqueue(struct socket_context* ctx, struct send_item* item)
+{
+    if (ctx->tail) {
+        ctx->tail->next = item;
+    } else {
+        ctx->head = item;
+    }
+    ctx->tail = item;
+    if (!ctx->write) {
+        ctx->write = item;
+    }
+}
+
+/*
+ * Lets lwIP take acknowledgements while a send waits for room, false once the connection is gone.
+ * Never called from callbacks of lwIP, the stack is not reentrant.
+ */
+static bool wait_for_room(struct socket_context* ctx)
+{
+    struct tcp_pcb* pcb = ctx->tcp_pcb;
+    cyw43_arch_lwip_end();
+    cyw43_arch_poll();
+    cyw43_arch_wait_for_work_until(make_timeout_time_ms(MQTT_POLL_TIMEOUT));
+    cyw43_arch_lwip_begin();
+    return pcb && ctx->tcp_pcb == pcb && ctx->client->net.connected;
+}
+
+/*
+ * Sends a buffer that lwIP must not reference, like a large payload of the caller. The queue
+ * entry only counts its bytes, lwIP copies them in pieces as the send window opens. Returns
+ * once everything is written, so the memory needed stays within the TCP send buffer.
+ */
+static int send_borrowed(struct socket_context* state, const uint8_t* data, uint32_t len)
+{
+    struct send_item* item;
+    while (!(item = item_alloc(state, 0))) {
+        if (!wait_for_room(state)) {
+            return ERROR_HOST_UNAVAILABLE;
+        }
+    }
+    item->next = NULL;
+    item->len = len;
+    item->written = 0;
+    item->acked = 0;
+    item->source = data;
+    state->borrowed = item;
+    enqueue(state, item);
+
+    for (;;) {
+        err_t err = write_queued(state);
+        if (err == ERR_OK) {
+            err = tcp_output(state->tcp_pcb);
+        }
+        if (err != ERR_OK) {
+            LOG_ERROR("LwIP: tcp_write() returned: %d", err);
+            return ERROR_SW_FAILURE;
+        }
+        if (!state->borrowed) {
+            return STATUS_SUCCESS;
+        }
+        // The rest may also be written from tcp_sent() while we wait
+        if (!wait_for_room(state)) {
+            return ERROR_HOST_UNAVAILABLE;
+        }
+        if (!state->borrowed) {
+            return STATUS_SUCCESS;
+        }
+    }
+}
+
 static int socket_send(struct mqtt_client* client, struct mqtt_pbuf* buf)
 {
-    if (client) {
-        struct socket_context* state = (struct socket_context*) client->context;
-        if (state) {
-            if (!state->client->net.connected)  {
-                return state->client->connect.deferred ? STATUS_PENDING : ERROR_NOT_CONNECTED;
-            }
-            cyw43_arch_lwip_begin();
+    if (!client || !buf || !buf->payload || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct socket_context* state = (struct socket_context*) client->context;
+    if (!state->client->net.connected)  {
+        return state->client->config->connect.deferred ? STATUS_PENDING : ERROR_NOT_CONNECTED;
+    }
 #ifdef MQTT_LWIP_VERBOSE
-            LOG_DEBUG("LwIP: tcp send data=0x%p, len=%d", buf->payload, buf->len);
+    LOG_DEBUG("LwIP: tcp send data=0x%p, len=%d", buf->payload, buf->len);
 #endif
-            err_t err = tcp_write(state->tcp_pcb, buf->payload, buf->len, TCP_WRITE_FLAG_COPY);
-            if (err != ERR_OK) {
-                LOG_ERROR("LwIP: tcp_write() returned: %d", err);
-                return ERROR_SW_FAILURE;
-            }
-            cyw43_arch_lwip_end();
-            return STATUS_SUCCESS;
+
+    int result = STATUS_SUCCESS;
+    cyw43_arch_lwip_begin();
+    struct send_item* item = state->pending;
+    if (item && buf->payload == item->data) {
+        // The packet was built in a send buffer of ours, lwIP references it directly
+        item->len = (uint32_t) buf->len;
+        state->pending = NULL;
+    } else if ((buf->len <= TCP_SND_BUF || state->in_callback) && (item = item_alloc(state, (uint32_t) buf->len))) {
+        // Coalesced packets come from a buffer of the client which is reused at once. In a
+        // callback larger ones are copied too, nothing may wait for room there.
+        item->next = NULL;
+        item->len = (uint32_t) buf->len;
+        item->written = 0;
+        item->acked = 0;
+        item->source = NULL;
+        memcpy(item->data, buf->payload, buf->len);
+    } else if (state->in_callback) {
+        // Waiting for room would poll lwIP from inside lwIP. Nothing is taken, the client keeps
+        // coalesced packets until transport_resume_send() and fails any other send.
+        state->resume_send = true;
+        result = STATUS_BUSY;
+    } else {
+        // Large payloads of the caller, or no room for a copy
+        result = send_borrowed(state, (const uint8_t*) buf->payload, (uint32_t) buf->len);
+    }
+    if (item) {
+        enqueue(state, item);
+        // What does not fit into the send window now goes out from tcp_sent()
+        err_t err = write_queued(state);
+        if (err == ERR_OK) {
+            err = tcp_output(state->tcp_pcb);
+        }
+        if (err != ERR_OK) {
+            LOG_ERROR("LwIP: tcp_write() returned: %d", err);
+            result = ERROR_SW_FAILURE;
         }
     }
-    return ERROR_NULL_REFERENCE;
+    cyw43_arch_lwip_end();
+    return result;
 }
 
-void mqtt_assign_net_api(struct mqtt_client* client)
+static void release(struct mqtt_client* client)
 {
-    static struct socket_context ctx;
-    memset(&ctx, 0, sizeof(ctx));
-    if (client) {
-        client->net.alloc_send_buf = alloc_send_buf;
-        client->net.free_send_buf = free_send_buf;
-        client->net.open_conn = open_conn;
-        client->net.close_conn = close_conn;
-        client->net.send = socket_send;
-        client->context = &ctx;
-        ctx.client = client;
-    }
-}
\ No newline at end of file
+    struct socket_context* ctx = (struct socket_context*) client->context;
+    cyw43_arch_lwip_begin();
+    if (ctx->tcp_pcb) {
+        // Freed without disconnect, no callback may see the context anymore. Queued
+        // packets are freed with it, lwIP must not send them anymore.
+        detach_pcb(ctx->tcp_pcb);
+        if (ctx->head || tcp_close(ctx->tcp_pcb) != ERR_OK) {
+            tcp_abort(ctx->tcp_pcb);
+        }
+    }
+    if (ctx->closing_pcb) {
+        detach_pcb(ctx->closing_pcb);
+        tcp_abort(ctx->closing_pcb);
+    }
+    cyw43_arch_lwip_end();
+    drop_queue(ctx);
+    if (ctx->pending) {
+        item_free(ctx, ctx->pending);
+    }
+    transport_state_free(client, ctx);
+    client->context = NULL;
+}
+
+static int attach(struct mqtt_client* client, void* context)
+{
+    struct socket_context* ctx = transport_state_alloc(client, sizeof(struct socket_context));
+    if (!ctx) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    ctx->client = client;
+    client->net.alloc_send_buf = alloc_send_buf;
+    client->net.free_send_buf = free_send_buf;
+    client->net.open_conn = open_conn;
+    client->net.close_conn = close_conn;
+    client->net.send = socket_send;
+    client->net.release = release;
+    client->context = ctx;
+    return OK;
+}
+
+const struct mqtt_transport mqtt_tcp_transport = {
+    .scheme = "tcp",
+    .attach = attach,
+    .context = NULL
+};
@@ -0,0 +1,257 @@
+/**
+ * @file mqtt_memory.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief MQTT Network interface implementation over an in-memory pipe
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "mqtt_memory.h"
+#include "status.h"
+#include "systime.h"
+#include "netbuf.h"
+
+// The free running counters wrap around without a jump in the ring position
+_Static_assert((MQTT_MEM_PIPE_SIZE & (MQTT_MEM_PIPE_SIZE - 1)) == 0, "MQTT_MEM_PIPE_SIZE must be a power of two");
+
+/***** Channels **********************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static void channel_setup(struct mqtt_mem_channel* ch, uint8_t* buffer, uint32_t size)
+{
+    if (buffer && size) {
+        // Largest power of two within the given part, the counters wrap around without a jump then
+        while (size & (size - 1)) {
+            size &= size - 1;
+        }
+        ch->data = buffer;
+        ch->size = size;
+    } else {
+        ch->data = ch->ring;
+        ch->size = MQTT_MEM_PIPE_SIZE;
+    }
+}
+
+static void channel_reset(struct mqtt_mem_channel* ch)
+{
+    ch->rd = 0;
+    ch->wr = 0;
+    ch->first = 0;
+    ch->count = 0;
+}
+
+static bool drop_write(struct mqtt_mem_pipe* pipe)
+{
+    if (!pipe->config.loss_permille) {
+        return false;
+    }
+    // xorshift32, reproducible for a given seed
+    uint32_t x = pipe->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pipe->rng = x;
+    return x % 1000 < pipe->config.loss_permille;
+}
+
+static int channel_write(struct mqtt_mem_pipe* pipe, struct mqtt_mem_channel* ch, const uint8_t* data, uint32_t len)
+{
+    if (!len) {
+        return OK;
+    }
+    if (len > ch->size) {
+        return ERROR_OUT_OF_RANGE; // Would never fit, not even into the empty channel
+    }
+    if (len > ch->size - (ch->wr - ch->rd) || ch->count == MQTT_MEM_PIPE_WRITES) {
+        return ERROR_OUT_OF_RESOURCE;
+    }
+    if (drop_write(pipe)) {
+        pipe->dropped++;
+        return OK; // Lost on the way, the writer does not notice
+    }
+
+    uint32_t pos = ch->wr & (ch->size - 1);
+    uint32_t part = ch->size - pos;
+    if (part > len) {
+        part = len;
+    }
+    memcpy(ch->data + pos, data, part);
+    memcpy(ch->data, data + part, len - part);
+    ch->wr += len;
+
+    uint16_t index = (ch->first + ch->count++) % MQTT_MEM_PIPE_WRITES;
+    ch->writes[index].end = ch->wr;
+    ch->writes[index].due = get_time_ms() + pipe->config.latency_ms;
+    return OK;
+}
+
+static uint32_t channel_read(struct mqtt_mem_pipe* pipe, struct mqtt_mem_channel* ch, uint8_t* data, uint32_t len)
+{
+    // Readable are the bytes of all writes which are due, or of the first one only
+    uint32_t now = get_time_ms();
+    uint32_t end = ch->rd;
+    for (uint16_t i = 0; i < ch->count; i++) {
+        uint16_t index = (ch->first + i) % MQTT_MEM_PIPE_WRITES;
+        if ((int32_t)(now - ch->writes[index].due) < 0) {
+            break;
+        }
+        end = ch->writes[index].end;
+        if (pipe->config.split_writes) {
+            break;
+        }
+    }
+
+    uint32_t n = end - ch->rd;
+    if (pipe->config.max_segment && n > pipe->config.max_segment) {
+        n = pipe->config.max_segment;
+    }
+    if (n > len) {
+        n = len;
+    }
+
+    uint32_t pos = ch->rd & (ch->size - 1);
+    uint32_t part = ch->size - pos;
+    if (part > n) {
+        part = n;
+    }
+    memcpy(data, ch->data + pos, part);
+    memcpy(data + part, ch->data, n - part);
+    ch->rd += n;
+
+    // Drop the boundaries of writes read completely
+    while (ch->count && (int32_t)(ch->rd - ch->writes[ch->first].end) >= 0) {
+        ch->first = (ch->first + 1) % MQTT_MEM_PIPE_WRITES;
+        ch->count--;
+    }
+    return n;
+}
+
+void mqtt_mem_pipe_init(struct mqtt_mem_pipe* pipe, const struct mqtt_mem_config* config)
+{
+    memset(&pipe->config, 0, sizeof(pipe->config));
+    if (config) {
+        pipe->config = *config;
+    }
+    pipe->rng = pipe->config.seed ? pipe->config.seed : 1;
+    pipe->dropped = 0;
+    pipe->connected = false;
+    pipe->peer_closed = false;
+    uint32_t half = pipe->config.buffer_size / 2;
+    channel_setup(&pipe->to_peer, pipe->config.buffer, half);
+    channel_setup(&pipe->to_client, pipe->config.buffer ? pipe->config.buffer + half : NULL, half);
+    channel_reset(&pipe->to_peer);
+    channel_reset(&pipe->to_client);
+}
+
+/***** Peer side *********************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+int mqtt_mem_peer_write(struct mqtt_mem_pipe* pipe, const void* data, uint32_t len)
+{
+    if (!pipe || (!data && len)) {
+        return ERROR_NULL_REFERENCE;
+    }
+    if (!pipe->connected || pipe->peer_closed) {
+        return ERROR_NOT_CONNECTED;
+    }
+    return channel_write(pipe, &pipe->to_client, data, len);
+}
+
+uint32_t mqtt_mem_peer_read(struct mqtt_mem_pipe* pipe, void* data, uint32_t len)
+{
+    if (!pipe || !data) {
+        return 0;
+    }
+    return channel_read(pipe, &pipe->to_peer, data, len);
+}
+
+void mqtt_mem_peer_close(struct mqtt_mem_pipe* pipe)
+{
+    if (pipe) {
+        pipe->peer_closed = true;
+    }
+}
+
+/***** Client side *******************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static int open_conn(struct mqtt_client* client, const char* addr)
+{
+    struct mqtt_mem_pipe* pipe = (struct mqtt_mem_pipe*) client->context;
+    if (!pipe) {
+        return ERROR_NULL_REFERENCE;
+    }
+    // A new connection starts with empty channels, like a new socket would
+    channel_reset(&pipe->to_peer);
+    channel_reset(&pipe->to_client);
+    pipe->peer_closed = false;
+    pipe->connected = true;
+    client->net.connected = true;
+    return OK;
+}
+
+static int close_conn(struct mqtt_client* client)
+{
+    struct mqtt_mem_pipe* pipe = (struct mqtt_mem_pipe*) client->context;
+    if (!pipe) {
+        return ERROR_NULL_REFERENCE;
+    }
+    pipe->connected = false;
+    client->net.connected = false;
+    return OK;
+}
+
+static int mem_send(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    struct mqtt_mem_pipe* pipe = (struct mqtt_mem_pipe*) client->context;
+    if (!pipe || !buf || !buf->payload) {
+        return ERROR_NULL_REFERENCE;
+    }
+    if (pipe->peer_closed) {
+        return ERROR_HOST_UNAVAILABLE;
+    }
+    return channel_write(pipe, &pipe->to_peer, buf->payload, (uint32_t) buf->len);
+}
+
+static int mem_recv(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    struct mqtt_mem_pipe* pipe = (struct mqtt_mem_pipe*) client->context;
+    if (!pipe || !buf || !buf->payload) {
+        return ERROR_NULL_REFERENCE;
+    }
+    buf->len = channel_read(pipe, &pipe->to_client, buf->payload, (uint32_t) buf->len);
+    if (buf->len) {
+        return STATUS_SUCCESS;
+    }
+    // Closed by the peer and everything it wrote before has been read
+    if (pipe->peer_closed && !pipe->to_client.count) {
+        return ERROR_HOST_UNAVAILABLE;
+    }
+    return STATUS_PASSED;
+}
+
+int mqtt_mem_attach(struct mqtt_client* stat, void* pipe)
+{
+    if (!pipe) {
+        return ERROR_NULL_REFERENCE;
+    }
+    stat->net.alloc_recv_buf = netbuf_alloc_recv;
+    stat->net.alloc_send_buf = netbuf_alloc_send;
+    stat->net.free_recv_buf = netbuf_free_recv;
+    stat->net.free_send_buf = netbuf_free_send;
+    stat->net.open_conn = open_conn;
+    stat->net.close_conn = close_conn;
+    stat->net.send = mem_send;
+    stat->net.recv = mem_recv;
+    stat->context = pipe;
+    return OK;
+}
@@ -0,0 +1,499 @@
+/**
+ * @file mqtt_shm.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief MQTT Network interface implementation over shared memory rings (Linux)
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "mqtt_shm.h"
+#include "status.h"
+#include "systime.h"
+#include "netbuf.h"
+#include "transport.h"
+
+// Both processes operate on the same words, this only works without hidden locks
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2, "The shared memory transport needs lock-free 32 bit atomics");
+_Static_assert((MQTT_SHM_RING_SIZE & (MQTT_SHM_RING_SIZE - 1)) == 0, "MQTT_SHM_RING_SIZE must be a power of two");
+
+#define SHM_MAGIC      0x4d514c53u  // "MQLS"
+#define SHM_FOREVER    UINT32_MAX
+
+enum shm_state {
+    SHM_CREATED,            // Zero filled by ftruncate(), not yet initialized by the peer
+    SHM_LISTENING,
+    SHM_CONNECTED,
+    SHM_CLIENT_CLOSED,
+    SHM_PEER_CLOSED
+};
+
+/*
+ * Single producer/single consumer ring with free running counters. Each side
+ * owns the cache line of the counter it writes. The sleeping flag is set by
+ * a side before it waits on the futex of the counter the other side writes.
+ */
+struct shm_ring {
+    _Alignas(64) _Atomic uint32_t head;         // Written by the producer
+    _Atomic uint32_t consumer_sleeping;         // Consumer waits on head
+    _Alignas(64) _Atomic uint32_t tail;         // Written by the consumer
+    _Atomic uint32_t producer_sleeping;         // Producer waits on tail
+};
+
+/* Layout of the segment, the data of to_peer and then of to_client follows */
+struct shm_segment {
+    uint32_t magic;
+    uint32_t ring_size;
+    _Atomic uint32_t state;
+    struct shm_ring to_peer;
+    struct shm_ring to_client;
+};
+
+struct shm_context {
+    struct shm_segment* seg;
+    size_t size;
+};
+
+/***** Rings *************************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+static void futex_wait(_Atomic uint32_t* word, uint32_t seen, uint32_t timeout_ms)
+{
+    struct timespec ts = { .tv_sec = timeout_ms / 1000, .tv_nsec = (long) (timeout_ms % 1000) * 1000000L };
+    // Not FUTEX_PRIVATE_FLAG, the word is shared between processes
+    syscall(SYS_futex, (uint32_t*) word, FUTEX_WAIT, seen, &ts, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* word)
+{
+    syscall(SYS_futex, (uint32_t*) word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* The other side only pays for the system call when this side actually sleeps */
+static void wake_sleeper(_Atomic uint32_t* word, _Atomic uint32_t* sleeping)
+{
+    // Orders the counter update before the flag check, pairs with the store in wait_change()
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(sleeping, memory_order_relaxed)) {
+        futex_wake(word);
+    }
+}
+
+/* On a single CPU the other side cannot make progress while this one spins */
+static int spin_count(void)
+{
+    static _Atomic int count = -1;
+    int n = atomic_load_explicit(&count, memory_order_relaxed);
+    if (n < 0) {
+        n = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? MQTT_SHM_SPIN_COUNT : 0;
+        atomic_store_explicit(&count, n, memory_order_relaxed);
+    }
+    return n;
+}
+
+/* Spins and then sleeps until the word differs from seen or the timeout expired */
+static void wait_change(_Atomic uint32_t* word, uint32_t seen, _Atomic uint32_t* sleeping, uint32_t timeout_ms)
+{
+    int spins = spin_count();
+    for (int i = 0; i < spins; i++) {
+        if (atomic_load_explicit(word, memory_order_acquire) != seen) {
+            return;
+        }
+        cpu_relax();
+    }
+    atomic_store(sleeping, 1);
+    if (atomic_load(word) == seen) {
+        futex_wait(word, seen, timeout_ms);
+    }
+    atomic_store_explicit(sleeping, 0, memory_order_relaxed);
+}
+
+static uint32_t ring_write(struct shm_ring* r, uint8_t* data, uint32_t size, const uint8_t* src, uint32_t len)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    uint32_t n = size - (head - tail);
+    if (n > len) {
+        n = len;
+    }
+    if (!n) {
+        return 0;
+    }
+    uint32_t pos = head & (size - 1);
+    uint32_t first = n < size - pos ? n : size - pos;
+    memcpy(data + pos, src, first);
+    memcpy(data, src + first, n - first);
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+    wake_sleeper(&r->head, &r->consumer_sleeping);
+    return n;
+}
+
+static uint32_t ring_read(struct shm_ring* r, const uint8_t* data, uint32_t size, uint8_t* dst, uint32_t len)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint32_t n = head - tail;
+    if (n > len) {
+        n = len;
+    }
+    if (!n) {
+        return 0;
+    }
+    uint32_t pos = tail & (size - 1);
+    uint32_t first = n < size - pos ? n : size - pos;
+    memcpy(dst, data + pos, first);
+    memcpy(dst + first, data, n - first);
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    wake_sleeper(&r->tail, &r->producer_sleeping);
+    return n;
+}
+
+/***** Endpoints *********************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static uint8_t* ring_data(struct shm_segment* seg, bool to_client)
+{
+    return (uint8_t*) (seg + 1) + (to_client ? seg->ring_size : 0);
+}
+
+/* Sleeps are sliced, so a side notices when the other one closes while it waits */
+static uint32_t wait_slice(uint32_t deadline, uint32_t timeout_ms)
+{
+    if (timeout_ms == SHM_FOREVER) {
+        return MQTT_POLL_TIMEOUT;
+    }
+    int32_t left = (int32_t) (deadline - get_time_ms());
+    if (left <= 0) {
+        return 0;
+    }
+    return (uint32_t) left < MQTT_POLL_TIMEOUT ? (uint32_t) left : MQTT_POLL_TIMEOUT;
+}
+
+/* Number of bytes read, 0 on timeout, ERROR_HOST_UNAVAILABLE when the other side closed */
+static int endpoint_read(struct shm_segment* seg, bool peer, uint8_t* dst, uint32_t len, uint32_t timeout_ms)
+{
+    struct shm_ring* r = peer ? &seg->to_peer : &seg->to_client;
+    const uint8_t* data = ring_data(seg, !peer);
+    uint32_t closed = peer ? SHM_CLIENT_CLOSED : SHM_PEER_CLOSED;
+    uint32_t deadline = get_time_ms() + (timeout_ms == SHM_FOREVER ? 0 : timeout_ms);
+
+    for (;;) {
+        uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        uint32_t n = ring_read(r, data, seg->ring_size, dst, len);
+        if (n) {
+            return (int) n;
+        }
+        if (atomic_load_explicit(&seg->state, memory_order_acquire) == closed) {
+            // Bytes written before closing are still delivered
+            n = ring_read(r, data, seg->ring_size, dst, len);
+            return n ? (int) n : ERROR_HOST_UNAVAILABLE;
+        }
+        uint32_t slice = timeout_ms ? wait_slice(deadline, timeout_ms) : 0;
+        if (!slice) {
+            return 0;
+        }
+        wait_change(&r->head, tail, &r->consumer_sleeping, slice);
+    }
+}
+
+static int endpoint_write(struct shm_segment* seg, bool peer, const uint8_t* src, uint32_t len, uint32_t timeout_ms)
+{
+    struct shm_ring* r = peer ? &seg->to_client : &seg->to_peer;
+    uint8_t* data = ring_data(seg, peer);
+    uint32_t deadline = get_time_ms() + (timeout_ms == SHM_FOREVER ? 0 : timeout_ms);
+
+    for (;;) {
+        if (atomic_load_explicit(&seg->state, memory_order_acquire) != SHM_CONNECTED) {
+            return ERROR_HOST_UNAVAILABLE;
+        }
+        uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        uint32_t n = ring_write(r, data, seg->ring_size, src, len);
+        src += n;
+        len -= n;
+        if (!len) {
+            return OK;
+        }
+        uint32_t slice = wait_slice(deadline, timeout_ms);
+        if (!slice) {
+            return ERROR_TIMEOUT;
+        }
+        wait_change(&r->tail, tail, &r->producer_sleeping, slice);
+    }
+}
+
+/* Wakes whoever sleeps on the segment, after a state change */
+static void wake_all(struct shm_segment* seg)
+{
+    futex_wake(&seg->to_peer.head);
+    futex_wake(&seg->to_peer.tail);
+    futex_wake(&seg->to_client.head);
+    futex_wake(&seg->to_client.tail);
+}
+
+/* "name", "/name" and "shm://name" address the same segment */
+static int segment_name(const char* name, char* out, size_t size)
+{
+    while (*name == '/') {
+        name++;
+    }
+    size_t len = strlen(name);
+    if (!len || len + 2 > size || strchr(name, '/')) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+    out[0] = '/';
+    memcpy(out + 1, name, len + 1);
+    return OK;
+}
+
+/***** Peer side *********************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+int mqtt_shm_peer_create(struct mqtt_shm_peer* peer, const char* name, uint32_t ring_size)
+{
+    if (!peer || !name) {
+        return ERROR_NULL_REFERENCE;
+    }
+    if (!ring_size) {
+        ring_size = MQTT_SHM_RING_SIZE;
+    }
+    if (ring_size & (ring_size - 1)) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+    int result = segment_name(name, peer->name, sizeof(peer->name));
+    if (FAILED(result)) {
+        return result;
+    }
+
+    peer->size = sizeof(struct shm_segment) + 2 * (size_t) ring_size;
+    shm_unlink(peer->name);
+    int fd = shm_open(peer->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+        return ERROR_RESOURCE_UNAVAILABLE;
+    }
+    if (ftruncate(fd, (off_t) peer->size) == -1) {
+        close(fd);
+        shm_unlink(peer->name);
+        return ERROR_OUT_OF_MEMORY;
+    }
+    peer->segment = mmap(NULL, peer->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (peer->segment == MAP_FAILED) {
+        peer->segment = NULL;
+        shm_unlink(peer->name);
+        return ERROR_OUT_OF_MEMORY;
+    }
+
+    struct shm_segment* seg = (struct shm_segment*) peer->segment;
+    seg->magic = SHM_MAGIC;
+    seg->ring_size = ring_size;
+    // Publishes magic and size to clients checking the state
+    atomic_store_explicit(&seg->state, SHM_LISTENING, memory_order_release);
+    return OK;
+}
+
+int mqtt_shm_peer_read(struct mqtt_shm_peer* peer, void* data, uint32_t len, uint32_t timeout_ms)
+{
+    if (!peer || !peer->segment || !data) {
+        return ERROR_NULL_REFERENCE;
+    }
+    return endpoint_read((struct shm_segment*) peer->segment, true, data, len, timeout_ms);
+}
+
+int mqtt_shm_peer_write(struct mqtt_shm_peer* peer, const void* data, uint32_t len, uint32_t timeout_ms)
+{
+    if (!peer || !peer->segment || !data) {
+        return ERROR_NULL_REFERENCE;
+    }
+    return endpoint_write((struct shm_segment*) peer->segment, true, data, len, timeout_ms);
+}
+
+void mqtt_shm_peer_accept(struct mqtt_shm_peer* peer)
+{
+    if (!peer || !peer->segment) {
+        return;
+    }
+    struct shm_segment* seg = (struct shm_segment*) peer->segment;
+    if (atomic_load(&seg->state) != SHM_CLIENT_CLOSED) {
+        return;
+    }
+    // Nobody else touches the rings until the next client has connected
+    atomic_store_explicit(&seg->to_peer.head, 0, memory_order_relaxed);
+    atomic_store_explicit(&seg->to_peer.tail, 0, memory_order_relaxed);
+    atomic_store_explicit(&seg->to_client.head, 0, memory_order_relaxed);
+    atomic_store_explicit(&seg->to_client.tail, 0, memory_order_relaxed);
+    atomic_store_explicit(&seg->state, SHM_LISTENING, memory_order_release);
+}
+
+void mqtt_shm_peer_destroy(struct mqtt_shm_peer* peer)
+{
+    if (!peer || !peer->segment) {
+        return;
+    }
+    struct shm_segment* seg = (struct shm_segment*) peer->segment;
+    atomic_store(&seg->state, SHM_PEER_CLOSED);
+    wake_all(seg);
+    munmap(peer->segment, peer->size);
+    shm_unlink(peer->name);
+    peer->segment = NULL;
+}
+
+/***** Client side *******************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static int open_conn(struct mqtt_client* client, const char* addr)
+{
+    if (!client || !addr || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct shm_context* ctx = (struct shm_context*) client->context;
+    char name[MQTT_SHM_NAME_SIZE];
+    int result = segment_name(addr, name, sizeof(name));
+    if (FAILED(result)) {
+        return result;
+    }
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+        return ERROR_HOST_UNAVAILABLE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(struct shm_segment)) {
+        close(fd);
+        return ERROR_HOST_UNAVAILABLE;
+    }
+    void* mem = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+
+    // The peer may still be initializing, the state is only set afterwards
+    struct shm_segment* seg = (struct shm_segment*) mem;
+    uint32_t state = SHM_LISTENING;
+    if (!atomic_compare_exchange_strong(&seg->state, &state, SHM_CONNECTED)) {
+        munmap(mem, (size_t) st.st_size);
+        return ERROR_HOST_UNAVAILABLE;
+    }
+    if (seg->magic != SHM_MAGIC || (size_t) st.st_size < sizeof(struct shm_segment) + 2 * (size_t) seg->ring_size) {
+        atomic_store(&seg->state, SHM_CLIENT_CLOSED);
+        munmap(mem, (size_t) st.st_size);
+        return ERROR_INVALID_DATA;
+    }
+    ctx->seg = seg;
+    ctx->size = (size_t) st.st_size;
+    client->net.connected = true;
+    return OK;
+}
+
+static int close_conn(struct mqtt_client* client)
+{
+    if (!client || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct shm_context* ctx = (struct shm_context*) client->context;
+    client->net.connected = false;
+    if (!ctx->seg) {
+        return OK;
+    }
+    uint32_t state = SHM_CONNECTED;
+    atomic_compare_exchange_strong(&ctx->seg->state, &state, SHM_CLIENT_CLOSED);
+    wake_all(ctx->seg);
+    munmap(ctx->seg, ctx->size);
+    ctx->seg = NULL;
+    return OK;
+}
+
+static int shm_send(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    if (!client || !buf || !buf->payload || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct shm_context* ctx = (struct shm_context*) client->context;
+    if (!ctx->seg) {
+        return ERROR_HOST_UNAVAILABLE;
+    }
+    // Waits for room like a blocking socket, a packet is never sent partially
+    return endpoint_write(ctx->seg, false, buf->payload, (uint32_t) buf->len, SHM_FOREVER);
+}
+
+static int shm_recv(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    if (!client || !buf || !buf->payload || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct shm_context* ctx = (struct shm_context*) client->context;
+    if (!ctx->seg) {
+        buf->len = 0;
+        return ERROR_HOST_UNAVAILABLE;
+    }
+    int n = endpoint_read(ctx->seg, false, buf->payload, (uint32_t) buf->len, MQTT_POLL_TIMEOUT);
+    if (n <= 0) {
+        buf->len = 0;
+        return n ? n : STATUS_PASSED;
+    }
+    buf->len = (uint32_t) n;
+    return STATUS_SUCCESS;
+}
+
+static void release(struct mqtt_client* client)
+{
+    struct shm_context* ctx = (struct shm_context*) client->context;
+    if (ctx->seg) {
+        close_conn(client); // Freed without disconnect
+    }
+    transport_state_free(client, ctx);
+    client->context = NULL;
+}
+
+static int attach(struct mqtt_client* client, void* context)
+{
+    struct shm_context* ctx = transport_state_alloc(client, sizeof(struct shm_context));
+    if (!ctx) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    client->net.alloc_recv_buf = netbuf_alloc_recv;
+    client->net.alloc_send_buf = netbuf_alloc_send;
+    client->net.free_recv_buf = netbuf_free_recv;
+    client->net.free_send_buf = netbuf_free_send;
+    client->net.open_conn = open_conn;
+    client->net.close_conn = close_conn;
+    client->net.send = shm_send;
+    client->net.recv = shm_recv;
+    client->net.release = release;
+    client->context = ctx;
+    return OK;
+}
+
+const struct mqtt_transport mqtt_shm_transport = {
+    .scheme = "shm",
+    .attach = attach,
+    .context = NULL
+};
@@ -1,7 +1,7 @@
 /**
  * @file mqtt_socket.c
  * @author Pierre Biermann (https://github.com/ByteBender747)
- * @brief MQTT Network interface implementation for Berkeley sockets
+ * @brief MQTT Network interface implementation for Berkeley sockets (TCP and Unix domain)
  * @version 0.1
  * @date 2025-06-30
  * 
@@ -12,8 +12,10 @@
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 
 #include <unistd.h>
+#include <stddef.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -24,17 +26,17 @@
 #include <errno.h>
 #include <poll.h>
 
-#include "mqtt_types.h"
+#include "mqtt.h"
 #include "status.h"
-
-#define RECV_BUFFER_SIZE      4096
+#include "netbuf.h"
+#include "transport.h"
+#include "tcp.h"
 
 struct socket_context {
     int handle;
-    struct mqtt_client* client;
 };
 
-static int create_tcp_client(const char* ipaddr, uint16_t port, int* sh)
+int mqtt_tcp_connect(const char* ipaddr, uint16_t port, int* sh)
 {
     struct sockaddr_in sa;
     int handle = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -48,7 +50,8 @@ static int create_tcp_client(const char* ipaddr, uint16_t port, int* sh)
         sa.sin_addr.s_addr = htonl(INADDR_ANY);
     } else {
         int res = inet_pton(AF_INET, ipaddr, &sa.sin_addr);
-        if (res == -1) {
+        if (res != 1) {
+            close(handle);
             return ERROR_INVALID_DATA;
         }
     }
@@ -60,56 +63,66 @@ static int create_tcp_client(const char* ipaddr, uint16_t port, int* sh)
     return OK;
 }
 
-static int alloc_send_buf(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
+/* A leading '@' selects the abstract namespace (Linux), anything else is a filesystem path */
+static int create_unix_client(const char* path, int* sh)
 {
-    buf->payload = malloc(len);
-    if (!buf->payload) {
-        buf->len = 0;
-        return ERROR_OUT_OF_MEMORY;
+    struct sockaddr_un sa;
+    size_t len = strlen(path);
+    if (!len || len >= sizeof(sa.sun_path)) {
+        return ERROR_INVALID_ARGUMENT;
     }
-    buf->len = len;
-    return OK;
-}
-
-static int alloc_recv_buf(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
-{
-    uint32_t alloc_len = (len > 0) ? len : RECV_BUFFER_SIZE;
-    buf->payload = malloc(alloc_len);
-    if (!buf->payload) {
-        buf->len = 0;
-        return ERROR_OUT_OF_MEMORY;
+    memset(&sa, 0, sizeof sa);
+    sa.sun_family = AF_UNIX;
+    memcpy(sa.sun_path, path, len);
+    socklen_t sa_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + 1);
+    if (path[0] == '@') {
+#ifdef __linux__
+        // Abstract names are not terminated, every byte of the length counts
+        sa.sun_path[0] = '\0';
+        sa_len--;
+#else
+        return ERROR_INVALID_ARGUMENT;
+#endif
     }
-    buf->len = alloc_len;
-    return OK;
-}
 
-static int free_send_buf(struct mqtt_client* client, struct mqtt_pbuf* buf)
-{
-    if (buf->payload) {
-        free(buf->payload);
-        buf->payload = NULL;
+    int handle = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (handle == -1) {
+        return ERROR_HW_FAILURE;
     }
-    buf->len = 0;
+    if (connect(handle, (struct sockaddr *)&sa, sa_len) == -1) {
+        close(handle);
+        return ERROR_HOST_UNAVAILABLE;
+    }
+    *sh = handle;
     return OK;
 }
 
-static int free_recv_buf(struct mqtt_client* client, struct mqtt_pbuf* buf)
+static int open_conn(struct mqtt_client* client, const char* addr)
 {
-    if (buf->payload) {
-        free(buf->payload);
-        buf->payload = NULL;
+    if (!client || !addr || !client->context) {
+        return ERROR_NULL_REFERENCE;
     }
-    buf->len = 0;
-    return OK;
+    struct socket_context* ctx = (struct socket_context*)client->context;
+    char host[INET_ADDRSTRLEN];
+    uint16_t port;
+    int result = transport_parse_address(addr, host, sizeof(host), MQTT_PORT, &port);
+    if (FAILED(result)) {
+        return result;
+    }
+    result = mqtt_tcp_connect(host, port, &ctx->handle);
+    if (SUCCESSFUL(result)) {
+        client->net.connected = true;
+    }
+    return result;
 }
 
-static int open_conn(struct mqtt_client* client, const char* addr)
+static int open_unix_conn(struct mqtt_client* client, const char* addr)
 {
     if (!client || !addr || !client->context) {
         return ERROR_NULL_REFERENCE;
     }
     struct socket_context* ctx = (struct socket_context*)client->context;
-    int result = create_tcp_client(addr, MQTT_PORT, &ctx->handle);
+    int result = create_unix_client(addr, &ctx->handle);
     if (SUCCESSFUL(result)) {
         client->net.connected = true;
     }
@@ -123,10 +136,12 @@ static int close_conn(struct mqtt_client* client)
     }
     
     struct socket_context* ctx = (struct socket_context*) client->context;
-    if (close(ctx->handle) == -1) {
+    int handle = ctx->handle;
+    ctx->handle = -1;
+    client->net.connected = false;
+    if (close(handle) == -1) {
         return ERROR_HW_FAILURE;
     }
-    client->net.connected = false;
 
     return OK;
 }
@@ -198,17 +213,55 @@ static int socket_recv(struct mqtt_client* client, struct mqtt_pbuf* buf)
     return STATUS_SUCCESS;
 }
 
-void mqtt_assign_net_api(struct mqtt_client* client)
+static void release(struct mqtt_client* client)
+{
+    struct socket_context* ctx = (struct socket_context*) client->context;
+    if (ctx->handle >= 0) {
+        close(ctx->handle); // Freed without disconnect
+    }
+    transport_state_free(client, ctx);
+    client->context = NULL;
+}
+
+/* Both socket families share buffers, framing and I/O, only connecting differs */
+static int attach_socket(struct mqtt_client* client, int (*open)(struct mqtt_client*, const char*))
 {
-    static struct socket_context ctx;
-    client->net.alloc_recv_buf = alloc_recv_buf;
-    client->net.alloc_send_buf = alloc_send_buf;
-    client->net.free_recv_buf = free_recv_buf;
-    client->net.free_send_buf = free_send_buf;
-    client->net.open_conn = open_conn;
+    struct socket_context* ctx = transport_state_alloc(client, sizeof(struct socket_context));
+    if (!ctx) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    ctx->handle = -1;
+    client->net.alloc_recv_buf = netbuf_alloc_recv;
+    client->net.alloc_send_buf = netbuf_alloc_send;
+    client->net.free_recv_buf = netbuf_free_recv;
+    client->net.free_send_buf = netbuf_free_send;
+    client->net.open_conn = open;
     client->net.close_conn = close_conn;
     client->net.send = socket_send;
     client->net.recv = socket_recv;
-    client->context = &ctx;
-    ctx.client = client;
-}
\ No newline at end of file
+    client->net.release = release;
+    client->context = ctx;
+    return OK;
+}
+
+static int attach_tcp(struct mqtt_client* client, void* context)
+{
+    return attach_socket(client, open_conn);
+}
+
+static int attach_unix(struct mqtt_client* client, void* context)
+{
+    return attach_socket(client, open_unix_conn);
+}
+
+const struct mqtt_transport mqtt_tcp_transport = {
+    .scheme = "tcp",
+    .attach = attach_tcp,
+    .context = NULL
+};
+
+const struct mqtt_transport mqtt_unix_transport = {
+    .scheme = "unix",
+    .attach = attach_unix,
+    .context = NULL
+};
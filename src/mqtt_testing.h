@@ -0,0 +1,47 @@
+/**
+ * @file mqtt_testing.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Entry points into internal codec functions, only built with MQTT_TESTING
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#ifndef MQTT_TESTING_H_INCLUDED
+#define MQTT_TESTING_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mqtt_types.h"
+
+#ifdef MQTT_TESTING
+
+/*
+ * Thin wrappers around static functions of mqtt_client.c. Pack functions write
+ * through stat->pout, unpack functions read through stat->pin up to stat->pin_end.
+ * The library itself keeps the functions static, so nothing of this is part of a
+ * regular build.
+ */
+
+void mqtt_test_pack_variable_size(struct mqtt_client* stat, uint32_t size);
+uint32_t mqtt_test_unpack_variable_size(struct mqtt_client* stat);
+void mqtt_test_pack_string(struct mqtt_client* stat, const char* data);
+char* mqtt_test_unpack_string(struct mqtt_client* stat);
+void mqtt_test_release_packet_data(struct mqtt_client* stat);
+
+/* Size estimation when stat->pout is NULL, encoding otherwise, like the library does */
+void mqtt_test_make_publish(struct mqtt_client* stat, struct mqtt_pub_packet* msg);
+
+/* Processes the variable header and payload of a PUBLISH, data starts after the fixed header */
+int mqtt_test_process_publish(struct mqtt_client* stat, uint8_t flags, uint8_t* data, uint32_t len);
+
+int mqtt_test_reserve_slot(struct mqtt_client* stat, mqtt_packet_type await);
+int mqtt_test_free_slot(struct mqtt_client* stat, uint16_t packet_id);
+bool mqtt_test_await_packet(struct mqtt_client* stat, mqtt_packet_type type);
+
+#endif
+
+#endif /* MQTT_TESTING_H_INCLUDED */
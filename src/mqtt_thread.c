@@ -0,0 +1,281 @@
+/**
+ * @file mqtt_thread.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Background I/O thread with dispatch of received messages to worker threads
+ * @version 0.1
+ * @date 2025-07-24
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "mqtt.h"
+#include "common.h"
+#include "status.h"
+#include "systime.h"
+#include "mqtt_alloc.h"
+
+struct dispatch_job {
+    struct dispatch_job* next;
+    struct mqtt_message msg;
+    /* Copies of topic, strings, correlation data and payload follow */
+};
+
+struct dispatch_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct dispatch_job* head;
+    struct dispatch_job* tail;
+    bool stop;
+    struct mqtt_client* client;
+};
+
+struct mqtt_io_thread {
+    pthread_t thread;
+    atomic_bool running;
+    unsigned int worker_count;
+    struct dispatch_worker workers[];
+};
+
+void WEAK mqtt_dispatched_publish(struct mqtt_client* stat, const struct mqtt_message* msg)
+{
+    /* Can be overloaded by user code */
+}
+
+static uint32_t hash_topic(const char* topic)
+{
+    // FNV-1a, messages of one topic always end up at the same worker
+    uint32_t hash = 2166136261u;
+    while (*topic) {
+        hash ^= (uint8_t) *topic++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static char* copy_string(char** dest, const char* source)
+{
+    if (!source) {
+        return NULL;
+    }
+    char* copy = *dest;
+    size_t len = strlen(source) + 1;
+    memcpy(copy, source, len);
+    *dest += len;
+    return copy;
+}
+
+static struct dispatch_job* create_job(struct mqtt_client* stat)
+{
+    const char* topic = stat->received_publish.topic;
+    const char* response_topic = stat->received_publish.response_topic;
+    const char* content_type = stat->received_publish.content_type;
+    size_t size = sizeof(struct dispatch_job)
+                  + strlen(topic) + 1
+                  + (response_topic ? strlen(response_topic) + 1 : 0)
+                  + (content_type ? strlen(content_type) + 1 : 0)
+                  + stat->received_publish.correlation_data.len
+                  + stat->received_publish.payload.len;
+
+    struct dispatch_job* job = mqtt_malloc(stat, size);
+    if (!job) {
+        return NULL;
+    }
+    char* data = (char*)(job + 1);
+
+    job->next = NULL;
+    job->msg.topic = copy_string(&data, topic);
+    job->msg.response_topic = copy_string(&data, response_topic);
+    job->msg.content_type = copy_string(&data, content_type);
+
+    job->msg.correlation_data.len = stat->received_publish.correlation_data.len;
+    job->msg.correlation_data.maxlen = job->msg.correlation_data.len;
+    job->msg.correlation_data.data = job->msg.correlation_data.len ? (uint8_t*) data : NULL;
+    if (job->msg.correlation_data.len) {
+        memcpy(data, stat->received_publish.correlation_data.data, job->msg.correlation_data.len);
+        data += job->msg.correlation_data.len;
+    }
+
+    job->msg.payload.len = stat->received_publish.payload.len;
+    job->msg.payload.maxlen = job->msg.payload.len;
+    job->msg.payload.data = job->msg.payload.len ? (uint8_t*) data : NULL;
+    if (job->msg.payload.len) {
+        memcpy(data, stat->received_publish.payload.data, job->msg.payload.len);
+    }
+
+    job->msg.packet_id = stat->received_publish.packet_id;
+    job->msg.message_expiry_interval = stat->received_publish.message_expiry_interval;
+    job->msg.subscription_identifier = stat->received_publish.subscription_identifier;
+    job->msg.qos = stat->received_publish.qos;
+    job->msg.payload_format_indicator = stat->received_publish.payload_format_indicator;
+    job->msg.dup = stat->received_publish.dup;
+    job->msg.retain = stat->received_publish.retain;
+    return job;
+}
+
+static int dispatch_publish(struct mqtt_client* stat)
+{
+    struct mqtt_io_thread* io = stat->io_thread;
+    struct dispatch_job* job = create_job(stat);
+    if (!job) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+
+    struct dispatch_worker* worker = &io->workers[hash_topic(job->msg.topic) % io->worker_count];
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail) {
+        worker->tail->next = job;
+    } else {
+        worker->head = job;
+    }
+    worker->tail = job;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->lock);
+    return OK;
+}
+
+static void* worker_main(void* arg)
+{
+    struct dispatch_worker* worker = (struct dispatch_worker*) arg;
+
+    pthread_mutex_lock(&worker->lock);
+    while (1) {
+        while (!worker->head && !worker->stop) {
+            pthread_cond_wait(&worker->cond, &worker->lock);
+        }
+        struct dispatch_job* job = worker->head;
+        if (!job) {
+            break; // Stopped and all jobs handled
+        }
+        worker->head = job->next;
+        if (!worker->head) {
+            worker->tail = NULL;
+        }
+        pthread_mutex_unlock(&worker->lock);
+
+        mqtt_dispatched_publish(worker->client, &job->msg);
+        mqtt_free(worker->client, job);
+
+        pthread_mutex_lock(&worker->lock);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
+}
+
+static void* io_thread_main(void* arg)
+{
+    struct mqtt_client* stat = (struct mqtt_client*) arg;
+    struct mqtt_io_thread* io = stat->io_thread;
+    uint32_t last_ping = get_time_ms();
+
+    while (atomic_load(&io->running) && stat->net.connected) {
+        int result = mqtt_poll(stat);
+        if (FAILED(result) && BASE_ERROR(result) == E_ERROR_HOST_UNAVAILABLE) {
+            stat->connected = false;
+            break;
+        }
+
+        // Keep the connection alive independent of the load of the workers
+        uint32_t keep_alive = stat->connack.server_keep_alive;
+        if (stat->connected && keep_alive && (get_time_ms() - last_ping >= keep_alive * SECOND_MS / 2)) {
+            mqtt_ping(stat);
+            last_ping = get_time_ms();
+        }
+    }
+    return NULL;
+}
+
+static void stop_workers(struct mqtt_io_thread* io, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        pthread_mutex_lock(&io->workers[i].lock);
+        io->workers[i].stop = true;
+        pthread_cond_signal(&io->workers[i].cond);
+        pthread_mutex_unlock(&io->workers[i].lock);
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        pthread_join(io->workers[i].thread, NULL);
+        pthread_cond_destroy(&io->workers[i].cond);
+        pthread_mutex_destroy(&io->workers[i].lock);
+    }
+}
+
+int mqtt_start_io_thread(struct mqtt_client* stat, unsigned int worker_count)
+{
+    if (!stat) {
+        return ERROR_NULL_REFERENCE;
+    }
+    if (stat->io_thread) {
+        return ERROR_INVALID_OPERATION;
+    }
+    if (!worker_count) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+
+    // Other threads talk to the client through the submission queue only
+    int result = mqtt_enable_submit_queue(stat);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    struct mqtt_io_thread* io = mqtt_calloc(stat, sizeof(struct mqtt_io_thread)
+                                            + worker_count * sizeof(struct dispatch_worker));
+    if (!io) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    io->worker_count = worker_count;
+    atomic_init(&io->running, true);
+
+    for (unsigned int i = 0; i < worker_count; i++) {
+        struct dispatch_worker* worker = &io->workers[i];
+        worker->client = stat;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            pthread_cond_destroy(&worker->cond);
+            pthread_mutex_destroy(&worker->lock);
+            stop_workers(io, i);
+            mqtt_free(stat, io);
+            return ERROR_OUT_OF_RESOURCE;
+        }
+    }
+
+    stat->io_thread = io;
+    stat->dispatch_publish = dispatch_publish;
+    if (pthread_create(&io->thread, NULL, io_thread_main, stat) != 0) {
+        stat->dispatch_publish = NULL;
+        stat->io_thread = NULL;
+        stop_workers(io, worker_count);
+        mqtt_free(stat, io);
+        return ERROR_OUT_OF_RESOURCE;
+    }
+    return OK;
+}
+
+int mqtt_stop_io_thread(struct mqtt_client* stat)
+{
+    if (!stat) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct mqtt_io_thread* io = stat->io_thread;
+    if (!io) {
+        return ERROR_INVALID_OPERATION;
+    }
+
+    atomic_store(&io->running, false);
+    pthread_join(io->thread, NULL);
+
+    // Messages already dispatched are still handled by the workers
+    stop_workers(io, io->worker_count);
+
+    stat->dispatch_publish = NULL;
+    stat->io_thread = NULL;
+    mqtt_free(stat, io);
+    return OK;
+}
@@ -0,0 +1,448 @@
+/**
+ * @file mqtt_tls.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief MQTT Network interface implementation over TLS (OpenSSL)
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include "mqtt_tls.h"
+#include "status.h"
+#include "netbuf.h"
+#include "transport.h"
+#include "tcp.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10101000L
+#error "The TLS transport needs OpenSSL 1.1.1 or newer"
+#endif
+
+#define TLS_KEY_SIZE    128
+#define TLS_HOST_SIZE   256
+
+/* Resumable session of one broker, keyed by its address */
+struct tls_session {
+    char key[TLS_KEY_SIZE];
+    SSL_SESSION* session;
+    uint32_t used;
+};
+
+struct mqtt_tls_context {
+    SSL_CTX* ssl_ctx;
+    char* server_name;
+    pthread_mutex_t lock;       // Guards the cache and the statistics
+    struct tls_session cache[MQTT_TLS_SESSION_CACHE];
+    uint32_t clock;
+    struct mqtt_tls_stats stats;
+};
+
+/* Per-client state, fits into MQTT_STATIC_TRANSPORT_SIZE */
+struct tls_connection {
+    int handle;
+    SSL* ssl;
+    struct mqtt_tls_context* tls;
+    const char* key;            // Broker address of the client, outlives the connection
+};
+
+static pthread_once_t tls_once = PTHREAD_ONCE_INIT;
+static int connection_index = -1;
+static struct mqtt_tls_context* default_context;
+
+/***** Session cache *****************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static SSL_SESSION* cache_lookup(struct mqtt_tls_context* tls, const char* key)
+{
+    SSL_SESSION* session = NULL;
+    pthread_mutex_lock(&tls->lock);
+    for (int i = 0; i < MQTT_TLS_SESSION_CACHE; i++) {
+        struct tls_session* entry = &tls->cache[i];
+        if (entry->session && !strcmp(entry->key, key)) {
+            if (SSL_SESSION_is_resumable(entry->session)) {
+                session = entry->session;
+                SSL_SESSION_up_ref(session);
+                entry->used = ++tls->clock;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tls->lock);
+    return session;
+}
+
+/* Takes over the reference of the session, the least recently used broker makes room */
+static bool cache_store(struct mqtt_tls_context* tls, const char* key, SSL_SESSION* session)
+{
+    if (strlen(key) >= TLS_KEY_SIZE) {
+        return false;
+    }
+    pthread_mutex_lock(&tls->lock);
+    struct tls_session* slot = &tls->cache[0];
+    for (int i = 0; i < MQTT_TLS_SESSION_CACHE; i++) {
+        struct tls_session* entry = &tls->cache[i];
+        if (entry->session && !strcmp(entry->key, key)) {
+            slot = entry;
+            break;
+        }
+        if (!entry->session || entry->used < slot->used) {
+            slot = entry;
+        }
+    }
+    if (slot->session) {
+        SSL_SESSION_free(slot->session);
+    }
+    strcpy(slot->key, key);
+    slot->session = session;
+    slot->used = ++tls->clock;
+    pthread_mutex_unlock(&tls->lock);
+    return true;
+}
+
+/* With TLS 1.3 the tickets arrive after the handshake, while application data is read */
+static int new_session(SSL* ssl, SSL_SESSION* session)
+{
+    struct tls_connection* conn = SSL_get_ex_data(ssl, connection_index);
+    if (!conn || !conn->key) {
+        return 0;
+    }
+    return cache_store(conn->tls, conn->key, session) ? 1 : 0;
+}
+
+/***** Contexts **********************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static void tls_init(void)
+{
+    connection_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+static void create_default_context(void)
+{
+    default_context = mqtt_tls_create_context(NULL);
+}
+
+struct mqtt_tls_context* mqtt_tls_create_context(const struct mqtt_tls_config* config)
+{
+    static const struct mqtt_tls_config defaults = { 0 };
+    if (!config) {
+        config = &defaults;
+    }
+    pthread_once(&tls_once, tls_init);
+    if (connection_index < 0) {
+        return NULL;
+    }
+
+    struct mqtt_tls_context* tls = calloc(1, sizeof(struct mqtt_tls_context));
+    if (!tls) {
+        return NULL;
+    }
+    tls->ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (!tls->ssl_ctx || pthread_mutex_init(&tls->lock, NULL)) {
+        SSL_CTX_free(tls->ssl_ctx);
+        free(tls);
+        return NULL;
+    }
+
+    SSL_CTX* ctx = tls->ssl_ctx;
+    bool ok = SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    if (config->insecure) {
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    } else {
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+        if (config->ca_file || config->ca_path) {
+            ok = ok && SSL_CTX_load_verify_locations(ctx, config->ca_file, config->ca_path);
+        } else {
+            ok = ok && SSL_CTX_set_default_verify_paths(ctx);
+        }
+    }
+    if (config->cert_file) {
+        ok = ok && SSL_CTX_use_certificate_chain_file(ctx, config->cert_file) == 1;
+        ok = ok && SSL_CTX_use_PrivateKey_file(ctx, config->key_file ? config->key_file : config->cert_file,
+                                               SSL_FILETYPE_PEM) == 1;
+        ok = ok && SSL_CTX_check_private_key(ctx) == 1;
+    }
+    if (config->max_record) {
+        // Smaller records keep the latency of small publishes down on slow links
+        ok = ok && SSL_CTX_set_max_send_fragment(ctx, config->max_record);
+    }
+    // Records carry what one send hands over, without padding them to a block size.
+    // Small publishes are combined into one record by the coalescing of the client.
+    ok = ok && SSL_CTX_set_block_padding(ctx, 1);
+
+    // Sessions are only kept in our cache, per broker instead of per session id
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, new_session);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (ok && config->server_name) {
+        tls->server_name = strdup(config->server_name);
+        ok = tls->server_name != NULL;
+    }
+    if (!ok) {
+        mqtt_tls_free_context(tls);
+        return NULL;
+    }
+    return tls;
+}
+
+void mqtt_tls_free_context(struct mqtt_tls_context* tls)
+{
+    if (!tls) {
+        return;
+    }
+    for (int i = 0; i < MQTT_TLS_SESSION_CACHE; i++) {
+        if (tls->cache[i].session) {
+            SSL_SESSION_free(tls->cache[i].session);
+        }
+    }
+    SSL_CTX_free(tls->ssl_ctx);
+    pthread_mutex_destroy(&tls->lock);
+    free(tls->server_name);
+    free(tls);
+}
+
+void mqtt_tls_get_stats(struct mqtt_tls_context* tls, struct mqtt_tls_stats* stats)
+{
+    if (!tls || !stats) {
+        return;
+    }
+    pthread_mutex_lock(&tls->lock);
+    *stats = tls->stats;
+    pthread_mutex_unlock(&tls->lock);
+}
+
+/***** Client side *******************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static void disconnect(struct tls_connection* conn)
+{
+    if (conn->ssl) {
+        SSL_shutdown(conn->ssl);    // Sends close_notify, does not wait for the answer
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
+    }
+    if (conn->handle >= 0) {
+        close(conn->handle);
+        conn->handle = -1;
+    }
+}
+
+static int set_verified_name(SSL* ssl, const char* name)
+{
+    struct in_addr addr;
+    if (inet_pton(AF_INET, name, &addr) == 1) {
+        // No SNI for IP addresses, the certificate has to carry the address
+        return X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), name);
+    }
+    return SSL_set_tlsext_host_name(ssl, name) && SSL_set1_host(ssl, name);
+}
+
+static int handshake(struct tls_connection* conn, const char* host)
+{
+    struct mqtt_tls_context* tls = conn->tls;
+    conn->ssl = SSL_new(tls->ssl_ctx);
+    if (!conn->ssl) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    if (!SSL_set_fd(conn->ssl, conn->handle) || !SSL_set_ex_data(conn->ssl, connection_index, conn) ||
+        !set_verified_name(conn->ssl, tls->server_name ? tls->server_name : host)) {
+        return ERROR_SW_FAILURE;
+    }
+
+    SSL_SESSION* session = cache_lookup(tls, conn->key);
+    if (session) {
+        SSL_set_session(conn->ssl, session);
+        SSL_SESSION_free(session);
+    }
+    if (SSL_connect(conn->ssl) != 1) {
+        SSL_set_quiet_shutdown(conn->ssl, 1);
+        return SSL_get_verify_result(conn->ssl) != X509_V_OK ? ERROR_SERVER_DECLINED : ERROR_PROTOCOL;
+    }
+
+    pthread_mutex_lock(&tls->lock);
+    tls->stats.handshakes++;
+    if (SSL_session_reused(conn->ssl)) {
+        tls->stats.resumed++;
+    }
+    pthread_mutex_unlock(&tls->lock);
+    return OK;
+}
+
+static int open_conn(struct mqtt_client* client, const char* addr)
+{
+    if (!client || !addr || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct tls_connection* conn = (struct tls_connection*) client->context;
+    char host[TLS_HOST_SIZE];
+    uint16_t port;
+    int result = transport_parse_address(addr, host, sizeof(host), MQTT_TLS_PORT, &port);
+    if (FAILED(result)) {
+        return result;
+    }
+    result = mqtt_tcp_connect(host, port, &conn->handle);
+    if (FAILED(result)) {
+        return result;
+    }
+    // Every send is a complete record already, waiting for more only adds latency
+    int one = 1;
+    setsockopt(conn->handle, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    conn->key = addr;
+    result = handshake(conn, host);
+    if (FAILED(result)) {
+        disconnect(conn);
+        return result;
+    }
+    // The handshake blocks, afterwards reads must not stall the poll loop
+    fcntl(conn->handle, F_SETFL, fcntl(conn->handle, F_GETFL) | O_NONBLOCK);
+    client->net.connected = true;
+    return OK;
+}
+
+static int close_conn(struct mqtt_client* client)
+{
+    if (!client || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    disconnect((struct tls_connection*) client->context);
+    client->net.connected = false;
+    return OK;
+}
+
+static int tls_send(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    if (!client || !buf || !buf->payload || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct tls_connection* conn = (struct tls_connection*) client->context;
+    if (!conn->ssl) {
+        return ERROR_HOST_UNAVAILABLE;
+    }
+
+    // Waits like a blocking socket, without partial writes SSL_write() sends all or nothing
+    for (;;) {
+        int n = SSL_write(conn->ssl, buf->payload, (int) buf->len);
+        if (n > 0) {
+            return OK;
+        }
+        struct pollfd pfd = { .fd = conn->handle };
+        switch (SSL_get_error(conn->ssl, n)) {
+            case SSL_ERROR_WANT_WRITE:
+                pfd.events = POLLOUT;
+                break;
+            case SSL_ERROR_WANT_READ:
+                pfd.events = POLLIN;
+                break;
+            default:
+                SSL_set_quiet_shutdown(conn->ssl, 1);
+                return ERROR_HOST_UNAVAILABLE;
+        }
+        if (poll(&pfd, 1, MQTT_POLL_TIMEOUT) == -1 && errno != EINTR) {
+            return ERROR_HW_FAILURE;
+        }
+    }
+}
+
+static int tls_recv(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    if (!client || !buf || !buf->payload || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct tls_connection* conn = (struct tls_connection*) client->context;
+    if (!conn->ssl) {
+        buf->len = 0;
+        return ERROR_HOST_UNAVAILABLE;
+    }
+
+    // Decrypted bytes may be buffered in the SSL object while the socket is idle
+    if (!SSL_pending(conn->ssl)) {
+        struct pollfd pfd = { .events = POLLIN, .fd = conn->handle };
+        poll(&pfd, 1, MQTT_POLL_TIMEOUT);
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+            buf->len = 0;
+            return STATUS_PASSED;
+        }
+    }
+
+    int n = SSL_read(conn->ssl, buf->payload, (int) buf->len);
+    if (n > 0) {
+        buf->len = (uint32_t) n;
+        return STATUS_SUCCESS;
+    }
+    buf->len = 0;
+    switch (SSL_get_error(conn->ssl, n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            return STATUS_PASSED;   // Incomplete record or a session ticket only
+        default:
+            // No close_notify on a broken connection
+            SSL_set_quiet_shutdown(conn->ssl, 1);
+            return ERROR_HOST_UNAVAILABLE;
+    }
+}
+
+static void release(struct mqtt_client* client)
+{
+    struct tls_connection* conn = (struct tls_connection*) client->context;
+    disconnect(conn); // Freed without disconnect
+    transport_state_free(client, conn);
+    client->context = NULL;
+}
+
+int mqtt_tls_attach(struct mqtt_client* stat, void* ctx)
+{
+    struct mqtt_tls_context* tls = (struct mqtt_tls_context*) ctx;
+    if (!tls) {
+        static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+        pthread_once(&default_once, create_default_context);
+        tls = default_context;
+        if (!tls) {
+            return ERROR_RESOURCE_UNAVAILABLE;
+        }
+    }
+    struct tls_connection* conn = transport_state_alloc(stat, sizeof(struct tls_connection));
+    if (!conn) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    conn->handle = -1;
+    conn->tls = tls;
+    stat->net.alloc_recv_buf = netbuf_alloc_recv;
+    stat->net.alloc_send_buf = netbuf_alloc_send;
+    stat->net.free_recv_buf = netbuf_free_recv;
+    stat->net.free_send_buf = netbuf_free_send;
+    stat->net.open_conn = open_conn;
+    stat->net.close_conn = close_conn;
+    stat->net.send = tls_send;
+    stat->net.recv = tls_recv;
+    stat->net.release = release;
+    stat->context = conn;
+    return OK;
+}
+
+const struct mqtt_transport mqtt_tls_default_transport = {
+    .scheme = "mqtts",
+    .attach = mqtt_tls_attach,
+    .context = NULL
+};
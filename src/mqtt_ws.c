@@ -0,0 +1,721 @@
+/**
+ * @file mqtt_ws.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief MQTT Network interface implementation over WebSocket (RFC 6455)
+ * @version 0.1
+ * @date 2025-07-29
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/random.h>
+
+#include "mqtt.h"
+#include "mqtt_ws.h"
+#include "status.h"
+#include "systime.h"
+#include "transport.h"
+#include "sha1.h"
+#ifdef MQTT_TLS_TRANSPORT
+#include "mqtt_tls.h"
+#endif
+
+#define WS_HEADROOM      14     // Largest header of a client frame: 2 bytes, 8 bytes length, 4 bytes mask
+#define WS_CONTROL_SIZE  125
+#define WS_HOST_SIZE     256
+#define WS_NONCE_SIZE    16
+#define WS_GUID          "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define WS_FIN           0x80
+#define WS_RSV           0x70
+#define WS_MASK          0x80
+
+enum ws_opcode {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xa
+};
+
+/* Per-client state, followed by the state of the inner transport */
+struct ws_connection {
+    struct mqtt_net_api inner;      // Functions of the transport the frames travel on
+    void* inner_context;
+    uint8_t* send_frame;            // Payload of the send buffer with headroom for the frame header
+    uint64_t rng;                   // Masking keys
+    uint64_t remaining;             // Payload bytes of the current frame still to come
+    uint16_t default_port;
+    uint8_t header[WS_HEADROOM];    // Frame header, it may arrive in pieces
+    uint8_t header_len;
+    uint8_t header_need;
+    uint8_t opcode;
+    bool in_payload;
+    bool fragmented;                // A binary message continues in the next frame
+    bool close_received;
+    uint8_t control_len;
+    uint8_t control[WS_CONTROL_SIZE];
+    size_t addr_size;
+    char addr[];                    // "host:port" for the inner transport, outlives the connection
+};
+
+/***** Inner transport ***************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+/* The functions of the inner transport find their own state in the client context */
+
+static int inner_open(struct mqtt_client* client, struct ws_connection* ws, const char* addr)
+{
+    client->context = ws->inner_context;
+    int result = ws->inner.open_conn(client, addr);
+    client->context = ws;
+    return result;
+}
+
+static int inner_close(struct mqtt_client* client, struct ws_connection* ws)
+{
+    client->context = ws->inner_context;
+    int result = ws->inner.close_conn(client);
+    client->context = ws;
+    return result;
+}
+
+static int inner_send(struct mqtt_client* client, struct ws_connection* ws, struct mqtt_pbuf* buf)
+{
+    client->context = ws->inner_context;
+    int result = ws->inner.send(client, buf);
+    client->context = ws;
+    return result;
+}
+
+static int inner_recv(struct mqtt_client* client, struct ws_connection* ws, struct mqtt_pbuf* buf)
+{
+    client->context = ws->inner_context;
+    int result = ws->inner.recv(client, buf);
+    client->context = ws;
+    return result;
+}
+
+static int inner_alloc_send(struct mqtt_client* client, struct ws_connection* ws, struct mqtt_pbuf* buf,
+                            uint32_t len)
+{
+    client->context = ws->inner_context;
+    int result = ws->inner.alloc_send_buf(client, buf, len);
+    client->context = ws;
+    return result;
+}
+
+static int inner_free_send(struct mqtt_client* client, struct ws_connection* ws, struct mqtt_pbuf* buf)
+{
+    client->context = ws->inner_context;
+    int result = ws->inner.free_send_buf(client, buf);
+    client->context = ws;
+    return result;
+}
+
+/***** Frames ************************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static uint32_t next_mask(struct ws_connection* ws)
+{
+    // xorshift64*, seeded per connection
+    uint64_t x = ws->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    ws->rng = x;
+    return (uint32_t) ((x * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static void mask_copy(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t key[4])
+{
+    // Eight bytes per step, the key repeated twice keeps its phase at every multiple of four
+    uint32_t key32;
+    memcpy(&key32, key, 4);
+    uint64_t key64 = (uint64_t) key32 << 32 | key32;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        uint64_t w[4];
+        memcpy(w, src + i, sizeof(w));
+        w[0] ^= key64;
+        w[1] ^= key64;
+        w[2] ^= key64;
+        w[3] ^= key64;
+        memcpy(dst + i, w, sizeof(w));
+    }
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, src + i, sizeof(w));
+        w ^= key64;
+        memcpy(dst + i, &w, sizeof(w));
+    }
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ key[i & 3];
+    }
+}
+
+static size_t header_size(uint64_t len)
+{
+    return (len < 126 ? 2 : len <= UINT16_MAX ? 4 : 10) + 4;
+}
+
+static size_t make_header(uint8_t* header, uint8_t opcode, uint64_t len, const uint8_t key[4])
+{
+    size_t n = 0;
+    header[n++] = WS_FIN | opcode;
+    if (len < 126) {
+        header[n++] = WS_MASK | (uint8_t) len;
+    } else if (len <= UINT16_MAX) {
+        header[n++] = WS_MASK | 126;
+        header[n++] = (uint8_t) (len >> 8);
+        header[n++] = (uint8_t) len;
+    } else {
+        header[n++] = WS_MASK | 127;
+        for (int i = 7; i >= 0; i--) {
+            header[n++] = (uint8_t) (len >> (8 * i));
+        }
+    }
+    memcpy(header + n, key, 4);
+    return n + 4;
+}
+
+static int send_control(struct mqtt_client* client, struct ws_connection* ws, uint8_t opcode, const uint8_t* data,
+                        size_t len)
+{
+    // Control frames are small, they are sent from the stack while a packet may be in the send buffer
+    uint8_t frame[WS_HEADROOM + WS_CONTROL_SIZE];
+    uint8_t key[4];
+    uint32_t mask = next_mask(ws);
+    memcpy(key, &mask, sizeof(key));
+    size_t n = make_header(frame, opcode, len, key);
+    mask_copy(frame + n, data, len, key);
+    struct mqtt_pbuf buf = { .payload = frame, .len = n + len };
+    return inner_send(client, ws, &buf);
+}
+
+static int handle_control(struct mqtt_client* client, struct ws_connection* ws)
+{
+    switch (ws->opcode) {
+        case WS_PING:
+            return send_control(client, ws, WS_PONG, ws->control, ws->control_len);
+        case WS_CLOSE:
+            // Echo the status code, the broker closes the connection afterwards
+            ws->close_received = true;
+            send_control(client, ws, WS_CLOSE, ws->control, ws->control_len >= 2 ? 2 : 0);
+            return OK;
+        default:
+            return OK;      // Unsolicited pongs are allowed
+    }
+}
+
+static int start_frame(struct ws_connection* ws)
+{
+    const uint8_t* header = ws->header;
+    if (header[0] & WS_RSV) {
+        return ERROR_PROTOCOL;      // No extension was negotiated
+    }
+    uint64_t len = header[1] & 0x7f;
+    if (len == 126) {
+        len = (uint64_t) header[2] << 8 | header[3];
+    } else if (len == 127) {
+        len = 0;
+        for (int i = 2; i < 10; i++) {
+            len = len << 8 | header[i];
+        }
+        if (len >> 63) {
+            return ERROR_PROTOCOL;
+        }
+    }
+
+    bool fin = header[0] & WS_FIN;
+    uint8_t opcode = header[0] & 0x0f;
+    switch (opcode) {
+        case WS_CONTINUATION:
+            if (!ws->fragmented) {
+                return ERROR_PROTOCOL;
+            }
+            ws->fragmented = !fin;
+            break;
+        case WS_BINARY:
+            if (ws->fragmented) {
+                return ERROR_PROTOCOL;
+            }
+            ws->fragmented = !fin;
+            break;
+        case WS_CLOSE:
+        case WS_PING:
+        case WS_PONG:
+            // Control frames may arrive between the fragments of a message
+            if (!fin || len > WS_CONTROL_SIZE) {
+                return ERROR_PROTOCOL;
+            }
+            ws->control_len = 0;
+            break;
+        default:
+            return ERROR_PROTOCOL;  // MQTT is carried in binary frames only
+    }
+    ws->opcode = opcode;
+    ws->remaining = len;
+    ws->in_payload = true;
+    return OK;
+}
+
+/*
+ * Decodes the frames in a received buffer in place. The payloads of binary and
+ * continuation frames are moved to the front of the buffer, which joins fragmented
+ * messages into the byte stream.
+ */
+static int decode_frames(struct mqtt_client* client, struct ws_connection* ws, uint8_t* data, size_t len,
+                         size_t* stream_len)
+{
+    size_t pos = 0;
+    size_t out = 0;
+    while (pos < len && !ws->close_received) {
+        if (!ws->in_payload) {
+            while (ws->header_len < ws->header_need && pos < len) {
+                ws->header[ws->header_len++] = data[pos++];
+            }
+            if (ws->header_len < ws->header_need) {
+                break;
+            }
+            if (ws->header_need == 2) {
+                if (ws->header[1] & WS_MASK) {
+                    *stream_len = out;
+                    return ERROR_PROTOCOL;  // Frames of the broker are not masked
+                }
+                uint8_t code = ws->header[1] & 0x7f;
+                if (code >= 126) {
+                    ws->header_need = code == 126 ? 4 : 10;
+                    continue;
+                }
+            }
+            ws->header_len = 0;
+            ws->header_need = 2;
+            int result = start_frame(ws);
+            if (FAILED(result)) {
+                *stream_len = out;
+                return result;
+            }
+        }
+
+        size_t take = (ws->remaining < len - pos) ? (size_t) ws->remaining : len - pos;
+        if (ws->opcode < WS_CLOSE) {
+            memmove(data + out, data + pos, take);
+            out += take;
+        } else {
+            memcpy(ws->control + ws->control_len, data + pos, take);
+            ws->control_len += (uint8_t) take;
+        }
+        pos += take;
+        ws->remaining -= take;
+        if (!ws->remaining) {
+            ws->in_payload = false;
+            if (ws->opcode >= WS_CLOSE) {
+                int result = handle_control(client, ws);
+                if (FAILED(result)) {
+                    *stream_len = out;
+                    return result;
+                }
+            }
+        }
+    }
+    *stream_len = out;
+    return OK;
+}
+
+/***** Opening handshake *************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static bool has_token(const char* list, const char* token)
+{
+    size_t len = strlen(token);
+    const char* p = list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        const char* end = p;
+        while (*end && *end != ',') {
+            end++;
+        }
+        size_t n = end - p;
+        while (n && (p[n - 1] == ' ' || p[n - 1] == '\t')) {
+            n--;
+        }
+        if (n == len && !strncasecmp(p, token, len)) {
+            return true;
+        }
+        p = end;
+    }
+    return false;
+}
+
+static int check_response(char* response, const char* key)
+{
+    // "HTTP/1.1 101 Switching Protocols", anything else is a refusal of the server or a proxy
+    if (strncmp(response, "HTTP/1.1 101", 12) || (response[12] != ' ' && response[12] != '\r')) {
+        return ERROR_SERVER_DECLINED;
+    }
+
+    char text[BASE64_SIZE(WS_NONCE_SIZE) + sizeof(WS_GUID)];
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    char accept[BASE64_SIZE(SHA1_DIGEST_SIZE)];
+    snprintf(text, sizeof(text), "%s%s", key, WS_GUID);
+    sha1(text, strlen(text), digest);
+    base64_encode(digest, sizeof(digest), accept);
+
+    bool upgrade = false;
+    bool connection = false;
+    bool accepted = false;
+    char* line = strstr(response, "\r\n") + 2;
+    while (*line != '\r') {
+        char* eol = strstr(line, "\r\n");
+        *eol = '\0';
+        char* value = strchr(line, ':');
+        if (value) {
+            *value++ = '\0';
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+            for (char* end = eol; end > value && (end[-1] == ' ' || end[-1] == '\t'); end--) {
+                end[-1] = '\0';
+            }
+            if (!strcasecmp(line, "Upgrade")) {
+                upgrade = !strcasecmp(value, "websocket");
+            } else if (!strcasecmp(line, "Connection")) {
+                connection = has_token(value, "upgrade");
+            } else if (!strcasecmp(line, "Sec-WebSocket-Accept")) {
+                accepted = !strcmp(value, accept);
+            } else if (!strcasecmp(line, "Sec-WebSocket-Protocol") && strcmp(value, "mqtt")) {
+                return ERROR_PROTOCOL;
+            } else if (!strcasecmp(line, "Sec-WebSocket-Extensions")) {
+                return ERROR_PROTOCOL;
+            }
+        }
+        line = eol + 2;
+    }
+    return (upgrade && connection && accepted) ? OK : ERROR_PROTOCOL;
+}
+
+static int handshake(struct mqtt_client* client, struct ws_connection* ws, const char* host, size_t host_len,
+                     const char* path)
+{
+    uint8_t nonce[WS_NONCE_SIZE];
+    if (getentropy(nonce, sizeof(nonce))) {
+        for (size_t i = 0; i < sizeof(nonce); i += 4) {
+            uint32_t r = next_mask(ws);
+            memcpy(nonce + i, &r, 4);
+        }
+    }
+    char key[BASE64_SIZE(WS_NONCE_SIZE)];
+    base64_encode(nonce, sizeof(nonce), key);
+
+    char message[MQTT_WS_HANDSHAKE_SIZE];
+    int n = snprintf(message, sizeof(message),
+                     "GET %s HTTP/1.1\r\n"
+                     "Host: %.*s\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: %s\r\n"
+                     "Sec-WebSocket-Version: 13\r\n"
+                     "Sec-WebSocket-Protocol: mqtt\r\n"
+                     "\r\n",
+                     path, (int) host_len, host, key);
+    if (n < 0 || (size_t) n >= sizeof(message)) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+    struct mqtt_pbuf buf = { .payload = message, .len = (size_t) n };
+    int result = inner_send(client, ws, &buf);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    // The response is read into the same buffer
+    size_t len = 0;
+    char* end = NULL;
+    uint32_t start = get_time_ms();
+    while (!end) {
+        if (len == sizeof(message) - 1) {
+            return ERROR_PROTOCOL;
+        }
+        if (get_time_ms() - start >= MQTT_WS_HANDSHAKE_TIMEOUT) {
+            return ERROR_TIMEOUT;
+        }
+        buf.payload = message + len;
+        buf.len = sizeof(message) - 1 - len;
+        result = inner_recv(client, ws, &buf);
+        if (FAILED(result)) {
+            return result;
+        }
+        if (result == STATUS_SUCCESS) {
+            len += buf.len;
+            message[len] = '\0';
+            end = strstr(message, "\r\n\r\n");
+        }
+    }
+    if (end + 4 != message + len) {
+        return ERROR_PROTOCOL;      // The broker sends nothing before our CONNECT
+    }
+    return check_response(message, key);
+}
+
+/***** Network interface *************************************************************************/
+/*                                                                                               */
+/*************************************************************************************************/
+
+static int open_conn(struct mqtt_client* client, const char* addr)
+{
+    if (!client || !addr || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct ws_connection* ws = (struct ws_connection*) client->context;
+
+    // "host[:port][/path]", the inner transport gets "host:port"
+    const char* slash = strchr(addr, '/');
+    size_t host_len = slash ? (size_t) (slash - addr) : strlen(addr);
+    const char* path = slash ? slash : MQTT_WS_PATH;
+    if (host_len + 8 > ws->addr_size) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+    memcpy(ws->addr, addr, host_len);
+    ws->addr[host_len] = '\0';
+    char host[WS_HOST_SIZE];
+    uint16_t port;
+    int result = transport_parse_address(ws->addr, host, sizeof(host), ws->default_port, &port);
+    if (FAILED(result)) {
+        return result;
+    }
+    snprintf(ws->addr, ws->addr_size, "%s:%u", host, port);
+
+    ws->header_len = 0;
+    ws->header_need = 2;
+    ws->in_payload = false;
+    ws->fragmented = false;
+    ws->close_received = false;
+    if (getentropy(&ws->rng, sizeof(ws->rng)) || !ws->rng) {
+        ws->rng = ((uint64_t) get_time_ms() << 32) ^ (uintptr_t) ws ^ 0x9e3779b97f4a7c15ULL;
+    }
+
+    result = inner_open(client, ws, ws->addr);
+    if (FAILED(result)) {
+        return result;
+    }
+    result = handshake(client, ws, addr, host_len, path);
+    if (FAILED(result)) {
+        inner_close(client, ws);
+        return result;
+    }
+    return OK;
+}
+
+static int close_conn(struct mqtt_client* client)
+{
+    if (!client || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct ws_connection* ws = (struct ws_connection*) client->context;
+    if (client->net.connected && !ws->close_received) {
+        // Normal closure, best effort as the broker may be gone already
+        static const uint8_t status[2] = { 1000 >> 8, 1000 & 0xff };
+        send_control(client, ws, WS_CLOSE, status, sizeof(status));
+    }
+    return inner_close(client, ws);
+}
+
+static int ws_alloc_send(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
+{
+    struct ws_connection* ws = (struct ws_connection*) client->context;
+    if (len > UINT32_MAX - WS_HEADROOM) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+    // Room for the frame header in front of the packet, the frame goes out in one send
+    int result = inner_alloc_send(client, ws, buf, len + WS_HEADROOM);
+    if (FAILED(result)) {
+        return result;
+    }
+    buf->payload = (uint8_t*) buf->payload + WS_HEADROOM;
+    buf->len = len;
+    ws->send_frame = buf->payload;
+    return OK;
+}
+
+static int ws_free_send(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    struct ws_connection* ws = (struct ws_connection*) client->context;
+    if (buf->payload && buf->payload == ws->send_frame) {
+        buf->payload = ws->send_frame - WS_HEADROOM;
+        ws->send_frame = NULL;
+    }
+    return inner_free_send(client, ws, buf);
+}
+
+static int ws_alloc_recv(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
+{
+    struct ws_connection* ws = (struct ws_connection*) client->context;
+    client->context = ws->inner_context;
+    int result = ws->inner.alloc_recv_buf(client, buf, len);
+    client->context = ws;
+    return result;
+}
+
+static int ws_free_recv(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    struct ws_connection* ws = (struct ws_connection*) client->context;
+    client->context = ws->inner_context;
+    int result = ws->inner.free_recv_buf(client, buf);
+    client->context = ws;
+    return result;
+}
+
+static int ws_send(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    if (!client || !buf || !buf->payload || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct ws_connection* ws = (struct ws_connection*) client->context;
+    uint8_t* payload = (uint8_t*) buf->payload;
+    uint8_t key[4];
+    uint32_t mask = next_mask(ws);
+    memcpy(key, &mask, sizeof(key));
+
+    if (payload == ws->send_frame) {
+        // The header goes into the headroom, the packet is masked in place
+        uint8_t header[WS_HEADROOM];
+        size_t n = make_header(header, WS_BINARY, buf->len, key);
+        memcpy(payload - n, header, n);
+        mask_copy(payload, payload, buf->len, key);
+        struct mqtt_pbuf frame = { .payload = payload - n, .len = buf->len + n };
+        return inner_send(client, ws, &frame);
+    }
+
+    // Coalesced packets come from a buffer of the client, the frame is a masked copy
+    struct mqtt_pbuf frame;
+    size_t n = header_size(buf->len);
+    if (buf->len > UINT32_MAX - n) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+    int result = inner_alloc_send(client, ws, &frame, (uint32_t) (buf->len + n));
+    if (FAILED(result)) {
+        return result;
+    }
+    make_header((uint8_t*) frame.payload, WS_BINARY, buf->len, key);
+    mask_copy((uint8_t*) frame.payload + n, payload, buf->len, key);
+    result = inner_send(client, ws, &frame);
+    inner_free_send(client, ws, &frame);
+    return result;
+}
+
+static int ws_recv(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    if (!client || !buf || !buf->payload || !client->context) {
+        return ERROR_NULL_REFERENCE;
+    }
+    struct ws_connection* ws = (struct ws_connection*) client->context;
+    if (ws->close_received) {
+        buf->len = 0;
+        return ERROR_HOST_UNAVAILABLE;
+    }
+
+    int result = inner_recv(client, ws, buf);
+    if (result != STATUS_SUCCESS) {
+        buf->len = 0;
+        return result;
+    }
+    size_t len;
+    result = decode_frames(client, ws, (uint8_t*) buf->payload, buf->len, &len);
+    buf->len = len;
+    if (FAILED(result)) {
+        return result;
+    }
+    if (!len) {
+        // Only headers, control frames or the closing handshake
+        return ws->close_received ? ERROR_HOST_UNAVAILABLE : STATUS_PASSED;
+    }
+    return STATUS_SUCCESS;
+}
+
+static void release(struct mqtt_client* client)
+{
+    struct ws_connection* ws = (struct ws_connection*) client->context;
+    if (ws->inner.release) {
+        client->context = ws->inner_context;
+        ws->inner.release(client);
+    }
+    transport_state_free(client, ws);
+    client->context = NULL;
+}
+
+int mqtt_ws_attach(struct mqtt_client* stat, void* config)
+{
+    const struct mqtt_ws_config* ws_config = (const struct mqtt_ws_config*) config;
+    const struct mqtt_transport* inner = (ws_config && ws_config->inner) ? ws_config->inner : &mqtt_tcp_transport;
+    if (!inner->attach || !stat->broker_addr) {
+        return ERROR_NULL_REFERENCE;
+    }
+
+    // Allocated before the state of the inner transport, see transport_state_alloc()
+    size_t addr_size = strlen(stat->broker_addr) + 8;
+    struct ws_connection* ws = transport_state_alloc(stat, sizeof(struct ws_connection) + addr_size);
+    if (!ws) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    int result = inner->attach(stat, inner->context);
+    if (FAILED(result)) {
+        transport_state_free(stat, ws);
+        return result;
+    }
+    if (!stat->net.recv || !stat->net.alloc_recv_buf || !stat->net.free_recv_buf) {
+        // The frames are decoded from what the inner transport receives
+        if (stat->net.release) {
+            stat->net.release(stat);
+            stat->net.release = NULL;
+        }
+        transport_state_free(stat, ws);
+        return ERROR_UNSUPPORTED;
+    }
+
+    ws->inner = stat->net;
+    ws->inner_context = stat->context;
+    ws->default_port = (ws_config && ws_config->port) ? ws_config->port : MQTT_WS_PORT;
+    ws->header_need = 2;
+    ws->addr_size = addr_size;
+    stat->net.alloc_recv_buf = ws_alloc_recv;
+    stat->net.alloc_send_buf = ws_alloc_send;
+    stat->net.free_recv_buf = ws_free_recv;
+    stat->net.free_send_buf = ws_free_send;
+    stat->net.open_conn = open_conn;
+    stat->net.close_conn = close_conn;
+    stat->net.send = ws_send;
+    stat->net.recv = ws_recv;
+    stat->net.release = release;
+    stat->context = ws;
+    return OK;
+}
+
+const struct mqtt_transport mqtt_ws_transport = {
+    .scheme = "ws",
+    .attach = mqtt_ws_attach,
+    .context = NULL
+};
+
+#ifdef MQTT_TLS_TRANSPORT
+static const struct mqtt_ws_config wss_config = {
+    .inner = &mqtt_tls_default_transport,
+    .port = MQTT_WSS_PORT
+};
+
+const struct mqtt_transport mqtt_wss_transport = {
+    .scheme = "wss",
+    .attach = mqtt_ws_attach,
+    .context = (void*) &wss_config
+};
+#endif
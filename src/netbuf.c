@@ -0,0 +1,98 @@
+/**
+ * @file netbuf.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Send and receive buffers of network interfaces working on plain memory
+ * @version 0.1
+ * @date 2025-07-29
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#include "netbuf.h"
+#include "status.h"
+#include "mqtt_alloc.h"
+
+#ifdef MQTT_STATIC_MEMORY
+int netbuf_alloc_send(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
+{
+    if (len > sizeof(client->storage.send)) {
+        buf->payload = NULL;
+        buf->len = 0;
+        return ERROR_OUT_OF_MEMORY;
+    }
+    buf->payload = client->storage.send;
+    buf->len = len;
+    return OK;
+}
+
+int netbuf_alloc_recv(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
+{
+    uint32_t alloc_len = (len > 0) ? len : sizeof(client->storage.recv);
+    if (alloc_len > sizeof(client->storage.recv)) {
+        buf->payload = NULL;
+        buf->len = 0;
+        return ERROR_OUT_OF_MEMORY;
+    }
+    buf->payload = client->storage.recv;
+    buf->len = alloc_len;
+    return OK;
+}
+
+int netbuf_free_send(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    buf->payload = NULL;
+    buf->len = 0;
+    return OK;
+}
+
+int netbuf_free_recv(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    buf->payload = NULL;
+    buf->len = 0;
+    return OK;
+}
+#else
+int netbuf_alloc_send(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
+{
+    buf->payload = mqtt_malloc(client, len);
+    if (!buf->payload) {
+        buf->len = 0;
+        return ERROR_OUT_OF_MEMORY;
+    }
+    buf->len = len;
+    return OK;
+}
+
+int netbuf_alloc_recv(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len)
+{
+    uint32_t alloc_len = (len > 0) ? len : NETBUF_RECV_SIZE;
+    buf->payload = mqtt_malloc(client, alloc_len);
+    if (!buf->payload) {
+        buf->len = 0;
+        return ERROR_OUT_OF_MEMORY;
+    }
+    buf->len = alloc_len;
+    return OK;
+}
+
+int netbuf_free_send(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    if (buf->payload) {
+        mqtt_free(client, buf->payload);
+        buf->payload = NULL;
+    }
+    buf->len = 0;
+    return OK;
+}
+
+int netbuf_free_recv(struct mqtt_client* client, struct mqtt_pbuf* buf)
+{
+    if (buf->payload) {
+        mqtt_free(client, buf->payload);
+        buf->payload = NULL;
+    }
+    buf->len = 0;
+    return OK;
+}
+#endif
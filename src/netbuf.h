@@ -0,0 +1,33 @@
+/**
+ * @file netbuf.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Send and receive buffers of network interfaces working on plain memory
+ * @version 0.1
+ * @date 2025-07-29
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#ifndef NETBUF_H_INCLUDED
+#define NETBUF_H_INCLUDED
+
+#include <stdint.h>
+
+#include "mqtt_types.h"
+
+/* Size of receive buffers requested with length 0 */
+#ifndef NETBUF_RECV_SIZE
+#define NETBUF_RECV_SIZE  4096
+#endif
+
+/*
+ * Buffers come from the allocator of the client, or from the client storage
+ * with MQTT_STATIC_MEMORY. The signatures match struct mqtt_net_api.
+ */
+int netbuf_alloc_send(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len);
+int netbuf_alloc_recv(struct mqtt_client* client, struct mqtt_pbuf* buf, uint32_t len);
+int netbuf_free_send(struct mqtt_client* client, struct mqtt_pbuf* buf);
+int netbuf_free_recv(struct mqtt_client* client, struct mqtt_pbuf* buf);
+
+#endif /* NETBUF_H_INCLUDED */
@@ -0,0 +1,108 @@
+/**
+ * @file sha1.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief SHA-1 and base64, as needed for the WebSocket handshake
+ * @version 0.1
+ * @date 2025-07-29
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#include <string.h>
+
+#include "sha1.h"
+
+#define ROL(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(uint32_t h[5], const uint8_t* p)
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16 | (uint32_t) p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t t = ROL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+void sha1(const void* data, size_t len, uint8_t digest[SHA1_DIGEST_SIZE])
+{
+    uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    const uint8_t* p = (const uint8_t*) data;
+    size_t left = len;
+    for (; left >= 64; left -= 64, p += 64) {
+        sha1_block(h, p);
+    }
+
+    // Padding: 0x80, zeros and the message length in bits, big endian
+    uint8_t tail[128] = { 0 };
+    memcpy(tail, p, left);
+    tail[left] = 0x80;
+    size_t tail_len = left < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t) len * 8;
+    for (int i = 0; i < 8; i++) {
+        tail[tail_len - 1 - i] = (uint8_t) (bits >> (8 * i));
+    }
+    sha1_block(h, tail);
+    if (tail_len == 128) {
+        sha1_block(h, tail + 64);
+    }
+
+    for (int i = 0; i < 5; i++) {
+        digest[4 * i] = (uint8_t) (h[i] >> 24);
+        digest[4 * i + 1] = (uint8_t) (h[i] >> 16);
+        digest[4 * i + 2] = (uint8_t) (h[i] >> 8);
+        digest[4 * i + 3] = (uint8_t) h[i];
+    }
+}
+
+void base64_encode(const void* data, size_t len, char* out)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8_t* p = (const uint8_t*) data;
+    for (; len >= 3; len -= 3, p += 3) {
+        uint32_t v = (uint32_t) p[0] << 16 | (uint32_t) p[1] << 8 | p[2];
+        *out++ = alphabet[v >> 18];
+        *out++ = alphabet[(v >> 12) & 0x3f];
+        *out++ = alphabet[(v >> 6) & 0x3f];
+        *out++ = alphabet[v & 0x3f];
+    }
+    if (len) {
+        uint32_t v = (uint32_t) p[0] << 16 | (len > 1 ? (uint32_t) p[1] << 8 : 0);
+        *out++ = alphabet[v >> 18];
+        *out++ = alphabet[(v >> 12) & 0x3f];
+        *out++ = len > 1 ? alphabet[(v >> 6) & 0x3f] : '=';
+        *out++ = '=';
+    }
+    *out = '\0';
+}
@@ -0,0 +1,28 @@
+/**
+ * @file sha1.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief SHA-1 and base64, as needed for the WebSocket handshake
+ * @version 0.1
+ * @date 2025-07-29
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#ifndef SHA1_H_INCLUDED
+#define SHA1_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA1_DIGEST_SIZE  20
+
+/* Size of the base64 text of len bytes, including the terminating zero */
+#define BASE64_SIZE(len)  ((((len) + 2) / 3) * 4 + 1)
+
+void sha1(const void* data, size_t len, uint8_t digest[SHA1_DIGEST_SIZE]);
+
+/* Writes BASE64_SIZE(len) characters to out */
+void base64_encode(const void* data, size_t len, char* out);
+
+#endif /* SHA1_H_INCLUDED */
@@ -0,0 +1,72 @@
+/**
+ * @file submit_queue.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Lock-free multi-producer/single-consumer submission queue
+ * @version 0.1
+ * @date 2025-07-22
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#include <stddef.h>
+
+#include "submit_queue.h"
+
+#define QUEUE_MASK (MQTT_SUBMIT_QUEUE_SIZE - 1)
+
+/*
+ * Bounded ring with one sequence counter per slot. A slot is free for the producer
+ * owning position pos when its sequence equals pos, and holds a request for the
+ * consumer when its sequence equals pos + 1. Producers claim positions with a CAS
+ * on the tail, the single consumer advances the head without atomics.
+ */
+
+void submit_queue_init(struct submit_queue* queue)
+{
+    atomic_init(&queue->tail, 0);
+    queue->head = 0;
+    for (uint32_t i = 0; i < MQTT_SUBMIT_QUEUE_SIZE; ++i) {
+        atomic_init(&queue->slots[i].sequence, i);
+    }
+}
+
+bool submit_queue_push(struct submit_queue* queue, const struct submit_request* request)
+{
+    uint32_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    while (1) {
+        uint32_t seq = atomic_load_explicit(&queue->slots[pos & QUEUE_MASK].sequence, memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // Queue is full
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+    queue->slots[pos & QUEUE_MASK].request = *request;
+    atomic_store_explicit(&queue->slots[pos & QUEUE_MASK].sequence, pos + 1, memory_order_release);
+    return true;
+}
+
+struct submit_request* submit_queue_peek(struct submit_queue* queue)
+{
+    uint32_t pos = queue->head;
+    uint32_t seq = atomic_load_explicit(&queue->slots[pos & QUEUE_MASK].sequence, memory_order_acquire);
+    if (seq != pos + 1) {
+        return NULL; // Queue is empty or the producer has not finished writing yet
+    }
+    return &queue->slots[pos & QUEUE_MASK].request;
+}
+
+void submit_queue_pop(struct submit_queue* queue)
+{
+    uint32_t pos = queue->head;
+    atomic_store_explicit(&queue->slots[pos & QUEUE_MASK].sequence, pos + MQTT_SUBMIT_QUEUE_SIZE,
+                          memory_order_release);
+    queue->head = pos + 1;
+}
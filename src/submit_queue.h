@@ -0,0 +1,58 @@
+/**
+ * @file submit_queue.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Lock-free multi-producer/single-consumer submission queue
+ * @version 0.1
+ * @date 2025-07-22
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#ifndef SUBMIT_QUEUE_H_INCLUDED
+#define SUBMIT_QUEUE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "mqtt_const.h"
+
+#if (MQTT_SUBMIT_QUEUE_SIZE & (MQTT_SUBMIT_QUEUE_SIZE - 1)) != 0
+#error "MQTT_SUBMIT_QUEUE_SIZE must be a power of two"
+#endif
+
+#define SUBMIT_QUEUE_CACHE_LINE 64
+
+enum submit_kind {
+    SUBMIT_PUBLISH = 1,
+    SUBMIT_ACK = 2
+};
+
+struct submit_request {
+    uint8_t kind;
+    uint8_t qos;
+    bool retain;
+    uint16_t packet_id;
+    uint16_t payload_len;
+    char* topic;        /* Topic and payload share one allocation owned by the request */
+    uint8_t* payload;
+};
+
+struct submit_queue {
+    _Atomic uint32_t tail;
+    uint8_t pad0[SUBMIT_QUEUE_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t head;
+    uint8_t pad1[SUBMIT_QUEUE_CACHE_LINE - sizeof(uint32_t)];
+    struct {
+        _Atomic uint32_t sequence;
+        struct submit_request request;
+    } slots[MQTT_SUBMIT_QUEUE_SIZE];
+};
+
+void submit_queue_init(struct submit_queue* queue);
+bool submit_queue_push(struct submit_queue* queue, const struct submit_request* request);
+struct submit_request* submit_queue_peek(struct submit_queue* queue);
+void submit_queue_pop(struct submit_queue* queue);
+
+#endif /* SUBMIT_QUEUE_H_INCLUDED */
@@ -0,0 +1,39 @@
+/**
+ * @file systime.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Monotonic system time
+ * @version 0.1
+ * @date 2025-07-20
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#ifdef PICO_BOARD
+#include "pico/stdlib.h"
+#else
+#include <time.h>
+#endif
+#endif
+
+#include "systime.h"
+
+uint32_t get_time_ms(void)
+{
+    #ifdef _WIN32
+        return (uint32_t) GetTickCount64();
+    #else
+    #ifdef PICO_BOARD
+        return to_ms_since_boot(get_absolute_time());
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+    #endif
+    #endif
+}
@@ -0,0 +1,19 @@
+/**
+ * @file systime.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Monotonic system time
+ * @version 0.1
+ * @date 2025-07-20
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#ifndef SYSTIME_H_INCLUDED
+#define SYSTIME_H_INCLUDED
+
+#include <stdint.h>
+
+uint32_t get_time_ms(void);
+
+#endif /* SYSTIME_H_INCLUDED */
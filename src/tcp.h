@@ -0,0 +1,20 @@
+/**
+ * @file tcp.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief TCP connection setup shared by the socket based transports
+ * @version 0.1
+ * @date 2025-07-29
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#ifndef TCP_H_INCLUDED
+#define TCP_H_INCLUDED
+
+#include <stdint.h>
+
+/* Blocking connect to an IPv4 address, the handle is only set on success */
+int mqtt_tcp_connect(const char* ipaddr, uint16_t port, int* handle);
+
+#endif /* TCP_H_INCLUDED */
@@ -0,0 +1,164 @@
+/**
+ * @file transport.c
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Registry of the transports clients can be created with
+ * @version 0.1
+ * @date 2025-07-29
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt.h"
+#include "status.h"
+#include "transport.h"
+#include "mqtt_alloc.h"
+#ifdef MQTT_SHM_TRANSPORT
+#include "mqtt_shm.h"
+#endif
+#ifdef MQTT_TLS_TRANSPORT
+#include "mqtt_tls.h"
+#endif
+#ifdef MQTT_WS_TRANSPORT
+#include "mqtt_ws.h"
+#endif
+
+/* Built-in transports of the network interface modules linked into the library, the first is the default */
+static const struct mqtt_transport* const builtin_transports[] = {
+    &mqtt_tcp_transport,
+#ifdef MQTT_UNIX_SOCKET
+    &mqtt_unix_transport,
+#endif
+#ifdef MQTT_SHM_TRANSPORT
+    &mqtt_shm_transport,
+#endif
+#ifdef MQTT_TLS_TRANSPORT
+    &mqtt_tls_default_transport,
+#endif
+#ifdef MQTT_WS_TRANSPORT
+    &mqtt_ws_transport,
+#ifdef MQTT_TLS_TRANSPORT
+    &mqtt_wss_transport,
+#endif
+#endif
+};
+
+static const struct mqtt_transport* registered_transports[MQTT_MAX_TRANSPORTS];
+
+static const struct mqtt_transport* find_transport(const char* scheme, size_t len)
+{
+    // Registered transports take precedence, they may replace a built-in one
+    for (int i = 0; i < MQTT_MAX_TRANSPORTS; i++) {
+        const struct mqtt_transport* t = registered_transports[i];
+        if (t && strlen(t->scheme) == len && !strncmp(t->scheme, scheme, len)) {
+            return t;
+        }
+    }
+    for (size_t i = 0; i < sizeof(builtin_transports) / sizeof(builtin_transports[0]); i++) {
+        const struct mqtt_transport* t = builtin_transports[i];
+        if (t->scheme && strlen(t->scheme) == len && !strncmp(t->scheme, scheme, len)) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+int mqtt_register_transport(const struct mqtt_transport* transport)
+{
+    if (!transport || !transport->scheme || !transport->attach) {
+        return ERROR_NULL_REFERENCE;
+    }
+    if (!*transport->scheme || strstr(transport->scheme, "://")) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+
+    int free_slot = -1;
+    for (int i = 0; i < MQTT_MAX_TRANSPORTS; i++) {
+        const struct mqtt_transport* t = registered_transports[i];
+        if (t && !strcmp(t->scheme, transport->scheme)) {
+            registered_transports[i] = transport;
+            return OK;
+        }
+        if (!t && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        return ERROR_OUT_OF_RESOURCE;
+    }
+    registered_transports[free_slot] = transport;
+    return OK;
+}
+
+const struct mqtt_transport* transport_select(const char** broker_addr)
+{
+    const char* addr = *broker_addr;
+    const char* sep = addr ? strstr(addr, "://") : NULL;
+    if (!sep) {
+        return builtin_transports[0];
+    }
+    const struct mqtt_transport* t = find_transport(addr, sep - addr);
+    if (t) {
+        *broker_addr = sep + 3;
+    }
+    return t;
+}
+
+const char* transport_strip_scheme(const char* broker_addr)
+{
+    const char* sep = broker_addr ? strstr(broker_addr, "://") : NULL;
+    return sep ? sep + 3 : broker_addr;
+}
+
+int transport_parse_address(const char* addr, char* host, size_t size, uint16_t default_port, uint16_t* port)
+{
+    const char* colon = strchr(addr, ':');
+    size_t len = colon ? (size_t)(colon - addr) : strlen(addr);
+    if (len >= size) {
+        return ERROR_INVALID_ARGUMENT;
+    }
+    memcpy(host, addr, len);
+    host[len] = '\0';
+
+    *port = default_port;
+    if (colon) {
+        char* end;
+        unsigned long value = strtoul(colon + 1, &end, 10);
+        if (end == colon + 1 || *end || !value || value > UINT16_MAX) {
+            return ERROR_INVALID_ARGUMENT;
+        }
+        *port = (uint16_t) value;
+    }
+    return OK;
+}
+
+void* transport_state_alloc(struct mqtt_client* stat, size_t size)
+{
+#ifdef MQTT_STATIC_MEMORY
+    // A transport layered on another one allocates its state first, the inner one follows behind
+    size_t offset = (stat->storage.transport_used + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    if (offset > sizeof(stat->storage.transport) || size > sizeof(stat->storage.transport) - offset) {
+        return NULL;
+    }
+    uint8_t* state = stat->storage.transport + offset;
+    memset(state, 0, size);
+    stat->storage.transport_used = (uint16_t) (offset + size);
+    return state;
+#else
+    return mqtt_calloc(stat, size);
+#endif
+}
+
+void transport_state_free(struct mqtt_client* stat, void* state)
+{
+#ifdef MQTT_STATIC_MEMORY
+    if (state == stat->storage.transport) {
+        stat->storage.transport_used = 0;
+    }
+#else
+    mqtt_free(stat, state);
+#endif
+}
@@ -0,0 +1,50 @@
+/**
+ * @file transport.h
+ * @author Pierre Biermann (https://github.com/ByteBender747)
+ * @brief Selection of the transport of a client and per-client transport state
+ * @version 0.1
+ * @date 2025-07-29
+ * 
+ * @copyright Copyright (c) 2025
+ * 
+ */
+
+#ifndef TRANSPORT_H_INCLUDED
+#define TRANSPORT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mqtt_types.h"
+
+/*
+ * Finds the transport for a broker address. A "scheme://" prefix selects a
+ * registered or built-in transport and is stripped from the address, without
+ * prefix the default transport of the platform is used.
+ * Returns NULL for unknown schemes.
+ */
+const struct mqtt_transport* transport_select(const char** broker_addr);
+
+/* Address without its "scheme://" prefix, for transports given by descriptor */
+const char* transport_strip_scheme(const char* broker_addr);
+
+/* Splits "host:port", the port is optional and defaults to default_port */
+int transport_parse_address(const char* addr, char* host, size_t size, uint16_t default_port, uint16_t* port);
+
+/*
+ * Zeroed state of the transport of a client, from the allocator of the client or
+ * from the client storage with MQTT_STATIC_MEMORY. NULL if it does not fit.
+ * In the client storage the states of layered transports follow each other,
+ * freeing the first one releases all of them.
+ */
+void* transport_state_alloc(struct mqtt_client* stat, size_t size);
+void transport_state_free(struct mqtt_client* stat, void* state);
+
+/*
+ * Sends what a transport refused from inside a callback of its network stack, the
+ * acknowledgements held back and the coalesced packets. Called by the transport
+ * once the stack has room again, implemented by the client.
+ */
+int transport_resume_send(struct mqtt_client* stat);
+
+#endif /* TRANSPORT_H_INCLUDED */